@@ -22,6 +22,10 @@ void wait_for_activate(void);
 // This function returns TRUE if the agent is activated, FALSE otherwise.
 int is_agent_activated(void);
 
+// How often (in msec) the reactor tasks waiting for the activation to
+// complete check for it (see is_agent_activated())
+#define ACTIVATE_TASK_POLL 1000
+
 // Set the activate event (for tests to bypass the activate step)
 void set_activate_event(void);
 
@@ -34,6 +34,7 @@ void agent_exit(int status)
 {
     terminate_status = status;
     if(util_is_main_thread()) {
+        log_flush();
         _exit(terminate_status);
     } else {
         UTIL_EVENT_SET(&terminate_agent);
@@ -89,6 +90,7 @@ int agent_main(void)
     for(;;) {
         if(UTIL_EVENT_TIMEDWAIT(&terminate_agent, WD_CHECK_TIMEOUT * 1000) == 0)
         {
+            log_flush();
             _exit(terminate_status);
         }
         util_wd_check_all();
@@ -0,0 +1,401 @@
+// (c) 2022 minim.co
+// unum command push channel
+
+#include "unum.h"
+
+
+/* Temporary, log to console from here */
+//#undef LOG_DST
+//#undef LOG_DBG_DST
+//#define LOG_DST LOG_DST_CONSOLE
+//#define LOG_DBG_DST LOG_DST_CONSOLE
+
+
+#ifdef FEATURE_CMD_PUSH
+
+// The agent keeps a GET request to CMD_PUSH_PATH open, the server holds
+// it (long-poll) and sends the commands in the response body as soon as
+// they are issued (it can either end the response after the commands or
+// keep streaming them w/ the chunked encoding). Each command is a JSON
+// object on its own line:
+// {"cmd":"<command name>","data":<payload>}
+// The payload is optional, it is what the agent would otherwise download
+// from .../commands/<command name>. It can be a JSON object (passed to the
+// command as JSON text) or a string (passed as is). The empty lines are
+// the heartbeats keeping the idle connection alive. When the response
+// ends the agent immediately sends the next request over the same
+// (kept alive) connection.
+
+// URL path of the push channel, parameters:
+// - MAC addr (in xx:xx:xx:xx:xx:xx format)
+#define CMD_PUSH_PATH "/v3/unums/%s/commands/push"
+
+// Initial size of the buffer for the records split between the chunks
+#define CMD_PUSH_BUF_SIZE 4096
+
+// Push response parser state
+typedef struct {
+    char *buf;  // buffer for collecting the record split between chunks
+    int len;    // length of the data in the buffer
+    int size;   // buffer size
+    int skip;   // TRUE while skipping the rest of an overlong record
+    int cmds;   // number of the commands received
+    // Function adding the command to the queue
+    int (*add)(const char *cmd, const char *data, int len);
+} CMD_PUSH_STATE_t;
+
+
+// Process the command record (w/o the trailing newline)
+static void cmd_push_rec(CMD_PUSH_STATE_t *st, char *rec, int len)
+{
+    json_t *root;
+    json_t *jdata;
+    json_error_t jerr;
+    const char *cmd;
+    const char *data = NULL;
+    char *data_str = NULL;
+    int data_len = 0;
+
+    // Skip the heartbeats
+    while(len > 0 && isspace(rec[len - 1])) {
+        --len;
+    }
+    if(len <= 0) {
+        return;
+    }
+
+    root = json_loadb(rec, len, JSON_REJECT_DUPLICATES, &jerr);
+    if(!root) {
+        log("%s: error at l:%d c:%d parsing command record, msg: '%s'\n",
+            __func__, jerr.line, jerr.column, jerr.text);
+        return;
+    }
+    for(;;)
+    {
+        cmd = json_string_value(json_object_get(root, "cmd"));
+        if(!cmd || !*cmd) {
+            log("%s: invalid command record\n", __func__);
+            break;
+        }
+        jdata = json_object_get(root, "data");
+        if(json_is_string(jdata)) {
+            data = json_string_value(jdata);
+            data_len = json_string_length(jdata);
+        } else if(jdata != NULL && !json_is_null(jdata)) {
+            data = data_str = json_dumps(jdata, JSON_COMPACT);
+            if(!data_str) {
+                log("%s: failed to prepare <%s> payload\n", __func__, cmd);
+                break;
+            }
+            data_len = strlen(data_str);
+        }
+        log("%s: received <%s>, payload %d bytes\n",
+            __func__, cmd, (data ? data_len : -1));
+        if(st->add(cmd, data, data_len) == 0) {
+            ++(st->cmds);
+        }
+        break;
+    }
+
+    if(data_str) {
+        UTIL_FREE(data_str);
+    }
+    json_decref(root);
+}
+
+// HTTP stream callback, splits the response data into the records
+// Returns: 0 to continue, negative to abort the request
+static int cmd_push_data(char *data, int len, void *cookie)
+{
+    CMD_PUSH_STATE_t *st = (CMD_PUSH_STATE_t *)cookie;
+    char *nl;
+    int rec_len;
+
+    util_wd_poll();
+
+    while(len > 0)
+    {
+        nl = memchr(data, '\n', len);
+        rec_len = nl ? (nl - data) : len;
+
+        // Complete record in the chunk, process it in place
+        if(nl && st->len == 0 && !st->skip) {
+            cmd_push_rec(st, data, rec_len);
+            data += rec_len + 1;
+            len -= rec_len + 1;
+            continue;
+        }
+
+        // Collect the part of the record in the buffer
+        if(!st->skip && st->len + rec_len > CMD_PUSH_MAX_REC_LEN) {
+            log("%s: record longer than %d bytes, skipping\n",
+                __func__, CMD_PUSH_MAX_REC_LEN);
+            st->skip = TRUE;
+            st->len = 0;
+        }
+        if(!st->skip && st->len + rec_len > st->size) {
+            int new_size = st->size ? st->size : CMD_PUSH_BUF_SIZE;
+            char *new_buf;
+            while(new_size < st->len + rec_len) {
+                new_size *= 2;
+            }
+            new_buf = UTIL_REALLOC(st->buf, new_size);
+            if(!new_buf) {
+                log("%s: failed to allocate %d bytes\n", __func__, new_size);
+                return -1;
+            }
+            st->buf = new_buf;
+            st->size = new_size;
+        }
+        if(!st->skip) {
+            memcpy(st->buf + st->len, data, rec_len);
+            st->len += rec_len;
+        }
+        data += rec_len;
+        len -= rec_len;
+
+        // End of the record
+        if(nl) {
+            if(!st->skip) {
+                cmd_push_rec(st, st->buf, st->len);
+            }
+            st->len = 0;
+            st->skip = FALSE;
+            ++data;
+            --len;
+        }
+    }
+
+    return 0;
+}
+
+// Make the push channel request to the url, the commands received are
+// passed to the add() function.
+// Returns: the HTTP response code or negative if the request has failed,
+//          the number of the commands received is stored in *cmds
+static int cmd_push_poll(char *url, int *cmds,
+                         int (*add)(const char *, const char *, int))
+{
+    HTTP_STREAM_t hs;
+    CMD_PUSH_STATE_t st;
+    http_rsp *rsp;
+    int code = -1;
+
+    memset(&st, 0, sizeof(st));
+    st.add = add;
+    memset(&hs, 0, sizeof(hs));
+    hs.f = cmd_push_data;
+    hs.cookie = &st;
+    hs.timeout = CMD_PUSH_POLL_TIMEOUT;
+    hs.idle_timeout = CMD_PUSH_IDLE_TIMEOUT;
+
+    rsp = http_get_stream(url, "Accept: application/x-ndjson\0", &hs);
+    if(rsp != NULL) {
+        code = rsp->code;
+        // The last record might not have the newline
+        if((code / 100) == 2 && st.len > 0 && !st.skip) {
+            cmd_push_rec(&st, st.buf, st.len);
+        }
+        free_rsp(rsp);
+    }
+    if(st.buf) {
+        UTIL_FREE(st.buf);
+    }
+    *cmds = st.cmds;
+
+    return code;
+}
+
+// Command push channel loop
+static void cmd_push(THRD_PARAM_t *p)
+{
+    char *my_mac = util_device_mac();
+    unsigned int retry_delay = CMD_PUSH_RETRY_MIN;
+    unsigned int delay, sec;
+    unsigned long t_start;
+    int code, cmds;
+    char url[256];
+
+    log("%s: started\n", __func__);
+
+    // Check that we have MAC address
+    if(!my_mac) {
+        log("%s: cannot get device MAC\n", __func__);
+        return;
+    }
+
+    log("%s: waiting for provision to complete\n", __func__);
+    wait_for_provision();
+    log("%s: done waiting for provision\n", __func__);
+
+    util_wd_set_timeout(REQ_CONNECT_TIMEOUT + CMD_PUSH_POLL_TIMEOUT +
+                        CMD_PUSH_RETRY_MAX);
+
+    for(;;)
+    {
+        util_wd_poll();
+
+        util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API, url,
+                       sizeof(url), CMD_PUSH_PATH, my_mac);
+        t_start = util_time(1);
+        code = cmd_push_poll(url, &cmds, cmdproc_add_cmd_data);
+
+        // The server has ended the response, send the next request
+        // right away
+        if((code / 100) == 2 &&
+           (cmds > 0 || util_time(1) - t_start >= CMD_PUSH_MIN_POLL_TIME))
+        {
+            retry_delay = CMD_PUSH_RETRY_MIN;
+            continue;
+        }
+
+        if(code == 404 || code == 501) {
+            log("%s: push channel is not supported by the server (%d)\n",
+                __func__, code);
+            delay = CMD_PUSH_UNSUPPORTED_DELAY;
+        } else {
+            log("%s: push request has failed, code %d, retry in %u sec\n",
+                __func__, code, retry_delay);
+            delay = retry_delay;
+            retry_delay = UTIL_MIN(retry_delay * 2, CMD_PUSH_RETRY_MAX);
+        }
+        // Sleep in the steps short enough for the watchdog
+        for(; delay > 0; delay -= sec) {
+            sec = UTIL_MIN(delay, CMD_PUSH_RETRY_MAX);
+            sleep(sec);
+            util_wd_poll();
+        }
+    }
+
+    // Never reaches here
+    log("%s: done\n", __func__);
+}
+
+// Start the command push channel thread, returns 0 if successful
+int cmd_push_start(void)
+{
+    return util_start_thrd("cmd_push", cmd_push, NULL, NULL);
+}
+
+
+#ifdef DEBUG
+
+// Test server listening socket
+static int test_push_srv_fd = -1;
+
+// Chunks the test server sends (the records are split between the
+// chunks in different ways), delay (in ms) is before sending the chunk
+static struct {
+    unsigned int delay;
+    char *chunk;
+} test_push_chunks[] = {
+    {  100, "\n" },
+    {  500, "{\"cmd\":\"wireless_scan\"}\n" },
+    { 1000, "{\"cmd\":\"port_scan\",\"da" },
+    {  200, "ta\":{\"devices\":[\"00:11:22:33:44:55\"]}}\n\n" },
+    { 1000, "{\"cmd\":\"shell_cmd\",\"data\":{\"command\":\"echo 1\"}}\n"
+            "{\"cmd\":\"bad\"" },
+    {  100, "}\n{broken}\n{\"cmd\":\"fetch_urls\",\"data\":\"[]\"}" },
+    {    0, NULL }
+};
+
+// Test server thread, serves one request sending the test chunks
+static void test_push_server(THRD_PARAM_t *p)
+{
+    int ii, fd, len;
+    char buf[1024];
+
+    fd = accept(test_push_srv_fd, NULL, NULL);
+    if(fd < 0) {
+        printf("%s: accept() error: %s\n", __func__, strerror(errno));
+        return;
+    }
+    // Read the request headers (the request is small, no need to
+    // be precise here)
+    for(len = 0; len < sizeof(buf) - 1;) {
+        int rc = recv(fd, buf + len, sizeof(buf) - 1 - len, 0);
+        if(rc <= 0) {
+            break;
+        }
+        len += rc;
+        buf[len] = 0;
+        if(strstr(buf, "\r\n\r\n") != NULL) {
+            break;
+        }
+    }
+    printf("%s: request:\n%s", __func__, buf);
+
+    len = snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: application/x-ndjson\r\n"
+                   "Transfer-Encoding: chunked\r\n\r\n");
+    send(fd, buf, len, 0);
+    for(ii = 0; test_push_chunks[ii].chunk != NULL; ii++) {
+        usleep(test_push_chunks[ii].delay * 1000);
+        len = snprintf(buf, sizeof(buf), "%x\r\n%s\r\n",
+                       (unsigned int)strlen(test_push_chunks[ii].chunk),
+                       test_push_chunks[ii].chunk);
+        send(fd, buf, len, 0);
+    }
+    send(fd, "0\r\n\r\n", 5, 0);
+    sleep(1);
+    close(fd);
+}
+
+// Test start time (in ms)
+static unsigned long long test_push_t0;
+
+// Test function for adding the commands to the queue
+static int test_push_add(const char *cmd, const char *data, int len)
+{
+    printf("%llums: <%s>, payload: %s%.*s%s\n",
+           util_time(1000) - test_push_t0, cmd,
+           (data ? "'" : "none"), (data ? len : 0), (data ? data : ""),
+           (data ? "'" : ""));
+    return 0;
+}
+
+// Test the command push channel against a local stub server
+int test_cmd_push(void)
+{
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    char url[64];
+    int code, cmds;
+
+    test_push_srv_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(test_push_srv_fd < 0) {
+        printf("%s: socket() error: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(test_push_srv_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+       listen(test_push_srv_fd, 1) != 0 ||
+       getsockname(test_push_srv_fd, (struct sockaddr *)&sa, &sa_len) != 0)
+    {
+        printf("%s: error setting up server: %s\n", __func__, strerror(errno));
+        close(test_push_srv_fd);
+        return -1;
+    }
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/push",
+             ntohs(sa.sin_port));
+    if(util_start_thrd("test_push_srv", test_push_server, NULL, NULL) != 0) {
+        printf("%s: failed to start the server thread\n", __func__);
+        close(test_push_srv_fd);
+        return -1;
+    }
+
+    printf("%s: requesting %s\n", __func__, url);
+    test_push_t0 = util_time(1000);
+    code = cmd_push_poll(url, &cmds, test_push_add);
+    printf("%s: done in %llums, code %d, %d commands\n", __func__,
+           util_time(1000) - test_push_t0, code, cmds);
+    close(test_push_srv_fd);
+
+    return (code == 200 && cmds == 5) ? 0 : -1;
+}
+
+#endif // DEBUG
+
+#endif // FEATURE_CMD_PUSH
@@ -21,6 +21,11 @@ static UTIL_MUTEX_t cmd_q_m = UTIL_MUTEX_INITIALIZER;
 char *cmd_q_buf;
 char *cmd_q[CMD_Q_MAX_SIZE];
 
+// Command payloads (NULL if the payload has to be downloaded) and
+// their lengths, parallel to the cmd_q[] array
+static char *cmd_q_data[CMD_Q_MAX_SIZE];
+static int cmd_q_data_len[CMD_Q_MAX_SIZE];
+
 // Command queue start and length
 static unsigned int cmd_q_start = 0;
 static unsigned int cmd_q_len = 0;
@@ -171,17 +176,30 @@ int cmd_to_shell(char *cmd, char *s, int s_len)
     return err;
 }
 
-// Add command to the commands queue, retunrs 0 if successful
-int cmdproc_add_cmd(const char *cmd)
+// Add command w/ its payload to the commands queue (the payload is
+// copied, it is used instead of downloading the data for the commands
+// w/ CMD_RULE_F_DATA), retunrs 0 if successful
+int cmdproc_add_cmd_data(const char *cmd, const char *data, int len)
 {
     unsigned int ii;
     unsigned int jj;
     int ret = 0;
+    char *data_copy = NULL;
 
     if(!cmd) {
         log("%s: error, invalid command pointer\n", __func__);
         return -1;
     }
+    if(data) {
+        data_copy = UTIL_MALLOC(len + 1);
+        if(!data_copy) {
+            log("%s: error allocating %d bytes for <%s> payload\n",
+                __func__, len + 1, cmd);
+            return -1;
+        }
+        memcpy(data_copy, data, len);
+        data_copy[len] = 0;
+    }
     UTIL_MUTEX_TAKE(&cmd_q_m);
     for(;;) {
         // Only allow (max - 1) commands to be added as we might be
@@ -194,32 +212,46 @@ int cmdproc_add_cmd(const char *cmd)
             break;
         }
         // Prioritize pull router config over other commands
+        ii = (cmd_q_start + cmd_q_len) % CMD_Q_MAX_SIZE;
         if (strncmp(cmd, "pull_router_config", CMD_STR_MAX_LEN - 1) == 0) {
-            ii = cmd_q_start;
-            jj = (cmd_q_start + 1 ) % CMD_Q_MAX_SIZE;
-            // Shift - right all the pending commands
-            while (jj != cmd_q_start) {
-                strncpy(cmd_q[jj], cmd_q[ii], CMD_STR_MAX_LEN - 1);
-                jj = (jj + 1 ) % CMD_Q_MAX_SIZE;
-                ii = (ii + 1 ) % CMD_Q_MAX_SIZE;
+            // Shift right all the pending commands (moving the string
+            // pointers, starting from the end), then use the free
+            // entry from the end at the start of the queue.
+            char *free_entry = cmd_q[ii];
+            while(ii != cmd_q_start) {
+                jj = (ii + CMD_Q_MAX_SIZE - 1) % CMD_Q_MAX_SIZE;
+                cmd_q[ii] = cmd_q[jj];
+                cmd_q_data[ii] = cmd_q_data[jj];
+                cmd_q_data_len[ii] = cmd_q_data_len[jj];
+                ii = jj;
             }
-            strncpy(cmd_q[cmd_q_start], cmd, CMD_STR_MAX_LEN - 1);
-            cmd_q[cmd_q_start][CMD_STR_MAX_LEN - 1] = 0;
-        } else {
-            ii = (cmd_q_start + cmd_q_len) % CMD_Q_MAX_SIZE;
-            strncpy(cmd_q[ii], cmd, CMD_STR_MAX_LEN - 1);
-            cmd_q[ii][CMD_STR_MAX_LEN - 1] = 0;
+            cmd_q[ii] = free_entry;
         }
+        strncpy(cmd_q[ii], cmd, CMD_STR_MAX_LEN - 1);
+        cmd_q[ii][CMD_STR_MAX_LEN - 1] = 0;
+        cmd_q_data[ii] = data_copy;
+        cmd_q_data_len[ii] = len;
+        data_copy = NULL;
         ++cmd_q_len;
         // Notify the command processor that a command is ready
-        log("%s: set command received event for <%s> md_q_len = %d cmd_q_start = %d ii = %d\n", __func__, cmd, cmd_q_len, cmd_q_start, ii);
+        log("%s: set command received event for <%s>%s md_q_len = %d cmd_q_start = %d ii = %d\n", __func__, cmd, (data ? " w/ payload" : ""), cmd_q_len, cmd_q_start, ii);
         UTIL_EVENT_SET(&cmd_ready);
         break;
     }
     UTIL_MUTEX_GIVE(&cmd_q_m);
+
+    if(data_copy) {
+        UTIL_FREE(data_copy);
+    }
     return ret;
 }
 
+// Add command to the commands queue, retunrs 0 if successful
+int cmdproc_add_cmd(const char *cmd)
+{
+    return cmdproc_add_cmd_data(cmd, NULL, 0);
+}
+
 // Find the rule matching the command "cmd" in the rule set "rule_set"
 // Returns: pointer to the rule or NULL if not found
 CMD_RULE_t *find_rule_by_cmd(CMD_RULE_t *rule_set, char *cmd)
@@ -283,6 +315,8 @@ static void cmdproc(THRD_PARAM_t *p)
         int rc, err, len;
         char *cmd = NULL;
         char *data = NULL;
+        char *cmd_data = NULL;
+        int cmd_data_len = 0;
         http_rsp *rsp = NULL;
         CMD_RULE_t *rule = NULL;
         char url[256];
@@ -305,8 +339,12 @@ static void cmdproc(THRD_PARAM_t *p)
                 break;
             }
 
-            // Grab the command pointer and advance the queue start
+            // Grab the command pointer (and the payload if it came w/
+            // the command) and advance the queue start
             cmd = cmd_q[cmd_q_start];
+            cmd_data = cmd_q_data[cmd_q_start];
+            cmd_data_len = cmd_q_data_len[cmd_q_start];
+            cmd_q_data[cmd_q_start] = NULL;
             cmd_q_start = (cmd_q_start + 1) % CMD_Q_MAX_SIZE;
             --cmd_q_len;
 
@@ -327,6 +365,9 @@ static void cmdproc(THRD_PARAM_t *p)
 
         // If no rule found, then nothing to do for the command
         if(!rule) {
+            if(cmd_data) {
+                UTIL_FREE(cmd_data);
+            }
             continue;
         }
 
@@ -339,6 +380,13 @@ static void cmdproc(THRD_PARAM_t *p)
         len = 0;
         for(;(rule->flags & CMD_RULE_F_DATA) != 0;)
         {
+            // The payload came w/ the command, no need to download it
+            if(cmd_data) {
+                data = cmd_data;
+                len = cmd_data_len;
+                break;
+            }
+
             // Prepare the URL string
             util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API, url,
                            sizeof(url), CMD_PATH, my_mac, cmd);
@@ -394,7 +442,13 @@ static void cmdproc(THRD_PARAM_t *p)
         if(err && (rule->flags & CMD_RULE_F_RETRY) != 0) {
             log("%s: command <%s> has failed, re-adding\n",
                 __func__, cmd);
-            cmdproc_add_cmd(cmd);
+            cmdproc_add_cmd_data(cmd, cmd_data, cmd_data_len);
+        }
+
+        // No longer need the payload that came w/ the command
+        if(cmd_data) {
+            UTIL_FREE(cmd_data);
+            cmd_data = NULL;
         }
     }
 
@@ -418,6 +472,12 @@ int cmdproc_init(int level)
         }
         // Start the command processor job
         ret = util_start_thrd("cmdproc", cmdproc, NULL, NULL);
+#ifdef FEATURE_CMD_PUSH
+        // Start the command push channel job
+        if(ret == 0) {
+            ret = cmd_push_start();
+        }
+#endif // FEATURE_CMD_PUSH
     }
     return ret;
 }
@@ -16,6 +16,29 @@
 // Max time (in sec) for command execution (device specific .h can override)
 #define CMD_MAX_EXE_TIME 60
 
+#ifdef FEATURE_CMD_PUSH
+// Command push channel (see cmd_push.c). The agent keeps a long-poll (or
+// streaming) request open to the server, the server sends the commands
+// w/ their payloads in the response as soon as they are issued.
+// Max time (in sec) the push request can stay open (the server is
+// expected to end it earlier)
+#define CMD_PUSH_POLL_TIMEOUT 300
+// Abort the push request if nothing (not even the heartbeat newline)
+// is received for so many seconds
+#define CMD_PUSH_IDLE_TIMEOUT 90
+// Min and max delay (in sec) before retrying after a failed request
+#define CMD_PUSH_RETRY_MIN 5
+#define CMD_PUSH_RETRY_MAX 300
+// Delay (in sec) before trying again if the server does not support
+// the push channel
+#define CMD_PUSH_UNSUPPORTED_DELAY 3600
+// Requests ending quicker than this (in sec) w/o commands are treated
+// as failed (prevents hammering the server in a tight loop)
+#define CMD_PUSH_MIN_POLL_TIME 2
+// Max length of the command record in the push response
+#define CMD_PUSH_MAX_REC_LEN (256 * 1024)
+#endif // FEATURE_CMD_PUSH
+
 // Shell command file location (device specific .h can override)
 #define CMD_SHELL_PNAME "/tmp/unum_cmd.sh"
 
@@ -63,6 +86,16 @@ extern CMD_RULE_t cmd_platform_rules[];
 // Add command to the commands queue, retunrs 0 if successful
 int cmdproc_add_cmd(const char *cmd);
 
+// Add command w/ its payload to the commands queue (the payload is
+// copied, it is used instead of downloading the data for the commands
+// w/ CMD_RULE_F_DATA), retunrs 0 if successful
+int cmdproc_add_cmd_data(const char *cmd, const char *data, int len);
+
+#ifdef FEATURE_CMD_PUSH
+// Start the command push channel thread, returns 0 if successful
+int cmd_push_start(void);
+#endif // FEATURE_CMD_PUSH
+
 // Generic processing function for commands running in shell.
 // The parameters: command name, shell command script and its length
 // Returns 0 if successful (exit code from the system() call)
@@ -8,7 +8,7 @@ CPPFLAGS += -I$(UNUM_PATH)/cmdproc/$(MODEL)
 
 # Add common code file(s)
 OBJECTS += ./cmdproc/cmdproc.o ./cmdproc/fetch_urls.o ./cmdproc/telnet.o
-OBJECTS += ./cmdproc/pingflood.o
+OBJECTS += ./cmdproc/pingflood.o ./cmdproc/cmd_push.o
 
 # Add model specific code file
 OBJECTS += ./cmdproc/$(MODEL)/dev_cmds.o
@@ -11,10 +11,8 @@
 //#define LOG_DBG_DST LOG_DST_CONSOLE
 
 
-// TX ring socket, address and length
-static int tx_ss = -1;
-static void *tx_ring = MAP_FAILED;
-static unsigned int tx_ring_len = 0;
+// TX ring for sending the flood packets
+static UTIL_TXRING_t tx_ring = { .s = -1, .ring = MAP_FAILED, .len = 0 };
 
 // Accumulator for counting sent requests and received replies data
 static unsigned long dot11_bytes_tx_count; // bytes tx from 802.11 counters
@@ -119,32 +117,6 @@ static int fill_icmp(void *ptr)
     return icmp_len;
 }
 
-// Find next free buffer (start searching from buffer 0 if restart is TRUE)
-static struct tpacket_hdr *get_free_buffer(int restart)
-{
-    static int next = 0;
-    int i, ii;
-
-    if(restart) {
-        ii = 0;
-    } else {
-        ii = next;
-    }
-    for(i = 0; i < PINGFLOOD_TX_PKT_NUM_BUFS; ++i)
-    {
-        struct tpacket_hdr *tph =
-            (struct tpacket_hdr *)(tx_ring + (PINGFLOOD_TX_PKT_BUF_SIZE * ii));
-        ii = (ii + 1) % PINGFLOOD_TX_PKT_NUM_BUFS;
-        if((volatile int)tph->tp_status == TP_STATUS_AVAILABLE)
-        {
-            next = ii;
-            return tph;
-        }
-    }
-
-    return NULL;
-}
-
 // Fill in the tx ring w/ the ping packets
 static int prepare_ring(unsigned char *smac, IPV4_ADDR_t *sip,
                         unsigned char *dmac, IPV4_ADDR_t *dip)
@@ -153,11 +125,10 @@ static int prepare_ring(unsigned char *smac, IPV4_ADDR_t *sip,
     int sum_pkt_len = 0;
     int num_pkts = 0;
 
-    for(i = 0; i < PINGFLOOD_TX_PKT_NUM_BUFS; i++)
+    for(i = 0; i < tx_ring.frame_nr; i++)
     {
-        struct tpacket_hdr *tph =
-            (struct tpacket_hdr *)(tx_ring + (PINGFLOOD_TX_PKT_BUF_SIZE * i));
-        void *pkt = (void *)tph + (TPACKET_HDRLEN - sizeof(struct sockaddr_ll));
+        struct tpacket_hdr *tph = UTIL_TXRING_FRAME(&tx_ring, i);
+        void *pkt = UTIL_TXRING_DATA(tph);
         void *pkt_ip = pkt + sizeof(struct ether_header);
         void *pkt_icmp = pkt + sizeof(struct ether_header) +
                                sizeof(struct iphdr);
@@ -178,7 +149,7 @@ static int prepare_ring(unsigned char *smac, IPV4_ADDR_t *sip,
 static int do_flood(unsigned char *mac,
                     unsigned long msec, unsigned long byps_limit)
 {
-    int ii, err = 0;
+    int err = 0;
     unsigned long cur_t, end_t, last_t;
     unsigned long pkts_sent;
     WIRELESS_COUNTERS_t wc_before = { .flags = 0 };
@@ -209,12 +180,11 @@ static int do_flood(unsigned char *mac,
         int pkts_pending = 0;
         while(bytes_tx_bucket >= bytes_per_pkt)
         {
-            tph = get_free_buffer(!pkts_sent);
+            tph = util_txring_get(&tx_ring, !pkts_sent);
             if(!tph) {
                 break;
             }
-            tph->tp_status = TP_STATUS_SEND_REQUEST;
-            __sync_synchronize();
+            util_txring_queue(&tx_ring, tph, tph->tp_len);
             bytes_tx_bucket -= bytes_per_pkt;
             ++pkts_pending;
             ++pkts_sent;
@@ -222,8 +192,8 @@ static int do_flood(unsigned char *mac,
 
         // Try to send all buffers with TP_STATUS_SEND_REQUEST
         if(pkts_pending) {
-            err = send(tx_ss, NULL, 0, MSG_DONTWAIT);
-            if(err < 0 && EAGAIN != errno && EWOULDBLOCK != errno)
+            err = util_txring_send(&tx_ring);
+            if(err < 0)
             {
                 log("%s: send() error %s\n", __func__, strerror(errno));
                 break;
@@ -253,15 +223,7 @@ static int do_flood(unsigned char *mac,
     }
 
     // Count not yet transmitted buffers
-    for(ii = 0; ii < PINGFLOOD_TX_PKT_NUM_BUFS; ++ii)
-    {
-        struct tpacket_hdr *tph =
-            (struct tpacket_hdr *)(tx_ring + (PINGFLOOD_TX_PKT_BUF_SIZE * ii));
-        if((volatile int)tph->tp_status != TP_STATUS_AVAILABLE)
-        {
-            --pkts_sent;
-        }
-    }
+    pkts_sent -= util_txring_pending(&tx_ring);
 
     // Bytes we attempted to transmit
     bytes_tx_count = pkts_sent * bytes_per_pkt;
@@ -300,126 +262,6 @@ static int do_flood(unsigned char *mac,
     return 0;
 }
 
-// Set up tx ring and socket
-static int tx_ring_setup(char *ifname)
-{
-    int ifidx, ss, val;
-    struct sockaddr_ll my_addr;
-
-    // Make sure no ring and no socket
-    if(tx_ss >= 0 || tx_ring_len > 0) {
-        log("%s: error, busy\n", __func__);
-        return -1;
-    }
-
-    ss = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
-    if(ss < 0)
-    {
-        log("%s: socket() failed, %s\n", __func__, strerror(errno));
-        return -2;
-    }
-
-    // Get the index of the network interface
-    struct ifreq s_ifr;
-    memset(&s_ifr, 0, sizeof(s_ifr));
-    strncpy(s_ifr.ifr_name, ifname, sizeof(s_ifr.ifr_name)-1);
-    if(ioctl(ss, SIOCGIFINDEX, &s_ifr) < 0)
-    {
-        close(ss);
-        log("%s: SIOCGIFINDEX failed, %s\n", __func__, strerror(errno));
-        return -3;
-    }
-    // Update with interface index
-    ifidx = s_ifr.ifr_ifindex;
-
-    // Bind to the interface
-    memset(&my_addr, 0, sizeof(struct sockaddr_ll));
-    my_addr.sll_family = AF_PACKET;
-    my_addr.sll_protocol = htons(ETH_P_ALL);
-    my_addr.sll_ifindex = ifidx;
-    if(bind(ss, (struct sockaddr *)&my_addr, sizeof(struct sockaddr_ll)) < 0)
-    {
-        close(ss);
-        log("%s: bind() failed, %s\n", __func__, strerror(errno));
-        return -4;
-    }
-
-    // Set packet loss option
-    val = 1;
-    if(setsockopt(ss, SOL_PACKET, PACKET_LOSS, (char *)&val, sizeof(val)) < 0)
-    {
-        close(ss);
-        log("%s: PACKET_LOSS failed, %s\n", __func__, strerror(errno));
-        return -5;
-    }
-
-#ifdef PACKET_QDISC_BYPASS
-    // Set PACKET_QDISC_BYPASS option (only available in 3.14 or later)
-    val = 1;
-    if(setsockopt(ss, SOL_PACKET, PACKET_QDISC_BYPASS,
-                  (char *)&val, sizeof(val)) < 0)
-    {
-        close(ss);
-        log("%s: PACKET_QDISC_BYPASS failed, %s\n", __func__, strerror(errno));
-        return -6;
-    }
-#endif // PACKET_QDISC_BYPASS
-
-    // Set up TX ring
-    struct tpacket_req req;
-    memset(&req, 0, sizeof(req));
-    req.tp_block_size = getpagesize();
-    req.tp_frame_size = PINGFLOOD_TX_PKT_BUF_SIZE;
-    req.tp_block_nr   = PINGFLOOD_TX_PKT_NUM_BUFS /
-                            (getpagesize() / PINGFLOOD_TX_PKT_BUF_SIZE);
-    req.tp_frame_nr   = PINGFLOOD_TX_PKT_NUM_BUFS;
-
-    if(setsockopt(ss, SOL_PACKET, PACKET_TX_RING,
-                  (char *)&req, sizeof(req)) < 0)
-    {
-        close(ss);
-        log("%s: PACKET_TX_RING failed, %s\n", __func__, strerror(errno));
-        return -7;
-    }
-
-    // mmap Tx ring memory
-    unsigned int len = req.tp_block_size * req.tp_block_nr;
-    void *ring = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, ss, 0);
-    if(ring == MAP_FAILED) {
-        close(ss);
-        log("%s: mmap error, %s\n", __func__, strerror(errno));
-        return -8;
-    }
-
-    // Setup complete
-    tx_ss = ss;
-    tx_ring = ring;
-    tx_ring_len = len;
-
-    return 0;
-}
-
-// Free Tx ring resources
-static void tx_ring_free(void)
-{
-    if(tx_ring_len > 0)
-    {
-        if(munmap(tx_ring, tx_ring_len) != 0)
-        {
-            log("%s: error unmapping memory at %p, len %u\n",
-                __func__, tx_ring, tx_ring_len);
-        }
-        tx_ring_len = 0;
-        tx_ring = MAP_FAILED;
-    }
-    if(tx_ss >= 0)
-    {
-        close(tx_ss);
-        tx_ss = -1;
-    }
-    return;
-}
-
 // The engine of the pingflood test
 static char *pingflood(char *ifname, unsigned char *mac, IPV4_ADDR_t *ip,
                        unsigned long test_msec, unsigned long byps_limit)
@@ -436,7 +278,10 @@ static char *pingflood(char *ifname, unsigned char *mac, IPV4_ADDR_t *ip,
         return NULL;
     }
     // Set up tx ring
-    if(tx_ring_setup(ifname) < 0) {
+    if(util_txring_open(&tx_ring, ifname, PINGFLOOD_TX_PKT_BUF_SIZE,
+                        PINGFLOOD_TX_PKT_NUM_BUFS,
+                        UTIL_TXRING_QDISC_BYPASS) < 0)
+    {
         log("%s: %s tx ring setup has failed, aborting\n", __func__, ifname);
         return NULL;
     }
@@ -456,7 +301,7 @@ static char *pingflood(char *ifname, unsigned char *mac, IPV4_ADDR_t *ip,
     }
 
     // Free tx ring resources
-    tx_ring_free();
+    util_txring_close(&tx_ring);
 
     return jstr;
 }
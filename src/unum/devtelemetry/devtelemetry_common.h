@@ -18,7 +18,7 @@
 #include "../festats/festats.h"
 
 
-// Get the interface counters and capturing stats
+// Get the previous epoch interface counters and capturing stats
 DT_IF_STATS_t *dt_get_if_stats(void);
 
 // This functon handles adding festats connection info to devices
@@ -27,44 +27,55 @@ DT_IF_STATS_t *dt_get_if_stats(void);
 //          all or some of the info
 int dt_add_fe_conn(FE_CONN_t *fe_conn);
 
-// Reset all DNS tables (including the table usage stats)
+// Reset the previous epoch DNS tables (including the table usage stats)
 void dt_reset_dns_tables(void);
 
-// Get the pointer to the DNS ip addresses table
-// The table should only be accessed from the tpcap thread
+// Swap the current and the previous epoch DNS tables
+// (called by the tpcap thread)
+void dt_dns_epoch_swap(void);
+
+// Reset the previous epoch main telemetry tables (including the
+// table usage stats and the interface counters)
+void dt_reset_dev_tables(void);
+
+// Swap the current and the previous epoch main telemetry tables
+// (called by the tpcap thread)
+void dt_main_epoch_swap(void);
+
+// Get the pointer to the previous epoch DNS ip addresses table
+// The table should only be accessed from the sender thread
 DT_DNS_IP_t *dt_get_dns_ip_tbl(void);
 
-// Get the pointer to the devices table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch devices table
+// The table should only be accessed from the sender thread
 DT_DEVICE_t **dt_get_dev_tbl(void);
 
-// Generate and pass to the sender the devices telemetry JSON.
-// If the previously submitted JSON buffer is not yet consumed
-// replace it with the new one.
+// Swap the current and the previous epoch tables and notify the
+// sender that the data is ready to be serialized and sent.
 // The function is called from the TPCAP thread/handler.
 // Avoid blocking if possible.
 void dt_sender_data_ready(void);
 
-// Returns pointer to the DNS name table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch DNS name table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_dns_name_tbl_stats(int reset);
 
-// Returns pointer to the DNS IP table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch DNS IP table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_dns_ip_tbl_stats(int reset);
 
-// Returns pointer to the devices table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch devices table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_dev_tbl_stats(int reset);
 
-// Returns pointer to the connections table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch connections table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_conn_tbl_stats(int reset);
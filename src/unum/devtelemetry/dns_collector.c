@@ -84,61 +84,81 @@ static PKT_PROC_ENTRY_t collector_dns_udp = {
 };
 
 
-// DNS IPs table (direct placement)
+// DNS IPs table (the entries are taken in order, the ones past
+// ip_tbl_used are all zeroes)
 static DT_DNS_IP_t *ip_tbl = NULL;
+static unsigned int ip_tbl_used = 0;
+// DNS IPs hash table (IP address -> DNS IPs table entry)
+static UTIL_RHT_t ip_rht;
 // DNS names table (uses pointers)
 static DT_DNS_NAME_t **name_tbl = NULL;
+// Arena the name table items are allocated from
+static UTIL_ARENA_t name_arena;
 
 // Structures tracking DNS name and IP tables stats
 static DT_TABLE_STATS_t name_tbl_stats;
 static DT_TABLE_STATS_t ip_tbl_stats;
 
-
-// Returns pointer to the DNS name table stats.
-// Use from the tpcap callbacks only.
+// The previous telemetry epoch DNS tables (swapped w/ the current epoch
+// ones above by dt_dns_epoch_swap(), accessed by the sender only)
+static struct {
+    DT_DNS_IP_t *ip_tbl;
+    unsigned int ip_tbl_used;
+    UTIL_RHT_t ip_rht;
+    DT_DNS_NAME_t **name_tbl;
+    UTIL_ARENA_t name_arena;
+    DT_TABLE_STATS_t name_tbl_stats;
+    DT_TABLE_STATS_t ip_tbl_stats;
+} prev;
+
+
+// Returns pointer to the previous epoch DNS name table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_dns_name_tbl_stats(int reset)
 {
     static DT_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &name_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.name_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&name_tbl_stats, 0, sizeof(name_tbl_stats));
+        memset(&prev.name_tbl_stats, 0, sizeof(prev.name_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Get the pointer to the DNS ip addresses table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch DNS ip addresses table
+// The table should only be accessed from the sender thread
 DT_DNS_IP_t *dt_get_dns_ip_tbl(void)
 {
-    return ip_tbl;
+    return prev.ip_tbl;
 }
 
-// Returns pointer to the DNS IP table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch DNS IP table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_dns_ip_tbl_stats(int reset)
 {
     static DT_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &ip_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.ip_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&ip_tbl_stats, 0, sizeof(ip_tbl_stats));
+        memset(&prev.ip_tbl_stats, 0, sizeof(prev.ip_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Reset all DNS tables (including the table usage stats)
+// Reset the previous epoch DNS tables (including the table usage stats)
 void dt_reset_dns_tables(void)
 {
     int ii;
 
-    // Reset IP table (it is direct placement, just memset)
-    memset(ip_tbl, 0, DTEL_MAX_DNS_IPS * sizeof(DT_DNS_IP_t));
+    // Reset IP table (only the used entries need to be wiped)
+    memset(prev.ip_tbl, 0, prev.ip_tbl_used * sizeof(DT_DNS_IP_t));
+    prev.ip_tbl_used = 0;
+    util_rht_clear(&prev.ip_rht);
     // Reset name table (keeping already allocated items memory)
     for(ii = 0; ii < DTEL_MAX_DNS_NAMES; ii++) {
-        DT_DNS_NAME_t *item = name_tbl[ii];
+        DT_DNS_NAME_t *item = prev.name_tbl[ii];
         if(item) {
             *(item->name) = 0;
             item->cname = NULL;
@@ -150,6 +170,19 @@ void dt_reset_dns_tables(void)
     return;
 }
 
+// Swap the current epoch DNS tables w/ the previous epoch ones (should
+// already be reset). Called by the tpcap thread.
+void dt_dns_epoch_swap(void)
+{
+    UTIL_SWAP(ip_tbl, prev.ip_tbl);
+    UTIL_SWAP(ip_tbl_used, prev.ip_tbl_used);
+    UTIL_SWAP(ip_rht, prev.ip_rht);
+    UTIL_SWAP(name_tbl, prev.name_tbl);
+    UTIL_SWAP(name_arena, prev.name_arena);
+    UTIL_SWAP(name_tbl_stats, prev.name_tbl_stats);
+    UTIL_SWAP(ip_tbl_stats, prev.ip_tbl_stats);
+}
+
 // Determine if an ip table entry is in use
 // return TRUE if in use, FALSE if not
 int dt_dns_check_in_use(const DT_DNS_IP_t *entry)
@@ -168,173 +201,126 @@ int dt_dns_check_in_use(const DT_DNS_IP_t *entry)
 }
 
 #ifdef DEBUG
-// Find DNS IP entry in the IP table
+// Find DNS IP entry in the previous epoch IP table (for the tests, they
+// examine the tables after the epoch swap)
+// key - IP table entry w/ the key fields (u and af) set, the rest zeroed
 // Returns a pointer to the IP table entry of NULL if not found
-// Call only from the TPCAP thread/handlers
-static DT_DNS_IP_t *dt_find_dns_ipv4(IPV4_ADDR_t *ip)
+static DT_DNS_IP_t *dt_find_dns_ip(DT_DNS_IP_t *key)
 {
-    int ii, idx;
-    DT_DNS_IP_t *ret = NULL;
+    unsigned int probes;
+    DT_DNS_IP_t *ret;
 
     // Total # of find requests
-    ++(ip_tbl_stats.find_all);
+    ++(prev.ip_tbl_stats.find_all);
 
-    // Generate hash-based index
-    idx = util_hash(ip, sizeof(*ip)) % DTEL_MAX_DNS_IPS;
+    ret = util_rht_find(&prev.ip_rht, key,
+                        util_rht_hash(&prev.ip_rht, key), &probes);
 
-    for(ii = 0; ii < (DTEL_MAX_DNS_IPS / DT_SEARCH_LIMITER); ii++) {
-        // If we hit an empty entry then the IP we are looking for
-        // is not in the table (we NEVER remove individual entries)
-        if(!dt_dns_check_in_use(&ip_tbl[idx])) {
-            break;
-        }
-        if(ip_tbl[idx].u.ipv4.i == ip->i) {
-            ret = &(ip_tbl[idx]);
-            break;
-        }
-        // Collision, try the next index
-        idx = (idx + 1) % DTEL_MAX_DNS_IPS;
-    }
-
-    if(ii < 10) {
-        ++(ip_tbl_stats.find_10);
+    if(probes < 10) {
+        ++(prev.ip_tbl_stats.find_10);
     }
     if(!ret) {
-        ++(ip_tbl_stats.find_fails);
+        ++(prev.ip_tbl_stats.find_fails);
     }
 
     return ret;
 }
 
-#ifdef FEATURE_IPV6_TELEMETRY
 // Find DNS IP entry in the IP table
 // Returns a pointer to the IP table entry of NULL if not found
-// Call only from the TPCAP thread/handlers
-static DT_DNS_IP_t *dt_find_dns_ipv6(IPV6_ADDR_t *ip)
+// (previous epoch table, for the tests)
+static DT_DNS_IP_t *dt_find_dns_ipv4(IPV4_ADDR_t *ip)
 {
-    int ii, idx;
-    DT_DNS_IP_t *ret = NULL;
+    DT_DNS_IP_t key;
 
-    // Total # of find requests
-    ++(ip_tbl_stats.find_all);
+    memset(&key, 0, sizeof(key));
+    key.u.ipv4.i = ip->i;
+    key.af = AF_INET;
 
-    // Generate hash-based index
-    idx = util_hash(ip, sizeof(*ip)) % DTEL_MAX_DNS_IPS;
+    return dt_find_dns_ip(&key);
+}
 
-    for(ii = 0; ii < (DTEL_MAX_DNS_IPS / DT_SEARCH_LIMITER); ii++) {
-        // If we hit an empty entry then the IP we are looking for
-        // is not in the table (we NEVER remove inidividual entries)
-        if(!dt_dns_check_in_use(&ip_tbl[idx])) {
-            break;
-        }
-        if(ip_tbl[idx].u.ipv6.l.h == ip->l.h && ip_tbl[idx].u.ipv6.l.l == ip->l.l) {
-            ret = &(ip_tbl[idx]);
-            break;
-        }
-        // Collision, try the next index
-        idx = (idx + 1) % DTEL_MAX_DNS_IPS;
-    }
+#ifdef FEATURE_IPV6_TELEMETRY
+// Find DNS IP entry in the IP table
+// Returns a pointer to the IP table entry of NULL if not found
+// (previous epoch table, for the tests)
+static DT_DNS_IP_t *dt_find_dns_ipv6(IPV6_ADDR_t *ip)
+{
+    DT_DNS_IP_t key;
 
-    if(ii < 10) {
-        ++(ip_tbl_stats.find_10);
-    }
-    if(!ret) {
-        ++(ip_tbl_stats.find_fails);
-    }
+    memset(&key, 0, sizeof(key));
+    key.u.ipv6.l.h = ip->l.h;
+    key.u.ipv6.l.l = ip->l.l;
+    key.af = AF_INET6;
 
-    return ret;
+    return dt_find_dns_ip(&key);
 }
 #endif // FEATURE_IPV6_TELEMETRY
 #endif // DEBUG
 
 // Add to or update DNS IP->name mapping in the IP table
+// key - IP table entry w/ the key fields (u and af) set, the rest zeroed
 // Returns a pointer to the IP table entry added/updated or NULL
-static DT_DNS_IP_t *add_dns_ipv4(IPV4_ADDR_t *ip, DT_DNS_NAME_t *dname)
+static DT_DNS_IP_t *add_dns_ip(DT_DNS_IP_t *key, DT_DNS_NAME_t *dname)
 {
-    int ii, idx;
-    DT_DNS_IP_t *ret = NULL;
+    unsigned int probes;
+    uint32_t hash;
+    DT_DNS_IP_t *ret;
 
     // Total # of add requests
     ++(ip_tbl_stats.add_all);
 
-    // Generate hash-based index
-    idx = util_hash(ip, sizeof(*ip)) % DTEL_MAX_DNS_IPS;
-
-    for(ii = 0; ii < (DTEL_MAX_DNS_IPS / DT_SEARCH_LIMITER); ii++) {
-        // If we hit an empty entry then the IP we are looking for
-        // is not in the table (we NEVER remove individual entries)
-        if(!dt_dns_check_in_use(&ip_tbl[idx])) {
-            ret = &(ip_tbl[idx]);
-            ret->u.ipv4.i = ip->i;
-            ret->af = AF_INET;
-        } else if(ip_tbl[idx].u.ipv4.i != ip->i) {
-            // Collision, try the next index
-            idx = (idx + 1) % DTEL_MAX_DNS_IPS;
-            continue;
-        } else {
-            // The IP is already listed
-            ++(ip_tbl_stats.add_found);
-        }
-        // Update the DNS name
-        ip_tbl[idx].dns = dname;
-        ret = &(ip_tbl[idx]);
-        break;
+    hash = util_rht_hash(&ip_rht, key);
+    ret = util_rht_find(&ip_rht, key, hash, &probes);
+    if(ret) {
+        // The IP is already listed
+        ++(ip_tbl_stats.add_found);
+    } else if(ip_tbl_used < DTEL_MAX_DNS_IPS) {
+        // Take the next unused entry
+        ret = &(ip_tbl[ip_tbl_used]);
+        memcpy(ret, key, sizeof(DT_DNS_IP_t));
+        util_rht_add(&ip_rht, ret, hash, &probes);
+        ++ip_tbl_used;
+    } else {
+        ++(ip_tbl_stats.add_busy);
+        return NULL;
     }
+    // Update the DNS name
+    ret->dns = dname;
 
-    if(ii < 10) {
+    if(probes < 10) {
         ++(ip_tbl_stats.add_10);
     }
-    if(!ret) {
-        ++(ip_tbl_stats.add_busy);
-    }
 
     return ret;
 }
 
-#ifdef FEATURE_IPV6_TELEMETRY
 // Add to or update DNS IP->name mapping in the IP table
 // Returns a pointer to the IP table entry added/updated or NULL
-static DT_DNS_IP_t *add_dns_ipv6(IPV6_ADDR_t *ip, DT_DNS_NAME_t *dname)
+static DT_DNS_IP_t *add_dns_ipv4(IPV4_ADDR_t *ip, DT_DNS_NAME_t *dname)
 {
-    int ii, idx;
-    DT_DNS_IP_t *ret = NULL;
+    DT_DNS_IP_t key;
 
-    // Total # of add requests
-    ++(ip_tbl_stats.add_all);
+    memset(&key, 0, sizeof(key));
+    key.u.ipv4.i = ip->i;
+    key.af = AF_INET;
 
-    // Generate hash-based index
-    idx = util_hash(ip, sizeof(*ip)) % DTEL_MAX_DNS_IPS;
-
-    for(ii = 0; ii < (DTEL_MAX_DNS_IPS / DT_SEARCH_LIMITER); ii++) {
-        // If we hit an empty entry then the IP we are looking for
-        // is not in the table (we NEVER remove individual entries)
-        if(!dt_dns_check_in_use(&ip_tbl[idx])) {
-            ret = &(ip_tbl[idx]);
-            ret->u.ipv6.l.h = ip->l.h;
-            ret->u.ipv6.l.l = ip->l.l;
-            ret->af = AF_INET6;
-        } else if(ip_tbl[idx].u.ipv6.l.h != ip->l.h || ip_tbl[idx].u.ipv6.l.l != ip->l.l) {
-            // Collision, try the next index
-            idx = (idx + 1) % DTEL_MAX_DNS_IPS;
-            continue;
-        } else {
-            // The IP is already listed
-            ++(ip_tbl_stats.add_found);
-        }
-        // Update the DNS name
-        ip_tbl[idx].dns = dname;
-        ret = &(ip_tbl[idx]);
-        break;
-    }
+    return add_dns_ip(&key, dname);
+}
 
-    if(ii < 10) {
-        ++(ip_tbl_stats.add_10);
-    }
-    if(!ret) {
-        ++(ip_tbl_stats.add_busy);
-    }
+#ifdef FEATURE_IPV6_TELEMETRY
+// Add to or update DNS IP->name mapping in the IP table
+// Returns a pointer to the IP table entry added/updated or NULL
+static DT_DNS_IP_t *add_dns_ipv6(IPV6_ADDR_t *ip, DT_DNS_NAME_t *dname)
+{
+    DT_DNS_IP_t key;
 
-    return ret;
+    memset(&key, 0, sizeof(key));
+    key.u.ipv6.l.h = ip->l.h;
+    key.u.ipv6.l.l = ip->l.l;
+    key.af = AF_INET6;
+
+    return add_dns_ip(&key, dname);
 }
 #endif // FEATURE_IPV6_TELEMETRY
 
@@ -362,9 +348,9 @@ static DT_DNS_NAME_t *add_dns_name(char *name)
         // If we hit an empty entry then the name we are looking for
         // is not in the table (we NEVER remove inidividual entries)
         if(!name_tbl[idx]) {
-            ret = malloc(sizeof(DT_DNS_NAME_t));
+            ret = util_arena_alloc(&name_arena);
             if(!ret) { // Run out of memory
-                ++(name_tbl_stats.add_limit);
+                ++(name_tbl_stats.add_nomem);
                 return NULL;
             }
             *(ret->name) = 0;
@@ -572,17 +558,29 @@ static void dns_udp_rcv_cb(TPCAP_IF_t *tpif,
 int dt_dns_collector_init(void)
 {
     PKT_PROC_ENTRY_t *pe;
+    int ii;
 
     // Allocate memory for the DNS info tables (never freed).
-    // The names table allocates memory for each element
-    // when required and stores the pointer in the array.
+    // The names table takes memory for each element from the
+    // arena when required and stores the pointer in the array.
     // Once allocated the DNS entries are never freed (reused
-    // when needed).
-    ip_tbl = calloc(DTEL_MAX_DNS_IPS, sizeof(DT_DNS_IP_t));
-    name_tbl = calloc(DTEL_MAX_DNS_NAMES, sizeof(DT_DNS_NAME_t *));
-    if(!name_tbl || !ip_tbl) {
-        log("%s: failed to allocate memory for data tables\n", __func__);
-        return -1;
+    // when needed). There are two sets of the tables, for the current
+    // and the previous epoch.
+    for(ii = 0; ii < 2; ii++)
+    {
+        ip_tbl = calloc(DTEL_MAX_DNS_IPS, sizeof(DT_DNS_IP_t));
+        name_tbl = calloc(DTEL_MAX_DNS_NAMES, sizeof(DT_DNS_NAME_t *));
+        if(!name_tbl || !ip_tbl ||
+           util_arena_init(&name_arena, sizeof(DT_DNS_NAME_t),
+                           DTEL_MAX_DNS_NAMES) != 0 ||
+           util_rht_init(&ip_rht, DTEL_MAX_DNS_IPS, offsetof(DT_DNS_IP_t, u),
+                         offsetof(DT_DNS_IP_t, af) +
+                         sizeof(unsigned short)) != 0)
+        {
+            log("%s: failed to allocate memory for data tables\n", __func__);
+            return -1;
+        }
+        dt_dns_epoch_swap();
     }
 
     // Add the collector packet processing entries.
@@ -609,7 +607,7 @@ void dt_dns_tbls_test(void)
     int ii, count = 0, ecount = 0;
     printf("IP->DNS tables dump:\n");
     for(ii = 0; ii < DTEL_MAX_DNS_IPS; ii++) {
-        DT_DNS_IP_t *ip_item = &(ip_tbl[ii]);
+        DT_DNS_IP_t *ip_item = &(prev.ip_tbl[ii]);
         if(dt_dns_check_in_use(ip_item)) {
             count++;
             if (ip_item->af == AF_INET) {
@@ -666,6 +664,7 @@ void dt_dns_tbls_test(void)
     printf("DNS name table stats:\n");
     printf("  add_all = %lu\n", name_tbl_st->add_all);
     printf("  add_limit = %lu\n", name_tbl_st->add_limit);
+    printf("  add_nomem = %lu\n", name_tbl_st->add_nomem);
     printf("  add_busy = %lu\n", name_tbl_st->add_busy);
     printf("  add_10 = %lu\n", name_tbl_st->add_10);
     printf("  add_found = %lu\n", name_tbl_st->add_found);
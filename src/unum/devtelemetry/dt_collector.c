@@ -57,17 +57,63 @@ static PKT_PROC_ENTRY_t collector_stats_cb_only = {
 // capturing when stats are reported to the devtelemetry subsystem.
 static int cap_iteration = 0;
 
-// Discovered device table (uses pointers)
+// Discovered devices (pointers to the dev_arena items indexed by the item
+// slot #, NULL if the slot is not in use)
 static DT_DEVICE_t **dev_tbl;
-// Connections table (uses pointers)
-static DT_CONN_t **conn_tbl;
-// Interface counters and capturing stats (direct placement, static allocation)
-static DT_IF_STATS_t stats_tbl[DEVTELEMETRY_NUM_SLICES][TPCAP_STAT_IF_MAX];
+// Devices hash table (MAC -> device)
+static UTIL_RHT_t dev_rht;
+// Devices min-heap ordered by rating and then by the time added, the
+// device at the top is the first candidate for replacement when the table
+// is full. The dev_hpos[] keeps each device (by arena slot #) position
+// in the heap.
+static DT_DEVICE_t **dev_heap;
+static unsigned int *dev_hpos;
+static unsigned int dev_heap_len;
+// Connections hash table (connection header -> connection)
+static UTIL_RHT_t conn_rht;
+// Arenas the device and connection table items are allocated from
+static UTIL_ARENA_t dev_arena;
+static UTIL_ARENA_t conn_arena;
+// Interface counters and capturing stats (direct placement, static
+// allocation, points to one of the stats_tbls[])
+static DT_IF_STATS_t stats_tbls[2][DEVTELEMETRY_NUM_SLICES][TPCAP_STAT_IF_MAX];
+static DT_IF_STATS_t (*stats_tbl)[TPCAP_STAT_IF_MAX] = stats_tbls[0];
+
+// Interface kinds (see dt_if_kind()), valid while the interface
+// configuration generation is the same
+static struct {
+    unsigned int gen;
+    int count;
+    struct {
+        char name[IFNAMSIZ];
+        int kind;
+    } e[TPCAP_STAT_IF_MAX];
+} if_kinds;
 
 // Structures tracking the device and connection tables stats
 static DT_TABLE_STATS_t dev_tbl_stats;
 static DT_TABLE_STATS_t conn_tbl_stats;
 
+// The tables above are filled in by the tpcap thread during the current
+// telemetry epoch. At the end of the epoch they are swapped w/ the tables
+// of the previous epoch (see dt_main_epoch_swap()) that the sender has
+// serialized and reset by then, so the capturing does not stop while
+// the telemetry is being prepared.
+// The previous epoch tables (accessed by the sender only)
+static struct {
+    DT_DEVICE_t **dev_tbl;
+    UTIL_RHT_t dev_rht;
+    DT_DEVICE_t **dev_heap;
+    unsigned int *dev_hpos;
+    unsigned int dev_heap_len;
+    UTIL_RHT_t conn_rht;
+    UTIL_ARENA_t dev_arena;
+    UTIL_ARENA_t conn_arena;
+    DT_IF_STATS_t (*stats_tbl)[TPCAP_STAT_IF_MAX];
+    DT_TABLE_STATS_t dev_tbl_stats;
+    DT_TABLE_STATS_t conn_tbl_stats;
+} prev = { .stats_tbl = stats_tbls[1] };
+
 #ifndef FEATURE_LAN_ONLY
 // 25 bits of IP mcast MAC in network order for matching mcast destinations
 static uint32_t *ip_mc_mac =
@@ -77,31 +123,109 @@ static uint32_t *ip_mc_mac_mask =
 #endif // !FEATURE_LAN_ONLY
 
 
-// Reset device telemetry main tables (including the table usage stats)
-static void dt_reset_dev_tables(void)
+// Reset the previous epoch device telemetry main tables (including
+// the table usage stats and the interface counters)
+void dt_reset_dev_tables(void)
 {
-    int ii;
-
-    // Reset devices table (keeping already allocated items memory)
-    for(ii = 0; ii < DTEL_MAX_DEV; ii++) {
-        DT_DEVICE_t *item = dev_tbl[ii];
-        if(item) {
-            memset(item, 0, sizeof(DT_DEVICE_t));
-        }
-    }
-    // Reset name table (keeping already allocated items memory)
-    for(ii = 0; ii < DTEL_MAX_CONN; ii++) {
-        DT_CONN_t *item = conn_tbl[ii];
-        if(item) {
-            item->hdr.dev = NULL;
-        }
-    }
+    // Drop all the devices and connections (the memory stays allocated)
+    memset(prev.dev_tbl, 0, DTEL_MAX_DEV * sizeof(DT_DEVICE_t *));
+    util_rht_clear(&prev.dev_rht);
+    util_rht_clear(&prev.conn_rht);
+    util_arena_reset(&prev.dev_arena);
+    util_arena_reset(&prev.conn_arena);
+    prev.dev_heap_len = 0;
+    // Reset the interface counters/stats table
+    memset(prev.stats_tbl, 0, sizeof(stats_tbls[0]));
     // Reset stats
     dt_dev_tbl_stats(TRUE);
     dt_conn_tbl_stats(TRUE);
     return;
 }
 
+// Swap the current epoch device telemetry main tables w/ the previous
+// epoch ones (should already be reset). Called by the tpcap thread.
+void dt_main_epoch_swap(void)
+{
+    UTIL_SWAP(dev_tbl, prev.dev_tbl);
+    UTIL_SWAP(dev_rht, prev.dev_rht);
+    UTIL_SWAP(dev_heap, prev.dev_heap);
+    UTIL_SWAP(dev_hpos, prev.dev_hpos);
+    UTIL_SWAP(dev_heap_len, prev.dev_heap_len);
+    UTIL_SWAP(conn_rht, prev.conn_rht);
+    UTIL_SWAP(dev_arena, prev.dev_arena);
+    UTIL_SWAP(conn_arena, prev.conn_arena);
+    UTIL_SWAP(stats_tbl, prev.stats_tbl);
+    UTIL_SWAP(dev_tbl_stats, prev.dev_tbl_stats);
+    UTIL_SWAP(conn_tbl_stats, prev.conn_tbl_stats);
+}
+
+// Returns TRUE if device d1 should be replaced before d2
+static __inline__ int dev_heap_less(DT_DEVICE_t *d1, DT_DEVICE_t *d2)
+{
+    return (d1->rating < d2->rating ||
+            (d1->rating == d2->rating && d1->t_add < d2->t_add));
+}
+
+// Put the device to the heap position pos
+static __inline__ void dev_heap_set(unsigned int pos, DT_DEVICE_t *dev)
+{
+    dev_heap[pos] = dev;
+    dev_hpos[UTIL_ARENA_IDX(&dev_arena, dev)] = pos;
+}
+
+// Move the device at the heap position pos up or down the heap
+// to restore the heap order.
+static void dev_heap_fix(unsigned int pos)
+{
+    DT_DEVICE_t *dev = dev_heap[pos];
+    unsigned int child;
+
+    while(pos > 0 && dev_heap_less(dev, dev_heap[(pos - 1) / 2])) {
+        dev_heap_set(pos, dev_heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    while((child = pos * 2 + 1) < dev_heap_len) {
+        if(child + 1 < dev_heap_len &&
+           dev_heap_less(dev_heap[child + 1], dev_heap[child]))
+        {
+            ++child;
+        }
+        if(!dev_heap_less(dev_heap[child], dev)) {
+            break;
+        }
+        dev_heap_set(pos, dev_heap[child]);
+        pos = child;
+    }
+    dev_heap_set(pos, dev);
+}
+
+// Update the device rating, all the rating changes should go
+// through here to keep the devices heap in order.
+static void dev_set_rating(DT_DEVICE_t *dev, uint16_t rating)
+{
+    if(dev->rating == rating) {
+        return;
+    }
+    dev->rating = rating;
+    dev_heap_fix(dev_hpos[UTIL_ARENA_IDX(&dev_arena, dev)]);
+}
+
+// Remove all the connections chained to the device (except the one
+// combined with the device entry) from the connections table.
+static void dev_del_conns(DT_DEVICE_t *dev)
+{
+    DT_CONN_t *conn, *next;
+
+    for(conn = dev->conn.next; conn != NULL; conn = next) {
+        next = conn->next;
+        util_rht_del(&conn_rht, &(conn->hdr),
+                     util_rht_hash(&conn_rht, &(conn->hdr)));
+        util_arena_free(&conn_arena, conn);
+    }
+    dev->conn.next = NULL;
+    dev->last_conn = &(dev->conn);
+}
+
 // Add to the connection table or find (if already there) the matching
 // one and return the pointer to the table entry (NULL if not there and
 // cannot add). If the connection is added the header is copied over
@@ -110,52 +234,38 @@ static void dt_reset_dev_tables(void)
 // device connections chain pointer are updated.
 static DT_CONN_t *add_conn(DT_CONN_HDR_t *hdr)
 {
-    int ii, idx;
+    unsigned int probes;
+    uint32_t hash;
     DT_CONN_t *ret = NULL;
 
     // Total # of add requests
     ++(conn_tbl_stats.add_all);
 
-    // Generate hash-based index
-    idx = util_hash(hdr, sizeof(DT_CONN_HDR_t)) % DTEL_MAX_CONN;
-
-    for(ii = 0; ii < (DTEL_MAX_CONN / DT_SEARCH_LIMITER); ii++) {
-        // If we hit an empty entry then the connection we are looking for
-        // is not in the table (we NEVER remove inidividual entries)
-        if(!conn_tbl[idx]) {
-            ret = malloc(sizeof(DT_CONN_t));
-            if(!ret) { // Run out of memory
-                ++(conn_tbl_stats.add_limit);
-                return NULL;
-            }
-            ret->hdr.dev = NULL;
-            conn_tbl[idx] = ret;
+    hash = util_rht_hash(&conn_rht, hdr);
+    ret = util_rht_find(&conn_rht, hdr, hash, &probes);
+    if(ret) {
+        ++(conn_tbl_stats.add_found);
+    } else {
+        ret = util_arena_alloc(&conn_arena);
+        if(!ret) { // Run out of memory
+            ++(conn_tbl_stats.add_nomem);
+            return NULL;
         }
-        if(conn_tbl[idx]->hdr.dev == NULL) {
-            ret = conn_tbl[idx];
-            memcpy(&(ret->hdr), hdr, sizeof(DT_CONN_HDR_t));
-            memset((void *)ret + sizeof(DT_CONN_HDR_t), 0,
-                   sizeof(DT_CONN_t) - sizeof(DT_CONN_HDR_t));
-            ret->hdr.dev->last_conn->next = ret;
-            ret->hdr.dev->last_conn = ret;
-            break;
+        memcpy(&(ret->hdr), hdr, sizeof(DT_CONN_HDR_t));
+        memset((void *)ret + sizeof(DT_CONN_HDR_t), 0,
+               sizeof(DT_CONN_t) - sizeof(DT_CONN_HDR_t));
+        if(util_rht_add(&conn_rht, ret, hash, &probes) != 0) {
+            util_arena_free(&conn_arena, ret);
+            ++(conn_tbl_stats.add_busy);
+            return NULL;
         }
-        // Check if this is the same connection
-        if(memcmp(&(conn_tbl[idx]->hdr), hdr, sizeof(DT_CONN_HDR_t)) == 0) {
-            ret = conn_tbl[idx];
-            ++(conn_tbl_stats.add_found);
-            break;
-        }
-        // Collision, try the next index
-        idx = (idx + 1) % DTEL_MAX_CONN;
+        ret->hdr.dev->last_conn->next = ret;
+        ret->hdr.dev->last_conn = ret;
     }
 
-    if(ii < 10) {
+    if(probes < 10) {
         ++(conn_tbl_stats.add_10);
     }
-    if(!ret) {
-        ++(conn_tbl_stats.add_busy);
-    }
 
     return ret;
 }
@@ -169,83 +279,55 @@ static DT_CONN_t *add_conn(DT_CONN_HDR_t *hdr)
 // The found  entries are returned as-is.
 static DT_DEVICE_t *add_dev(unsigned char *mac, int rating)
 {
-    int ii, idx;
-    int p_idx, p_rating;
-    unsigned long p_t_add;
+    unsigned int probes;
+    uint32_t hash;
     unsigned long tt = util_time(10);
     DT_DEVICE_t *ret = NULL;
 
     // Total # of add requests
     ++(dev_tbl_stats.add_all);
 
-    // Generate hash-based index
-    idx = util_hash(mac, 6) % DTEL_MAX_DEV;
+    hash = util_rht_hash(&dev_rht, mac);
+    ret = util_rht_find(&dev_rht, mac, hash, &probes);
+    if(probes < 10) {
+        ++(dev_tbl_stats.add_10);
+    }
+    if(ret) {
+        ++(dev_tbl_stats.add_found);
+        return ret;
+    }
 
-    // The device table is relatively small, so we will examine the whole
-    // table (if necessary) to find an entry or a free row.
-    // If we have no free space then a device with the same or lower rating
-    // (based on what we've seen) will be replaced with the more recent device.
-    p_idx = p_rating = -1;
-    p_t_add = 0;
-    for(ii = 0; ii < DTEL_MAX_DEV; ii++) {
-        // If we hit a free entry then the device we are looking for
-        // is not in the table (since we NEVER free entries taken).
-        if(!dev_tbl[idx]) {
-            ret = malloc(sizeof(DT_DEVICE_t));
-            if(!ret) { // Run out of memory
-                ++(dev_tbl_stats.add_limit);
-                return NULL;
-            }
-            memset(ret, 0, sizeof(DT_DEVICE_t));
-            dev_tbl[idx] = ret;
-        }
-        if(dev_tbl[idx]->rating == 0) {
-            ret = dev_tbl[idx];
-            memcpy(ret->mac, mac, sizeof(ret->mac));
-            ret->t_add = tt;
-            ret->last_conn = &(ret->conn);
-            break;
-        }
-        // Check if this is our MAC address entry
-        if(memcmp(dev_tbl[idx]->mac, mac, 6) == 0) {
-            ret = dev_tbl[idx];
-            ++(dev_tbl_stats.add_found);
-            break;
-        }
-        // If entry has a lower rating (or the same rating but is older) then
-        // it is a candidate for replacement. Remember it unless already have
-        // a better candidate.
-        if(dev_tbl[idx]->rating < rating ||
-           (dev_tbl[idx]->rating == rating && dev_tbl[idx]->t_add < tt))
+    if(dev_arena.count < dev_arena.max) {
+        ret = util_arena_alloc(&dev_arena);
+        memset(ret, 0, sizeof(DT_DEVICE_t));
+        dev_tbl[UTIL_ARENA_IDX(&dev_arena, ret)] = ret;
+        dev_heap_set(dev_heap_len, ret);
+        ++dev_heap_len;
+    } else {
+        // If we have no free space then a device with the lowest rating
+        // (or the oldest one of the same rating) is replaced with the
+        // new device if its rating is lower or the same.
+        ret = dev_heap[0];
+        if(ret->rating > rating || (ret->rating == rating && ret->t_add >= tt))
         {
-            if(p_idx < 0 || dev_tbl[idx]->rating < p_rating ||
-               (dev_tbl[idx]->rating==p_rating && dev_tbl[idx]->t_add<p_t_add))
-            {
-                p_idx = idx;
-                p_rating = dev_tbl[idx]->rating;
-                p_t_add = dev_tbl[idx]->t_add;
-            }
+            ++(dev_tbl_stats.add_busy);
+            return NULL;
         }
-        // Check the next index
-        idx = (idx + 1) % DTEL_MAX_DEV;
-    }
-
-    if(ii < 10) {
-        ++(dev_tbl_stats.add_10);
-    }
-    if(!ret) {
-        // Use the replacement entry if available
-        if(p_idx >= 0) {
-            ret = dev_tbl[p_idx];
-            memset(ret, 0, sizeof(DT_DEVICE_t));
-            memcpy(ret->mac, mac, sizeof(ret->mac));
-            ret->t_add = tt;
-            ret->last_conn = &(ret->conn);
+        dev_del_conns(ret);
+        util_rht_del(&dev_rht, ret->mac, util_rht_hash(&dev_rht, ret->mac));
+        // Entries that were never rated are not counted as replaced
+        if(ret->rating != 0) {
             ++(dev_tbl_stats.add_repl);
-        } else {
-            ++(dev_tbl_stats.add_busy);
         }
+        memset(ret, 0, sizeof(DT_DEVICE_t));
     }
+    memcpy(ret->mac, mac, sizeof(ret->mac));
+    ret->t_add = tt;
+    ret->last_conn = &(ret->conn);
+    // The table can't be full since it is sized for all the arena items
+    util_rht_add(&dev_rht, ret, hash, NULL);
+    // The new entry has rating 0, move it to the top of the heap
+    dev_heap_fix(dev_hpos[UTIL_ARENA_IDX(&dev_arena, ret)]);
 
     return ret;
 }
@@ -510,6 +592,7 @@ static void ip_pkt_rcv_cb(TPCAP_IF_t *tpif,
 
     // Prepare header for the connection info table entry
     DT_CONN_HDR_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
     if (iph->version == 4) {
         hdr.ip.ipv4.i = peer_ipv4.i;
         hdr.ip_proto = iph->protocol;
@@ -577,15 +660,16 @@ static void ip_pkt_rcv_cb(TPCAP_IF_t *tpif,
     // 111 - pkts in/out
     if(dev->rating == 0) {
         // 100 - packet is in, 010 - out
-        dev->rating = rating;
+        dev_set_rating(dev, rating);
     } else if(dev->rating < 6) {
         // Make it at least 110 if we saw packets both in and out
-        dev->rating |= rating;
+        rating |= dev->rating;
         // Set bit 0 if we already saw more than one connection or
         // more than a few packets for the same connection.
         if(dev->conn.next || dev->conn.upd_total > 2) {
-            dev->rating |= 1;
+            rating |= 1;
         }
+        dev_set_rating(dev, rating);
     }
 
     return;
@@ -732,7 +816,7 @@ int dt_add_fe_conn(FE_CONN_t *fe_conn)
             __func__, bytes_to, bytes_from);
 
     // Update device rating
-    dev->rating |= rating;
+    dev_set_rating(dev, dev->rating | rating);
 
     // Update bytes_read in the festats connection
     fe_conn->in.bytes_read = fe_conn->in.bytes - bytes_to_rem;
@@ -744,6 +828,37 @@ int dt_add_fe_conn(FE_CONN_t *fe_conn)
     return all_accounted;
 }
 
+// Get the interface kind. The platform lookup might be slow (i.e. querying
+// the radio), so the result is kept until the interface configuration
+// changes.
+static int dt_if_kind(char *ifname)
+{
+    unsigned int gen = util_net_if_gen();
+    int ii, kind;
+
+    if(util_get_interface_kind == NULL) {
+        return -1;
+    }
+    if(gen == 0 || gen != if_kinds.gen) {
+        if_kinds.gen = gen;
+        if_kinds.count = 0;
+    }
+    for(ii = 0; ii < if_kinds.count; ii++) {
+        if(strncmp(if_kinds.e[ii].name, ifname, IFNAMSIZ) == 0) {
+            return if_kinds.e[ii].kind;
+        }
+    }
+    kind = util_get_interface_kind(ifname);
+    if(if_kinds.count < TPCAP_STAT_IF_MAX) {
+        strncpy(if_kinds.e[ii].name, ifname, IFNAMSIZ - 1);
+        if_kinds.e[ii].name[IFNAMSIZ - 1] = 0;
+        if_kinds.e[ii].kind = kind;
+        ++(if_kinds.count);
+    }
+
+    return kind;
+}
+
 // Stats callback called by tpcap thread every capturing time slice
 // interval.
 // st -> tp_if_stats[] array from tpcap
@@ -781,11 +896,7 @@ static void stats_ready_cb(TPCAP_IF_STATS_t *st)
         dtst->tp_drops = ste->tp_drops;
         dtst->slice = slice_num;
         dtst->wan = (ii == TPCAP_WAN_STATS_IDX);
-        if(util_get_interface_kind != NULL) {
-            dtst->kind = util_get_interface_kind(dtst->name);
-        } else {
-            dtst->kind = -1;
-        }
+        dtst->kind = dt_if_kind(dtst->name);
         if(util_get_ipcfg(dtst->name, &dtst->ipcfg) != 0) {
             memset(&dtst->ipcfg, 0, sizeof(dtst->ipcfg));
         }
@@ -803,65 +914,53 @@ static void stats_ready_cb(TPCAP_IF_STATS_t *st)
 
     // Tell telemetry sender to grab data and start the transmission after
     // collecting DEVTELEMETRY_NUM_SLICES of the capturing time intervals.
+    // The sender swaps the epoch tables here and serializes the data in
+    // its own thread.
     if(slice_num == (DEVTELEMETRY_NUM_SLICES - 1)) {
-        // Tell sender that the device telemetry data is ready
         dt_sender_data_ready();
-
-        // Unlock IP forwarding stats table
-        fe_conn_tbl_stats(TRUE);
-
-        // Reset the interface counters/stats table
-        memset(&stats_tbl, 0, sizeof(stats_tbl));
-        // Reset DNS tables
-        dt_reset_dns_tables();
-        // Reset main telemetry tables
-        dt_reset_dev_tables();
-
-        // Reset fingerprinting tables (since we send them with
-        // the devices telemetry have to do it here)
-        fp_reset_tables();
     }
 }
 
-// Returns pointer to the devices table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch devices table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_dev_tbl_stats(int reset)
 {
     static DT_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &dev_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.dev_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&dev_tbl_stats, 0, sizeof(dev_tbl_stats));
+        memset(&prev.dev_tbl_stats, 0, sizeof(prev.dev_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Returns pointer to the connections table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch connections table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 DT_TABLE_STATS_t *dt_conn_tbl_stats(int reset)
 {
     static DT_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &conn_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.conn_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&conn_tbl_stats, 0, sizeof(conn_tbl_stats));
+        memset(&prev.conn_tbl_stats, 0, sizeof(prev.conn_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Get the interface counters and capturing stats
+// Get the previous epoch interface counters and capturing stats
 DT_IF_STATS_t *dt_get_if_stats(void)
 {
-    return &(stats_tbl[0][0]);
+    return &(prev.stats_tbl[0][0]);
 }
 
-// Get the pointer to the devices table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch devices table (DTEL_MAX_DEV
+// device pointers, NULL for the unused entries)
+// The table should only be accessed from the sender thread
 DT_DEVICE_t **dt_get_dev_tbl(void)
 {
-    return dev_tbl;
+    return prev.dev_tbl;
 }
 
 // Device info collector init function
@@ -869,18 +968,35 @@ DT_DEVICE_t **dt_get_dev_tbl(void)
 int dt_main_collector_init(void)
 {
     PKT_PROC_ENTRY_t *pe;
+    int ii;
 
     // Allocate memory for the device and connection tables (never freed).
-    // the device table preallocates the memory for data structs of
-    // all DTEL_MAX_DEV devices, the conectioon table uses array of
-    // pointers to the data structs that are allocated when needed.
-    // Once the connection data structure is allocated and the pointer
-    // is stored in the array it is never removed/freed.
-    dev_tbl = calloc(DTEL_MAX_DEV, sizeof(DT_DEVICE_t *));
-    conn_tbl = calloc(DTEL_MAX_CONN, sizeof(DT_CONN_t *));
-    if(!dev_tbl || !conn_tbl) {
-        log("%s: failed to allocate memory for data tables\n", __func__);
-        return -1;
+    // The data structs are taken from the arenas (preallocated for all
+    // DTEL_MAX_DEV devices and DTEL_MAX_CONN connections) when needed and
+    // indexed by the hash tables. The devices are replaced (by rating)
+    // when the device table is full, the replaced device connections are
+    // removed from the connections table.
+    // There are two sets of the tables, for the current and the previous
+    // epoch (swapped at the end of each epoch).
+    for(ii = 0; ii < 2; ii++)
+    {
+        dev_tbl = calloc(DTEL_MAX_DEV, sizeof(DT_DEVICE_t *));
+        dev_heap = calloc(DTEL_MAX_DEV, sizeof(DT_DEVICE_t *));
+        dev_hpos = calloc(DTEL_MAX_DEV, sizeof(unsigned int));
+        if(!dev_tbl || !dev_heap || !dev_hpos ||
+           util_arena_init(&dev_arena, sizeof(DT_DEVICE_t),
+                           DTEL_MAX_DEV) != 0 ||
+           util_arena_init(&conn_arena, sizeof(DT_CONN_t),
+                           DTEL_MAX_CONN) != 0 ||
+           util_rht_init(&dev_rht, DTEL_MAX_DEV,
+                         offsetof(DT_DEVICE_t, mac), 6) != 0 ||
+           util_rht_init(&conn_rht, DTEL_MAX_CONN,
+                         offsetof(DT_CONN_t, hdr), sizeof(DT_CONN_HDR_t)) != 0)
+        {
+            log("%s: failed to allocate memory for data tables\n", __func__);
+            return -1;
+        }
+        dt_main_epoch_swap();
     }
 
     // Reset table stats (more for consistency since they are in BSS
@@ -904,9 +1020,9 @@ int dt_main_collector_init(void)
         return -2;
     }
 
-    // Reset the interface counters/stats table (more for consistency since
-    // it is BSS segment anyway)
-    memset(&stats_tbl, 0, sizeof(stats_tbl));
+    // Reset the interface counters/stats tables (more for consistency since
+    // they are in BSS segment anyway)
+    memset(&stats_tbls, 0, sizeof(stats_tbls));
 
     return 0;
 }
@@ -1064,7 +1180,7 @@ void dt_main_tbls_test(void)
     printf("Devices & connections tables dump:\n");
     printf("----------------------------------\n");
     for(ii = 0; ii < DTEL_MAX_DEV; ii++) {
-        DT_DEVICE_t *dev = dev_tbl[ii];
+        DT_DEVICE_t *dev = prev.dev_tbl[ii];
         if(dev != 0 && dev->rating != 0) {
             count++;
             printf(MAC_PRINTF_FMT_TPL " " IP_PRINTF_FMT_TPL
@@ -1089,6 +1205,7 @@ void dt_main_tbls_test(void)
     printf("Devices table stats:\n");
     printf("  add_all = %lu\n", d_tbl_st->add_all);
     printf("  add_limit = %lu\n", d_tbl_st->add_limit);
+    printf("  add_nomem = %lu\n", d_tbl_st->add_nomem);
     printf("  add_busy = %lu\n", d_tbl_st->add_busy);
     printf("  add_repl = %lu\n", d_tbl_st->add_repl);
     printf("  add_10 = %lu\n", d_tbl_st->add_10);
@@ -1096,6 +1213,7 @@ void dt_main_tbls_test(void)
     printf("Connections table stats:\n");
     printf("  add_all = %lu\n", c_tbl_st->add_all);
     printf("  add_limit = %lu\n", c_tbl_st->add_limit);
+    printf("  add_nomem = %lu\n", c_tbl_st->add_nomem);
     printf("  add_busy = %lu\n", c_tbl_st->add_busy);
     printf("  add_10 = %lu\n", c_tbl_st->add_10);
     printf("  add_found = %lu\n", c_tbl_st->add_found);
@@ -1105,6 +1223,7 @@ void dt_main_tbls_test(void)
         printf("Fast forwarding connection table stats:\n");
         printf("  add_all = %lu\n", fe_tbl_st->add_all);
         printf("  add_limit = %lu\n", fe_tbl_st->add_limit);
+        printf("  add_nomem = %lu\n", fe_tbl_st->add_nomem);
         printf("  add_busy = %lu\n", fe_tbl_st->add_busy);
         printf("  add_10 = %lu\n", fe_tbl_st->add_10);
         printf("  add_found = %lu\n", fe_tbl_st->add_found);
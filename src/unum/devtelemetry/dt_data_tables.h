@@ -15,6 +15,8 @@
 // 1 - do not give up until the whole table is examined.
 // 2 - examine 1/2 of the table before giving up
 // 4 - examine 1/4 of the table before giving up
+// Only the DNS names table uses it now, the device, connection and DNS IP
+// tables are indexed by the Robin Hood hash tables (see util_rht.h).
 #define DT_SEARCH_LIMITER 2
 
 // Forward declarations
@@ -94,7 +96,8 @@ struct _DT_DEVICE {
 } __attribute__((packed));
 typedef struct _DT_DEVICE DT_DEVICE_t;
 
-// DNS table IP address entry
+// DNS table IP address entry (the IP address and the address family
+// are the entry key, keep them together in front)
 struct _DT_DNS_IP {
     union {
         IPV4_ADDR_t ipv4;         // IP address the name is discovered for
@@ -102,8 +105,8 @@ struct _DT_DNS_IP {
         IPV6_ADDR_t ipv6;         // IP address the name is discovered for
 #endif // FEATURE_IPV6_TELEMETRY
     } u;
-    struct _DT_DNS_NAME *dns; // DNS name entry pointer for the IP
     unsigned short af;        // address family (AF_INET or AF_INET6)
+    struct _DT_DNS_NAME *dns; // DNS name entry pointer for the IP
 };
 typedef struct _DT_DNS_IP DT_DNS_IP_t;
 
@@ -149,6 +152,7 @@ typedef struct _DT_TABLE_STATS {
     unsigned long add_10;    // Items placed to <10 offset from the hash-row
     unsigned long add_found; // Items being added that are already in the table
     unsigned long add_repl;  // Items being replaced (devices table only)
+    unsigned long add_nomem; // Items not added due to no memory for them
     unsigned long find_all;  // All attempts to find an entry
     unsigned long find_fails;// Failed attempts to find an entry
     unsigned long find_10;   // searches completed after examining <10 rows
@@ -23,13 +23,27 @@ static JSON_VAL_TPL_t *tpl_interfaces_array_f(char *key, int ii);
 static JSON_VAL_TPL_t *tpl_dns_array_f(char *key, int idx);
 static JSON_VAL_TPL_t *tpl_devcon_array_f(char *key, int idx);
 
-// Devices telemetry JSON data pointer (set by tpcap handler,
-// consumed by the dt_sender() thread).
-static char *dev_telemetry_json;
-
-// The event is set once the devices telemetry JSON is prepared for
-// the transmission
-static UTIL_EVENT_t json_ready = UTIL_EVENT_INITIALIZER;
+// The collector tables are kept in two sets (epochs). The tpcap thread
+// fills the current epoch tables and at the end of the telemetry period
+// swaps them w/ the previous epoch ones (see dt_sender_data_ready()).
+// The sender task then serializes the previous epoch tables and resets
+// them for reuse, so capturing does not stop while the JSON is built.
+// The flag is set by the tpcap thread when it hands the previous epoch
+// to the sender and is cleared by the sender when it is done with it.
+static volatile int epoch_busy = FALSE;
+
+#ifdef FEATURE_GZIP_REQUESTS
+// Send the telemetry compressed if the request compression is enabled
+// (the compression threshold is ignored since the telemetry JSON is
+// typically much larger and its size is not known till it is generated)
+#  define DT_GZIP() (unum_config.gzip_requests != 0)
+#else  // FEATURE_GZIP_REQUESTS
+#  define DT_GZIP() FALSE
+#endif // FEATURE_GZIP_REQUESTS
+
+// The sender task ID, the task is woken up once the previous epoch
+// tables are ready to be serialized
+static int dt_sender_tid = -1;
 
 // Template for root device telemetry JSON object
 static JSON_OBJ_TPL_t tpl_dt_root = {
@@ -47,10 +61,9 @@ static JSON_OBJ_TPL_t tpl_dt_root = {
 // connections array of a specific device. It is a helper for
 // tpl_devcon_array_f().
 // Note: the generated jansson objects can refer to string
-//       pointers that can change in tpcap task later since
-//       serialization of the whole telemetry object is done
-//       in the context of the tpcap thread before it resumes
-//       and all the objects are released after JSON is generated.
+//       pointers in the previous epoch tables since those are
+//       not touched by the tpcap thread till the sender is done
+//       serializing the whole telemetry object and resets them.
 static JSON_VAL_TPL_t *tpl_con_array_f(DT_DEVICE_t *dev, int idx)
 {
     int ii;
@@ -179,10 +192,9 @@ static JSON_VAL_TPL_t *tpl_con_array_f(DT_DEVICE_t *dev, int idx)
 // connections (it is handler for both "devices" key in the root
 // and "peers" key in the device's info object)
 // Note: the generated jansson objects can refer to string
-//       pointers that can change in tpcap task later since
-//       serialization of the whole telemetry object is done
-//       in the context of the tpcap thread before it resumes
-//       and all the objects are released after JSON is generated.
+//       pointers in the previous epoch tables since those are
+//       not touched by the tpcap thread till the sender is done
+//       serializing the whole telemetry object and resets them.
 static JSON_VAL_TPL_t *tpl_devcon_array_f(char *key, int idx)
 {
     int ii;
@@ -216,7 +228,8 @@ static JSON_VAL_TPL_t *tpl_devcon_array_f(char *key, int idx)
 
     // If starting over
     if(idx == 0) {
-        last_idx = last_ii = 0;
+        last_idx = 0;
+        last_ii = -1;
     }
     // The next query index should be the last +1, otherwise error
     else if(idx != last_idx + 1) {
@@ -279,10 +292,9 @@ static JSON_VAL_TPL_t *tpl_devcon_array_f(char *key, int idx)
 // Dynamically builds JSON template for the devices telemetry
 // DNS info array.
 // Note: the generated jansson objects can refer to string
-//       pointers that can change in tpcap task later since
-//       serialization of the whole telemetry object is done
-//       in the context of the tpcap thread before it resumes
-//       and all the objects are released after JSON is generated.
+//       pointers in the previous epoch tables since those are
+//       not touched by the tpcap thread till the sender is done
+//       serializing the whole telemetry object and resets them.
 static JSON_VAL_TPL_t *tpl_dns_array_f(char *key, int idx)
 {
     int ii;
@@ -302,7 +314,8 @@ static JSON_VAL_TPL_t *tpl_dns_array_f(char *key, int idx)
 
     // Starting over
     if(idx == 0) {
-        last_idx = last_ii = 0;
+        last_idx = 0;
+        last_ii = -1;
     }
     // The next query index should be the last +1, otherwise error
     else if(idx != last_idx + 1) {
@@ -349,10 +362,9 @@ static JSON_VAL_TPL_t *tpl_dns_array_f(char *key, int idx)
 // Dynamically builds JSON template for the devices telemetry
 // interfaces array.
 // Note: the generated jansson objects can refer to string
-//       pointers that can change in tpcap task later since
-//       serialization of the whole telemetry object is done
-//       in the context of the tpcap thread before it resumes
-//       and all the objects are released after JSON is generated.
+//       pointers in the previous epoch tables since those are
+//       not touched by the tpcap thread till the sender is done
+//       serializing the whole telemetry object and resets them.
 static JSON_VAL_TPL_t *tpl_interfaces_array_f(char *key, int ii)
 {
     // Static buffer tpl_tbl_interfaces_obj refers to (the array builder just
@@ -469,6 +481,7 @@ static JSON_VAL_TPL_t *tpl_tbl_stats_array_f(char *key, int ii)
       { "add_10", { .type = JSON_VAL_PUL, {.pul = &tbl_stats.add_10}}},
       { "add_found", { .type = JSON_VAL_PUL, {.pul = &tbl_stats.add_found}}},
       { "add_repl", { .type = JSON_VAL_PUL, {.pul = &tbl_stats.add_repl}}},
+      { "add_nomem", { .type = JSON_VAL_PUL, {.pul = &tbl_stats.add_nomem}}},
 #ifdef DT_CONN_MAP_IP_TO_DNS
       { "find_all", { .type = JSON_VAL_PUL, {.pul = &tbl_stats.find_all}}},
       { "find_fails", { .type = JSON_VAL_PUL, {.pul = &tbl_stats.find_fails}}},
@@ -502,11 +515,25 @@ static JSON_VAL_TPL_t *tpl_tbl_stats_array_f(char *key, int ii)
     return &tpl_tbl_stats_obj_val;
 }
 
-// Serializes devices telemetry data and returns pointer to
-// the generated JSON.
-// The function is called from the TPCAP thread/handler.
-// Avoid blocking if possible.
-static char *serialize_data(void)
+// Free the devices telemetry JSON data returned by serialize_data()
+static void free_data(void *data)
+{
+#ifdef FEATURE_GZIP_REQUESTS
+    if(DT_GZIP()) {
+        util_gz_free((UTIL_GZ_t *)data);
+        return;
+    }
+#endif // FEATURE_GZIP_REQUESTS
+    util_free_json_str((char *)data);
+}
+
+// Serializes devices telemetry data of the previous epoch and returns
+// pointer to the generated JSON (compressed if DT_GZIP() is TRUE). The
+// JSON is compressed as it is generated, so the uncompressed copy of
+// the potentially large telemetry JSON is never kept in memory.
+// The function is called from the sender thread (or the tpcap thread
+// when running the tpcap tests).
+static void *serialize_data(void)
 {
 #ifdef DEBUG
     if(tpcap_test_param.int_val == TPCAP_TEST_DT) {
@@ -530,168 +557,181 @@ static char *serialize_data(void)
         }
         printf("Device telemetry JSON:\n%s\n", jstr);
         util_free_json_str(jstr);
+        if(tpcap_test_param.int_val == TPCAP_TEST_DT_JSON) {
+            util_tpl_json_bench(tpl_dt_root);
+        }
         return NULL;
     }
 #endif // DEBUG
 
+#ifdef FEATURE_GZIP_REQUESTS
+    if(DT_GZIP()) {
+        return util_tpl_to_json_gz(tpl_dt_root);
+    }
+#endif // FEATURE_GZIP_REQUESTS
     return util_tpl_to_json_str(tpl_dt_root);
 }
 
-// Generate and pass to the sender the devices telemetry JSON.
-// If the previously submitted JSON buffer is not yet consumed
-// replace it with the new one.
+// Reset the previous epoch devices telemetry tables and hand them
+// back to the tpcap thread.
+static void release_epoch(void)
+{
+    // Unlock IP forwarding stats table
+    fe_conn_tbl_stats(TRUE);
+
+    // Reset DNS tables
+    dt_reset_dns_tables();
+    // Reset main telemetry tables (along w/ the interface counters)
+    dt_reset_dev_tables();
+    // Reset fingerprinting tables (since we send them with
+    // the devices telemetry have to do it here)
+    fp_reset_tables();
+
+    // Release the previous epoch tables to the tpcap thread
+    __sync_synchronize();
+    epoch_busy = FALSE;
+}
+
+// Serialize the previous epoch devices telemetry tables, then reset
+// them and hand them back to the tpcap thread.
+// Returns the JSON data (see serialize_data()) or NULL.
+static void *serialize_epoch(void)
+{
+    void *json = serialize_data();
+    release_epoch();
+    return json;
+}
+
+// Swap the current and the previous epoch tables and notify the
+// sender that the data is ready to be serialized and sent.
+// If the sender is not yet done w/ the previous epoch the current
+// one continues (its data slices are overwritten in the next period).
+// Until the sender is running and the agent is activated nobody
+// processes the previous epoch, its data is dropped right away.
 // The function is called from the TPCAP thread/handler.
 // Avoid blocking if possible.
 void dt_sender_data_ready(void)
 {
-    char *old_json;
-    char *new_json;
-    int ii;
-
-    new_json = serialize_data();
-    if(!new_json) {
-        log("%s: Error, failed to build devices telemetry JSON\n",
-            __func__);
+    if(epoch_busy) {
+        log("%s: Warning, the previous epoch is not yet processed, "
+            "extending the current one\n", __func__);
         return;
     }
 
-    for(ii = 0; ii < 3; ii++)
-    {
-        old_json = dev_telemetry_json;
-        if(__sync_bool_compare_and_swap(&dev_telemetry_json,
-                                        old_json, new_json))
-        {
-            break;
-        }
-    }
-    if(ii >= 3) {
-        // This really should never happen, but if it does free
-        // the buffer and hope that the next time it will work.
-        log("%s: Error submitting new JSON buffer", __func__);
-        util_free_json_str(new_json);
+    dt_main_epoch_swap();
+    dt_dns_epoch_swap();
+    fp_epoch_swap();
+
+    __sync_synchronize();
+    epoch_busy = TRUE;
+
+#ifdef DEBUG
+    // The tpcap tests do not run the sender, process the data here
+    if(tpcap_test_param.int_val != 0) {
+        serialize_epoch();
         return;
     }
-    // If the sender got stuck and has not yet consumed
-    // the JSON buffer submitted before, free it and log a message.
-    if(old_json) {
-        log("%s: Warning, last JSON buffer wasn't sent, dropping\n",
-            __func__);
-        util_free_json_str(old_json);
-        old_json = NULL;
+#endif // DEBUG
+
+    // Nobody to send the data to yet, do not let it pile up
+    if(dt_sender_tid < 0 || !is_agent_activated()) {
+        release_epoch();
+        return;
     }
-    // Notify the sender that the new pointer is ready
-    UTIL_EVENT_SETALL(&json_ready);
+
+    // Notify the sender that the previous epoch tables are ready
+    util_reactor_task_wake(dt_sender_tid, 0);
 
     return;
 }
 
-// Grab the prepared for sending JSON buffer when it is ready
-// and return to the caller.
-// The function is called from the devices telemetry sender thread.
-static char *consume_devices_telemetry_json()
+// Device telemetry info sender task step (runs in the reactor worker
+// pool when woken up by dt_sender_data_ready())
+static int dt_sender(THRD_PARAM_t *p)
 {
-    char *json = NULL;
+    static char url[256];
+    http_rsp *rsp = NULL;
+    void *jstr = NULL;
 
-    while(!json)
-    {
-        // Wait till we are signalled that the JSON is ready
-        UTIL_EVENT_WAIT(&json_ready);
-        // Note: this construct does not guarantee submission of
-        //       every buffer when the system is under stress and
-        //       fails to either collect or transmit information
-        //       within the telemetry period time.
-        UTIL_EVENT_RESET(&json_ready);
-        // Grab the pointer to the data buffer
-        json = dev_telemetry_json;
-        if(!json) {
-            continue;
-        }
-        if(!__sync_bool_compare_and_swap(&dev_telemetry_json,
-                                         json, NULL))
-        {
-            continue;
-        }
-        // We have pulled a valid pointer out of dev_telemetry_json
-        break;
+    // Wait for activate to complete
+    if(!is_agent_activated()) {
+        return ACTIVATE_TASK_POLL;
     }
 
-    return json;
-}
-
-// Device telemetry info sender
-static void dt_sender(THRD_PARAM_t *p)
-{
-    http_rsp *rsp = NULL;
-    char url[256];
-    char *my_mac = util_device_mac();
+    // First step after the activation
+    if(*url == 0) {
+        log("%s: done waiting for activate\n", __func__);
 
-    log("%s: started\n", __func__);
+        util_wd_set_timeout(HTTP_REQ_MAX_TIME + DEVTELEMETRY_NUM_SLICES *
+                                                unum_config.tpcap_time_slice);
 
-    // Check that we have MAC address
-    if(!my_mac) {
-        log("%s: cannot get device MAC\n", __func__);
-        return;
+        // Prepare the URL string
+        util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API,
+                       url, sizeof(url), DEVTELEMETRY_PATH, util_device_mac());
     }
 
-    log("%s: waiting for activate to complete\n", __func__);
-    wait_for_activate();
-    log("%s: done waiting for activate\n", __func__);
-
-    util_wd_set_timeout(HTTP_REQ_MAX_TIME +
-                        DEVTELEMETRY_NUM_SLICES * unum_config.tpcap_time_slice);
-
-    // Prepare the URL string
-    util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API, url, sizeof(url),
-                   DEVTELEMETRY_PATH, my_mac);
+    // Nothing to do unless the previous epoch is ready
+    if(!epoch_busy) {
+        return REACTOR_TASK_SLEEP;
+    }
 
     for(;;) {
-        char *jstr = NULL;
-
 
-        for(;;) {
-
-            // Retrieve the telemetry data JSON
-            jstr = consume_devices_telemetry_json();
-            if(!jstr) {
-                log("%s: JSON encode failed\n", __func__);
-                break;
-            }
+        // Serialize the previous epoch, its tables are released
+        // before sending, so capturing never waits for the upload.
+        jstr = serialize_epoch();
+        if(!jstr) {
+            log("%s: JSON encode failed\n", __func__);
+            break;
+        }
 
-            // Send the telemetry info
-            rsp = http_post(url,
-                            "Content-Type: application/json\0"
-                            "Accept: application/json\0",
-                            jstr, strlen(jstr));
-
-            if(rsp == NULL || (rsp->code / 100) != 2) {
-                log("%s: request error, code %d%s\n",
-                    __func__, rsp ? rsp->code : 0, rsp ? "" : "(none)");
-                break;
-            }
+        // Send the telemetry info
+#ifdef FEATURE_GZIP_REQUESTS
+        if(DT_GZIP()) {
+            rsp = http_post_gz_spool(url, (UTIL_GZ_t *)jstr);
+        } else
+#endif // FEATURE_GZIP_REQUESTS
+        rsp = http_post_spool(url, jstr, strlen(jstr));
 
+        // The spooled request is delivered later by the uploader
+        if(rsp != NULL && rsp->code == HTTP_RSP_CODE_SPOOLED) {
             break;
         }
 
-        if(jstr) {
-            util_free_json_str(jstr);
-            jstr = NULL;
+        if(rsp == NULL || (rsp->code / 100) != 2) {
+            log("%s: request error, code %d%s\n",
+                __func__, rsp ? rsp->code : 0, rsp ? "" : "(none)");
+            break;
         }
 
-        if(rsp) {
-            free_rsp(rsp);
-            rsp = NULL;
-        }
+        break;
+    }
+
+    if(jstr) {
+        free_data(jstr);
+        jstr = NULL;
+    }
 
-        util_wd_poll();
+    if(rsp) {
+        free_rsp(rsp);
+        rsp = NULL;
     }
 
-    // Never reaches here
-    log("%s: done\n", __func__);
+    util_wd_poll();
+
+    return REACTOR_TASK_SLEEP;
 }
 
 // Sender init fuction
 int dt_sender_start()
 {
-    return util_start_thrd("devtelemetry", dt_sender, NULL, NULL);
+    // Check that we have MAC address
+    if(!util_device_mac()) {
+        log("%s: cannot get device MAC\n", __func__);
+        return 0;
+    }
+    dt_sender_tid = util_reactor_task_add("devtelemetry", dt_sender, NULL, 0,
+                                          REACTOR_TASK_F_BLOCKING);
+    return (dt_sender_tid < 0) ? dt_sender_tid : 0;
 }
 
@@ -30,6 +30,8 @@ static FE_CONN_t **conn_tbl;
 // Connection table entry present flag. This is split into separate array
 // to allow clearing it fast. 
 static unsigned char *conn_present;
+// Arena the connection table entries are allocated from
+static UTIL_ARENA_t conn_arena;
 
 // ARP/NDP tables, allocated at startup and never released
 static FE_ARP_t *arp_tbl;
@@ -278,8 +280,17 @@ static int fe_add_if(const char *ifname, void *unused)
 
 // Update interface info that is used during the pass to determine
 // which IP addresses and interface names are tracked on the LAN side
+// (skipped while the interface configuration generation is the same)
 static void fe_update_if_info()
 {
+    static unsigned int if_gen = 0;
+    unsigned int gen = util_net_if_gen();
+
+    if(gen != 0 && gen == if_gen) {
+        return;
+    }
+    if_gen = gen;
+
     // Prefill the iflist
     memset(lan_ifnames, 0, sizeof(lan_ifnames));
 
@@ -448,124 +459,303 @@ static void fe_update_arp_table()
     return;
 }
 
+// Neighbor (ARP/NDP) tracker tables updates through rtnetlink.
+// The festats thread subscribes to the neighbor events and applies them
+// to the tracker tables as they come in (including while it waits between
+// the passes), so the MACs of the short lived devices are captured too.
+// The full neighbor table dump is done when the socket is opened, every
+// FESTATS_NEIGH_RESYNC_PASSES passes and after the events are lost.
+
+// Neighbor states w/ a valid link layer address of a device (the NOARP
+// entries are for the multicast, broadcast and point-to-point addresses)
+#define FE_NUD_VALID (NUD_PERMANENT | NUD_REACHABLE | \
+                      NUD_PROBE | NUD_STALE | NUD_DELAY)
+
+// Address family of the neighbor table dumps
 #ifdef FEATURE_IPV6_TELEMETRY
-static int recv_msg(char* buf_p, unsigned int buf_size, struct sockaddr_nl sock_addr, int sock)
+#  define FE_NEIGH_FAMILY AF_UNSPEC
+#else  // FEATURE_IPV6_TELEMETRY
+#  define FE_NEIGH_FAMILY AF_INET
+#endif // FEATURE_IPV6_TELEMETRY
+
+// Netlink socket for the neighbor events and dumps (-1 if not open)
+static int neigh_sock = -1;
+// Sequence # of the last dump request and the flag indicating it's done
+static unsigned int neigh_seq;
+static int neigh_dump_done;
+// Passes left till the next full resync (0 - resync on the next pass)
+static int neigh_resync_in;
+// Neighbor messages receive buffer
+static char neigh_buf[16384];
+
+// Apply neighbor message to the ARP or NDP tracker table
+static void fe_neigh_msg(struct nlmsghdr *nh)
 {
-    struct nlmsghdr *nh;
-    int len, nll = 0;
-    while (1) {
-        len = recv(sock, buf_p, buf_size - nll, 0);
-        if (len < 0)
-            return len;
+    struct ndmsg *ndm = NLMSG_DATA(nh);
+    struct rtattr *rta;
+    int len;
+    unsigned char *dst = NULL, *lladdr = NULL;
+    int dst_len = 0, lladdr_len = 0;
+
+    if(nh->nlmsg_type != RTM_NEWNEIGH ||
+       nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ndm)))
+    {
+        // The removed entries are left in the tracker tables, connections
+        // of a device might outlive its neighbor entry and the last known
+        // MAC is still the best guess for them (the tracker table entries
+        // are replaced by age).
+        return;
+    }
+    if((ndm->ndm_state & FE_NUD_VALID) == 0) {
+        return;
+    }
+    len = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*ndm));
+    rta = (struct rtattr *)((char *)ndm + NLMSG_ALIGN(sizeof(*ndm)));
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if(rta->rta_type == NDA_DST) {
+            dst = RTA_DATA(rta);
+            dst_len = RTA_PAYLOAD(rta);
+        } else if(rta->rta_type == NDA_LLADDR) {
+            lladdr = RTA_DATA(rta);
+            lladdr_len = RTA_PAYLOAD(rta);
+        }
+    }
+    if(dst == NULL || lladdr == NULL || lladdr_len != 6) {
+        return;
+    }
+    // Skip the multicast MACs (i.e. 33:33:* of the IPv6 multicast groups)
+    if((lladdr[0] & 1) != 0) {
+        return;
+    }
 
-        nh = (struct nlmsghdr *)buf_p;
+    if(ndm->ndm_family == AF_INET && dst_len == 4)
+    {
+        char ifname[IFNAMSIZ];
+        FE_ARP_t ae = {.uptime = util_time(1),
+                       .no_mac = FALSE};
 
-        if (nh->nlmsg_type == NLMSG_DONE)
-            break;
-        buf_p += len;
-        nll += len;
-        if ((sock_addr.nl_groups & RTMGRP_NEIGH) == RTMGRP_NEIGH)
-            break;
+        memcpy(ae.ipv4.b, dst, sizeof(ae.ipv4.b));
+        memcpy(ae.mac, lladdr, sizeof(ae.mac));
+        if(if_indextoname(ndm->ndm_ifindex, ifname) == NULL ||
+           fe_find_ipv4cfg_by_ifname(ifname, NULL) != 0)
+        {
+            DBG_ARP_NDP("%s: skip entry " IP_PRINTF_FMT_TPL
+                        " for interface %d\n", __func__,
+                        IP_PRINTF_ARG_TPL(ae.ipv4.b), ndm->ndm_ifindex);
+            return;
+        }
+        fe_add_arp_entry(&ae);
+    }
+#ifdef FEATURE_IPV6_TELEMETRY
+    else if(ndm->ndm_family == AF_INET6 && dst_len == 16)
+    {
+        FE_NDP_t entry = {.uptime = util_time(1),
+                          .no_mac = FALSE};
 
-        if ((sock_addr.nl_groups & RTMGRP_IPV4_ROUTE) == RTMGRP_IPV4_ROUTE)
-            break;
+        memcpy(entry.ipv6.b, dst, sizeof(entry.ipv6.b));
+        memcpy(entry.mac, lladdr, sizeof(entry.mac));
+        fe_add_ndp_entry(&entry);
     }
-    return nll;
+#endif // FEATURE_IPV6_TELEMETRY
+
+    return;
 }
 
-// Update NDP tracker table from a netlink route socket
-// For use only from the festats thread.
-static void fe_update_ndp_table()
+// Close the neighbor socket
+static void fe_neigh_close(void)
+{
+    if(neigh_sock >= 0) {
+        close(neigh_sock);
+        neigh_sock = -1;
+    }
+}
+
+// Open the neighbor socket subscribed to the neighbor events
+// Returns: 0 - if successful, negative if fails
+static int fe_neigh_open(void)
 {
     struct sockaddr_nl sa;
-    struct nlmsghdr *nh;
-    int sock, seq = 0;
-    struct msghdr msg;
-    struct iovec iov;
-    int nll;
-    struct {
-        struct nlmsghdr nl;
-        struct ndmsg rt;
-        char buf[8192];
-    } req;
-    struct rtattr *rt_attr;
-    struct ndmsg *rt_msg = NULL;
-    int rtl = -1;
-    static char buf[8192];
 
-    sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
-    if (sock < 0) {
+    neigh_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(neigh_sock < 0) {
         log("%s: open netlink socket: %s\n", __func__, strerror(errno));
-        return;
+        return -1;
     }
     memset(&sa, 0, sizeof(sa));
     sa.nl_family = AF_NETLINK;
-    if (bind(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
-        fprintf(stderr, "%s: bind netlink socket: %s\n", __func__, strerror(errno));
-        close(sock);
-        return;
+    sa.nl_groups = RTMGRP_NEIGH;
+    if(bind(neigh_sock, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        log("%s: bind netlink socket: %s\n", __func__, strerror(errno));
+        fe_neigh_close();
+        return -2;
+    }
+    // Resync on the next pass
+    neigh_resync_in = 0;
+
+    return 0;
+}
+
+// Receive and apply all the pending neighbor messages
+// Returns: 0 - if successful, negative if the socket has failed
+//          (and it has been closed)
+static int fe_neigh_read(void)
+{
+    int len;
+    struct nlmsghdr *nh;
+
+    while(neigh_sock >= 0)
+    {
+        len = recv(neigh_sock, neigh_buf, sizeof(neigh_buf), MSG_DONTWAIT);
+        if(len < 0 && errno == EINTR) {
+            continue;
+        }
+        if(len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if(len < 0 && errno == ENOBUFS) {
+            // Some events were dropped, do the full resync
+            log("%s: events lost, the socket buffer overflow\n", __func__);
+            neigh_resync_in = 0;
+            continue;
+        }
+        if(len <= 0) {
+            log("%s: recv from netlink: %s\n", __func__,
+                (len < 0 ? strerror(errno) : "no data"));
+            fe_neigh_close();
+            return -1;
+        }
+        for(nh = (struct nlmsghdr *)neigh_buf; NLMSG_OK(nh, len);
+            nh = NLMSG_NEXT(nh, len))
+        {
+            if(nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR)
+            {
+                if(nh->nlmsg_seq == neigh_seq) {
+                    neigh_dump_done = TRUE;
+                }
+                continue;
+            }
+            fe_neigh_msg(nh);
+        }
     }
+
+    return (neigh_sock >= 0) ? 0 : -1;
+}
+
+// Dump the neighbor tables into the tracker tables
+// family - the address family to dump (AF_UNSPEC for all)
+// Returns: 0 - if successful, negative if fails
+static int fe_neigh_resync(int family)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct ndmsg ndm;
+    } req;
+    unsigned long t_end = util_time(1000) + FESTATS_NEIGH_DUMP_TMO;
+
     memset(&req, 0, sizeof(req));
-    req.nl.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
-    req.nl.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-    req.nl.nlmsg_type = RTM_GETNEIGH;
-    req.rt.ndm_family = AF_INET6;
-    req.nl.nlmsg_pid = 0;
-    req.nl.nlmsg_seq = ++seq;
-    memset(&msg, 0, sizeof(msg));
-    iov.iov_base = (void *)&req.nl;
-    iov.iov_len = req.nl.nlmsg_len;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    if (sendmsg(sock, &msg, 0) < 0) {
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ndmsg));
+    req.nh.nlmsg_type = RTM_GETNEIGH;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++neigh_seq;
+    req.ndm.ndm_family = family;
+    neigh_dump_done = FALSE;
+    if(send(neigh_sock, &req, req.nh.nlmsg_len, 0) < 0) {
         log("%s: send to netlink: %s\n", __func__, strerror(errno));
-        close(sock);
+        fe_neigh_close();
+        return -1;
+    }
+    while(!neigh_dump_done)
+    {
+        struct pollfd pfd = { .fd = neigh_sock, .events = POLLIN };
+        long tmo = (long)(t_end - util_time(1000));
+
+        if(tmo <= 0 || poll(&pfd, 1, tmo) == 0) {
+            log("%s: timeout waiting for the dump\n", __func__);
+            return -2;
+        }
+        if(fe_neigh_read() != 0) {
+            return -3;
+        }
+    }
+
+    return 0;
+}
+
+#ifdef FEATURE_IPV6_TELEMETRY
+// Update NDP tracker table w/ the one time dump through a netlink socket
+// that is not subscribed to the neighbor events (the fallback if the
+// events socket cannot be used).
+// For use only from the festats thread.
+static void fe_update_ndp_table(void)
+{
+    neigh_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(neigh_sock < 0) {
+        log("%s: open netlink socket: %s\n", __func__, strerror(errno));
         return;
     }
-    memset(buf, 0, sizeof(buf));
-    nll = recv_msg(buf, sizeof(buf), sa, sock);
-    if (nll < 0) {
-        log("%s recv from netlink: %s\n", __func__, strerror(nll));
-        close(sock);
+    fe_neigh_resync(AF_INET6);
+    fe_neigh_close();
+
+    return;
+}
+#endif // FEATURE_IPV6_TELEMETRY
+
+// Update ARP & NDP tracker tables. Normally it only applies the pending
+// neighbor events and periodically does the full resync. If the netlink
+// events socket cannot be used it falls back to polling the ARP cache
+// and dumping the NDP table.
+// For use only from the festats thread.
+static void fe_update_neigh_tables(void)
+{
+#ifdef DEBUG
+    if(*test_arp_file != 0) {
+        fe_update_arp_table();
         return;
     }
-    nh = (struct nlmsghdr *)buf;
+#endif // DEBUG
+    if(neigh_sock < 0) {
+        fe_neigh_open();
+    }
+    if(fe_neigh_read() == 0) {
+        if(neigh_resync_in > 0) {
+            --neigh_resync_in;
+        } else if(fe_neigh_resync(FE_NEIGH_FAMILY) == 0) {
+            neigh_resync_in = FESTATS_NEIGH_RESYNC_PASSES;
+        }
+    }
+    if(neigh_sock < 0) {
+        fe_update_arp_table();
+#ifdef FEATURE_IPV6_TELEMETRY
+        fe_update_ndp_table();
+#endif // FEATURE_IPV6_TELEMETRY
+    }
 
-    for (; NLMSG_OK(nh, nll); nh = NLMSG_NEXT(nh, nll)) {
-        FE_NDP_t entry = {.uptime = util_time(1),
-                          .no_mac = FALSE};
+    return;
+}
 
-        rt_msg = (struct ndmsg *)NLMSG_DATA(nh);
-        if (rt_msg->ndm_state != NUD_REACHABLE && rt_msg->ndm_state != NUD_STALE) {
-            continue;
+// Wait for the specified time applying the neighbor events as they come
+// For use only from the festats thread.
+static void fe_neigh_wait(unsigned long msec)
+{
+    unsigned long t_end = util_time(1000) + msec;
+    unsigned long now;
+
+    while((now = util_time(1000)) < t_end)
+    {
+        struct pollfd pfd = { .fd = neigh_sock, .events = POLLIN };
+
+        if(neigh_sock < 0) {
+            util_msleep(t_end - now);
+            break;
         }
-        rt_attr = (struct rtattr *)RTM_RTA(rt_msg);
-        rtl = RTM_PAYLOAD(nh);
-        for (; RTA_OK(rt_attr, rtl); rt_attr = RTA_NEXT(rt_attr, rtl)) {
-            switch (rt_attr->rta_type) {
-            case NDA_DST:
-            {
-                unsigned char* addr = RTA_DATA(rt_attr);
-                memcpy(entry.ipv6.b, addr, sizeof(entry.ipv6.b));
-                break;
-            }
-            case NDA_LLADDR:
-            {
-                uint8_t* mac_p = RTA_DATA(rt_attr);
-                memcpy(entry.mac, mac_p, sizeof(entry.mac));
-                break;
-            }
-            default:
-                break;
-            }
+        if(poll(&pfd, 1, t_end - now) > 0) {
+            fe_neigh_read();
         }
-        fe_add_ndp_entry(&entry);
     }
 
-    close(sock);
     return;
 }
-#endif // FEATURE_IPV6_TELEMETRY
 
 // Query ARP table tracker for a match to specified IP address
 // For use only from the festats thread.
@@ -793,9 +983,9 @@ FE_CONN_t *fe_upd_conn_start(FE_CONN_HDR_t *hdr)
         // is not in the table (we should NEVER have gaps)
         if(!conn_tbl[idx]) {
             // New entry, allocate some memory for it
-            ret = UTIL_MALLOC(sizeof(FE_CONN_t));
+            ret = util_arena_alloc(&conn_arena);
             if(!ret) { // Run out of memory
-                ++(conn_tbl_stats.add_limit);
+                ++(conn_tbl_stats.add_nomem);
                 return NULL;
             }
             ret->flags = 0;
@@ -1068,10 +1258,7 @@ static void fe_stats_pass(void)
     fe_update_if_info();
 
     // Update ARP & NDP tracker tables
-    fe_update_arp_table();
-#ifdef FEATURE_IPV6_TELEMETRY
-    fe_update_ndp_table();
-#endif // FEATURE_IPV6_TELEMETRY
+    fe_update_neigh_tables();
 
     // Mark all connection entries as not longer present
     memset(conn_present, 0, FESTATS_MAX_CONN * sizeof(*conn_present));
@@ -1119,7 +1306,7 @@ static void festats(THRD_PARAM_t *p)
         // Wait for the current time slice's remaining duration
         unsigned long t_sleep = t_end - util_time(1000);
         if(t_sleep <= FESTATS_INTERVAL_MSEC) {
-            util_msleep(t_sleep);
+            fe_neigh_wait(t_sleep);
         } else {
             log("%s: iteration took %ul more that %d ms\n",
                 __func__, (~t_sleep) + 1, FESTATS_INTERVAL_MSEC);
@@ -1146,21 +1333,11 @@ static void fe_free_tables(void)
         UTIL_FREE(conn_present);
         conn_present = NULL;
     }
-    if(conn_tbl)
-    {
-        int ii;
-        for(ii = 0; ii < FESTATS_MAX_CONN; ++ii)
-        {
-            FE_CONN_t *conn = conn_tbl[ii];
-            if(conn == NULL) {
-                continue;
-            }
-            conn_tbl[ii] = NULL;
-            UTIL_FREE(conn);
-        }
+    if(conn_tbl) {
         UTIL_FREE(conn_tbl);
         conn_tbl = NULL;
     }
+    util_arena_destroy(&conn_arena);
 
     return;
 }
@@ -1170,7 +1347,9 @@ static int fe_allocate_tables(void)
 {
     conn_tbl = UTIL_CALLOC(FESTATS_MAX_CONN, sizeof(*conn_tbl));
     conn_present = UTIL_CALLOC(FESTATS_MAX_CONN, sizeof(*conn_present));
-    if(conn_tbl == NULL || conn_present == NULL) {
+    if(conn_tbl == NULL || conn_present == NULL ||
+       util_arena_init(&conn_arena, sizeof(FE_CONN_t), FESTATS_MAX_CONN) != 0)
+    {
         fe_free_tables();
         log("%s: unable to allocate memory for connections\n", __func__);
         return -1;
@@ -1213,6 +1392,8 @@ int fe_start_subsystem(void)
 // paths to the files for ARP and platform connection trackers.
 char test_arp_file[80];
 char test_conn_file[80];
+// Platform connection tracker backend forced by the test (FE_CONN_SRC_*)
+int test_conn_src = FE_CONN_SRC_DEFAULT;
 
 // A few protocol names
 static char *proto_name(unsigned char proto)
@@ -1279,14 +1460,18 @@ int test_fe_defrag(void)
             while(conn_tbl[idx]) {
                 idx = (idx + 1) & (FESTATS_MAX_CONN - 1);
             }
-            FE_CONN_t *conn = UTIL_MALLOC(sizeof(FE_CONN_t));
+            FE_CONN_t *conn = util_arena_alloc(&conn_arena);
+            if(conn == NULL) {
+                printf("Out of arena slots at entry %d\n", ii);
+                break;
+            }
             memset(conn, 0, sizeof(*conn));
             sprintf((char *)conn->mac, "%6d", idx);
             conn->off = off;
             conn_tbl[idx] = conn;
             conn_present[idx] = TRUE;
         }
-        printf("Added %d entries...\n", fill);
+        printf("Added %d entries...\n", ii);
 
         // Run the defrag
         unsigned long tt_start = util_time(1000);
@@ -1319,18 +1504,12 @@ int test_fe_defrag(void)
         }
         printf("Done checking the table.\n");
 
-        // Cleanup after the test run
+        // Cleanup after the test run (the entries are in the arena, all
+        // released at once)
         printf("Cleanup...\n");
-        for(ii = 0; ii < FESTATS_MAX_CONN; ++ii) {
-            int idx = ii;
-            FE_CONN_t *conn = conn_tbl[idx];
-            if(conn == NULL) {
-                continue;
-            }
-            conn_tbl[idx] = NULL;
-            UTIL_FREE(conn);
-            conn_present[idx] = FALSE;
-        }
+        memset(conn_tbl, 0, FESTATS_MAX_CONN * sizeof(*conn_tbl));
+        memset(conn_present, 0, FESTATS_MAX_CONN * sizeof(*conn_present));
+        util_arena_reset(&conn_arena);
         printf("Done.\n");
     }
     
@@ -1420,10 +1599,8 @@ int test_fe_arp_ndp(void)
         else if(*str == '1')
         {
             printf("Scanning ARP/NDP table...\n");
-            fe_update_arp_table();
-#ifdef FEATURE_IPV6_TELEMETRY
-            fe_update_ndp_table();
-#endif // FEATURE_IPV6_TELEMETRY
+            neigh_resync_in = 0;
+            fe_update_neigh_tables();
         }
         else if(*str == '2')
         {
@@ -1541,6 +1718,7 @@ static void scan_stats_test(void)
     printf("Connections table stats (reset requested after printout):\n");
     printf("  add_all   = %lu\n", conn_stats->add_all);
     printf("  add_limit = %lu\n", conn_stats->add_limit);
+    printf("  add_nomem = %lu\n", conn_stats->add_nomem);
     printf("  add_busy  = %lu\n", conn_stats->add_busy);
     printf("  add_10    = %lu\n", conn_stats->add_10);
     printf("  add_found = %lu\n", conn_stats->add_found);
@@ -1552,6 +1730,93 @@ static void scan_stats_test(void)
     return;
 }
 
+// Run a scan pass w/ the specified connection tracker backend and
+// return a copy of the present connection entries.
+// The caller must free the returned array.
+static FE_CONN_t *backend_pass(int src, int *count)
+{
+    int ii, cnt = 0;
+    FE_CONN_t *conns;
+    unsigned long t_start;
+
+    conns = UTIL_MALLOC(FESTATS_MAX_CONN * sizeof(FE_CONN_t));
+    if(!conns) {
+        return NULL;
+    }
+    test_conn_src = src;
+    t_start = util_time(1000);
+    fe_stats_pass();
+    printf("Pass w/ %s backend took %lums\n",
+           (src == FE_CONN_SRC_PROC ? "/proc" : "netlink"),
+           util_time(1000) - t_start);
+    first_pass = FALSE;
+    test_conn_src = FE_CONN_SRC_DEFAULT;
+    for(ii = 0; ii < FESTATS_MAX_CONN; ii++) {
+        if(conn_tbl[ii] && conn_present[ii]) {
+            conns[cnt++] = *(conn_tbl[ii]);
+        }
+    }
+    *count = cnt;
+    return conns;
+}
+
+// Run a pass w/ the /proc parser and then w/ the netlink backend
+// and compare the connections they have found.
+static void compare_backends_test(void)
+{
+    int ii, jj, p_cnt = 0, n_cnt = 0;
+    int match = 0, only_p = 0, bytes_lower = 0;
+    FE_CONN_t *p_conns, *n_conns;
+
+    p_conns = backend_pass(FE_CONN_SRC_PROC, &p_cnt);
+    n_conns = backend_pass(FE_CONN_SRC_NETLINK, &n_cnt);
+    if(!p_conns || !n_conns) {
+        printf("Unable to allocate memory\n");
+        UTIL_FREE(p_conns);
+        UTIL_FREE(n_conns);
+        return;
+    }
+
+    printf("Connections in /proc pass: %d, netlink pass: %d\n", p_cnt, n_cnt);
+    printf("------------------------------------------------\n");
+    for(ii = 0; ii < p_cnt; ii++) {
+        FE_CONN_t *pc = &(p_conns[ii]);
+        for(jj = 0; jj < n_cnt; jj++) {
+            if(memcmp(&(pc->hdr), &(n_conns[jj].hdr),
+                      sizeof(FE_CONN_HDR_t)) == 0)
+            {
+                break;
+            }
+        }
+        if(jj >= n_cnt) {
+            ++only_p;
+            printf("Only in /proc pass:\n");
+            print_fe_conn_info(pc);
+            continue;
+        }
+        ++match;
+        // The counters can only grow between the passes
+        if(n_conns[jj].in.bytes < pc->in.bytes ||
+           n_conns[jj].out.bytes < pc->out.bytes)
+        {
+            ++bytes_lower;
+            printf("Lower netlink counters:\n");
+            print_fe_conn_info(&(n_conns[jj]));
+        }
+    }
+    printf("------------------------------------------------\n");
+    printf("Matched: %d, only in /proc: %d, only in netlink: %d, "
+           "lower counters: %d\n",
+           match, only_p, n_cnt - match, bytes_lower);
+    printf("Note: the connections opened or closed between the passes "
+           "are expected to differ\n\n");
+
+    UTIL_FREE(p_conns);
+    UTIL_FREE(n_conns);
+
+    return;
+}
+
 // Set ARP and connection tracking files for various tests
 void test_festats_set_src_files(void)
 {
@@ -1605,11 +1870,15 @@ int test_festats()
     {
         char str[4];
 
-        printf("1 - scan connections, 2 - report, 3 - stats:\n");
+        printf("1 - scan connections, 2 - report, 3 - stats, "
+               "4 - compare backends:\n");
         scanf("%2s", str);
         if(*str == '1') {
             scan_pass_test();
         }
+        else if(*str == '4') {
+            compare_backends_test();
+        }
         else if(*str == '2') {
             report_test();
         }
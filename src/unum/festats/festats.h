@@ -30,6 +30,17 @@
 #  define FESTATS_MAX_NDP 1024
 #endif // FESTATS_MAX_NDP
 
+// Number of passes between the full neighbor (ARP/NDP) tables resyncs
+// (in between the tracker tables are updated from the neighbor events)
+#ifndef FESTATS_NEIGH_RESYNC_PASSES
+#  define FESTATS_NEIGH_RESYNC_PASSES 30
+#endif // FESTATS_NEIGH_RESYNC_PASSES
+
+// Max time to wait for the neighbor tables dump to complete (in ms)
+#ifndef FESTATS_NEIGH_DUMP_TMO
+#  define FESTATS_NEIGH_DUMP_TMO 2000
+#endif // FESTATS_NEIGH_DUMP_TMO
+
 // The values are placed in the tables based on their unique keys
 // hash. This works well while the tables are mostly empty.
 // When they fill up the number of collisions grows and the time needed to
@@ -58,6 +69,12 @@
 #if DEBUG
 extern char test_arp_file[];
 extern char test_conn_file[];
+// The variable is used by festats test to force the platform connection
+// tracker backend (for the platforms that have more than one).
+#define FE_CONN_SRC_DEFAULT 0 // platform default
+#define FE_CONN_SRC_PROC    1 // /proc file parser
+#define FE_CONN_SRC_NETLINK 2 // netlink
+extern int test_conn_src;
 #endif // DEBUG
 
 
@@ -3,6 +3,8 @@
 
 #include "unum.h"
 #include <linux/netfilter.h> // Move this unum.h?
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
 
 /* Temporary, log to console from here */
 //#undef LOG_DST
@@ -35,18 +37,119 @@
 #define UTIL_IPV4_IS_LOCAL_MCAST(a) \
 	(((a) & 0xff000000) == 0xef000000)
 
+// Socket receive buffer size for the ctnetlink destroy events (the events
+// for all the connections closed during FESTATS_INTERVAL_MSEC are queued)
+#define FE_CT_EV_RCVBUF (256 * 1024)
+
 // ToDo: Investigate a way to avoid this and use the one from opensource
 // This is a duplicate of what we already have in tpcap.c
 DEV_IP_CFG_t ipcfg;
 
-// Function called by common code to start the IP forwarding
-// engine stats collection pass.
-void fe_platform_update_stats()
+// Update the connection entry w/ the connection tracker counters.
+// hdr - the connection header w/ the IPs, ports, protocol and address
+//       family filled in (the rest is done by fe_prep_conn_hdr())
+// d_in - bytes in the reply direction of the tracked connection
+// d_out - bytes in the original direction of the tracked connection
+static void fe_update_conn(FE_CONN_HDR_t *hdr,
+                           unsigned long long d_in, unsigned long long d_out)
+{
+    int rxb = 0, txb = 0;
+
+    // Preprocess the header (fills in the remaining info)
+    if(fe_prep_conn_hdr(hdr) < 0) {
+        // Per my observation this log is printed in case of traffic
+        // generated from or received by the Router
+        // This seems to be creating a lot of noise
+        // Comment it out for now. 
+        // We have the same issue with 7020 too
+        // Discuss with Denis at code review time
+#if 0
+        log("%s: skipping p:%d " IP_PRINTF_FMT_TPL ":%hu -> "
+                IP_PRINTF_FMT_TPL ":%hu\n", __func__,
+                hdr->proto, IP_PRINTF_ARG_TPL(hdr->dev_ipv4.b), hdr->dev_port,
+                IP_PRINTF_ARG_TPL(hdr->peer_ipv4.b), hdr->peer_port);
+#endif
+        return;
+    }
+    FE_CONN_t *conn = fe_upd_conn_start(hdr);
+    if(!conn) {
+        log("%s: cannot add p:%d " IP_PRINTF_FMT_TPL ":%hu -> "
+            IP_PRINTF_FMT_TPL ":%hu\n", __func__,
+            hdr->proto, IP_PRINTF_ARG_TPL(hdr->dev.ipv4.b), hdr->dev_port,
+            IP_PRINTF_ARG_TPL(hdr->peer.ipv4.b), hdr->peer_port);
+        return;
+    }
+
+    if(conn->hdr.rev) { // Reverse, swap Tx/Rx
+        unsigned long long d_temp = d_in;
+
+        d_in = d_out;
+        d_out = d_temp;
+    }
+
+    if(d_in != conn->in.bytes) {
+        rxb = 1;
+    }
+    if(d_out != conn->out.bytes) {
+        txb = 1;
+    }
+
+    if (hdr->af == AF_INET) {
+        unsigned int dest_ip = hdr->peer.ipv4.i;
+        if (conn->hdr.rev) {
+            dest_ip = hdr->dev.ipv4.i;
+        }
+
+        if (UTIL_IPV4_IS_WELL_KNOWN_MCAST(dest_ip) ||
+            UTIL_IPV4_IS_LOCAL_MCAST(dest_ip) ||
+            (dest_ip & ipcfg.ipv4mask.i) ==
+            (ipcfg.ipv4.i & ipcfg.ipv4mask.i)) {
+            // A multicast packet or broadcast packet or packets to the router
+            // Well known and local multicast only
+            // ie 224.0.0.0 to 224.0.0.255 and
+            // 239.0.0.0 to 239.255.255.255
+            // Ignore this
+            // Our router does n't forward multicast packets to Internet
+            // We need to count packets only those coming from / going to
+            // Internet.
+            fe_upd_conn_end(conn, FALSE);
+            return;
+        }
+#ifdef FEATURE_IPV6_TELEMETRY
+    } else if (hdr->af == AF_INET6) {
+        if (IN6_IS_ADDR_MULTICAST(hdr->peer.ipv6.b)) {
+            // Our router doesn't forward multicast packets to Internet
+            // We need to count packets only those coming from / going to
+            // Internet.
+            fe_upd_conn_end(conn, FALSE);
+            return;
+        }
+#endif // FEATURE_IPV6_TELEMETRY
+    }
+    if (conn->in.bytes > d_in || conn->out.bytes > d_out) {
+        // If connection restarted between our polls zero the counters,
+        log("%s: skipping and resetting p:%d " IP_PRINTF_FMT_TPL ":%hu -> "
+                IP_PRINTF_FMT_TPL ":%hu\n", __func__,
+                hdr->proto, IP_PRINTF_ARG_TPL(hdr->dev.ipv4.b), hdr->dev_port,
+                IP_PRINTF_ARG_TPL(hdr->peer.ipv4.b), hdr->peer_port);
+        conn->in.bytes = 0;
+        conn->out.bytes = 0;
+        conn->out.bytes_read = 0;
+        conn->in.bytes_read = 0;
+    }
+    conn->in.bytes = d_in;   // Download
+    conn->out.bytes = d_out; // Upload
+
+    fe_upd_conn_end(conn, (txb != 0 || rxb != 0));
+}
+
+// Update the connections from /proc/net/nf_conntrack (or the test file)
+// Returns: 0 - if successful, negative if the file cannot be opened
+static int fe_proc_update_stats(void)
 {
     char str[512];
     char *str_p = NULL;
     FILE *fp_stats;
-    DEV_IP_CFG_t new_ipcfg;
 
     char *file = "/proc/net/nf_conntrack";
 #ifdef DEBUG
@@ -57,25 +160,12 @@ void fe_platform_update_stats()
     fp_stats = fopen(file, "r");
     if(!fp_stats) {
         log("%s: error opening %s: %s\n", __func__, file, strerror(errno));
-        return;
-    }
-
-    memset(&new_ipcfg, 0, sizeof(new_ipcfg));
-    // For now adding home network only
-    // We may have to rework on this when ipcfg values are reused from tpcap
-    if(util_get_ipcfg(PLATFORM_GET_MAIN_LAN_NET_DEV(), &new_ipcfg) != 0) {
-        log("%s: warning, IP configuration update for %s has failed\n",
-                    __func__, PLATFORM_GET_MAIN_LAN_NET_DEV());
-    }
-    else if(memcmp(&ipcfg, &new_ipcfg, sizeof(new_ipcfg))) {
-        log("%s: updating IP configuration for %s\n", __func__, PLATFORM_GET_MAIN_LAN_NET_DEV());
-        memcpy(&ipcfg, &new_ipcfg, sizeof(ipcfg));
+        return -1;
     }
 
     while(fgets(str, sizeof(str), fp_stats) != NULL)
     {
         unsigned long long d_in, d_out;
-        int rxb = 0, txb = 0;
         str_p = str;
 
         /*
@@ -112,6 +202,7 @@ void fe_platform_update_stats()
         }
         // Start filling in the header
         FE_CONN_HDR_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
         hdr.proto = ip_proto;
         hdr.pad = 0;
 
@@ -240,97 +331,383 @@ void fe_platform_update_stats()
         }
         d_in = strtoull(bytes2 + 6, NULL, 10);
 
-        // Preprocess the header (fills in the remaining info)
-        if(fe_prep_conn_hdr(&hdr) < 0) {
-            // Per my observation this log is printed in case of traffic
-            // generated from or received by the Router
-            // This seems to be creating a lot of noise
-            // Comment it out for now. 
-            // We have the same issue with 7020 too
-            // Discuss with Denis at code review time
-#if 0
-            log("%s: skipping p:%d " IP_PRINTF_FMT_TPL ":%hu -> "
-                    IP_PRINTF_FMT_TPL ":%hu\n", __func__,
-                    hdr.proto, IP_PRINTF_ARG_TPL(hdr.dev_ipv4.b), hdr.dev_port,
-                    IP_PRINTF_ARG_TPL(hdr.peer_ipv4.b), hdr.peer_port);
-#endif
-            continue;
-        }
-        FE_CONN_t *conn = fe_upd_conn_start(&hdr);
-        if(!conn) {
-            log("%s: cannot add p:%d " IP_PRINTF_FMT_TPL ":%hu -> "
-                IP_PRINTF_FMT_TPL ":%hu\n", __func__,
-                hdr.proto, IP_PRINTF_ARG_TPL(hdr.dev.ipv4.b), hdr.dev_port,
-                IP_PRINTF_ARG_TPL(hdr.peer.ipv4.b), hdr.peer_port);
-            continue;
+        fe_update_conn(&hdr, d_in, d_out);
+    }
+
+    fclose(fp_stats);
+    fp_stats = NULL;
+    return 0;
+}
+
+// ctnetlink (conntrack netlink) connection tracker backend.
+// Every pass the connection table is dumped with the counters in the
+// binary attributes (no text to parse). Between the passes the destroy
+// events are collected on a separate socket, they carry the final
+// counters of the connections, so the traffic of the connections that
+// are gone before the next dump is still accounted for. The events
+// socket is opened on the first pass since the kernel (w/ the default
+// nf_conntrack_events=2) only generates the events for the connections
+// created while there is a listener.
+
+// Receive buffer for the ctnetlink messages (the dump messages are
+// batched by the kernel up to the buffer size)
+static char ct_nl_buf[32768];
+
+// Sockets for the dumps and the destroy events
+static int ct_nl_sock = -1;
+static int ct_ev_sock = -1;
+
+// Dump request sequence number
+static unsigned int ct_nl_seq;
+
+// Set if ctnetlink is not available (the /proc parser is used instead)
+static int ct_nl_disabled = FALSE;
+
+// Parse netlink attributes into the table indexed by the attribute type
+// tb - the table (max + 1 entries)
+// max - max attribute type to capture
+// a - the first attribute
+// len - the length of the attributes
+static void ct_nl_parse(struct nlattr **tb, int max, struct nlattr *a, int len)
+{
+    memset(tb, 0, (max + 1) * sizeof(struct nlattr *));
+    while(len >= (int)sizeof(struct nlattr) &&
+          a->nla_len >= sizeof(struct nlattr) && a->nla_len <= len)
+    {
+        int type = a->nla_type & NLA_TYPE_MASK;
+        if(type <= max) {
+            tb[type] = a;
         }
+        len -= NLA_ALIGN(a->nla_len);
+        a = (struct nlattr *)((char *)a + NLA_ALIGN(a->nla_len));
+    }
+}
+
+// Netlink attribute data and length
+#define CT_NLA_DATA(_a) ((void *)((char *)(_a) + NLA_HDRLEN))
+#define CT_NLA_LEN(_a)  ((int)(_a)->nla_len - NLA_HDRLEN)
+// Parse nested attributes of _a
+#define CT_NLA_NESTED(_tb, _max, _a) \
+    ct_nl_parse((_tb), (_max), CT_NLA_DATA(_a), CT_NLA_LEN(_a))
+
+// Get the byte counter from CTA_COUNTERS_ORIG/REPLY attribute
+static unsigned long long ct_nl_bytes(struct nlattr *a)
+{
+    struct nlattr *tb[CTA_COUNTERS_MAX + 1];
+    uint64_t val64;
+    uint32_t val32;
+
+    if(a == NULL) {
+        return 0;
+    }
+    CT_NLA_NESTED(tb, CTA_COUNTERS_MAX, a);
+    if(tb[CTA_COUNTERS_BYTES] != NULL &&
+       CT_NLA_LEN(tb[CTA_COUNTERS_BYTES]) >= sizeof(val64))
+    {
+        memcpy(&val64, CT_NLA_DATA(tb[CTA_COUNTERS_BYTES]), sizeof(val64));
+        return be64toh(val64);
+    }
+    if(tb[CTA_COUNTERS32_BYTES] != NULL &&
+       CT_NLA_LEN(tb[CTA_COUNTERS32_BYTES]) >= sizeof(val32))
+    {
+        memcpy(&val32, CT_NLA_DATA(tb[CTA_COUNTERS32_BYTES]), sizeof(val32));
+        return ntohl(val32);
+    }
+
+    return 0;
+}
 
-        if(conn->hdr.rev) { // Reverse, swap Tx/Rx
-            unsigned long long d_temp = d_in;
+// Fill in the connection header from the CTA_TUPLE_ORIG attribute
+// Returns: 0 - if successful, negative if the connection is to be ignored
+static int ct_nl_tuple(struct nlattr *a, int family, FE_CONN_HDR_t *hdr)
+{
+    struct nlattr *tb[CTA_TUPLE_MAX + 1];
+    struct nlattr *tb_ip[CTA_IP_MAX + 1];
+    struct nlattr *tb_proto[CTA_PROTO_MAX + 1];
+    uint16_t port;
 
-            d_in = d_out;
-            d_out = d_temp;
+    CT_NLA_NESTED(tb, CTA_TUPLE_MAX, a);
+    if(tb[CTA_TUPLE_IP] == NULL || tb[CTA_TUPLE_PROTO] == NULL) {
+        return -1;
+    }
+    CT_NLA_NESTED(tb_proto, CTA_PROTO_MAX, tb[CTA_TUPLE_PROTO]);
+    if(tb_proto[CTA_PROTO_NUM] == NULL) {
+        return -2;
+    }
+    hdr->proto = *(uint8_t *)CT_NLA_DATA(tb_proto[CTA_PROTO_NUM]);
+    if(hdr->proto != IPPROTO_ICMP && hdr->proto != IPPROTO_UDP &&
+       hdr->proto != IPPROTO_TCP)
+    {
+        // Ignore if not a ICMP, TCP or UDP entry
+        return -3;
+    }
+    if(hdr->proto != IPPROTO_ICMP) {
+        if(tb_proto[CTA_PROTO_SRC_PORT] == NULL ||
+           tb_proto[CTA_PROTO_DST_PORT] == NULL)
+        {
+            return -4;
         }
+        memcpy(&port, CT_NLA_DATA(tb_proto[CTA_PROTO_SRC_PORT]), sizeof(port));
+        hdr->dev_port = ntohs(port);
+        memcpy(&port, CT_NLA_DATA(tb_proto[CTA_PROTO_DST_PORT]), sizeof(port));
+        hdr->peer_port = ntohs(port);
+    }
 
-        if(d_in != conn->in.bytes) {
-            rxb = 1;
+    CT_NLA_NESTED(tb_ip, CTA_IP_MAX, tb[CTA_TUPLE_IP]);
+    if(family == AF_INET) {
+        if(tb_ip[CTA_IP_V4_SRC] == NULL || tb_ip[CTA_IP_V4_DST] == NULL) {
+            return -5;
         }
-        if(d_out != conn->out.bytes) {
-            txb = 1;
+        hdr->af = AF_INET;
+        memcpy(hdr->dev.ipv4.b, CT_NLA_DATA(tb_ip[CTA_IP_V4_SRC]),
+               sizeof(hdr->dev.ipv4.b));
+        memcpy(hdr->peer.ipv4.b, CT_NLA_DATA(tb_ip[CTA_IP_V4_DST]),
+               sizeof(hdr->peer.ipv4.b));
+#ifdef FEATURE_IPV6_TELEMETRY
+    } else if(family == AF_INET6) {
+        if(tb_ip[CTA_IP_V6_SRC] == NULL || tb_ip[CTA_IP_V6_DST] == NULL) {
+            return -5;
         }
+        hdr->af = AF_INET6;
+        memcpy(hdr->dev.ipv6.b, CT_NLA_DATA(tb_ip[CTA_IP_V6_SRC]),
+               sizeof(hdr->dev.ipv6.b));
+        memcpy(hdr->peer.ipv6.b, CT_NLA_DATA(tb_ip[CTA_IP_V6_DST]),
+               sizeof(hdr->peer.ipv6.b));
+#endif // FEATURE_IPV6_TELEMETRY
+    } else {
+        // Ignore if not ipv4 or ipv6
+        return -6;
+    }
 
-        if (hdr.af == AF_INET) {
-            unsigned int dest_ip = hdr.peer.ipv4.i;
-            if (conn->hdr.rev) {
-                dest_ip = hdr.dev.ipv4.i;
-            }
+    return 0;
+}
 
-            if (UTIL_IPV4_IS_WELL_KNOWN_MCAST(dest_ip) ||
-                UTIL_IPV4_IS_LOCAL_MCAST(dest_ip) ||
-                (dest_ip & ipcfg.ipv4mask.i) ==
-                (ipcfg.ipv4.i & ipcfg.ipv4mask.i)) {
-                // A multicast packet or broadcast packet or packets to the router
-                // Well known and local multicast only
-                // ie 224.0.0.0 to 224.0.0.255 and
-                // 239.0.0.0 to 239.255.255.255
-                // Ignore this
-                // Our router does n't forward multicast packets to Internet
-                // We need to count packets only those coming from / going to
-                // Internet.
-                fe_upd_conn_end(conn, FALSE);
-                continue;
+// Process a ctnetlink conntrack message (dump entry or event)
+static void ct_nl_msg(struct nlmsghdr *nh)
+{
+    struct nfgenmsg *nfg = NLMSG_DATA(nh);
+    struct nlattr *tb[CTA_MAX + 1];
+    FE_CONN_HDR_t hdr;
+    unsigned long long d_in, d_out;
+
+    if(nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nfgenmsg))) {
+        return;
+    }
+    ct_nl_parse(tb, CTA_MAX,
+                (struct nlattr *)((char *)nfg + NLMSG_ALIGN(sizeof(*nfg))),
+                nh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof(*nfg))));
+    if(tb[CTA_TUPLE_ORIG] == NULL) {
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if(ct_nl_tuple(tb[CTA_TUPLE_ORIG], nfg->nfgen_family, &hdr) != 0) {
+        return;
+    }
+    d_out = ct_nl_bytes(tb[CTA_COUNTERS_ORIG]);
+    d_in = ct_nl_bytes(tb[CTA_COUNTERS_REPLY]);
+
+    DPRINTF("%s: %s p:%d af:%d ports %hu -> %hu, in:%llu out:%llu\n",
+            __func__, (NFNL_MSG_TYPE(nh->nlmsg_type) == IPCTNL_MSG_CT_DELETE ?
+                       "destroy" : "conn"),
+            hdr.proto, hdr.af, hdr.dev_port, hdr.peer_port, d_in, d_out);
+
+    fe_update_conn(&hdr, d_in, d_out);
+}
+
+// Close the ctnetlink sockets
+static void ct_nl_close(void)
+{
+    if(ct_nl_sock >= 0) {
+        close(ct_nl_sock);
+        ct_nl_sock = -1;
+    }
+    if(ct_ev_sock >= 0) {
+        close(ct_ev_sock);
+        ct_ev_sock = -1;
+    }
+}
+
+// Open a ctnetlink socket
+// group - multicast group to subscribe to (0 - none)
+// Returns: the socket or negative if fails
+static int ct_nl_open(int group)
+{
+    struct sockaddr_nl sa;
+    int sock;
+
+    sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+    if(sock < 0) {
+        log("%s: open netlink socket: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    if(bind(sock, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        log("%s: bind netlink socket: %s\n", __func__, strerror(errno));
+        close(sock);
+        return -2;
+    }
+    if(group != 0) {
+        int val = FE_CT_EV_RCVBUF;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val));
+        if(setsockopt(sock, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                      &group, sizeof(group)) < 0)
+        {
+            log("%s: netlink group %d: %s\n", __func__, group, strerror(errno));
+            close(sock);
+            return -3;
+        }
+    }
+
+    return sock;
+}
+
+// Apply the collected connection destroy events
+static void ct_nl_events(void)
+{
+    int len;
+    struct nlmsghdr *nh;
+
+    if(ct_ev_sock < 0) {
+        // Subscribe now, the next pass will have the events
+        ct_ev_sock = ct_nl_open(NFNLGRP_CONNTRACK_DESTROY);
+        return;
+    }
+    for(;;)
+    {
+        len = recv(ct_ev_sock, ct_nl_buf, sizeof(ct_nl_buf), MSG_DONTWAIT);
+        if(len < 0 && errno == ENOBUFS) {
+            // Some events were dropped, their connection counters
+            // will not include the traffic since the last pass
+            log("%s: events lost, the socket buffer overflow\n", __func__);
+            continue;
+        }
+        if(len <= 0) {
+            break;
+        }
+        for(nh = (struct nlmsghdr *)ct_nl_buf; NLMSG_OK(nh, len);
+            nh = NLMSG_NEXT(nh, len))
+        {
+            if(NFNL_SUBSYS_ID(nh->nlmsg_type) == NFNL_SUBSYS_CTNETLINK &&
+               NFNL_MSG_TYPE(nh->nlmsg_type) == IPCTNL_MSG_CT_DELETE)
+            {
+                ct_nl_msg(nh);
             }
+        }
+    }
+}
+
+// Update the connections from the ctnetlink conntrack table dump
+// Returns: 0 - if successful, negative if fails
+static int fe_ct_nl_update_stats(void)
+{
+    struct {
+        struct nlmsghdr nh;
+        struct nfgenmsg nfg;
+    } req;
+    struct nlmsghdr *nh;
+    int len, done = FALSE;
+
+    if(ct_nl_sock < 0 && (ct_nl_sock = ct_nl_open(0)) < 0) {
+        return -1;
+    }
+
+    // Collect the final counters of the connections that are gone
+    ct_nl_events();
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = sizeof(req);
+    req.nh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++ct_nl_seq;
 #ifdef FEATURE_IPV6_TELEMETRY
-        } else if (hdr.af == AF_INET6) {
-            if (IN6_IS_ADDR_MULTICAST(hdr.peer.ipv6.b)) {
-                // Our router doesn't forward multicast packets to Internet
-                // We need to count packets only those coming from / going to
-                // Internet.
-                fe_upd_conn_end(conn, FALSE);
-                continue;
-            }
+    req.nfg.nfgen_family = AF_UNSPEC;
+#else  // FEATURE_IPV6_TELEMETRY
+    req.nfg.nfgen_family = AF_INET;
 #endif // FEATURE_IPV6_TELEMETRY
+    req.nfg.version = NFNETLINK_V0;
+    if(send(ct_nl_sock, &req, sizeof(req), 0) < 0) {
+        log("%s: send to netlink: %s\n", __func__, strerror(errno));
+        ct_nl_close();
+        return -2;
+    }
+
+    while(!done)
+    {
+        len = recv(ct_nl_sock, ct_nl_buf, sizeof(ct_nl_buf), 0);
+        if(len < 0 && errno == EINTR) {
+            continue;
+        }
+        if(len <= 0) {
+            log("%s: recv from netlink: %s\n", __func__,
+                (len < 0 ? strerror(errno) : "no data"));
+            ct_nl_close();
+            return -3;
         }
-        if (conn->in.bytes > d_in || conn->out.bytes > d_out) {
-            // If connection restarted between our polls zero the counters,
-            log("%s: skipping and resetting p:%d " IP_PRINTF_FMT_TPL ":%hu -> "
-                    IP_PRINTF_FMT_TPL ":%hu\n", __func__,
-                    hdr.proto, IP_PRINTF_ARG_TPL(hdr.dev.ipv4.b), hdr.dev_port,
-                    IP_PRINTF_ARG_TPL(hdr.peer.ipv4.b), hdr.peer_port);
-            conn->in.bytes = 0;
-            conn->out.bytes = 0;
-            conn->out.bytes_read = 0;
-            conn->in.bytes_read = 0;
+        for(nh = (struct nlmsghdr *)ct_nl_buf; NLMSG_OK(nh, len);
+            nh = NLMSG_NEXT(nh, len))
+        {
+            if(nh->nlmsg_seq != ct_nl_seq) {
+                continue;
+            }
+            if(nh->nlmsg_type == NLMSG_DONE) {
+                done = TRUE;
+                break;
+            }
+            if(nh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(nh);
+                log("%s: netlink dump error: %s\n",
+                    __func__, strerror(-err->error));
+                // Not available in the kernel (no nf_conntrack_netlink)
+                if(err->error == -EOPNOTSUPP || err->error == -ENOENT) {
+                    ct_nl_disabled = TRUE;
+                }
+                ct_nl_close();
+                return -4;
+            }
+            ct_nl_msg(nh);
         }
-        conn->in.bytes = d_in;   // Download
-        conn->out.bytes = d_out; // Upload
+    }
+
+    return 0;
+}
 
-        fe_upd_conn_end(conn, (txb != 0 || rxb != 0));
-        // Discard our pointer to the entry
-        conn = NULL;
+// Function called by common code to start the IP forwarding
+// engine stats collection pass.
+void fe_platform_update_stats()
+{
+    DEV_IP_CFG_t new_ipcfg;
+    int use_nl = !ct_nl_disabled;
+
+    memset(&new_ipcfg, 0, sizeof(new_ipcfg));
+    // For now adding home network only
+    // We may have to rework on this when ipcfg values are reused from tpcap
+    if(util_get_ipcfg(PLATFORM_GET_MAIN_LAN_NET_DEV(), &new_ipcfg) != 0) {
+        log("%s: warning, IP configuration update for %s has failed\n",
+                    __func__, PLATFORM_GET_MAIN_LAN_NET_DEV());
     }
-    
-    fclose(fp_stats);
-    fp_stats = NULL;
+    else if(memcmp(&ipcfg, &new_ipcfg, sizeof(new_ipcfg))) {
+        log("%s: updating IP configuration for %s\n", __func__, PLATFORM_GET_MAIN_LAN_NET_DEV());
+        memcpy(&ipcfg, &new_ipcfg, sizeof(ipcfg));
+    }
+
+#ifdef DEBUG
+    if(test_conn_src == FE_CONN_SRC_NETLINK) {
+        use_nl = TRUE;
+    } else if(*test_conn_file != 0 || test_conn_src == FE_CONN_SRC_PROC) {
+        use_nl = FALSE;
+    }
+#endif // DEBUG
+
+    if(use_nl) {
+        if(fe_ct_nl_update_stats() == 0) {
+            return;
+        }
+        if(ct_nl_disabled) {
+            log("%s: ctnetlink is not available, using /proc\n", __func__);
+        }
+    }
+    // Fall back to parsing /proc/net/nf_conntrack
+    fe_proc_update_stats();
     return;
 }
@@ -25,9 +25,14 @@
 // JSON, called by devices telemetry when it prepares its own JSON.
 JSON_KEYVAL_TPL_t *fp_mk_json_tpl_f(char *key);
 
-// Reset all fingerprinting tables (including the table usage stats)
+// Reset the previous epoch fingerprinting tables (including the table
+// usage stats)
 void fp_reset_tables(void);
 
+// Swap the current and the previous epoch fingerprinting tables
+// (called by the tpcap thread)
+void fp_epoch_swap(void);
+
 // Subsystem init fuction
 int fp_init(int level);
 
@@ -66,29 +66,37 @@ static FP_DHCP_t **dhcp_tbl;
 // Structures tracking DHCP info table stats
 static FP_TABLE_STATS_t dhcp_tbl_stats;
 
+// The previous telemetry epoch DHCP info table and its stats (swapped
+// w/ the current epoch ones above by fp_dhcp_epoch_swap(), accessed by
+// the devices telemetry sender only)
+static struct {
+    FP_DHCP_t **dhcp_tbl;
+    FP_TABLE_STATS_t dhcp_tbl_stats;
+} prev;
 
-// Returns pointer to the DHCP info table stats.
-// Use from the tpcap callbacks only.
+
+// Returns pointer to the previous epoch DHCP info table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the returned data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 FP_TABLE_STATS_t *fp_dhcp_tbl_stats(int reset)
 {
     static FP_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &dhcp_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.dhcp_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&dhcp_tbl_stats, 0, sizeof(dhcp_tbl_stats));
+        memset(&prev.dhcp_tbl_stats, 0, sizeof(prev.dhcp_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Get the pointer to the DHCP info table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch DHCP info table
+// The table should only be accessed from the sender thread
 FP_DHCP_t **fp_get_dhcp_tbl(void)
 {
-    return dhcp_tbl;
+    return prev.dhcp_tbl;
 }
 
-// Reset all DHCP tables (including the table usage stats)
+// Reset the previous epoch DHCP tables (including the table usage stats)
 // Has to work (not crash) even if the subsystem is not initialized
 // (otherwise it will break devices telemetry tests)
 void fp_reset_dhcp_tables(void)
@@ -96,12 +104,12 @@ void fp_reset_dhcp_tables(void)
     int ii;
 
     // If we are not initialized, nothing to do
-    if(!dhcp_tbl) {
+    if(!prev.dhcp_tbl) {
         return;
     }
     // Reset DHCP table (keeping already allocated items memory)
     for(ii = 0; ii < FP_MAX_DEV; ii++) {
-        FP_DHCP_t *item = dhcp_tbl[ii];
+        FP_DHCP_t *item = prev.dhcp_tbl[ii];
         if(item) {
             // blob_len == 0 indicates unused entry
             item->blob_len = 0;
@@ -113,6 +121,14 @@ void fp_reset_dhcp_tables(void)
     return;
 }
 
+// Swap the current epoch DHCP tables w/ the previous epoch ones (should
+// already be reset). Called by the tpcap thread.
+void fp_dhcp_epoch_swap(void)
+{
+    UTIL_SWAP(dhcp_tbl, prev.dhcp_tbl);
+    UTIL_SWAP(dhcp_tbl_stats, prev.dhcp_tbl_stats);
+}
+
 // Add MAC to DHCP info table
 // Returns a pointer to the DHCP info table record that
 // can be used for the MAC DHCP info or NULL
@@ -274,16 +290,21 @@ static void dhcp_rcv_cb(TPCAP_IF_t *tpif,
 // Returns: 0 - if successful
 int fp_dhcp_init(void)
 {
+    int ii;
     PKT_PROC_ENTRY_t *pe;
 
     // Allocate memory for the DHCP info table (never freed).
     // The memory for each element is allocated when required
     // and stores the pointer in the array. Once allocated the
     // entries are never freed (reused when needed).
-    dhcp_tbl = calloc(FP_MAX_DEV, sizeof(FP_DHCP_t *));
-    if(!dhcp_tbl) {
-        log("%s: failed to allocate memory for data tables\n", __func__);
-        return -1;
+    // There are two tables, for the current and the previous telemetry epoch.
+    for(ii = 0; ii < 2; ii++) {
+        dhcp_tbl = calloc(FP_MAX_DEV, sizeof(FP_DHCP_t *));
+        if(!dhcp_tbl) {
+            log("%s: failed to allocate memory for data tables\n", __func__);
+            return -1;
+        }
+        fp_dhcp_epoch_swap();
     }
 
     // Add the collector packet processing entries.
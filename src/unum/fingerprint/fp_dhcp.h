@@ -4,19 +4,22 @@
 #ifndef _FINGERPRINT_DHCP_H
 #define _FINGERPRINT_DHCP_H
 
-// Returns pointer to the DHCP info table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch DHCP info table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the returned data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 FP_TABLE_STATS_t *fp_dhcp_tbl_stats(int reset);
 
-// Get the pointer to the DHCP info table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch DHCP info table
+// The table should only be accessed from the sender thread
 FP_DHCP_t **fp_get_dhcp_tbl(void);
 
-// Reset all DHCP tables (including the table usage stats)
+// Reset the previous epoch DHCP tables (including the table usage stats)
 void fp_reset_dhcp_tables(void);
 
+// Swap the current and the previous epoch DHCP tables
+void fp_dhcp_epoch_swap(void);
+
 // Init DHCP fingerprinting
 // Returns: 0 - if successful
 int fp_dhcp_init(void);
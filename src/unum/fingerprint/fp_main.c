@@ -383,7 +383,8 @@ JSON_KEYVAL_TPL_t *fp_mk_json_tpl_f(char *key)
     return &(tpl_fp_root[0]);
 }
 
-// Reset all fingerprinting tables (including the table usage stats)
+// Reset the previous epoch fingerprinting tables (including the table
+// usage stats)
 // Has to work (not crash) even if the subsystem is not initialized
 // (otherwise it will break devices telemetry tests)
 void fp_reset_tables(void)
@@ -394,6 +395,16 @@ void fp_reset_tables(void)
     fp_reset_useragent_tables();
 }
 
+// Swap the current and the previous epoch fingerprinting tables
+// (called by the tpcap thread at the end of the telemetry period)
+void fp_epoch_swap(void)
+{
+    fp_dhcp_epoch_swap();
+    fp_mdns_epoch_swap();
+    fp_ssdp_epoch_swap();
+    fp_useragent_epoch_swap();
+}
+
 // Subsystem init fuction. The subsystem runs individual fingerprinting
 // modules. The data collected by the modules is added to the devices
 // telemetry JSON.
@@ -88,29 +88,37 @@ static FP_MDNS_t **mdns_tbl;
 // Structures tracking mDNS info table stats
 static FP_TABLE_STATS_t mdns_tbl_stats;
 
+// The previous telemetry epoch mDNS info table and its stats (swapped
+// w/ the current epoch ones above by fp_mdns_epoch_swap(), accessed by
+// the devices telemetry sender only)
+static struct {
+    FP_MDNS_t **mdns_tbl;
+    FP_TABLE_STATS_t mdns_tbl_stats;
+} prev;
 
-// Returns pointer to the mDNS info table stats.
-// Use from the tpcap callbacks only.
+
+// Returns pointer to the previous epoch mDNS info table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the returned data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 FP_TABLE_STATS_t *fp_mdns_tbl_stats(int reset)
 {
     static FP_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &mdns_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.mdns_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&mdns_tbl_stats, 0, sizeof(mdns_tbl_stats));
+        memset(&prev.mdns_tbl_stats, 0, sizeof(prev.mdns_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Get the pointer to the mDNS info table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch mDNS info table
+// The table should only be accessed from the sender thread
 FP_MDNS_t **fp_get_mdns_tbl(void)
 {
-    return mdns_tbl;
+    return prev.mdns_tbl;
 }
 
-// Reset all mDNS tables (including the table usage stats)
+// Reset the previous epoch mDNS tables (including the table usage stats)
 // Has to work (not crash) even if the subsystem is not initialized
 // (otherwise it will break devices telemetry tests)
 void fp_reset_mdns_tables(void)
@@ -118,12 +126,12 @@ void fp_reset_mdns_tables(void)
     int ii;
 
     // If we are not initialized, nothing to do
-    if(!mdns_tbl) {
+    if(!prev.mdns_tbl) {
         return;
     }
     // Reset mDNS table (keeping already allocated items memory)
     for(ii = 0; ii < FP_MAX_DEV; ii++) {
-        FP_MDNS_t *item = mdns_tbl[ii];
+        FP_MDNS_t *item = prev.mdns_tbl[ii];
         if(item) {
             // blob_len == 0 indicates unused entry
             item->blob_len = 0;
@@ -135,6 +143,14 @@ void fp_reset_mdns_tables(void)
     return;
 }
 
+// Swap the current epoch mDNS tables w/ the previous epoch ones (should
+// already be reset). Called by the tpcap thread.
+void fp_mdns_epoch_swap(void)
+{
+    UTIL_SWAP(mdns_tbl, prev.mdns_tbl);
+    UTIL_SWAP(mdns_tbl_stats, prev.mdns_tbl_stats);
+}
+
 // Add MAC to mDNS info table
 // Returns a pointer to the mDNS info table record that
 // can be used for the MAC mDNS info or NULL
@@ -445,16 +461,22 @@ int cmd_mdns_discovery(char *cmd, char *s, int s_len)
 // Returns: 0 - if successful
 int fp_mdns_init(void)
 {
+    int ii;
     PKT_PROC_ENTRY_t *pe;
 
     // Allocate memory for the mDNS info table (never freed).
     // The memory for each element is allocated when required
     // and stores the pointer in the array. Once allocated the
     // entries are never freed (reused when needed).
-    mdns_tbl = calloc(FP_MAX_DEV, sizeof(FP_MDNS_t *));
-    if(!mdns_tbl) {
-        DPRINTF("%s: failed to allocate memory for data tables\n", __func__);
-        return -1;
+    // There are two tables, for the current and the previous telemetry epoch.
+    for(ii = 0; ii < 2; ii++) {
+        mdns_tbl = calloc(FP_MAX_DEV, sizeof(FP_MDNS_t *));
+        if(!mdns_tbl) {
+            DPRINTF("%s: failed to allocate memory for data tables\n",
+                    __func__);
+            return -1;
+        }
+        fp_mdns_epoch_swap();
     }
 
     // Add the collector packet processing entries.
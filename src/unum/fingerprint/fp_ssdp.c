@@ -28,15 +28,27 @@ static void ssdp_rsp_rcv_cb(TPCAP_IF_t *tpif,
 
 
 
-// SSDP start timer handle. There should be only 1 SSDP start timer
-// set at any time. If the timer is not set (or the handle is invalid)
-// then SSDP discovery cycle is currently in progress.
+// SSDP discovery cycle periodic timer handle (checks if it is time to
+// start a new discovery cycle every FP_SSDP_DISCOVERY_INIT_DELAY seconds)
 static TIMER_HANDLE_t ssdp_timer = 0;
 
+// SSDP discover periodic timer handle, the timer sends the discovery
+// every FP_SSDP_DISCOVERY_PERIOD seconds while the cycle is in progress
+// (0 if no discovery cycle is in progress). Both SSDP timers run in the
+// reactor thread, so they do not need any locking to share the state.
+static TIMER_HANDLE_t ssdp_discover_timer = 0;
+
 // Counts current discovery cycle attempts (up to FP_SSDP_DISCOVERY_ATTEMPTS
 // for each cycle)
 static int ssdp_discovery_attempt = 0;
 
+// Uptime (in seconds) when the last discovery cycle has completed
+// (0 if none has completed yet)
+static unsigned long long ssdp_cycle_done_t = 0;
+
+// Set by the "do_ssdp_discovery" command to start a new cycle right away
+static volatile int ssdp_discovery_req = FALSE;
+
 // SSDP packets processing entry
 static PKT_PROC_ENTRY_t fp_ssdp_pkt_proc = {
     0,
@@ -55,29 +67,37 @@ static FP_SSDP_t **ssdp_tbl;
 // Structures tracking SSDP info table stats
 static FP_TABLE_STATS_t ssdp_tbl_stats;
 
+// The previous telemetry epoch SSDP info table and its stats (swapped
+// w/ the current epoch ones above by fp_ssdp_epoch_swap(), accessed by
+// the devices telemetry sender only)
+static struct {
+    FP_SSDP_t **ssdp_tbl;
+    FP_TABLE_STATS_t ssdp_tbl_stats;
+} prev;
+
 
-// Returns pointer to the SSDP info table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch SSDP info table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the returned data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 FP_TABLE_STATS_t *fp_ssdp_tbl_stats(int reset)
 {
     static FP_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &ssdp_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.ssdp_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&ssdp_tbl_stats, 0, sizeof(ssdp_tbl_stats));
+        memset(&prev.ssdp_tbl_stats, 0, sizeof(prev.ssdp_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Get the pointer to the SSDP info table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch SSDP info table
+// The table should only be accessed from the sender thread
 FP_SSDP_t **fp_get_ssdp_tbl(void)
 {
-    return ssdp_tbl;
+    return prev.ssdp_tbl;
 }
 
-// Reset all SSDP tables (including the table usage stats)
+// Reset the previous epoch SSDP tables (including the table usage stats)
 // Has to work (not crash) even if the subsystem is not initialized
 // (otherwise it will break devices telemetry tests)
 void fp_reset_ssdp_tables(void)
@@ -85,12 +105,12 @@ void fp_reset_ssdp_tables(void)
     int ii;
 
     // If we are not initialized, nothing to do
-    if(!ssdp_tbl) {
+    if(!prev.ssdp_tbl) {
         return;
     }
     // Reset SSDP table (keeping already allocated items memory)
     for(ii = 0; ii < FP_MAX_DEV; ii++) {
-        FP_SSDP_t *item = ssdp_tbl[ii];
+        FP_SSDP_t *item = prev.ssdp_tbl[ii];
         if(item) {
             item->data[0] = 0; // indicates unused entry
         }
@@ -101,6 +121,14 @@ void fp_reset_ssdp_tables(void)
     return;
 }
 
+// Swap the current epoch SSDP tables w/ the previous epoch ones (should
+// already be reset). Called by the tpcap thread.
+void fp_ssdp_epoch_swap(void)
+{
+    UTIL_SWAP(ssdp_tbl, prev.ssdp_tbl);
+    UTIL_SWAP(ssdp_tbl_stats, prev.ssdp_tbl_stats);
+}
+
 // Add MAC to SSDP info table
 // Returns a pointer to the SSDP info table record that
 // can be used for the MAC SSDP info or NULL
@@ -262,154 +290,122 @@ static void ssdp_rsp_rcv_cb(TPCAP_IF_t *tpif,
     return;
 }
 
-// Start SSDP discovery. The function is a fast timer handler,
-// no long processing is allowed here. It verifies that the
-// server is ready to receive telemetry form the agent, then
-// starts SSDP discover. It only runs in the timer thread.
+// Send SSDP discovery. The function is a fast periodic timer handler,
+// no long processing is allowed here. It runs while the discovery cycle
+// is in progress, sets up the packet capturing filter on the first call,
+// sends the discovery FP_SSDP_DISCOVERY_ATTEMPTS times and then removes
+// the filter and cancels its timer.
 static void ssdp_discover(TIMER_PARAM_t *p)
 {
-    int end_cycle = FALSE;
+    // If starting the cycle set up packet capturing filter
+    if(ssdp_discovery_attempt <= 0)
+    {
+        // Add the SSDP info collector packet processing entries.
+        // If fails will try again when the timer fires next time
+        // (ssdp_discovery_attempt is not updated, so it will continue
+        // keep trying)
+        if(tpcap_add_proc_entry(&fp_ssdp_pkt_proc) != 0)
+        {
+            log("%s: tpcap_add_proc_entry() failed for: %s\n",
+                __func__, fp_ssdp_pkt_proc.desc);
+            return;
+        }
+    } // Just finished the cycle
+    else if(ssdp_discovery_attempt >= FP_SSDP_DISCOVERY_ATTEMPTS)
+    {
+        // Remove packet capturing filter and stop the timer. There is
+        // a chance that before data from this cycle is uploaded server
+        // starts a new one, there should be no harm in doing that.
+        tpcap_del_proc_entry(&fp_ssdp_pkt_proc);
+        util_timer_cancel(ssdp_discover_timer);
+        ssdp_discover_timer = 0;
+        ssdp_discovery_attempt = 0;
+        ssdp_cycle_done_t = util_time(1);
+        return;
+    }
 
-    // The timer handle is no longer active, so reset it to 0
-    ssdp_timer = 0;
+    // The cycle has just started or in progress, send the SSDP discovery.
+    // Ignore a failure to send, we try several times anyway.
+    UDP_PAYLOAD_t payload;
+    payload.dip = "239.255.255.250";
+    payload.dport = 1900;
+    payload.sport = 1900;
+    payload.data =  "M-SEARCH * HTTP/1.1\r\n"
+                    "HOST:239.255.255.250:1900\r\n"
+                    "MAN:\"ssdp:discover\"\r\n"
+                    "ST:upnp:rootdevice\r\n"
+                    "MX:" UTIL_STR(FP_SSDP_DISCOVERY_PERIOD) "\r\n"
+                    "\r\n";
+    payload.len = strlen(payload.data);
+
+    util_enum_ifs(UTIL_IF_ENUM_RTR_LAN,
+                  (UTIL_IF_ENUM_CB_t)send_udp_packet, &payload);
+
+    // Increment the attempt count
+    ++ssdp_discovery_attempt;
 
-    // Note: we are sure that command handler is not scheduling SSDP
-    //       processing since it MUST successfully cancel the old SSDP
-    //       timer before setting the new one (since we are running
-    //       nobody cancelled it)
+    return;
+}
 
-    unsigned long delay = FP_SSDP_DISCOVERY_INIT_DELAY;
-    for(;;) {
-        // If activation is not complete nothing to do
-        if(!is_agent_activated()) {
-            break;
-        }
+// SSDP discovery cycle timer handler. It is a fast periodic timer
+// handler (also fired once by the discovery command), no long processing
+// is allowed here. It verifies that the server is ready to receive
+// telemetry form the agent and starts the discovery cycle if it is time
+// for the next one or the server has requested it.
+static void ssdp_cycle(TIMER_PARAM_t *p)
+{
+    int req = ssdp_discovery_req;
 
-        // If starting the cycle set up packet capturing filter
-        if(ssdp_discovery_attempt <= 0)
-        {
-            // Add the SSDP info collector packet processing entries.
-            // If fails will try again in a few seconds (ssdp_discovery_attempt
-            // is not updated, so it will continue keep trying)
-            if(tpcap_add_proc_entry(&fp_ssdp_pkt_proc) != 0)
-            {
-                log("%s: tpcap_add_proc_entry() failed for: %s\n",
-                    __func__, fp_ssdp_pkt_proc.desc);
-                delay = FP_SSDP_DISCOVERY_PERIOD;
-                break;
-            }
-        } // Just finished the cycle
-        else if(ssdp_discovery_attempt >= FP_SSDP_DISCOVERY_ATTEMPTS)
-        {
-            // Remove packet capturing filter
-            tpcap_del_proc_entry(&fp_ssdp_pkt_proc);
-            // Set the delay for the long wait
-            delay = FP_SSDP_DISCOVERY_CYCLE_INTERVAL;
-            // There is a chance that before data from this cycle is uploaded
-            // server starts a new one, there should be no harm in doing that.
-            end_cycle = TRUE;
-            break;
+    // Nothing to do if the cycle is in progress
+    if(ssdp_discover_timer != 0) {
+        if(req) {
+            log("%s: SSDP discovery is already in progress\n", __func__);
+            ssdp_discovery_req = FALSE;
         }
-
-        // The cycle has just started or in progress, send the SSDP discovery.
-        // Ignore a failure to send, we try several times anyway.
-        UDP_PAYLOAD_t payload;
-        payload.dip = "239.255.255.250";
-        payload.dport = 1900;
-        payload.sport = 1900;
-        payload.data =  "M-SEARCH * HTTP/1.1\r\n"
-                        "HOST:239.255.255.250:1900\r\n"
-                        "MAN:\"ssdp:discover\"\r\n"
-                        "ST:upnp:rootdevice\r\n"
-                        "MX:" UTIL_STR(FP_SSDP_DISCOVERY_PERIOD) "\r\n"
-                        "\r\n";
-        payload.len = strlen(payload.data);
-
-        util_enum_ifs(UTIL_IF_ENUM_RTR_LAN,
-                      (UTIL_IF_ENUM_CB_t)send_udp_packet, &payload);
-
-        // Increment the attempt count and set the delay
-        ++ssdp_discovery_attempt;
-        delay = FP_SSDP_DISCOVERY_PERIOD;
-
-        break;
+        return;
     }
 
-    // Set the timer to call us again (either soon when it is time for the next
-    // attempt to send the discover or in a while if scheduling a new cycle)
-    TIMER_HANDLE_t timer = util_timer_set(delay * 1000,
-                                          "ssdp_discover", ssdp_discover,
-                                          NULL, FALSE);
-    if(timer == 0) {
-        log("%s: unable to set timer, SSDP fingerprinting terminated\n",
-            __func__);
-        // Nothing we can do here, just giving up on SSDP till server
-        // sends the command and we try to set up the timer again.
-        tpcap_del_proc_entry(&fp_ssdp_pkt_proc);
-        // Set discovery attempts to a negative value to have some indication
-        // that there is no longer SSDP timer scheduled or being processed.
-        ssdp_discovery_attempt = -1;
+    // If activation is not complete nothing to do
+    if(!is_agent_activated()) {
         return;
     }
 
-    // Set the timer handle global and reset the attempt count
-    // if we are done with the current cycle and successfully
-    // scheduled the next one.
-    if(end_cycle)
+    // Unless requested, wait for the cycle interval to pass since
+    // the last cycle
+    if(!req && ssdp_cycle_done_t != 0 &&
+       util_time(1) - ssdp_cycle_done_t < FP_SSDP_DISCOVERY_CYCLE_INTERVAL)
     {
-        ssdp_discovery_attempt = 0;
-        __sync_synchronize();
-        ssdp_timer = timer;
         return;
     }
+    ssdp_discovery_req = FALSE;
+
+    ssdp_discovery_attempt = 0;
+    ssdp_discover_timer = util_timer_set_periodic(0,
+                                          FP_SSDP_DISCOVERY_PERIOD * 1000,
+                                          "ssdp_discover", ssdp_discover,
+                                          NULL, FALSE);
+    if(ssdp_discover_timer == 0) {
+        log("%s: unable to set SSDP discover timer\n", __func__);
+    }
 
     return;
 }
 
 // The "do_ssdp_discovery" command processor. It executes
-// concurrently with the SSDP timer driven routines and
-// has to make sure there is only one SSDP timer/discovery
-// set or being processed at any time.
+// concurrently with the SSDP timer driven routines, so it only
+// sets the request flag and fires the cycle handler right away
+// to start the discovery in the reactor thread.
 void cmd_ssdp_discovery(void)
 {
     log("%s: processing SSDP discovery command\n", __func__);
 
-    // First get the current timer handle and try to cancel it
-    TIMER_HANDLE_t timer = ssdp_timer;
-
-    // If timer is not set while the ssdp_discovery_attempt has a valid
-    // non-negative value then we are already doing discovery and ignore
-    // the command.
-    if(!timer && ssdp_discovery_attempt >= 0) {
-        log("%s: SSDP discovery is already in progress\n", __func__);
-        return;
-    }
-
-    // Try to cancel the timer, if not successful then the timer has
-    // just fired triggering the new discovery and is not yet zeroed
-    // (unlikely)
-    if(timer != 0 && util_timer_cancel(timer) != 0) {
-        log("%s: unable to cancel timer 0x%x, discovery must be in progress\n",
-            __func__, timer);
-        return;
-    }
-
-    // The old timer is cancelled successfully (or not set) and we schedule
-    // new SSDP discovery to start immediately
-    ssdp_timer = 0;
-    ssdp_discovery_attempt = 0;
-    timer = util_timer_set(0, "ssdp_discover", ssdp_discover,
-                           NULL, FALSE);
-    if(timer == 0) {
+    ssdp_discovery_req = TRUE;
+    __sync_synchronize();
+    if(util_timer_set(0, "ssdp_cycle", ssdp_cycle, NULL, FALSE) == 0) {
         log("%s: failed to set SSDP discovery timer\n", __func__);
-        // Set discovery attempts to a negative value to have some indication
-        // that there is no longer SSDP timer scheduled or being processed.
-        ssdp_discovery_attempt = -1;
         return;
     }
 
-    // The discovery has been scheduled and it will take care of setting
-    // ssdp_timer global.
     log("%s: SSDP discovery successfully scheduled\n", __func__);
     return;
 }
@@ -418,6 +414,8 @@ void cmd_ssdp_discovery(void)
 // Returns: 0 - if successful
 int fp_ssdp_init(void)
 {
+    int ii;
+
 #if !defined(FEATURE_LAN_ONLY) && !defined(FEATURE_GUEST_NAT)
     // We do not do SSDP discovery in the AP operation mode (i.e. gateway
     // firmware in the AP mode), but do it in the standalone AP firmware
@@ -430,20 +428,26 @@ int fp_ssdp_init(void)
     // The memory for each element is allocated when required
     // and stores the pointer in the array. Once allocated the
     // entries are never freed (reused when needed).
-    ssdp_tbl = calloc(FP_MAX_DEV, sizeof(FP_SSDP_t *));
-    if(!ssdp_tbl) {
-        log("%s: failed to allocate memory for data tables\n", __func__);
-        return -1;
+    // There are two tables, for the current and the previous telemetry epoch.
+    for(ii = 0; ii < 2; ii++) {
+        ssdp_tbl = calloc(FP_MAX_DEV, sizeof(FP_SSDP_t *));
+        if(!ssdp_tbl) {
+            log("%s: failed to allocate memory for data tables\n", __func__);
+            return -1;
+        }
+        fp_ssdp_epoch_swap();
     }
 
     // Reset stats (more for consistency since they are in BSS
     // segment anyway)
     memset(&ssdp_tbl_stats, 0, sizeof(ssdp_tbl_stats));
 
-    // Schedule SSDP discovery start
-    ssdp_timer = util_timer_set(FP_SSDP_DISCOVERY_INIT_DELAY * 1000,
-                                "ssdp_discover", ssdp_discover,
-                                NULL, FALSE);
+    // Schedule SSDP discovery cycles (the first one is started after
+    // the initial delay, provided the agent is activated by then)
+    ssdp_timer = util_timer_set_periodic(FP_SSDP_DISCOVERY_INIT_DELAY * 1000,
+                                         FP_SSDP_DISCOVERY_INIT_DELAY * 1000,
+                                         "ssdp_cycle", ssdp_cycle,
+                                         NULL, FALSE);
     if(ssdp_timer == 0) {
         return -1;
     }
@@ -4,9 +4,9 @@
 #ifndef _FINGERPRINT_SSDP_H
 #define _FINGERPRINT_SSDP_H
 
-// Timeout (in sec) for scheduling the inital scan at startup
-// (it is scheduled at init, but if the agent is not yet
-// activated rescheduled w/ the same delay again)
+// Timeout (in sec) for scheduling the inital scan at startup, it is
+// also the period of checking if it is time to start the next cycle
+// (or the agent is activated if it was not ready for the first one)
 #define FP_SSDP_DISCOVERY_INIT_DELAY (3 * 60)
 
 // How many seconds to give the devices to respond to our
@@ -21,14 +21,14 @@
 #define FP_SSDP_DISCOVERY_CYCLE_INTERVAL (24 * 60 * 60)
 
 
-// Returns pointer to the SSDP info table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch SSDP info table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the returned data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 FP_TABLE_STATS_t *fp_ssdp_tbl_stats(int reset);
 
-// Get the pointer to the SSDP info table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch SSDP info table
+// The table should only be accessed from the sender thread
 FP_SSDP_t **fp_get_ssdp_tbl(void);
 
 // The "do_ssdp_discovery" command processor. It executes
@@ -38,9 +38,12 @@ FP_SSDP_t **fp_get_ssdp_tbl(void);
 // Note: declared weak so platforms not doing it do not have to stub
 void __attribute__((weak)) cmd_ssdp_discovery(void);
 
-// Reset all SSDP tables (including the table usage stats)
+// Reset the previous epoch SSDP tables (including the table usage stats)
 void fp_reset_ssdp_tables(void);
 
+// Swap the current and the previous epoch SSDP tables
+void fp_ssdp_epoch_swap(void);
+
 // Init SSDP fingerprinting
 // Returns: 0 - if successful
 int fp_ssdp_init(void);
@@ -42,28 +42,36 @@ static FP_USERAGENT_t *useragent_tbl;
 // Structures tracking UserAgent info table stats
 static FP_TABLE_STATS_t useragent_tbl_stats;
 
-// Returns pointer to the UserAgent info table stats.
-// Use from the tpcap callbacks only.
+// The previous telemetry epoch UserAgent info table and its stats (swapped
+// w/ the current epoch ones above by fp_useragent_epoch_swap(), accessed by
+// the devices telemetry sender only)
+static struct {
+    FP_USERAGENT_t *useragent_tbl;
+    FP_TABLE_STATS_t useragent_tbl_stats;
+} prev;
+
+// Returns pointer to the previous epoch UserAgent info table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the returned data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 FP_TABLE_STATS_t *fp_useragent_tbl_stats(int reset)
 {
     static FP_TABLE_STATS_t tbl_stats;
-    memcpy(&tbl_stats, &useragent_tbl_stats, sizeof(tbl_stats));
+    memcpy(&tbl_stats, &prev.useragent_tbl_stats, sizeof(tbl_stats));
     if(reset) {
-        memset(&useragent_tbl_stats, 0, sizeof(useragent_tbl_stats));
+        memset(&prev.useragent_tbl_stats, 0, sizeof(prev.useragent_tbl_stats));
     }
     return &tbl_stats;
 }
 
-// Get the pointer to the UserAgent info table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch UserAgent info table
+// The table should only be accessed from the sender thread
 FP_USERAGENT_t *fp_get_useragent_tbl(void)
 {
-    return useragent_tbl;
+    return prev.useragent_tbl;
 }
 
-// Reset all UserAgent tables (including the table usage stats)
+// Reset the previous epoch UserAgent tables (including the table usage stats)
 // Has to work (not crash) even if the subsystem is not initialized
 // (otherwise it will break devices telemetry tests)
 void fp_reset_useragent_tables(void)
@@ -71,13 +79,13 @@ void fp_reset_useragent_tables(void)
     int ii;
 
     // If we are not initialized, nothing to do
-    if(!useragent_tbl) {
+    if(!prev.useragent_tbl) {
         return;
     }
 
     // Reset useragent table (keeping already allocated items memory)
     for(ii = 0; ii < FP_MAX_DEV; ii++) {
-        useragent_tbl[ii].busy = FALSE;
+        prev.useragent_tbl[ii].busy = FALSE;
     }
     // Reset stats
     fp_useragent_tbl_stats(TRUE);
@@ -85,6 +93,14 @@ void fp_reset_useragent_tables(void)
     return;
 }
 
+// Swap the current epoch UserAgent tables w/ the previous epoch ones (should
+// already be reset). Called by the tpcap thread.
+void fp_useragent_epoch_swap(void)
+{
+    UTIL_SWAP(useragent_tbl, prev.useragent_tbl);
+    UTIL_SWAP(useragent_tbl_stats, prev.useragent_tbl_stats);
+}
+
 // Add MAC to UserAgent info table
 // Returns a pointer to the UserAgent info table record that
 // can be used for the MAC UserAgent info or NULL
@@ -131,13 +147,217 @@ FP_USERAGENT_t *add_useragent(unsigned char *mac)
     return ret;
 }
 
-#define HTTP_FIELD_SEPARATOR "\r\n"
-#define HTTP_END             "\r\n\r\n"
-#define HTTP_STRING "HTTP"
-#define USER_AGENT_STRING "User-Agent: "
-#define NON_ASCII_REPLACEMENT_CHAR ' '
+#define HTTP_STRING "HTTP/"
+#define USER_AGENT_NAME "user-agent:"
 #define MIN_HTTP_SIZE 16
 
+// Max number of HTTP flows the request headers split across TCP segments
+// are tracked for (the flows are mapped to the entries by hash, an entry
+// is taken over if another flow needs it)
+#define FP_USERAGENT_CONT_NUM 16
+// Max length of the incomplete header line kept till the next segment
+#define FP_USERAGENT_CONT_LEN (FP_MAX_USERAGENT_LEN + 32)
+// Max number of the segments to follow the request headers through
+#define FP_USERAGENT_CONT_SEGS 4
+// How long (in milliseconds) to wait for the next segment
+#define FP_USERAGENT_CONT_TMO 5000
+
+// Header scanning results
+#define UA_SCAN_MORE  0 // the headers continue beyond the data scanned
+#define UA_SCAN_FOUND 1 // found the UserAgent
+#define UA_SCAN_END   2 // reached the end of the headers, no UserAgent
+
+// The header scanner examines the payload 8 bytes at a time (SWAR).
+// UA_ZERO_BYTES() sets the high bit of every zero byte in the word
+// (w/o carries across the bytes, so there are no false positives),
+// UA_FIRST_BYTE() returns the memory offset of the first byte marked.
+#define UA_LOWS  0x7f7f7f7f7f7f7f7fULL
+#define UA_HIGHS 0x8080808080808080ULL
+#define UA_NLS   0x0a0a0a0a0a0a0a0aULL
+#define UA_CASE  0x2020202020202020ULL
+#define UA_ZERO_BYTES(_w) (~((((_w) & UA_LOWS) + UA_LOWS) | (_w) | UA_LOWS))
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#  define UA_FIRST_BYTE(_m) (__builtin_clzll(_m) >> 3)
+#else  // little endian
+#  define UA_FIRST_BYTE(_m) (__builtin_ctzll(_m) >> 3)
+#endif // little endian
+
+// Request headers continuation (for the headers split across segments)
+typedef struct {
+    uint32_t saddr;         // flow source IP
+    uint32_t daddr;         // flow destination IP
+    uint16_t sport;         // flow source port (net order)
+    uint16_t dport;         // flow destination port (net order)
+    uint32_t seq;           // expected seq # of the next segment
+    unsigned long long ts;  // time (in msec) it was saved, 0 - unused
+    int segs;               // number of the segments seen so far
+    int len;                // length of the incomplete line in data[]
+    char data[FP_USERAGENT_CONT_LEN]; // the incomplete line
+} FP_USERAGENT_CONT_t;
+
+// Request headers continuation table (tpcap thread only)
+static FP_USERAGENT_CONT_t useragent_cont[FP_USERAGENT_CONT_NUM];
+
+// Find the first '\n' in [p, end)
+// Returns: the pointer to it or NULL if not found
+static const char *ua_find_nl(const char *p, const char *end)
+{
+    uint64_t w, m;
+
+    for(; p + sizeof(w) <= end; p += sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        m = UA_ZERO_BYTES(w ^ UA_NLS);
+        if(m != 0) {
+            return p + UA_FIRST_BYTE(m);
+        }
+    }
+    for(; p < end; ++p) {
+        if(*p == '\n') {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+// Check that there are no non-ASCII characters in the string
+static int ua_is_ascii(const char *p, int len)
+{
+    uint64_t w, acc = 0;
+
+    for(; len >= sizeof(w); len -= sizeof(w), p += sizeof(w)) {
+        memcpy(&w, p, sizeof(w));
+        acc |= w;
+    }
+    for(; len > 0; --len, ++p) {
+        acc |= (unsigned char)*p;
+    }
+
+    return ((acc & UA_HIGHS) == 0);
+}
+
+// Check if the header line (w/o CRLF) is the UserAgent (the name is
+// not case sensitive)
+// Returns: TRUE and the value ptr and length if it is, FALSE otherwise
+static int ua_check_line(const char *line, int len,
+                         const char **ua, int *ua_len)
+{
+    uint64_t w, name;
+    int ii;
+
+    if(len < sizeof(USER_AGENT_NAME) - 1) {
+        return FALSE;
+    }
+    memcpy(&w, line, sizeof(w));
+    memcpy(&name, USER_AGENT_NAME, sizeof(name));
+    if((w | UA_CASE) != name || line[4] != '-' ||
+       (line[8] | 0x20) != 'n' || (line[9] | 0x20) != 't' || line[10] != ':')
+    {
+        return FALSE;
+    }
+    for(ii = sizeof(USER_AGENT_NAME) - 1;
+        ii < len && (line[ii] == ' ' || line[ii] == '\t'); ++ii);
+    *ua = line + ii;
+    *ua_len = len - ii;
+
+    return TRUE;
+}
+
+// Scan the HTTP request header lines in [p, end) for the UserAgent
+// in a single pass (p should point to the start of a header line).
+// Returns: UA_SCAN_* code, for UA_SCAN_FOUND the value ptr and length,
+//          for UA_SCAN_MORE the start of the incomplete last line in frag
+static int ua_scan(const char *p, const char *end,
+                   const char **ua, int *ua_len, const char **frag)
+{
+    const char *nl;
+    int len;
+
+    for(;;) {
+        nl = ua_find_nl(p, end);
+        len = (nl ? nl : end) - p;
+        if(len > 0 && p[len - 1] == '\r') {
+            --len;
+        }
+        if(nl && len == 0) {
+            return UA_SCAN_END;
+        }
+        // Do not wait for the rest of the line if already have enough
+        if(ua_check_line(p, len, ua, ua_len) &&
+           (nl || *ua_len >= FP_MAX_USERAGENT_LEN - 1))
+        {
+            return UA_SCAN_FOUND;
+        }
+        if(!nl) {
+            *frag = p;
+            return UA_SCAN_MORE;
+        }
+        p = nl + 1;
+    }
+}
+
+// Get the continuation table entry for the TCP flow
+static FP_USERAGENT_CONT_t *ua_cont_entry(struct iphdr *iph,
+                                          struct tcphdr *tcph)
+{
+    uint32_t key[3];
+
+    key[0] = iph->saddr;
+    key[1] = iph->daddr;
+    key[2] = ((uint32_t)tcph->source << 16) | tcph->dest;
+
+    return &useragent_cont[util_hash(key, sizeof(key)) %
+                           FP_USERAGENT_CONT_NUM];
+}
+
+// Find the request headers continuation the TCP segment is expected
+// to carry
+// Returns: the continuation entry ptr or NULL if none
+static FP_USERAGENT_CONT_t *ua_cont_find(struct iphdr *iph,
+                                         struct tcphdr *tcph)
+{
+    FP_USERAGENT_CONT_t *uc = ua_cont_entry(iph, tcph);
+
+    if(uc->ts == 0 || uc->saddr != iph->saddr || uc->daddr != iph->daddr ||
+       uc->sport != tcph->source || uc->dport != tcph->dest)
+    {
+        return NULL;
+    }
+    if(uc->seq != ntohl(tcph->seq) ||
+       util_time(1000) - uc->ts > FP_USERAGENT_CONT_TMO)
+    {
+        uc->ts = 0;
+        return NULL;
+    }
+
+    return uc;
+}
+
+// Save the incomplete header line to continue w/ the next segment
+static void ua_cont_save(FP_USERAGENT_CONT_t *uc,
+                         struct iphdr *iph, struct tcphdr *tcph,
+                         int seg_len, const char *frag, int len)
+{
+    int segs = uc ? uc->segs : 0;
+
+    if(segs + 1 >= FP_USERAGENT_CONT_SEGS) {
+        if(uc) {
+            uc->ts = 0;
+        }
+        return;
+    }
+    uc = ua_cont_entry(iph, tcph);
+    uc->saddr = iph->saddr;
+    uc->daddr = iph->daddr;
+    uc->sport = tcph->source;
+    uc->dport = tcph->dest;
+    uc->seq = ntohl(tcph->seq) + seg_len;
+    uc->ts = util_time(1000);
+    uc->segs = segs + 1;
+    uc->len = UTIL_MIN(len, sizeof(uc->data));
+    memmove(uc->data, frag, uc->len);
+}
+
 // UserAgent packets receive callback, called by tpcap thread for every
 // HTTP packet sent client -> server it captures.
 // Do not block or wait for anything here.
@@ -153,6 +373,12 @@ static void useragent_rcv_cb(TPCAP_IF_t *tpif,
     int header_total = thdr->tp_net - thdr->tp_mac + sizeof(struct iphdr) +
                        tcphdr->doff * 4;
     char *tcp = ((void *)iph) + sizeof(struct iphdr) + (tcphdr->doff * 4);
+    FP_USERAGENT_CONT_t *uc;
+    // Buffer for putting together the header line split across segments
+    char line[FP_USERAGENT_CONT_LEN + FP_MAX_USERAGENT_LEN];
+    const char *agent_string = NULL, *frag = NULL;
+    int agent_string_length = 0;
+    int ret;
 
     // ipv4 only until v6 support is added
     if (iph->version != 4) {
@@ -184,87 +410,106 @@ static void useragent_rcv_cb(TPCAP_IF_t *tpif,
     if(payload_size > (end_of_packet - tcp)) {
         payload_size = (end_of_packet - tcp);
     }
-
-    // If payload is less than a conservative min for an HTTP packet, return
-    if(payload_size < MIN_HTTP_SIZE) {
+    if(payload_size <= 0) {
         return;
     }
-
-    // If payload doesn't start w/ GET or POST, return
-    if(!(tcp[0] == 'G' && tcp[1] == 'E' && tcp[2] == 'T') &&
-       !(tcp[0] == 'P' && tcp[1] == 'O' && tcp[2] == 'S' && tcp[3] == 'T'))
-    {
-        return;
-    }
-
-    // Set Current Pointer to Start of Payload
-    char *curr = tcp;
-
-    // Find end of HTTP
-    char *end_of_http = memmem(curr, payload_size, HTTP_END, sizeof(HTTP_END) - 1);
-    if(end_of_http) {
-        payload_size = end_of_http - tcp + sizeof(HTTP_END) - 1;
-    }
-
-    // Find End of First Record -- If not found, return
-    char *end_of_record = memmem(curr, payload_size, HTTP_FIELD_SEPARATOR,
-                                 sizeof(HTTP_FIELD_SEPARATOR) - 1);
-    if(!end_of_record) {
-        DPRINTF("%s: Cannot find end of first field\n", __func__);
-        return;
-    }
-
-    // Look for HTTP in First Record -- If not found, return
-    char *http = memmem(curr, (int)(end_of_record - curr), HTTP_STRING,
-                        sizeof(HTTP_STRING) - 1);
-    if(!http) {
-        DPRINTF("%s: String 'HTTP' not found in first header field\n", __func__);
-        return;
+    end_of_packet = tcp + payload_size;
+
+    // Full segment payload size (the capture might be cut short)
+    int seg_len = ntohs(iph->tot_len) - sizeof(struct iphdr) -
+                  tcphdr->doff * 4;
+
+    uc = ua_cont_find(iph, tcphdr);
+    if(uc) {
+        // Finish the line the previous segment ended with
+        const char *nl = ua_find_nl(tcp, end_of_packet);
+        int len = (nl ? nl + 1 : end_of_packet) - tcp;
+        len = UTIL_MIN(len, sizeof(line) - uc->len);
+        memcpy(line, uc->data, uc->len);
+        memcpy(line + uc->len, tcp, len);
+        len += uc->len;
+        if(nl && line[len - 1] != '\n') {
+            // The line does not fit, cut it
+            line[len - 1] = '\n';
+        }
+        ret = ua_scan(line, line + len, &agent_string, &agent_string_length,
+                      &frag);
+        if(ret == UA_SCAN_MORE && nl) {
+            ret = ua_scan(nl + 1, end_of_packet,
+                          &agent_string, &agent_string_length, &frag);
+        }
+        else if(ret == UA_SCAN_MORE) {
+            end_of_packet = line + len;
+        }
     }
+    else
+    {
+        // If payload is less than a conservative min for an HTTP packet, return
+        if(payload_size < MIN_HTTP_SIZE) {
+            return;
+        }
 
-    // advance pointer to next record
-    curr = end_of_record + sizeof(HTTP_FIELD_SEPARATOR) - 1;
-    char *agent_string = NULL;
+        // If payload doesn't start w/ GET or POST, return
+        if(!(tcp[0] == 'G' && tcp[1] == 'E' && tcp[2] == 'T') &&
+           !(tcp[0] == 'P' && tcp[1] == 'O' && tcp[2] == 'S' && tcp[3] == 'T'))
+        {
+            return;
+        }
 
-    // Look Through Packet Until We Are At The End
-    while(curr < end_of_packet) {
-        end_of_record = memmem(curr, (int)(end_of_packet - curr),
-                               HTTP_FIELD_SEPARATOR,
-                               sizeof(HTTP_FIELD_SEPARATOR) - 1);
+        // Find End of First Record -- If not found, return
+        const char *end_of_record = ua_find_nl(tcp, end_of_packet);
         if(!end_of_record) {
-            DPRINTF("%s: record continues beyond end of capture\n", __func__);
+            DPRINTF("%s: Cannot find end of first field\n", __func__);
             return;
         }
 
-        agent_string = memmem(curr, (int)(end_of_record - curr),
-                              USER_AGENT_STRING,
-                              sizeof(USER_AGENT_STRING) - 1);
-        if(agent_string) {
-            agent_string += sizeof(USER_AGENT_STRING) - 1;
-            break;
+        // The request line should end w/ "HTTP/x.y"
+        int len = end_of_record - tcp;
+        if(len > 0 && tcp[len - 1] == '\r') {
+            --len;
+        }
+        if(len < sizeof(HTTP_STRING) + 3 ||
+           memcmp(tcp + len - sizeof(HTTP_STRING) - 2,
+                  HTTP_STRING, sizeof(HTTP_STRING) - 1) != 0)
+        {
+            DPRINTF("%s: String 'HTTP' not found in first header field\n",
+                    __func__);
+            return;
         }
-        curr = end_of_record + sizeof(HTTP_FIELD_SEPARATOR) - 1;
+
+        ret = ua_scan(end_of_record + 1, end_of_packet,
+                      &agent_string, &agent_string_length, &frag);
     }
 
-    if(!agent_string) {
+    if(ret == UA_SCAN_MORE) {
+        // Keep the incomplete line if the next segment can continue it
+        if(payload_size >= seg_len) {
+            ua_cont_save(uc, iph, tcphdr, seg_len,
+                         frag, end_of_packet - frag);
+        } else if(uc) {
+            uc->ts = 0;
+        }
+        DPRINTF("%s: record continues beyond end of capture\n", __func__);
+        return;
+    }
+    if(uc) {
+        uc->ts = 0;
+    }
+    if(ret != UA_SCAN_FOUND) {
         DPRINTF("%s: UserAgent field not found in HTTP header\n", __func__);
         return;
     }
 
     // Compute string length taking into account max length
-    int agent_string_length = end_of_record - agent_string;
     if(agent_string_length >= FP_MAX_USERAGENT_LEN) {
         agent_string_length = FP_MAX_USERAGENT_LEN - 1;
     }
 
     // Look any non ASCII characters and return if found
-    int jj;
-    for(jj=0; jj<agent_string_length; jj++) {
-        if((unsigned char)agent_string[jj] > 127) {
-            DPRINTF("%s: UserAgent field contains non-ASCII characters\n",
-                    __func__);
-            return;
-        }
+    if(!ua_is_ascii(agent_string, agent_string_length)) {
+        DPRINTF("%s: UserAgent field contains non-ASCII characters\n",
+                __func__);
+        return;
     }
 
     // Add/find the device by MAC address
@@ -277,9 +522,10 @@ static void useragent_rcv_cb(TPCAP_IF_t *tpif,
     }
 
     // Compute hash of UserAgent String
-    unsigned int hash = util_hash(agent_string, agent_string_length);
+    unsigned int hash = util_hash((void *)agent_string, agent_string_length);
 
     // Find a duplicate entry (by hash) if it exists
+    int jj;
     for(jj = 0; jj < fpu->index && jj < FP_MAX_USERAGENT_COUNT; jj++) {
         if(fpu->ua[jj] != NULL && fpu->ua[jj]->hash == hash) {
             return;
@@ -320,6 +566,7 @@ static void useragent_rcv_cb(TPCAP_IF_t *tpif,
 // Returns: 0 - if successful
 int fp_useragent_init(void)
 {
+    int ii;
     PKT_PROC_ENTRY_t *pe;
 
 #if !defined(FEATURE_LAN_ONLY) && !defined(FEATURE_GUEST_NAT)
@@ -329,10 +576,14 @@ int fp_useragent_init(void)
     }
 #endif // !FEATURE_LAN_ONLY && !FEATURE_GUEST_NAT
     // Allocate memory for the UserAgent info table (never freed).
-    useragent_tbl = UTIL_CALLOC(FP_MAX_DEV, sizeof(*useragent_tbl));
-    if(!useragent_tbl) {
-        log("%s: failed to allocate memory for data tables\n", __func__);
-        return -1;
+    // There are two tables, for the current and the previous telemetry epoch.
+    for(ii = 0; ii < 2; ii++) {
+        useragent_tbl = UTIL_CALLOC(FP_MAX_DEV, sizeof(*useragent_tbl));
+        if(!useragent_tbl) {
+            log("%s: failed to allocate memory for data tables\n", __func__);
+            return -1;
+        }
+        fp_useragent_epoch_swap();
     }
 
     // Get Address Information
@@ -363,3 +614,154 @@ int fp_useragent_init(void)
 
     return 0;
 }
+
+#ifdef DEBUG
+// Feed a synthetic HTTP request segment from the MAC to the UserAgent
+// collector (the MAC last byte is the test case #)
+static void test_ua_pkt(int tc, unsigned int seq, const char *data)
+{
+    static unsigned char buf[TPCAP_SNAP_LEN + 64];
+    struct tpacket2_hdr *thdr = (struct tpacket2_hdr *)buf;
+    struct ethhdr *ehdr;
+    struct iphdr *iph;
+    struct tcphdr *tcph;
+    int len = strlen(data);
+
+    memset(buf, 0, sizeof(buf));
+    thdr->tp_mac = TPACKET_ALIGN(sizeof(struct tpacket2_hdr));
+    thdr->tp_net = thdr->tp_mac + sizeof(struct ethhdr);
+    ehdr = (struct ethhdr *)(buf + thdr->tp_mac);
+    iph = (struct iphdr *)(buf + thdr->tp_net);
+    tcph = (struct tcphdr *)((void *)iph + sizeof(struct iphdr));
+    ehdr->h_source[5] = tc;
+    ehdr->h_proto = htons(ETH_P_IP);
+    iph->version = 4;
+    iph->ihl = sizeof(struct iphdr) / 4;
+    iph->tot_len = htons(sizeof(struct iphdr) + sizeof(struct tcphdr) + len);
+    iph->protocol = IPPROTO_TCP;
+    iph->saddr = htonl(0x0a000000 + tc);
+    iph->daddr = htonl(0x0a000001);
+    tcph->source = htons(40000 + tc);
+    tcph->dest = htons(80);
+    tcph->seq = htonl(seq);
+    tcph->doff = sizeof(struct tcphdr) / 4;
+    thdr->tp_len = sizeof(struct ethhdr) + ntohs(iph->tot_len);
+    thdr->tp_snaplen = UTIL_MIN(thdr->tp_len,
+                                sizeof(buf) - thdr->tp_mac);
+    memcpy((void *)tcph + sizeof(struct tcphdr), data,
+           thdr->tp_snaplen - (thdr->tp_len - len));
+
+    useragent_rcv_cb(NULL, &fp_useragent_pkt_proc, thdr, iph, NULL);
+}
+
+// Get the first UserAgent collected for the test case
+static char *test_ua_get(int tc)
+{
+    unsigned char mac[6] = { 0, 0, 0, 0, 0, tc };
+    int ii;
+
+    for(ii = 0; ii < FP_MAX_DEV; ii++) {
+        FP_USERAGENT_t *fpu = &useragent_tbl[ii];
+        if(fpu->busy && memcmp(fpu->mac, mac, 6) == 0 && fpu->index > 0) {
+            return fpu->ua[0]->data;
+        }
+    }
+    return NULL;
+}
+
+// Test UserAgent header scanner
+int test_fp_useragent(void)
+{
+    int ii, failed = 0;
+    unsigned long long t;
+    char big[2048];
+    struct {
+        const char *seg[3];   // the segments (NULL terminated)
+        int seq_gap;          // make a gap in the sequence before seg[1]
+        const char *expect;   // expected UserAgent (NULL if none)
+    } tests[] = {
+        { { "GET / HTTP/1.1\r\nHost: a\r\nUser-Agent: Test/1.0\r\n\r\n" },
+          0, "Test/1.0" },
+        { { "POST /x HTTP/1.0\r\nuser-agent:curl/7.84\r\nAccept: */*\r\n\r\n" },
+          0, "curl/7.84" },
+        { { "GET / HTTP/1.1\r\nHost: a\r\n\r\nUser-Agent: Late/1.0\r\n" },
+          0, NULL },
+        { { "GET / HTTP/1.1\r\nHost: a\r\nUser-Ag",
+            "ent: Split/2.0 (X11)\r\n\r\n" },
+          0, "Split/2.0 (X11)" },
+        { { "GET / HTTP/1.1\r\nHost: a\r\n",
+            "Accept: */*\r\nUser-Agent: Next/3.0",
+            "\r\n\r\n" },
+          0, "Next/3.0" },
+        { { "GET / HTTP/1.1\r\nHost: a\r\nUser-Ag",
+            "ent: Gap/1.0\r\n\r\n" },
+          1, NULL },
+        { { "GET / HTTP/1.1\r\nUser-Agent: Bad\xc3\xa9\r\n\r\n" },
+          0, NULL },
+        { { "GET / FTP/1.1\r\nUser-Agent: NoHttp/1.0\r\n\r\n" },
+          0, NULL },
+    };
+
+    // The collector adds to the current epoch table, reset it (and
+    // the previous epoch one) the same way the telemetry sender does
+    for(ii = 0; ii < 2; ii++) {
+        if(!useragent_tbl) {
+            useragent_tbl = UTIL_CALLOC(FP_MAX_DEV, sizeof(*useragent_tbl));
+            if(!useragent_tbl) {
+                printf("Failed to allocate the UserAgent table\n");
+                return -1;
+            }
+        }
+        fp_useragent_epoch_swap();
+        fp_reset_useragent_tables();
+    }
+    memset(useragent_cont, 0, sizeof(useragent_cont));
+
+    for(ii = 0; ii < UTIL_ARRAY_SIZE(tests); ii++) {
+        unsigned int seq = 1000;
+        int jj;
+        for(jj = 0; jj < 3 && tests[ii].seg[jj]; jj++) {
+            if(jj == 1) {
+                seq += tests[ii].seq_gap;
+            }
+            test_ua_pkt(ii + 1, seq, tests[ii].seg[jj]);
+            seq += strlen(tests[ii].seg[jj]);
+        }
+        char *ua = test_ua_get(ii + 1);
+        int ok = (tests[ii].expect == NULL) ? (ua == NULL) :
+                 (ua != NULL && strcmp(ua, tests[ii].expect) == 0);
+        printf("Case %d: got <%s> expected <%s>: %s\n", ii + 1,
+               ua ? ua : "NULL",
+               tests[ii].expect ? tests[ii].expect : "NULL",
+               ok ? "ok" : "FAILED");
+        if(!ok) {
+            ++failed;
+        }
+    }
+
+    // Time the scan of a typical browser request (the UserAgent is
+    // already in the table, so it measures the header scanning only)
+    snprintf(big, sizeof(big), "GET /index.html HTTP/1.1\r\n"
+             "Host: www.example.com\r\n"
+             "Accept: text/html,application/xhtml+xml,application/xml;"
+             "q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+             "Accept-Language: en-US,en;q=0.5\r\n"
+             "Accept-Encoding: gzip, deflate\r\n"
+             "Connection: keep-alive\r\n"
+             "Cookie: session=0123456789abcdef0123456789abcdef; "
+             "prefs=compact; theme=dark\r\n"
+             "Upgrade-Insecure-Requests: 1\r\n"
+             "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:102.0) "
+             "Gecko/20100101 Firefox/102.0\r\n\r\n");
+    t = util_time(1000000);
+    for(ii = 0; ii < 100000; ii++) {
+        test_ua_pkt(100, 1000, big);
+    }
+    t = util_time(1000000) - t;
+    printf("Scanned %d byte request 100000 times, %llu ns/pkt\n",
+           (int)strlen(big), t / 100);
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+    return failed ? -1 : 0;
+}
+#endif // DEBUG
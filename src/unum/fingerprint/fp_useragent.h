@@ -4,21 +4,29 @@
 #ifndef _FINGERPRINT_USERAGENT_H
 #define _FINGERPRINT_USERAGENT_H
 
-// Returns pointer to the UserAgent info table stats.
-// Use from the tpcap callbacks only.
+// Returns pointer to the previous epoch UserAgent info table stats.
+// Use from the devices telemetry sender only.
 // Subsequent calls override the returned data.
 // Pass TRUE to reset the table (allows to get data and reset in one call)
 FP_TABLE_STATS_t *fp_useragent_tbl_stats(int reset);
 
-// Get the pointer to the UserAgent info table
-// The table should only be accessed from the tpcap thread
+// Get the pointer to the previous epoch UserAgent info table
+// The table should only be accessed from the sender thread
 FP_USERAGENT_t *fp_get_useragent_tbl(void);
 
-// Reset all UserAgent tables (including the table usage stats)
+// Reset the previous epoch UserAgent tables (including the table usage stats)
 void fp_reset_useragent_tables(void);
 
+// Swap the current and the previous epoch UserAgent tables
+void fp_useragent_epoch_swap(void);
+
 // Init UserAgent fingerprinting
 // Returns: 0 - if successful
 int fp_useragent_init(void);
 
+#ifdef DEBUG
+// Test UserAgent header scanner
+int test_fp_useragent(void);
+#endif // DEBUG
+
 #endif // _FINGERPRINT_USERAGENT_H
@@ -20,6 +20,228 @@
 // upgrade check period (in seconds).
 #define FORCE_FW_UPDATE_CHECK_PERIOD 10
 
+// SHA-256 digest length (in bytes)
+#define FW_SHA256_LEN 32
+
+#ifdef USE_OPEN_SSL
+typedef SHA256_CTX FW_SHA256_CTX_t;
+static void fw_sha256_start(FW_SHA256_CTX_t *ctx)
+{
+    SHA256_Init(ctx);
+}
+static void fw_sha256_update(FW_SHA256_CTX_t *ctx, char *data, int len)
+{
+    SHA256_Update(ctx, data, len);
+}
+static void fw_sha256_finish(FW_SHA256_CTX_t *ctx, unsigned char *result)
+{
+    SHA256_Final(result, ctx);
+}
+#else  // USE_OPEN_SSL
+typedef mbedtls_sha256_context FW_SHA256_CTX_t;
+static void fw_sha256_start(FW_SHA256_CTX_t *ctx)
+{
+    mbedtls_sha256_init(ctx);
+    mbedtls_sha256_starts_ret(ctx, 0);
+}
+static void fw_sha256_update(FW_SHA256_CTX_t *ctx, char *data, int len)
+{
+    mbedtls_sha256_update_ret(ctx, (unsigned char *)data, len);
+}
+static void fw_sha256_finish(FW_SHA256_CTX_t *ctx, unsigned char *result)
+{
+    mbedtls_sha256_finish_ret(ctx, result);
+    mbedtls_sha256_free(ctx);
+}
+#endif // USE_OPEN_SSL
+
+// Firmware image download stream state
+typedef struct {
+    FW_SHA256_CTX_t sha;    // SHA-256 of the image data received so far
+    unsigned long long len; // number of the image bytes received
+    FILE *f;                // the image file
+    char *buf;              // buffer the image data passes through
+    int buf_len;            // number of bytes in the buffer
+    int err;                // TRUE if failed to write the data to f
+} FW_STREAM_t;
+
+#ifdef DEBUG
+// Simulate the connection drop once the download reaches the offset
+// (for testing the resume, 0 - disabled)
+static unsigned long long fw_stream_fail_at = 0;
+#endif // DEBUG
+
+// Write the buffered image data to the file
+// Returns: 0 - if successful, negative if fails
+static int fw_stream_flush(FW_STREAM_t *st)
+{
+    if(st->buf_len > 0 && fwrite(st->buf, 1, st->buf_len, st->f) != st->buf_len)
+    {
+        log("%s: failed to write %d bytes at offset %llu, %s\n", __func__,
+            st->buf_len, st->len - st->buf_len, strerror(errno));
+        st->err = TRUE;
+        return -1;
+    }
+    st->buf_len = 0;
+
+    return 0;
+}
+
+// Stream callback for the firmware image download. The data is hashed
+// as it arrives and written to the file through the bounded buffer (it
+// is flushed when the next chunk needs the space).
+// Returns: 0 to continue, negative to abort the request
+static int fw_stream_data(char *data, int len, void *cookie)
+{
+    FW_STREAM_t *st = (FW_STREAM_t *)cookie;
+    int cnt, drop = FALSE;
+
+#ifdef DEBUG
+    if(fw_stream_fail_at > 0 && st->len + len >= fw_stream_fail_at) {
+        len = fw_stream_fail_at - st->len;
+        fw_stream_fail_at = 0;
+        drop = TRUE;
+    }
+#endif // DEBUG
+
+    fw_sha256_update(&(st->sha), data, len);
+    st->len += len;
+
+    while(len > 0) {
+        if(st->buf_len >= FW_STREAM_BUF_SIZE && fw_stream_flush(st) != 0) {
+            return -1;
+        }
+        cnt = UTIL_MIN(len, FW_STREAM_BUF_SIZE - st->buf_len);
+        memcpy(st->buf + st->buf_len, data, cnt);
+        st->buf_len += cnt;
+        data += cnt;
+        len -= cnt;
+    }
+
+    return drop ? -1 : 0;
+}
+
+// Start the image over (when the download can not be resumed)
+// Returns: 0 - if successful, negative if fails
+static int fw_stream_restart(FW_STREAM_t *st)
+{
+    unsigned char result[FW_SHA256_LEN];
+
+    if(fflush(st->f) != 0 || ftruncate(fileno(st->f), 0) != 0) {
+        log("%s: failed to truncate the image file, %s\n",
+            __func__, strerror(errno));
+        return -1;
+    }
+    rewind(st->f);
+    fw_sha256_finish(&(st->sha), result);
+    fw_sha256_start(&(st->sha));
+    st->len = 0;
+    st->buf_len = 0;
+
+    return 0;
+}
+
+// Download the firmware image resuming (w/ HTTP Range) after the failures
+// and verify its SHA-256 as it arrives.
+// url - the image URL
+// sha256 - expected SHA-256 of the image (hex string), NULL if not known
+// file - file to save the image to (removed if the download fails)
+// Returns: 0 - if the image is downloaded (and verified if the hash is
+//          known), negative if fails
+static int fw_stream(char *url, char *sha256, char *file)
+{
+    unsigned char result[FW_SHA256_LEN];
+    char hex[FW_SHA256_LEN * 2 + 1];
+    unsigned long long prev_len;
+    FW_STREAM_t st;
+    HTTP_STREAM_t hs;
+    http_rsp *rsp;
+    int ii, code, rsp_ok, tries, ret = -1;
+
+    memset(&st, 0, sizeof(st));
+    st.buf = UTIL_MALLOC(FW_STREAM_BUF_SIZE);
+    if(!st.buf) {
+        log("%s: failed to allocate %d bytes\n", __func__, FW_STREAM_BUF_SIZE);
+        return -1;
+    }
+    st.f = fopen(file, "wb");
+    if(!st.f) {
+        log("%s: failed to open <%s>, %s\n", __func__, file, strerror(errno));
+        UTIL_FREE(st.buf);
+        return -2;
+    }
+    fw_sha256_start(&(st.sha));
+
+    memset(&hs, 0, sizeof(hs));
+    hs.f = fw_stream_data;
+    hs.cookie = &st;
+    hs.timeout = REQ_FILE_TIMEOUT;
+    hs.idle_timeout = FW_STREAM_IDLE_TIMEOUT;
+
+    for(tries = 0; tries < FW_STREAM_TRIES;)
+    {
+        prev_len = st.len;
+        hs.offset = st.len;
+        rsp = http_get_stream(url, NULL, &hs);
+        rsp_ok = (rsp != NULL);
+        code = rsp ? rsp->code : 0;
+        if(rsp) {
+            free_rsp(rsp);
+            rsp = NULL;
+        }
+        if(st.err) {
+            break;
+        }
+        // No code w/ the response means it is not HTTP (file:// URL)
+        if((code / 100) == 2 || (rsp_ok && code == 0)) {
+            ret = 0;
+            break;
+        }
+        log("%s: download stopped at %llu bytes, code %d\n",
+            __func__, st.len, code);
+        if(st.len > prev_len) {
+            // Made progress, resume right away
+            tries = 0;
+            continue;
+        }
+        ++tries;
+        // Give up on resuming if it keeps failing w/o getting any data
+        // (the server might not support the byte ranges)
+        if(st.len > 0 && tries >= FW_STREAM_RESUME_TRIES) {
+            log("%s: cannot resume, starting over\n", __func__);
+            if(fw_stream_restart(&st) != 0) {
+                break;
+            }
+        }
+        sleep(FW_STREAM_RETRY_DELAY);
+    }
+
+    fw_sha256_finish(&(st.sha), result);
+    for(ii = 0; ii < FW_SHA256_LEN; ii++) {
+        snprintf(hex + ii * 2, 3, "%02x", result[ii]);
+    }
+    if(ret == 0) {
+        log("%s: downloaded %llu bytes, SHA-256 %s\n", __func__, st.len, hex);
+    }
+    if(ret == 0 && sha256 != NULL && strcasecmp(sha256, hex) != 0) {
+        log("%s: SHA-256 mismatch, expected %s\n", __func__, sha256);
+        ret = -3;
+    }
+    if(ret == 0 && fw_stream_flush(&st) != 0) {
+        ret = -4;
+    }
+    if(fclose(st.f) != 0 && ret == 0) {
+        log("%s: failed to close <%s>, %s\n", __func__, file, strerror(errno));
+        ret = -5;
+    }
+    if(ret != 0) {
+        unlink(file);
+    }
+    UTIL_FREE(st.buf);
+
+    return ret;
+}
+
 // Called from command processor thread
 // Set the "Force Firmware Upgrade" flag 
 void cmd_force_fw_update(void)
@@ -172,6 +394,7 @@ static void fw_update(void)
         {
             char *download_url;
             char *new_fw_ver;
+            char *sha256 = NULL;
             int err;
 
             log("%s: Attempting%s upgrade now\n",
@@ -210,6 +433,7 @@ static void fw_update(void)
 
             // The firmware info is 2 lines, the first is the version
             // prefixed with the letter 'v', the second is the download URL.
+            // The optional third line is the SHA-256 of the image.
             sptr = strchr(rsp->data, '\n');
             if(!sptr) {
                 log("%s: firmware info is not split into lines\n", __func__);
@@ -239,7 +463,15 @@ static void fw_update(void)
             // chop the newline at the end ot the URL (if present)
             sptr = strchr(download_url, '\n');
             if(sptr) {
-                *sptr = 0;
+                *sptr++ = 0;
+                sha256 = sptr;
+                sptr = strchr(sha256, '\n');
+                if(sptr) {
+                    *sptr = 0;
+                }
+                if(strlen(sha256) != FW_SHA256_LEN * 2) {
+                    sha256 = NULL;
+                }
             }
             // Compare the current and the new firmware versions
             if(strcmp(new_fw_ver, cur_fw_ver) == 0) {
@@ -248,9 +480,11 @@ static void fw_update(void)
             }
 
             // Download the new firmware
-            log("%s: downloading new firmware %s from <%s>\n",
-                __func__, new_fw_ver, download_url);
-            if(http_get_file(download_url, NULL, UPGRADE_FILE_NAME) != 0) {
+            log("%s: downloading new firmware %s from <%s>, SHA-256 %s\n",
+                __func__, new_fw_ver, download_url,
+                (sha256 ? sha256 : "unknown"));
+            err = fw_stream(download_url, sha256, UPGRADE_FILE_NAME);
+            if(err != 0) {
                 log("%s: failed to download the new firmware\n", __func__);
                 // If we do not have backup address for the firmware storage
                 // host and there is an ongoing DNS outage, restart to try
@@ -297,6 +531,119 @@ static void fw_update(void)
     log("%s: done\n", __func__);
 }
 
+#ifdef DEBUG
+// Firmware streaming test files
+#define FW_STREAM_TEST_IMAGE "/tmp/unum_fw_test.img"
+#define FW_STREAM_TEST_OUT   "/tmp/unum_fw_test.out"
+// Test image size (not a multiple of the buffer size)
+#define FW_STREAM_TEST_SIZE  (3 * FW_STREAM_BUF_SIZE + 1234)
+
+// Compare the test output w/ the image
+// Returns: TRUE if the output file matches the first len bytes of
+//          the image
+static int test_fw_stream_cmp(char *img, int len)
+{
+    struct stat st;
+    char *buf;
+    FILE *f;
+    int ret;
+
+    if(stat(FW_STREAM_TEST_OUT, &st) != 0 || st.st_size != len) {
+        return FALSE;
+    }
+    buf = UTIL_MALLOC(len + 1);
+    f = fopen(FW_STREAM_TEST_OUT, "rb");
+    ret = (buf != NULL && f != NULL &&
+           fread(buf, 1, len + 1, f) == len && memcmp(buf, img, len) == 0);
+    if(f) {
+        fclose(f);
+    }
+    if(buf) {
+        UTIL_FREE(buf);
+    }
+
+    return ret;
+}
+
+// Test the firmware image streaming w/ the local file standing in for
+// the download server (file:// URL): the resume after a connection drop
+// and the SHA-256 check.
+int test_fw_stream(void)
+{
+    FW_SHA256_CTX_t sha;
+    unsigned char result[FW_SHA256_LEN];
+    char good[FW_SHA256_LEN * 2 + 1];
+    char bad[FW_SHA256_LEN * 2 + 1];
+    char *url = "file://" FW_STREAM_TEST_IMAGE;
+    int ii, len = FW_STREAM_TEST_SIZE;
+    int failed = 0;
+    char *img;
+    FILE *f;
+
+    img = UTIL_MALLOC(len);
+    if(!img) {
+        printf("Failed to allocate %d bytes\n", len);
+        return -1;
+    }
+    for(ii = 0; ii < len; ii++) {
+        img[ii] = rand();
+    }
+    f = fopen(FW_STREAM_TEST_IMAGE, "wb");
+    if(!f || fwrite(img, 1, len, f) != len) {
+        printf("Failed to create %s\n", FW_STREAM_TEST_IMAGE);
+        if(f) {
+            fclose(f);
+        }
+        UTIL_FREE(img);
+        return -1;
+    }
+    fclose(f);
+    fw_sha256_start(&sha);
+    fw_sha256_update(&sha, img, len);
+    fw_sha256_finish(&sha, result);
+    for(ii = 0; ii < FW_SHA256_LEN; ii++) {
+        snprintf(good + ii * 2, 3, "%02x", result[ii]);
+    }
+    strcpy(bad, good);
+    bad[0] = (bad[0] == '0') ? '1' : '0';
+
+    printf("File, dropping the connection at %d\n", FW_STREAM_BUF_SIZE + 100);
+    fw_stream_fail_at = FW_STREAM_BUF_SIZE + 100;
+    if(fw_stream(url, good, FW_STREAM_TEST_OUT) != 0 ||
+       !test_fw_stream_cmp(img, len))
+    {
+        printf("Failed to resume the download\n");
+        ++failed;
+    }
+
+    printf("File, bad SHA-256\n");
+    if(fw_stream(url, bad, FW_STREAM_TEST_OUT) == 0 ||
+       access(FW_STREAM_TEST_OUT, F_OK) == 0)
+    {
+        printf("The bad image is not rejected\n");
+        ++failed;
+    }
+
+    printf("File, dropping the connection at %d\n", 2 * FW_STREAM_BUF_SIZE);
+    fw_stream_fail_at = 2 * FW_STREAM_BUF_SIZE;
+    if(fw_stream(url, good, FW_STREAM_TEST_OUT) != 0 ||
+       !test_fw_stream_cmp(img, len))
+    {
+        printf("Failed to resume the download at the buffer boundary\n");
+        ++failed;
+    }
+
+    fw_stream_fail_at = 0;
+    unlink(FW_STREAM_TEST_IMAGE);
+    unlink(FW_STREAM_TEST_OUT);
+    UTIL_FREE(img);
+
+    printf("%s\n", (failed == 0) ? "PASSED" : "FAILED");
+
+    return (failed == 0) ? 0 : -1;
+}
+#endif // DEBUG
+
 // Firmware update process main function
 int fw_update_main(void)
 {
@@ -21,9 +21,31 @@
 // util_restart()), in sec.
 #define UPDATER_OFFLINE_RESTART 600
 
+// Size of the buffer the firmware image passes through on the way to
+// the file
+#define FW_STREAM_BUF_SIZE (64 * 1024)
+
+// Max firmware download attempts in a row that receive no data, the
+// attempts making progress resume (w/ HTTP Range) right away
+#define FW_STREAM_TRIES 6
+
+// Number of such attempts after which the download starts over (the
+// server might not support the byte ranges)
+#define FW_STREAM_RESUME_TRIES 3
+
+// Delay between the firmware download attempts receiving no data and
+// the no data timeout for the download (in sec)
+#define FW_STREAM_RETRY_DELAY 10
+#define FW_STREAM_IDLE_TIMEOUT 60
+
 // Firmware updater main entry point
 int fw_update_main(void);
 void cmd_force_fw_update(void);
 
+#ifdef DEBUG
+// Test the firmware image streaming (local file instead of the server)
+int test_fw_stream(void);
+#endif // DEBUG
+
 #endif // _FW_UPDATER_COMMON_H
 
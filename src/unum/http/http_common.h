@@ -9,6 +9,14 @@
 // of its previous size.
 #define RSP_BUF_SIZE 1024
 
+// Headers of the JSON requests (the double 0 terminated multi-string)
+#define HTTP_JSON_HEADERS "Content-Type: application/json\0" \
+                          "Accept: application/json\0"
+
+// Pseudo response code http_post_spool() reports for the requests it has
+// spooled (outside of the HTTP codes range)
+#define HTTP_RSP_CODE_SPOOLED 1
+
 // Structure containing HTTP request reply for GET/POST requests
 typedef struct {
     int code;           // response code
@@ -60,6 +68,21 @@ static __inline__ void free_rsp(http_rsp *old_rsp)
     UTIL_FREE(old_rsp);
 }
 
+// Callback for the streamed response data (see http_get_stream()), it is
+// called w/ each chunk of the response body as it arrives.
+// Returns: 0 to continue, negative to abort the request
+typedef int (*HTTP_STREAM_FUNC_t)(char *data, int len, void *cookie);
+
+// Streamed request parameters (see http_get_stream())
+typedef struct {
+    HTTP_STREAM_FUNC_t f; // callback for the response data
+    void *cookie;         // callback cookie
+    long timeout;         // max time (in seconds) the request can take
+    long idle_timeout;    // abort if no data for so many seconds (0 - none)
+    unsigned long long offset; // resume from the offset (0 - from the start)
+    void *ch;             // request handle (used internally)
+} HTTP_STREAM_t;
+
 // Returns NULL-teminated array of strings w/ hardcoded DNS names mapping
 // http subsystem will use if DNS is not working. The entries are in
 // the HOST:PORT:ADDRESS[,ADDRESS]... format.
@@ -81,6 +104,31 @@ http_rsp *http_post_short_timeout(char *url, char *headers, char *data, int len)
 http_rsp *http_post_all(char *url, char *headers, char *data, int len);
 http_rsp *http_post_no_retry(char *url, char *headers, char *data, int len);
 
+#ifdef FEATURE_GZIP_REQUESTS
+// Perform POST request sending gzip compressed data (see util_zlib.h)
+// The headers are passed as double 0 terminated multi-string.
+// The compressor must be finished, it is not freed by the function.
+// Returns pointer to the http_rsp if sucessful, NULL if unable to perform
+// the request.
+// The caller must free the http_rsp when it is no longer needed.
+http_rsp *http_post_gz(char *url, char *headers, UTIL_GZ_t *gz);
+#endif // FEATURE_GZIP_REQUESTS
+
+// Perform telemetry JSON POST request, if the request fails (no response,
+// timeout, throttling or server error) it is added to the spool (see
+// util_spool.h) for the uploader to deliver later. If the spool already
+// has requests waiting the request is added to it w/o trying to send.
+// Returns pointer to the http_rsp if the request was sent, the http_rsp
+// w/ HTTP_RSP_CODE_SPOOLED code if it was spooled, NULL if it was lost or
+// the failed request response if it could not be spooled.
+// The caller must free the http_rsp when it is no longer needed.
+http_rsp *http_post_spool(char *url, char *data, int len);
+#ifdef FEATURE_GZIP_REQUESTS
+// The same as http_post_spool(), but sends gzip compressed data (see
+// util_zlib.h). The compressor must be finished, it is not freed.
+http_rsp *http_post_gz_spool(char *url, UTIL_GZ_t *gz);
+#endif // FEATURE_GZIP_REQUESTS
+
 // Perform PUT request
 // The headers are passed as double 0 terminated multi-string.
 // Returns pointer to the http_rsp if sucessful, NULL if unable to perform
@@ -101,18 +149,61 @@ http_rsp *http_get_all(char *url, char *headers);
 http_rsp *http_get_no_retry(char *url, char *headers);
 http_rsp *http_get_conn_time(char *url, char *headers);
 
-// Download file from a URL, without storing any data
-// this is used to test speeds. returns 0 if successful
-// error otherwise.
-// Pass 0 as timeout_in_sec to disable the timeout completely.
-int http_download_test(char *ifname, char *url,
-                       long timeout_in_sec, size_t *size);
-
-// Uploads random data to an endpoint to test the upload speed
-// returns 0 if successful, -1 otherwise.
-// Pass 0 as timeout_in_sec to disable the timeout completely.
-int http_upload_test(char *ifname, char *url,
-                     long timeout_in_sec, size_t *size);
+// Perform GET request passing the response body to the callback as it
+// arrives instead of collecting it (for the long-poll and the streaming
+// responses the server keeps open). Only the body of the 2xx responses
+// is passed to the callback. The request is tried only once and the
+// connection is kept open for the next one. If hs->offset is set the
+// request asks only for the data starting at that offset (it fails if
+// the server does not support the byte ranges).
+// The headers are passed as double 0 terminated multi-string.
+// Returns pointer to the http_rsp (w/ no data) if sucessful, NULL if
+// unable to perform the request or it was aborted by the callback.
+// The caller must free the http_rsp when it is no longer needed.
+http_rsp *http_get_stream(char *url, char *headers, HTTP_STREAM_t *hs);
+
+// Max number of the concurrent streams in the transfer test
+#define HTTP_XFER_MAX_STREAMS 10
+// Max number of the transfer test byte counter samples
+#define HTTP_XFER_MAX_SAMPLES 512
+
+// Size of the random (incompressible) payload buffer the upload streams
+// send from (repeated as many times as needed to reach the upload size)
+#define HTTP_XFER_PAYLOAD_SIZE (256 * 1024)
+// curl upload buffer size for the transfer test streams (bigger buffer
+// means fewer read function calls per request)
+#define HTTP_XFER_UPLOAD_BUF_SIZE (128 * 1024)
+
+// Transfer (speed) test parameters and results (see http_xfer_test())
+typedef struct {
+    // Parameters
+    char *url;            // URL to download from or upload to
+    char *ifname;         // interface to bind to (NULL - no binding)
+    int upload;           // TRUE - upload, FALSE - download
+    int streams;          // number of the concurrent streams
+    int max_requests;     // max requests per stream (0 - no limit)
+    size_t upload_size;   // size of the body of each upload request
+    unsigned int time_limit_ms; // test duration limit
+    unsigned int sample_ms;     // byte counters sampling interval
+    // Results
+    int error;            // TRUE if any of the requests has failed
+    int num_samples;      // number of the samples taken
+    unsigned int duration_ms; // how long the test took
+    // Time (in ms since the test start) each sample was taken at
+    unsigned int sample_t[HTTP_XFER_MAX_SAMPLES];
+    // Bytes transferred by each stream since the test start at the
+    // time of each sample
+    unsigned long long bytes[HTTP_XFER_MAX_SAMPLES][HTTP_XFER_MAX_STREAMS];
+} HTTP_XFER_TEST_t;
+
+// Run the transfer (speed) test. The streams concurrently download from
+// (or upload to) the URL repeating the request as soon as it completes
+// until the time limit. All the streams are driven from the calling thread,
+// the transferred bytes counters are sampled every sample_ms.
+// The requests cut short by the time limit are not considered failed.
+// Returns 0 if successful, negative if failed to set up the test or
+// any of the requests has failed
+int http_xfer_test(HTTP_XFER_TEST_t *xt);
 
 // Subsystem init function
 int http_init(int level);
@@ -164,18 +164,201 @@ static size_t write_func(char *ptr, size_t size, size_t nmemb, void *userdata)
     return len;
 }
 
-// CURL write function to determine the size of the
-// requested file, but does not store any of the data.
-static size_t speedtest_chunk(void *contents, size_t size, size_t nmemb, void *userp)
+// CURL write function for the streamed requests (passes the response
+// data to the HTTP_STREAM_t callback)
+static size_t stream_write_func(char *ptr, size_t size, size_t nmemb,
+                                void *userdata)
 {
-  size_t realsize = size * nmemb;
+    size_t len = size * nmemb;
+    HTTP_STREAM_t *hs = (HTTP_STREAM_t *)userdata;
+    long resp_code = 0;
+
+    // Discard the body of the error responses (the code is 0 for the
+    // non-HTTP URLs, i.e. file://)
+    curl_easy_getinfo(hs->ch, CURLINFO_RESPONSE_CODE, &resp_code);
+    if(resp_code != 0 && (resp_code / 100) != 2) {
+        return len;
+    }
+    if(hs->f(ptr, len, hs->cookie) < 0) {
+        return 0; // will cause curl to fail with write error
+    }
 
-  size_t *total_size = (size_t *)userp;
-  *total_size += realsize;
+    return len;
+}
 
-  return realsize;
+// Pool of the reusable curl handles for the API requests. Reusing a
+// handle lets curl keep the connection to the server open (HTTP keep-alive)
+// and send the next request to the same endpoint w/o the TCP and TLS
+// handshakes. The DNS cache and TLS sessions are shared between all the
+// handles through http_share, so even the new connections skip the DNS
+// lookup and resume the TLS session.
+// The pool keeps only idle handles, the request takes the handle out
+// and puts it back when done. The handles idle for more than
+// HTTP_POOL_IDLE_TIMEOUT are cleaned up (closing the connections).
+typedef struct {
+    CURL *ch;             // curl handle, NULL if the entry is free
+    unsigned long t_idle; // uptime (sec) when the handle was put to the pool
+    char ep[HTTP_POOL_MAX_EP_LEN]; // endpoint the handle is connected to
+} HTTP_POOL_ENTRY_t;
+
+static HTTP_POOL_ENTRY_t http_pool[HTTP_POOL_SIZE];
+static UTIL_MUTEX_t http_pool_m = UTIL_MUTEX_INITIALIZER;
+
+// curl share object and the mutexes for locking the shared data
+static CURLSH *http_share = NULL;
+static UTIL_MUTEX_t http_share_m[CURL_LOCK_DATA_LAST];
+
+// curl share lock/unlock callbacks
+static void share_lock(CURL *ch, curl_lock_data data,
+                       curl_lock_access access, void *userptr)
+{
+    UTIL_MUTEX_TAKE(&(http_share_m[data]));
+}
+static void share_unlock(CURL *ch, curl_lock_data data, void *userptr)
+{
+    UTIL_MUTEX_GIVE(&(http_share_m[data]));
+}
+
+// Get the endpoint (scheme://host[:port]) part of the URL
+// Returns: 0 - if successful, negative if the URL endpoint cannot be
+//          determined or too long
+static int http_pool_ep(char *url, char *ep, int ep_len)
+{
+    char *ptr, *end;
+    int len;
+
+    ptr = strstr(url, "://");
+    if(!ptr) {
+        return -1;
+    }
+    end = strchr(ptr + 3, '/');
+    len = end ? (end - url) : strlen(url);
+    if(len >= ep_len) {
+        return -2;
+    }
+    memcpy(ep, url, len);
+    ep[len] = 0;
+
+    return 0;
+}
+
+// Get curl handle for the request to the endpoint ep. It takes an idle
+// handle connected to the endpoint from the pool or creates a new one.
+// The idle handles past HTTP_POOL_IDLE_TIMEOUT are cleaned up.
+// Returns: curl handle or NULL if unable to create one
+static CURL *http_pool_get(char *ep)
+{
+    int ii, num_old = 0;
+    CURL *ch = NULL;
+    CURL *old[HTTP_POOL_SIZE];
+    unsigned long now = util_time(1);
+
+    UTIL_MUTEX_TAKE(&http_pool_m);
+    for(ii = 0; ii < HTTP_POOL_SIZE; ii++) {
+        HTTP_POOL_ENTRY_t *pe = &(http_pool[ii]);
+        if(!pe->ch) {
+            continue;
+        }
+        if(now - pe->t_idle > HTTP_POOL_IDLE_TIMEOUT) {
+            old[num_old++] = pe->ch;
+            pe->ch = NULL;
+        } else if(!ch && strcmp(pe->ep, ep) == 0) {
+            ch = pe->ch;
+            pe->ch = NULL;
+        }
+    }
+    UTIL_MUTEX_GIVE(&http_pool_m);
+
+    // Do not hold the mutex while closing the connections
+    for(ii = 0; ii < num_old; ii++) {
+        curl_easy_cleanup(old[ii]);
+    }
+
+    if(ch) {
+        return ch;
+    }
+    ch = curl_easy_init();
+    if(ch && http_share) {
+        curl_easy_setopt(ch, CURLOPT_SHARE, http_share);
+    }
+
+    return ch;
+}
+
+// Return the curl handle used for the request to the endpoint ep
+// to the pool (or clean it up if the pool is full).
+static void http_pool_put(char *ep, CURL *ch)
+{
+    int ii, free_idx = -1, ep_count = 0;
+
+    // Drop all the request options (they point to the request
+    // data that is about to go away), the connection, the DNS
+    // cache, TLS sessions and the share are kept.
+    curl_easy_reset(ch);
+
+    UTIL_MUTEX_TAKE(&http_pool_m);
+    for(ii = 0; ii < HTTP_POOL_SIZE; ii++) {
+        HTTP_POOL_ENTRY_t *pe = &(http_pool[ii]);
+        if(!pe->ch) {
+            if(free_idx < 0) {
+                free_idx = ii;
+            }
+        } else if(strcmp(pe->ep, ep) == 0) {
+            ++ep_count;
+        }
+    }
+    if(free_idx >= 0 && ep_count < HTTP_POOL_MAX_PER_EP) {
+        HTTP_POOL_ENTRY_t *pe = &(http_pool[free_idx]);
+        strcpy(pe->ep, ep);
+        pe->t_idle = util_time(1);
+        pe->ch = ch;
+        ch = NULL;
+    }
+    UTIL_MUTEX_GIVE(&http_pool_m);
+
+    if(ch) {
+        curl_easy_cleanup(ch);
+    }
+}
+
+// Clean up all the pooled handles
+static void http_pool_cleanup(void)
+{
+    int ii;
+
+    UTIL_MUTEX_TAKE(&http_pool_m);
+    for(ii = 0; ii < HTTP_POOL_SIZE; ii++) {
+        if(http_pool[ii].ch) {
+            curl_easy_cleanup(http_pool[ii].ch);
+            http_pool[ii].ch = NULL;
+        }
+    }
+    UTIL_MUTEX_GIVE(&http_pool_m);
+}
+
+#ifdef FEATURE_GZIP_REQUESTS
+// CURL read function (reads the compressed data from the UTIL_GZ_t
+// compressor passed by curl as the userdata param)
+static size_t gz_read_func(char *ptr, size_t size, size_t nmemb,
+                           void *userdata)
+{
+    return util_gz_read((UTIL_GZ_t *)userdata, ptr, size * nmemb);
 }
 
+// CURL seek function for the compressed data (curl uses it to rewind
+// the data if it has to resend it, e.g. when following a redirect)
+static int gz_seek_func(void *userdata, curl_off_t offset, int origin)
+{
+    if(origin != SEEK_SET || offset < 0) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    if(util_gz_seek((UTIL_GZ_t *)userdata, (unsigned long)offset) != 0) {
+        return CURL_SEEKFUNC_FAIL;
+    }
+    return CURL_SEEKFUNC_OK;
+}
+#endif //FEATURE_GZIP_REQUESTS
+
 // Perform HTTP POST or GET request.
 // This is the worker function used by http_post/http_get wrappers.
 // The headers are passed as double 0 terminated multi-string.
@@ -192,6 +375,8 @@ static size_t speedtest_chunk(void *contents, size_t size, size_t nmemb, void *u
 #define HTTP_REQ_FLAGS_GET_CONNTIME      0x00080000
 #define HTTP_REQ_FLAGS_COMPRESS          0x00100000
 #define HTTP_REQ_FLAGS_NO_SSL_VERIFYHOST 0x00200000
+#define HTTP_REQ_FLAGS_GZ_DATA           0x00400000 // data is UTIL_GZ_t*
+#define HTTP_REQ_FLAGS_STREAM            0x00800000 // data is HTTP_STREAM_t*
 static http_rsp *http_req(char *url, char *headers,
                           int type, char *data, int len)
 {
@@ -208,11 +393,27 @@ static http_rsp *http_req(char *url, char *headers,
     char err_buf[CURL_ERROR_SIZE] = "";
     // dptr points to the data sent to the server
     // When data is not compressed it points to data
-    // Otherwise it points to the compressed string after the message is
-    // compressed. dlen follows dptr.
+    // Otherwise it is NULL and curl reads the compressed data through
+    // the read function. dlen is the length of the data sent.
     int compressed = FALSE;
     char *dptr = data;
     int dlen = len;
+    // The requests measuring the connection time always use a new
+    // handle (and a new connection). So do the requests using the static
+    // DNS entries during the DNS outage, CURLOPT_RESOLVE adds them to
+    // the DNS cache the pooled handles share and they never expire there.
+    char ep[HTTP_POOL_MAX_EP_LEN];
+    int no_dns = conncheck_no_dns();
+    int pooled = (!no_dns && (type & HTTP_REQ_FLAGS_GET_CONNTIME) == 0 &&
+                  http_pool_ep(url, ep, sizeof(ep)) == 0);
+    HTTP_STREAM_t *hs = NULL;
+
+    if((type & HTTP_REQ_FLAGS_STREAM) != 0) {
+        // The caller passed the stream parameters, not the data
+        hs = (HTTP_STREAM_t *)data;
+        data = dptr = NULL;
+        len = dlen = 0;
+    }
 
     rsp = alloc_rsp(NULL, RSP_BUF_SIZE);
     if(!rsp) {
@@ -220,7 +421,7 @@ static http_rsp *http_req(char *url, char *headers,
         return NULL;
     }
 
-    ch = curl_easy_init();
+    ch = pooled ? http_pool_get(ep) : curl_easy_init();
     if(!ch) {
         free_rsp(rsp);
         log("%s: url <%s>, error curl_easy_init() has failed\n", __func__, url);
@@ -245,12 +446,30 @@ static http_rsp *http_req(char *url, char *headers,
     curl_easy_setopt(ch, CURLOPT_URL, url);
     curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
     curl_easy_setopt(ch, CURLOPT_FOLLOWLOCATION, 1);
-    curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, write_func);
 
     void *rsp_vp = (void *)&rsp;
-    curl_easy_setopt(ch, CURLOPT_WRITEDATA, rsp_vp);
+    if(hs != NULL) {
+        hs->ch = ch;
+        curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, stream_write_func);
+        curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *)hs);
+    } else {
+        curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, write_func);
+        curl_easy_setopt(ch, CURLOPT_WRITEDATA, rsp_vp);
+    }
     curl_easy_setopt(ch, CURLOPT_ERRORBUFFER, err_buf);
-    if((type & HTTP_REQ_FLAGS_SHORT_TIMEOUT) != 0) {
+    if(hs != NULL) {
+        curl_easy_setopt(ch, CURLOPT_TIMEOUT, hs->timeout);
+        curl_easy_setopt(ch, CURLOPT_CONNECTTIMEOUT, REQ_CONNECT_TIMEOUT);
+        if(hs->idle_timeout > 0) {
+            curl_easy_setopt(ch, CURLOPT_LOW_SPEED_TIME, hs->idle_timeout);
+            curl_easy_setopt(ch, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        }
+        if(hs->offset > 0) {
+            // Sends "Range: bytes=<offset>-"
+            curl_easy_setopt(ch, CURLOPT_RESUME_FROM_LARGE,
+                             (curl_off_t)hs->offset);
+        }
+    } else if((type & HTTP_REQ_FLAGS_SHORT_TIMEOUT) != 0) {
         curl_easy_setopt(ch, CURLOPT_TIMEOUT, REQ_API_TIMEOUT_SHORT);
         // Give connecting the whole timeout, but just reuse the constant
         curl_easy_setopt(ch, CURLOPT_CONNECTTIMEOUT, REQ_API_TIMEOUT_SHORT);
@@ -265,31 +484,37 @@ static http_rsp *http_req(char *url, char *headers,
         curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 0);
     }
 #ifdef FEATURE_GZIP_REQUESTS
-    int cstrlen;
-    char *cstr = NULL;
-
-    // If compress flag is set and message length exceeds the threshold,
-    // then try to compress the message
-    if(data != NULL && (type & HTTP_REQ_FLAGS_COMPRESS) &&
-       unum_config.gzip_requests && len > unum_config.gzip_requests)
+    UTIL_GZ_t *gz = NULL;
+
+    if((type & HTTP_REQ_FLAGS_GZ_DATA) != 0) {
+        // The caller passed already compressed data
+        gz = (UTIL_GZ_t *)data;
+        data = "";
+        len = 0;
+    } else if(data != NULL && (type & HTTP_REQ_FLAGS_COMPRESS) &&
+              unum_config.gzip_requests && len > unum_config.gzip_requests)
     {
-        // Allocate memory for compressed message
-        // If the memory allocation fails, let the message
-        // go uncompressed
-        cstr = UTIL_MALLOC(len);
-        if(cstr) {
-            // Compress the message
-            cstrlen = util_compress(data, len, cstr, len);
-            if(cstrlen > 0) {
-                compressed = TRUE;
-                dptr = cstr;
-                dlen = cstrlen;
-            } else {
-                UTIL_FREE(cstr);
-                cstr = NULL;
-            }
+        // If compress flag is set and message length exceeds the threshold,
+        // then try to compress the message. The compressed data is kept
+        // in the fixed size chunks, there is no need to allocate a buffer
+        // for the worst case. If compression fails, let the message
+        // go uncompressed.
+        if((gz = util_gz_start()) != NULL &&
+           (util_gz_write(data, len, gz) != 0 || util_gz_finish(gz) != 0))
+        {
+            util_gz_free(gz);
+            gz = NULL;
         }
     }
+    if(gz != NULL) {
+        compressed = TRUE;
+        dptr = NULL;
+        dlen = gz->len;
+        curl_easy_setopt(ch, CURLOPT_READFUNCTION, gz_read_func);
+        curl_easy_setopt(ch, CURLOPT_READDATA, gz);
+        curl_easy_setopt(ch, CURLOPT_SEEKFUNCTION, gz_seek_func);
+        curl_easy_setopt(ch, CURLOPT_SEEKDATA, gz);
+    }
 #endif //FEATURE_GZIP_REQUESTS
     if(headers || compressed)
     {
@@ -316,7 +541,7 @@ static http_rsp *http_req(char *url, char *headers,
     if(slhdr) {
         curl_easy_setopt(ch, CURLOPT_HTTPHEADER, slhdr);
     }
-    if(conncheck_no_dns())
+    if(no_dns)
     {
         int ii;
         struct curl_slist *slold = NULL;
@@ -351,17 +576,37 @@ static http_rsp *http_req(char *url, char *headers,
             __func__, ch, (compressed ? "(gzip)" : ""), dlen,
             (len > MAX_LOG_DATA_LEN ? MAX_LOG_DATA_LEN : len), data,
             (len > MAX_LOG_DATA_LEN ? "..." : ""));
-        curl_easy_setopt(ch, CURLOPT_POSTFIELDS, dptr);
-        curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, dlen);
+        if(dptr != NULL) {
+            curl_easy_setopt(ch, CURLOPT_POSTFIELDS, dptr);
+            curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, dlen);
+        } else {
+            // The data is read by curl through the read function
+            curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE_LARGE,
+                             (curl_off_t)dlen);
+        }
     }
 
     if((type & HTTP_REQ_FLAGS_NO_RETRIES) != 0) {
         num_retries = 1;
     }
     curl_easy_setopt(ch, CURLOPT_DNS_CACHE_TIMEOUT, 200);
+    if(pooled) {
+        // Keep the connection alive while the handle is in the pool
+        curl_easy_setopt(ch, CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x074100
+        curl_easy_setopt(ch, CURLOPT_MAXAGE_CONN,
+                         (long)HTTP_POOL_IDLE_TIMEOUT);
+#endif // LIBCURL_VERSION_NUM >= 7.65.0
+    }
 
     for(retry = 0; retry < num_retries; retry++)
     {
+#ifdef FEATURE_GZIP_REQUESTS
+        // Compressed data is read by curl, start each try from the beginning
+        if(gz != NULL) {
+            util_gz_seek(gz, 0);
+        }
+#endif //FEATURE_GZIP_REQUESTS
         err = curl_easy_perform(ch);
         if(err) {
             log("%s: %p error (%d) %s\n",
@@ -397,7 +642,13 @@ static http_rsp *http_req(char *url, char *headers,
         rsp->time = (connect_time - name_lookup_time) * 1000.0;
     }
 
-    curl_easy_cleanup(ch);
+    // Put the handle back to the pool unless the request failed (the
+    // connection is likely broken)
+    if(pooled && err == 0) {
+        http_pool_put(ep, ch);
+    } else {
+        curl_easy_cleanup(ch);
+    }
     if(slhdr != NULL) {
         curl_slist_free_all(slhdr);
     }
@@ -405,9 +656,9 @@ static http_rsp *http_req(char *url, char *headers,
         curl_slist_free_all(sldns);
     }
 #ifdef FEATURE_GZIP_REQUESTS
-    // Free the compressed message string
-    if(cstr != NULL) {
-        UTIL_FREE(cstr);
+    // Free the compressed message unless it came from the caller
+    if(gz != NULL && (type & HTTP_REQ_FLAGS_GZ_DATA) == 0) {
+        util_gz_free(gz);
     }
 #endif //FEATURE_GZIP_REQUESTS
 
@@ -451,6 +702,83 @@ http_rsp *http_post_short_timeout(char *url, char *headers, char *data, int len)
                     data, len);
 }
 
+#ifdef FEATURE_GZIP_REQUESTS
+// Perform POST request sending gzip compressed data (see util_zlib.h)
+// The headers are passed as double 0 terminated multi-string.
+// The compressor must be finished, it is not freed by the function.
+// Returns pointer to the http_rsp if sucessful, NULL if unable to perform
+// the request.
+// The caller must free the http_rsp when it is no longer needed.
+http_rsp *http_post_gz(char *url, char *headers, UTIL_GZ_t *gz)
+{
+    return http_req(url, headers, HTTP_REQ_TYPE_POST | HTTP_REQ_FLAGS_GZ_DATA,
+                    (char *)gz, 0);
+}
+#endif //FEATURE_GZIP_REQUESTS
+
+// Replace the failed request response w/ the one telling the caller
+// that the request has been spooled
+static http_rsp *spooled_rsp(http_rsp *rsp)
+{
+    if(rsp) {
+        free_rsp(rsp);
+    }
+    rsp = alloc_rsp(NULL, 0);
+    if(rsp) {
+        rsp->code = HTTP_RSP_CODE_SPOOLED;
+    }
+    return rsp;
+}
+
+// Perform telemetry JSON POST request, spool it if it fails
+// Returns pointer to the http_rsp if the request was sent, the http_rsp
+// w/ HTTP_RSP_CODE_SPOOLED code if it was spooled, NULL if it was lost or
+// the failed request response if it could not be spooled.
+// The caller must free the http_rsp when it is no longer needed.
+http_rsp *http_post_spool(char *url, char *data, int len)
+{
+    http_rsp *rsp;
+
+    // Keep the order, do not jump ahead of the spooled requests
+    if(util_spool_pending() && util_spool_add(url, data, len) == 0) {
+        log("%s: <%s> added to the spool\n", __func__, url);
+        return spooled_rsp(NULL);
+    }
+    rsp = http_post(url, HTTP_JSON_HEADERS, data, len);
+    if(!rsp || UTIL_SPOOL_RETRY_CODE(rsp->code)) {
+        if(util_spool_add(url, data, len) == 0) {
+            log("%s: <%s> failed, code %d, added to the spool\n",
+                __func__, url, rsp ? rsp->code : 0);
+            rsp = spooled_rsp(rsp);
+        }
+    }
+
+    return rsp;
+}
+
+#ifdef FEATURE_GZIP_REQUESTS
+// The same as http_post_spool(), but sends gzip compressed data
+http_rsp *http_post_gz_spool(char *url, UTIL_GZ_t *gz)
+{
+    http_rsp *rsp;
+
+    if(util_spool_pending() && util_spool_add_gz(url, gz) == 0) {
+        log("%s: <%s> added to the spool\n", __func__, url);
+        return spooled_rsp(NULL);
+    }
+    rsp = http_post_gz(url, HTTP_JSON_HEADERS, gz);
+    if(!rsp || UTIL_SPOOL_RETRY_CODE(rsp->code)) {
+        if(util_spool_add_gz(url, gz) == 0) {
+            log("%s: <%s> failed, code %d, added to the spool\n",
+                __func__, url, rsp ? rsp->code : 0);
+            rsp = spooled_rsp(rsp);
+        }
+    }
+
+    return rsp;
+}
+#endif //FEATURE_GZIP_REQUESTS
+
 // Perform PUT request
 // The headers are passed as double 0 terminated multi-string.
 // Returns pointer to the http_rsp if sucessful, NULL if unable to perform
@@ -491,6 +819,14 @@ http_rsp *http_get_no_retry(char *url, char *headers)
                     HTTP_REQ_TYPE_GET | HTTP_REQ_FLAGS_NO_RETRIES,
                     NULL, 0);
 }
+// Perform GET request passing the response body to the callback as it
+// arrives (see http_common.h for details)
+http_rsp *http_get_stream(char *url, char *headers, HTTP_STREAM_t *hs)
+{
+    return http_req(url, headers,
+                    HTTP_REQ_TYPE_GET | HTTP_REQ_FLAGS_NO_RETRIES |
+                    HTTP_REQ_FLAGS_STREAM, (char *)hs, 0);
+}
 // The same as http_get(), but gets timing information
 http_rsp *http_get_conn_time(char *url, char *headers)
 {
@@ -503,132 +839,310 @@ http_rsp *http_get_conn_time(char *url, char *headers)
 
 
 
-// Download file from a URL, without storing any data
-// this is used to test speeds. returns 0 if successful
-// error otherwise.
-int http_download_test(char *ifname, char *url,
-                       long timeout_in_sec, size_t *returned_size)
-{
-    CURL *ch;
-    CURLcode res;
-    size_t total_size = 0;
-    int ret = 0;
-    long http_code = 0;
+// Transfer test stream
+typedef struct {
+    CURL *ch;                 // the stream curl handle
+    HTTP_XFER_TEST_t *xt;     // the test the stream belongs to
+    unsigned long long bytes; // bytes transferred since the test start
+    int requests;             // number of the requests started
+    char *payload;            // upload payload buffer (shared by the streams)
+    size_t payload_len;       // upload payload buffer length
+    size_t payload_off;       // stream start offset in the payload buffer
+    size_t sent;              // bytes of the current upload request sent
+} HTTP_XFER_STREAM_t;
 
-    ch = curl_easy_init();
-
-    // Setup CURL options
-    if(ifname) {
-        curl_easy_setopt(ch, CURLOPT_INTERFACE, ifname);
+// CURL write function for the transfer test streams, counts the
+// downloaded bytes w/o storing the data (the upload response body
+// is discarded and not counted)
+static size_t xfer_write_func(char *ptr, size_t size, size_t nmemb, void *data)
+{
+    HTTP_XFER_STREAM_t *xs = (HTTP_XFER_STREAM_t *)data;
+    size_t len = size * nmemb;
+    if(!xs->xt->upload) {
+        xs->bytes += len;
     }
-    curl_easy_setopt(ch, CURLOPT_URL, url);
-    curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 0);
-    curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
-    curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, speedtest_chunk);
-    
-    void * total_size_vp = (void *)&total_size;
-    curl_easy_setopt(ch, CURLOPT_WRITEDATA, total_size_vp);
-    curl_easy_setopt(ch, CURLOPT_USERAGENT, "unum/v3 (libcurl; minim.co)");
-    curl_easy_setopt(ch, CURLOPT_TIMEOUT, timeout_in_sec);
-
-    // Start the download
-    res = curl_easy_perform(ch);
-
-    curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &http_code);
-
-    // Handle errors
-    if(res == CURLE_OPERATION_TIMEDOUT) {
-        // Do not consider timed out requests as failed.
-        log("%s: error: curl_easy_perform() operation timed out\n", __func__);
-    } else if(res != CURLE_OK || (http_code / 100) != 2) {
-        log("%s: error: curl_easy_perform() http_code: %ld | failed: %s\n",
-            __func__, http_code, curl_easy_strerror(res));
-        ret = -1;
-    }
-    *returned_size = total_size;
-
-    curl_easy_cleanup(ch);
-    return ret;
+    return len;
 }
 
-typedef struct transfer_status
+// CURL read function for the transfer test upload streams, copies the
+// request body from the preallocated random payload buffer (wrapping
+// around at its end)
+static size_t xfer_read_func(char *ptr, size_t size, size_t nmemb, void *data)
 {
-    size_t total;
-    size_t uploaded;
-} transfer_status;
+    HTTP_XFER_STREAM_t *xs = (HTTP_XFER_STREAM_t *)data;
+    size_t len, off, done, cnt;
+
+    len = UTIL_MIN(size * nmemb, xs->xt->upload_size - xs->sent);
+    off = (xs->payload_off + xs->sent) % xs->payload_len;
+    for(done = 0; done < len; done += cnt) {
+        cnt = UTIL_MIN(len - done, xs->payload_len - off);
+        memcpy(ptr + done, xs->payload + off, cnt);
+        off = 0;
+    }
+    xs->sent += len;
+    xs->bytes += len;
+
+    return len;
+}
 
-// CURL reader function to generate a set size of data
-static size_t random_data_reader(void *ptr, size_t size,
-                                 size_t nmemb, void *data)
+// Allocate the upload payload buffer and fill it w/ pseudo-random bytes,
+// so the transparent compressing proxies can not shrink it
+static char *xfer_alloc_payload(size_t len)
 {
-    transfer_status *ts = data;
-    if (ts->uploaded >= ts->total) {
-        // We've reached our target, signal EOF.
-        return 0;
+    uint32_t *buf, x;
+    size_t ii;
+
+    buf = UTIL_MALLOC(len);
+    if(buf == NULL) {
+        return NULL;
+    }
+    // xorshift32, the seed must not be 0
+    x = (uint32_t)util_time(1000000) | 1;
+    for(ii = 0; ii < len / sizeof(uint32_t); ++ii) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[ii] = x;
     }
-    // Calculate how much data we want to "read"
-    size_t bytes_to_transfer = size * nmemb;
 
-    // Tell curl the random data we want to upload
-    memset(ptr, 125, bytes_to_transfer);
+    return (char *)buf;
+}
 
-    // Save our progress
-    ts->uploaded += bytes_to_transfer;
+// Bytes the upload stream has handed to its socket, but the server has
+// not acknowledged yet. The socket send buffer can hold megabytes, so
+// w/o excluding those the upload counters run ahead of the network.
+// The socket is looked up for the stream's current transfer, the streams
+// share the multi handle connection cache, so a re-added stream might be
+// using the connection another stream has opened.
+static unsigned long long xfer_unacked(HTTP_XFER_STREAM_t *xs)
+{
+#if LIBCURL_VERSION_NUM >= 0x072d00
+    curl_socket_t sock = CURL_SOCKET_BAD;
+    int outq = 0;
 
-    return bytes_to_transfer;
+    if(curl_easy_getinfo(xs->ch, CURLINFO_ACTIVESOCKET, &sock) == CURLE_OK &&
+       sock != CURL_SOCKET_BAD && ioctl(sock, TIOCOUTQ, &outq) == 0 &&
+       outq > 0)
+    {
+        return UTIL_MIN((unsigned long long)outq, xs->bytes);
+    }
+#endif // LIBCURL_VERSION_NUM >= 7.45.0
+    return 0;
 }
 
-// Uploads random data to an endpoint to test the upload speed
-// returns 0 if successful, -1 otherwise.
-int http_upload_test(char *ifname, char *url,
-                     long timeout_in_sec, size_t *uploaded_size)
+// Store the transfer test sample of the stream byte counters
+static void xfer_sample(HTTP_XFER_TEST_t *xt, HTTP_XFER_STREAM_t *xs,
+                        int streams, unsigned int t)
 {
-    CURL *ch;
-    CURLcode res;
-    int ret = 0;
-    long http_code = 0;
+    unsigned long long bytes;
+    int ii;
+
+    for(ii = 0; ii < streams; ++ii) {
+        bytes = xs[ii].bytes;
+        if(xt->upload) {
+            bytes -= xfer_unacked(&xs[ii]);
+            // Keep the counters monotonic
+            if(xt->num_samples > 0 &&
+               bytes < xt->bytes[xt->num_samples - 1][ii])
+            {
+                bytes = xt->bytes[xt->num_samples - 1][ii];
+            }
+        }
+        xt->bytes[xt->num_samples][ii] = bytes;
+    }
+    xt->sample_t[xt->num_samples] = t;
+    ++(xt->num_samples);
+}
 
-    // Setup our transfer status object
-    struct transfer_status ts;
-    ts.total = 4000L * 4000L; // arbitrary amount to upload
-    ts.uploaded = 0;
+// Run the transfer (speed) test. The streams concurrently download from
+// (or upload to) the URL repeating the request as soon as it completes
+// until the time limit. All the streams are driven from the calling thread,
+// the transferred bytes counters are sampled every sample_ms.
+// The requests cut short by the time limit are not considered failed.
+// Returns 0 if successful, negative if failed to set up the test or
+// any of the requests has failed
+int http_xfer_test(HTTP_XFER_TEST_t *xt)
+{
+    HTTP_XFER_STREAM_t xs[HTTP_XFER_MAX_STREAMS];
+    struct curl_slist *slhdr = NULL;
+    char *payload = NULL;
+    size_t payload_len = 0;
+    CURLM *cm;
+    CURLMsg *msg;
+    unsigned long long t_start, t_next, now;
+    unsigned int elapsed;
+    int ii, streams, active, running, left;
+
+    xt->error = FALSE;
+    xt->num_samples = 0;
+    xt->duration_ms = 0;
+    streams = xt->streams;
+    if(streams <= 0 || streams > HTTP_XFER_MAX_STREAMS ||
+       xt->sample_ms == 0 || xt->url == NULL)
+    {
+        log("%s: invalid test parameters\n", __func__);
+        return -1;
+    }
 
-    ch = curl_easy_init();
+    cm = curl_multi_init();
+    if(cm == NULL) {
+        log("%s: curl_multi_init() has failed\n", __func__);
+        return -2;
+    }
+    if(xt->upload) {
+        // Do not wait for "100 Continue" before sending each request body
+        slhdr = curl_slist_append(NULL, "Expect:");
+        // Random payload the streams send from (at different offsets)
+        payload_len = UTIL_MIN(xt->upload_size, HTTP_XFER_PAYLOAD_SIZE);
+        payload_len &= ~(sizeof(uint32_t) - 1);
+        payload = (payload_len > 0) ? xfer_alloc_payload(payload_len) : NULL;
+        if(payload == NULL) {
+            log("%s: failed to allocate %zu bytes payload\n",
+                __func__, payload_len);
+            curl_slist_free_all(slhdr);
+            curl_multi_cleanup(cm);
+            return -2;
+        }
+    }
+
+    memset(xs, 0, sizeof(xs));
+    for(ii = 0; ii < streams; ++ii)
+    {
+        CURL *ch = curl_easy_init();
+        if(ch == NULL) {
+            log("%s: curl_easy_init() has failed\n", __func__);
+            xt->error = TRUE;
+            break;
+        }
+        xs[ii].ch = ch;
+        xs[ii].xt = xt;
+        if(xt->ifname) {
+            curl_easy_setopt(ch, CURLOPT_INTERFACE, xt->ifname);
+        }
+        curl_easy_setopt(ch, CURLOPT_URL, xt->url);
+        curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 0);
+        curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
+        curl_easy_setopt(ch, CURLOPT_USERAGENT, "unum/v3 (libcurl; minim.co)");
+        curl_easy_setopt(ch, CURLOPT_TIMEOUT_MS, (long)xt->time_limit_ms);
+        curl_easy_setopt(ch, CURLOPT_PRIVATE, (char *)&(xs[ii]));
+        if(xt->upload) {
+            curl_easy_setopt(ch, CURLOPT_UPLOAD, 1L);
+            curl_easy_setopt(ch, CURLOPT_READFUNCTION, xfer_read_func);
+            curl_easy_setopt(ch, CURLOPT_READDATA, (void *)&(xs[ii]));
+            curl_easy_setopt(ch, CURLOPT_INFILESIZE_LARGE,
+                             (curl_off_t)xt->upload_size);
+            curl_easy_setopt(ch, CURLOPT_HTTPHEADER, slhdr);
+#if LIBCURL_VERSION_NUM >= 0x073e00
+            curl_easy_setopt(ch, CURLOPT_UPLOAD_BUFFERSIZE,
+                             (long)HTTP_XFER_UPLOAD_BUF_SIZE);
+#endif // LIBCURL_VERSION_NUM >= 7.62.0
+            xs[ii].payload = payload;
+            xs[ii].payload_len = payload_len;
+            xs[ii].payload_off = (payload_len / streams) * ii;
+        }
+        curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, xfer_write_func);
+        curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *)&(xs[ii]));
+    }
 
-    // Setup CURL options
-    if(ifname) {
-        curl_easy_setopt(ch, CURLOPT_INTERFACE, ifname);
+    active = 0;
+    for(ii = 0; ii < streams && !xt->error; ++ii) {
+        if(curl_multi_add_handle(cm, xs[ii].ch) != CURLM_OK) {
+            log("%s: curl_multi_add_handle() has failed\n", __func__);
+            xt->error = TRUE;
+            break;
+        }
+        ++(xs[ii].requests);
+        ++active;
     }
-    curl_easy_setopt(ch, CURLOPT_URL, url);
-    curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 0);
-    curl_easy_setopt(ch, CURLOPT_NOSIGNAL, 1);
-    curl_easy_setopt(ch, CURLOPT_UPLOAD, 1L);
-    curl_easy_setopt(ch, CURLOPT_READFUNCTION, random_data_reader);
 
-    void * ts_vp = (void *)&ts;
-    curl_easy_setopt(ch, CURLOPT_READDATA, ts_vp);
-    curl_easy_setopt(ch, CURLOPT_USERAGENT, "unum/v3 (libcurl; minim.co)");
-    curl_easy_setopt(ch, CURLOPT_TIMEOUT, timeout_in_sec);
+    t_start = now = util_time(1000);
+    t_next = t_start + xt->sample_ms;
+    while(active > 0 && !xt->error)
+    {
+        curl_multi_perform(cm, &running);
+        now = util_time(1000);
+        elapsed = (unsigned int)(now - t_start);
+
+        // Restart the streams that have completed their requests
+        while((msg = curl_multi_info_read(cm, &left)) != NULL)
+        {
+            HTTP_XFER_STREAM_t *s = NULL;
+            long http_code = 0;
 
-    // Start the upload
-    res = curl_easy_perform(ch);
+            if(msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&s);
+            curl_easy_getinfo(msg->easy_handle,
+                              CURLINFO_RESPONSE_CODE, &http_code);
+            if(msg->data.result == CURLE_OPERATION_TIMEDOUT) {
+                // Do not consider timed out requests as failed.
+                log("%s: request timed out\n", __func__);
+            } else if(msg->data.result != CURLE_OK || (http_code / 100) != 2) {
+                log("%s: error: http_code: %ld | failed: %s\n",
+                    __func__, http_code, curl_easy_strerror(msg->data.result));
+                xt->error = TRUE;
+            }
+            curl_multi_remove_handle(cm, msg->easy_handle);
+            if(!xt->error && s != NULL && elapsed < xt->time_limit_ms &&
+               (xt->max_requests <= 0 || s->requests < xt->max_requests))
+            {
+                // Re-adding the handle reuses its connection
+                s->sent = 0;
+                curl_easy_setopt(s->ch, CURLOPT_TIMEOUT_MS,
+                                 (long)(xt->time_limit_ms - elapsed));
+                if(curl_multi_add_handle(cm, s->ch) == CURLM_OK) {
+                    ++(s->requests);
+                    continue;
+                }
+                log("%s: curl_multi_add_handle() has failed\n", __func__);
+                xt->error = TRUE;
+            }
+            --active;
+        }
 
-    curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &http_code);
+        if(now >= t_next) {
+            xfer_sample(xt, xs, streams, elapsed);
+            t_next += xt->sample_ms;
+            if(t_next <= now) {
+                t_next = now + xt->sample_ms;
+            }
+        }
+        if(elapsed >= xt->time_limit_ms ||
+           xt->num_samples >= HTTP_XFER_MAX_SAMPLES)
+        {
+            break;
+        }
+        curl_multi_wait(cm, NULL, 0,
+                        (int)UTIL_MIN(t_next - now,
+                                      xt->time_limit_ms - elapsed),
+                        NULL);
+    }
 
-    // Handle errors
-    if (res == CURLE_OPERATION_TIMEDOUT) {
-        // Don't consider timed out requests as failed.
-        log("%s: error: curl_easy_perform() operation timed out\n", __func__);
-    } else if(res != CURLE_OK || (http_code / 100) != 2) {
-        log("%s: error: curl_easy_perform() http_code: %ld | failed: %s\n",
-            __func__, http_code, curl_easy_strerror(res));
-        ret = -1;
+    // Capture the bytes transferred since the last sample
+    xt->duration_ms = (unsigned int)(now - t_start);
+    if(!xt->error && xt->num_samples < HTTP_XFER_MAX_SAMPLES &&
+       (xt->num_samples == 0 ||
+        xt->sample_t[xt->num_samples - 1] < xt->duration_ms))
+    {
+        xfer_sample(xt, xs, streams, xt->duration_ms);
     }
 
-    *uploaded_size = ts.uploaded;
+    for(ii = 0; ii < streams; ++ii) {
+        if(xs[ii].ch != NULL) {
+            curl_multi_remove_handle(cm, xs[ii].ch);
+            curl_easy_cleanup(xs[ii].ch);
+        }
+    }
+    curl_multi_cleanup(cm);
+    if(slhdr != NULL) {
+        curl_slist_free_all(slhdr);
+    }
+    if(payload != NULL) {
+        UTIL_FREE(payload);
+    }
 
-    curl_easy_cleanup(ch);
-    return ret;
+    return xt->error ? -3 : 0;
 }
 
 
@@ -693,6 +1207,12 @@ static void kill_locks(void)
 // technically this should be called on application exit
 void http_deinit()
 {
+    http_pool_cleanup();
+    if(http_share) {
+        curl_share_cleanup(http_share);
+        http_share = NULL;
+    }
+
 #if defined(USE_OPEN_SSL) && (OPENSSL_VERSION_NUMBER < 0x10100000L)
     kill_locks();
 #endif
@@ -712,6 +1232,27 @@ int http_init(int level)
         log("%s: curl global init has failed, error %d\n", __func__, err);
     }
 
+    // Set up the DNS cache and TLS sessions sharing for the pooled handles
+    int ii;
+    for(ii = 0; ii < CURL_LOCK_DATA_LAST; ii++) {
+        UTIL_MUTEX_INIT(&(http_share_m[ii]));
+    }
+    http_share = curl_share_init();
+    if(!http_share ||
+       curl_share_setopt(http_share, CURLSHOPT_LOCKFUNC, share_lock) != 0 ||
+       curl_share_setopt(http_share, CURLSHOPT_UNLOCKFUNC, share_unlock) != 0 ||
+       curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != 0 ||
+       curl_share_setopt(http_share, CURLSHOPT_SHARE,
+                         CURL_LOCK_DATA_SSL_SESSION) != 0)
+    {
+        log("%s: curl share init has failed, not sharing DNS and TLS data\n",
+            __func__);
+        if(http_share) {
+            curl_share_cleanup(http_share);
+            http_share = NULL;
+        }
+    }
+
 #if defined(USE_OPEN_SSL) && (OPENSSL_VERSION_NUMBER < 0x10100000L)
     err = init_locks();
     if(err != 0) {
@@ -25,6 +25,18 @@
 #define REQ_API_TIMEOUT_SHORT  5
 #define REQ_FILE_TIMEOUT       1200
 
+// Pool of the reusable curl handles for the API requests (see http_curl.c)
+// Max number of idle handles kept in the pool
+#define HTTP_POOL_SIZE 4
+// Max number of idle handles kept for the same endpoint
+#define HTTP_POOL_MAX_PER_EP 2
+// Time (in seconds) an idle handle (and its connection) is kept around,
+// it should be longer than the telemetry reporting intervals
+#define HTTP_POOL_IDLE_TIMEOUT 120
+// Max length of the endpoint (scheme://host[:port]) string, URLs with
+// longer endpoint are not using the pool
+#define HTTP_POOL_MAX_EP_LEN 128
+
 // Timeouts used in common code for setting up watchdog
 // MAX time for HTTP REST API operations
 #define HTTP_REQ_MAX_TIME ((REQ_CONNECT_TIMEOUT + REQ_API_TIMEOUT) * REQ_RETRIES)
@@ -35,6 +35,7 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 #include <linux/types.h>
 #include <linux/reboot.h>
@@ -16,14 +16,25 @@
 // - MAC addr (in xx:xx:xx:xx:xx:xx format)
 #define TELEMETRY_PATH "/v3/unums/%s/firewall"
 
+// Version of the reported rules, incremented every time they change
 static int ipt_seq_num = 0;
-
-// Collects iptables data 
-// allocates JSON string with the iptables rules.
+// Version of the rules the changed chains are reported against
+static int ipt_base_seq_num = 0;
+// Number of reports since the last full one (negative forces full report)
+static int ipt_reports_since_full = -1;
+
+// Collects iptables data
+// allocates JSON string with the iptables rules. If the rules have not
+// changed since the last report only the seq_num is sent (heartbeat),
+// if some chains have changed only those chains are sent along with
+// the base_seq_num of the rules they change. The full rules are sent
+// every IPT_FULL_REPORT_PERIOD reports or after a failed report.
 static char *iptables_json()
 {
     char *ipt_filter = NULL;
     char *ipt_nat = NULL;
+    int *base_seq_num = NULL;
+    int count;
 
     // Collect iptables data
     ipt_collect_data();
@@ -37,83 +48,112 @@ static char *iptables_json()
         // Just log the error, but move on
     }
 
+    count = ipt_diff_rules();
+    if(count < 0 || ipt_reports_since_full < 0 ||
+       ipt_reports_since_full >= IPT_FULL_REPORT_PERIOD - 1)
+    {
+        // Full report
+        if(count != 0) {
+            ++ipt_seq_num;
+        }
+        ipt_reports_since_full = 0;
+    } else if(count == 0) {
+        // Heartbeat
+        ipt_filter = ipt_nat = NULL;
+        ++ipt_reports_since_full;
+    } else {
+        // Changed chains only
+        ipt_base_seq_num = ipt_seq_num++;
+        base_seq_num = &ipt_base_seq_num;
+        ipt_filter = ipt_get_changed_rules("filter");
+        ipt_nat = ipt_get_changed_rules("nat");
+        ++ipt_reports_since_full;
+    }
+
     JSON_OBJ_TPL_t tpl_tbl_ipt_obj = {
       {"filter",     {.type = JSON_VAL_STR, {.s = ipt_filter }}},
       {"nat",        {.type = JSON_VAL_STR, {.s = ipt_nat }}},
       {"seq_num", {.type = JSON_VAL_PINT,   {.pi = &ipt_seq_num}}},
+      {"base_seq_num", {.type = JSON_VAL_PINT, {.pi = base_seq_num}}},
       { NULL }
     };
 
     return util_tpl_to_json_str(tpl_tbl_ipt_obj);
 }
 
-static void iptables_telemetry(THRD_PARAM_t *p)
+// iptables telemetry task step (runs in the reactor worker pool)
+static int iptables_telemetry(THRD_PARAM_t *p)
 {
+    static char url[256];
     http_rsp *rsp = NULL;
-    char *my_mac = util_device_mac();
-    char url[256];
+    char *jstr = NULL;
 
-    log("%s: started\n", __func__);
+    // Wait for activate to complete
+    if(!is_agent_activated()) {
+        return ACTIVATE_TASK_POLL;
+    }
 
-    log("%s: waiting for activate to complete\n", __func__);
-    wait_for_activate();
-    log("%s: done waiting for activate\n", __func__);
+    // First step after the activation
+    if(*url == 0) {
+        log("%s: done waiting for activate\n", __func__);
 
-    util_wd_set_timeout(HTTP_REQ_MAX_TIME + unum_config.ipt_period);
+        util_wd_set_timeout(HTTP_REQ_MAX_TIME + unum_config.ipt_period);
 
-    // Prepare the URL string
-    util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API, url, sizeof(url),
-                   TELEMETRY_PATH, my_mac);
+        // Prepare the URL string
+        util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API,
+                       url, sizeof(url), TELEMETRY_PATH, util_device_mac());
+    }
 
     for(;;) {
-        char *jstr = NULL;
-
-        for(;;) {
-            // Prepare the iptables JSON
-            jstr = iptables_json();
-            if(!jstr) {
-                log("%s: JSON encode failed\n", __func__);
-                break;
-            }
+        // Prepare the iptables JSON
+        jstr = iptables_json();
+        if(!jstr) {
+            log("%s: JSON encode failed\n", __func__);
+            ipt_rules_reported(FALSE);
+            ipt_reports_since_full = -1;
+            break;
+        }
 #ifdef DEBUG
-            if(get_test_num() == U_TEST_IPTABLES) {
-                printf("%s: JSON for <%s>:\n%s\n", __func__, url, jstr);
-                break;
-            } else // send request (function call below) only if not a test
+        if(get_test_num() == U_TEST_IPTABLES) {
+            printf("%s: JSON for <%s>:\n%s\n", __func__, url, jstr);
+            ipt_rules_reported(TRUE);
+            break;
+        } else // send request (function call below) only if not a test
 #endif // DEBUG
 
-            // Send the iptables info
-            // Not checking the response
-            rsp = http_post_no_retry(url,
-                                     "Content-Type: application/json\0"
-                                     "Accept: application/json\0",
-                                     jstr, strlen(jstr));
-
-            if(rsp == NULL || (rsp->code / 100) != 2) {
-                log("%s: request error, code %d%s\n",
-                    __func__, rsp ? rsp->code : 0, rsp ? "" : "(none)");
-                break;
-            }
-
+        // Send the iptables info
+        // Not checking the response
+        rsp = http_post_no_retry(url,
+                                 "Content-Type: application/json\0"
+                                 "Accept: application/json\0",
+                                 jstr, strlen(jstr));
+
+        if(rsp == NULL || (rsp->code / 100) != 2) {
+            log("%s: request error, code %d%s\n",
+                __func__, rsp ? rsp->code : 0, rsp ? "" : "(none)");
+            // Not sure what the server has, send full rules next time
+            ipt_rules_reported(FALSE);
+            ipt_reports_since_full = -1;
             break;
         }
+        ipt_rules_reported(TRUE);
 
-        if(jstr) {
-            util_free_json_str(jstr);
-            jstr = NULL;
-        }
+        break;
+    }
 
-        if(rsp) {
-            free_rsp(rsp);
-            rsp = NULL;
-        }
+    if(jstr) {
+        util_free_json_str(jstr);
+        jstr = NULL;
+    }
 
-        util_wd_poll();
-        sleep(unum_config.ipt_period);
+    if(rsp) {
+        free_rsp(rsp);
+        rsp = NULL;
     }
 
-    // Never reaches here
-    log("%s: done\n", __func__);
+    util_wd_poll();
+
+    return unum_config.ipt_period * 1000;
 }
 
 // Subsystem init fuction
@@ -121,8 +161,10 @@ int iptables_init(int level)
 {
     int ret = 0;
     if(level == INIT_LEVEL_TELEMETRY) {
-        // Start the iptables reporting job
-        ret = util_start_thrd("iptables", iptables_telemetry, NULL, NULL);
+        // Start the iptables reporting task
+        ret = util_reactor_task_add("iptables", iptables_telemetry, NULL, 0,
+                                    REACTOR_TASK_F_BLOCKING);
+        ret = (ret < 0) ? ret : 0;
     }
     return ret;
 }
@@ -131,6 +173,8 @@ int iptables_init(int level)
 void test_iptables(void)
 {
     set_activate_event();
-    iptables_telemetry(NULL);
+    for(;;) {
+        util_msleep(iptables_telemetry(NULL));
+    }
 }
 #endif // DEBUG
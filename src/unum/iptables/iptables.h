@@ -22,6 +22,16 @@
 // Max length of a rule in the report
 #define MAX_IPT_ENTRY_LENGTH 256
 
+// Max number of chains per table tracked for detecting the changes
+#define IPT_MAX_CHAINS 128
+
+// Max chain name length (iptables limits it to 28 chars)
+#define IPT_CHAIN_NAME_LEN 32
+
+// Send the full rules (instead of only the changed chains) at least
+// once per this many reports
+#define IPT_FULL_REPORT_PERIOD 12
+
 // Load rules reported by iptables command into a memory buffer.
 // Rotate the buffers (to keep previous and the new rules.
 void ipt_collect_data(void);
@@ -33,4 +43,20 @@ int iptables_init(int level);
 // key can be either filter or nat
 char* ipt_get_rules(const char *key);
 
+// Compare the collected rules w/ the last reported ones
+// Returns: # of the changed and removed chains in all the tables,
+//          negative if unable to tell (the full rules have to be sent)
+int ipt_diff_rules(void);
+
+// Get the rules of the changed chains (nat or filter) found by
+// ipt_diff_rules(). The text has the same format as the full rules,
+// the chains that are gone are listed in "-X <chain>" lines at the end.
+// Returns: ptr to the text, NULL if nothing has changed in the table
+char *ipt_get_changed_rules(const char *key);
+
+// Remember the chains of the collected rules as reported (the next
+// ipt_diff_rules() compares to them), or forget the reported chains
+// if the report has failed (the next report then has to be a full one).
+void ipt_rules_reported(int ok);
+
 #endif // __IPTABLES_H
@@ -22,6 +22,29 @@ static int iptables_nat_offset = 0;
 // Flag indicating an error while collecting the data
 static int data_error = FALSE;
 
+// Chain info for detecting the changes in the rules
+typedef struct _IPT_CHAIN {
+    char name[IPT_CHAIN_NAME_LEN]; // chain name
+    uint32_t hash;                 // hash of the chain rules
+    int changed;                   // TRUE if the chain changed or is new
+} IPT_CHAIN_t;
+
+// Table chains, the ones from the last collected rules and the ones
+// from the last reported rules
+typedef struct _IPT_TABLE {
+    int count;        // # of chains in the collected rules
+    int overflow;     // TRUE if run out of space for the collected chains
+    IPT_CHAIN_t chains[IPT_MAX_CHAINS];
+    int rep_count;    // # of chains in the last reported rules
+    int rep_valid;    // TRUE if have the last reported rules
+    IPT_CHAIN_t rep[IPT_MAX_CHAINS];
+    char *delta;      // rules of the changed chains (see ipt_diff_rules())
+} IPT_TABLE_t;
+
+// Chains of the filter and nat tables
+static IPT_TABLE_t ipt_filter;
+static IPT_TABLE_t ipt_nat;
+
 // Read the output of the command
 // Here the command can be "iptables --list-rules" or "
 // "iptables -t nat --list-rules"
@@ -78,7 +101,9 @@ static char* read_iptables_rules_cmd(char *cmd,
         // It accounts for rule position number in the chain,
         // rule length and the terminating 0 at the end of the buffer.
         if((i + 10 + rule_len + 1) > *buf_len_ptr) {
-            char *ptr = UTIL_REALLOC(buf, (*buf_len_ptr+IPTABLES_REALLOC_SIZE));
+            // Double the buffer (it is kept across the collection cycles,
+            // so it should not need to grow once it fits the rules)
+            char *ptr = UTIL_REALLOC(buf, (*buf_len_ptr * 2));
             if(ptr == NULL) {
                 log("%s: Error while reallocating memory for the buffer: %d\n",
                     __func__, i);
@@ -92,7 +117,7 @@ static char* read_iptables_rules_cmd(char *cmd,
                 break;
             }
             buf = ptr;
-            *buf_len_ptr += IPTABLES_REALLOC_SIZE;
+            *buf_len_ptr *= 2;
         }
 
         // Find out rule position in the chain
@@ -148,11 +173,23 @@ static char *read_iptables_rules(char *buf, int *buf_len_ptr)
         return buf;
     }
 
-    // Offset in buf where the nat table rules start
-    iptables_nat_offset = str_len_ptr;
+    // Offset in buf where the nat table rules start (past the
+    // terminating 0 of the filter table rules)
+    iptables_nat_offset = str_len_ptr + 1;
+    if(iptables_nat_offset + 1 > *buf_len_ptr) {
+        char *ptr = UTIL_REALLOC(buf, (*buf_len_ptr * 2));
+        if(ptr == NULL) {
+            log("%s: Error while reallocating memory for the buffer\n",
+                __func__);
+            data_error = TRUE;
+            return buf;
+        }
+        buf = ptr;
+        *buf_len_ptr *= 2;
+    }
     // Read and append iptables -t nat --list-rules
     buf = read_iptables_rules_cmd(IPTABLES_NAT_RULES,
-                                  buf, str_len_ptr, 
+                                  buf, iptables_nat_offset,
                                   buf_len_ptr, &str_len_ptr);
     return buf;
 }
@@ -199,3 +236,221 @@ char* ipt_get_rules(const char *key)
         return NULL;
     }
 }
+
+// Find the chain by name
+// tbl - the table chains
+// name - the chain name (not necessarily 0-terminated)
+// len - the name length
+// last - ptr to the index of the chain found last time (checked first
+//        since the rules of a chain follow each other), updated
+// add - TRUE to add the chain if not found
+// Returns: ptr to the chain or NULL if not found (or no space)
+static IPT_CHAIN_t *ipt_find_chain(IPT_TABLE_t *tbl, char *name, int len,
+                                   int *last, int add)
+{
+    int ii;
+    IPT_CHAIN_t *ch;
+
+    if(len <= 0 || len >= IPT_CHAIN_NAME_LEN) {
+        return NULL;
+    }
+    if(*last >= 0 && *last < tbl->count) {
+        ch = &(tbl->chains[*last]);
+        if(strncmp(ch->name, name, len) == 0 && ch->name[len] == 0) {
+            return ch;
+        }
+    }
+    for(ii = 0; ii < tbl->count; ++ii) {
+        ch = &(tbl->chains[ii]);
+        if(strncmp(ch->name, name, len) == 0 && ch->name[len] == 0) {
+            *last = ii;
+            return ch;
+        }
+    }
+    if(!add) {
+        return NULL;
+    }
+    if(tbl->count >= IPT_MAX_CHAINS) {
+        tbl->overflow = TRUE;
+        return NULL;
+    }
+    ch = &(tbl->chains[tbl->count]);
+    memcpy(ch->name, name, len);
+    ch->name[len] = 0;
+    ch->hash = 2166136261U; // FNV-1a offset basis
+    ch->changed = TRUE;
+    *last = tbl->count++;
+
+    return ch;
+}
+
+// Find the chain for the rule line ("-P|-N|-A <chain> ...")
+// See ipt_find_chain() for the parameters.
+static IPT_CHAIN_t *ipt_find_rule_chain(IPT_TABLE_t *tbl, char *rule,
+                                        int *last, int add)
+{
+    char *name, *end;
+
+    name = strchr(rule, ' ');
+    if(name == NULL) {
+        return NULL;
+    }
+    ++name;
+    for(end = name; *end != 0 && *end != ' ' && *end != '\n'; ++end);
+
+    return ipt_find_chain(tbl, name, end - name, last, add);
+}
+
+// Check if the chain from the last report is gone
+static int ipt_chain_is_gone(IPT_TABLE_t *tbl, IPT_CHAIN_t *rep_ch)
+{
+    int last = -1;
+    return (ipt_find_chain(tbl, rep_ch->name, strlen(rep_ch->name),
+                           &last, FALSE) == NULL);
+}
+
+// Split the table rules into chains, calculate the chain hashes and
+// compare them to the last reported ones. Builds the text w/ the rules
+// of the changed chains followed by "-X <chain>" lines for the chains
+// that are gone.
+// Returns: # of changed and removed chains, negative if unable to tell
+static int ipt_diff_table(IPT_TABLE_t *tbl, char *rules)
+{
+    char *line, *next, *ptr;
+    IPT_CHAIN_t *ch;
+    int ii, jj, last, count, len;
+
+    if(tbl->delta) {
+        UTIL_FREE(tbl->delta);
+        tbl->delta = NULL;
+    }
+    tbl->count = 0;
+    tbl->overflow = FALSE;
+    if(rules == NULL) {
+        return -1;
+    }
+
+    // Hash the rules of each chain (FNV-1a over all the chain lines)
+    last = -1;
+    for(line = rules; *line != 0; line = next)
+    {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+        ch = ipt_find_rule_chain(tbl, line, &last, TRUE);
+        if(ch == NULL) {
+            continue;
+        }
+        for(ptr = line; ptr < next; ++ptr) {
+            ch->hash = (ch->hash ^ (unsigned char)*ptr) * 16777619U;
+        }
+    }
+    if(tbl->overflow) {
+        log("%s: more than %d chains in the table\n",
+            __func__, IPT_MAX_CHAINS);
+        return -2;
+    }
+    if(!tbl->rep_valid) {
+        return -3;
+    }
+
+    // Compare to the reported chains
+    count = 0;
+    for(ii = 0; ii < tbl->count; ++ii) {
+        ch = &(tbl->chains[ii]);
+        for(jj = 0; jj < tbl->rep_count; ++jj) {
+            if(strcmp(ch->name, tbl->rep[jj].name) == 0) {
+                ch->changed = (ch->hash != tbl->rep[jj].hash);
+                break;
+            }
+        }
+        count += ch->changed;
+    }
+    len = 0;
+    for(jj = 0; jj < tbl->rep_count; ++jj) {
+        if(ipt_chain_is_gone(tbl, &(tbl->rep[jj]))) {
+            ++count;
+            len += strlen(tbl->rep[jj].name) + 4;
+        }
+    }
+    if(count == 0) {
+        return 0;
+    }
+
+    // Build the text of the changed chains
+    tbl->delta = UTIL_MALLOC(strlen(rules) + len + 1);
+    if(tbl->delta == NULL) {
+        log("%s: failed to allocate %d bytes\n",
+            __func__, strlen(rules) + len + 1);
+        return -4;
+    }
+    ptr = tbl->delta;
+    last = -1;
+    for(line = rules; *line != 0; line = next)
+    {
+        next = strchr(line, '\n');
+        next = next ? next + 1 : line + strlen(line);
+        ch = ipt_find_rule_chain(tbl, line, &last, FALSE);
+        if(ch == NULL || !ch->changed) {
+            continue;
+        }
+        memcpy(ptr, line, next - line);
+        ptr += next - line;
+    }
+    for(jj = 0; jj < tbl->rep_count; ++jj) {
+        if(ipt_chain_is_gone(tbl, &(tbl->rep[jj]))) {
+            ptr += sprintf(ptr, "-X %s\n", tbl->rep[jj].name);
+        }
+    }
+    *ptr = 0;
+
+    return count;
+}
+
+// Compare the collected rules w/ the last reported ones
+// Returns: # of the changed and removed chains in all the tables,
+//          negative if unable to tell (the full rules have to be sent)
+int ipt_diff_rules(void)
+{
+    int f_count, n_count;
+
+    f_count = ipt_diff_table(&ipt_filter, ipt_get_rules("filter"));
+    n_count = ipt_diff_table(&ipt_nat, ipt_get_rules("nat"));
+    if(f_count < 0 || n_count < 0) {
+        return -1;
+    }
+
+    return f_count + n_count;
+}
+
+// Get the rules of the changed chains (nat or filter) found by
+// ipt_diff_rules(). The text has the same format as the full rules,
+// the chains that are gone are listed in "-X <chain>" lines at the end.
+// Returns: ptr to the text, NULL if nothing has changed in the table
+char *ipt_get_changed_rules(const char *key)
+{
+    if(strcmp(key, "filter") == 0) {
+        return ipt_filter.delta;
+    } else if(strcmp(key, "nat") == 0) {
+        return ipt_nat.delta;
+    }
+    return NULL;
+}
+
+// Remember the chains of the collected rules as reported (the next
+// ipt_diff_rules() compares to them), or forget the reported chains
+// if the report has failed (the next report then has to be a full one).
+void ipt_rules_reported(int ok)
+{
+    IPT_TABLE_t *tbls[] = { &ipt_filter, &ipt_nat };
+    int ii;
+
+    for(ii = 0; ii < UTIL_ARRAY_SIZE(tbls); ++ii) {
+        IPT_TABLE_t *tbl = tbls[ii];
+        tbl->rep_valid = (ok && !tbl->overflow && !data_error);
+        tbl->rep_count = 0;
+        if(tbl->rep_valid) {
+            memcpy(tbl->rep, tbl->chains, tbl->count * sizeof(IPT_CHAIN_t));
+            tbl->rep_count = tbl->count;
+        }
+    }
+}
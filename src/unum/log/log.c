@@ -229,12 +229,429 @@ static int init_log_entry(LOG_DST_t dst)
     return ret;
 }
 
+// Write the file log message prefix
+static void log_write_prefix(LOG_CONFIG_t *lc, int tid, time_t t)
+{
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    fprintf(lc->f, "%d %d.%02d.%02d %02d:%02d:%02d ",
+            tid, 1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday,
+            tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+#ifdef LOG_FLAG_FILE
+// Check the log file size and rotate if necessary (the caller should
+// hold the entry mutex if the entry requires it).
+static void log_rotate(LOG_CONFIG_t *lc)
+{
+    int ii;
+    long fpos;
+    char fn[LOG_MAX_PATH + 1];
+    int fn_len;
+
+    fpos = ftell(lc->f);
+    if(!lc->max_size || fpos < lc->max_size) {
+        return;
+    }
+    if(lc->cut_size && fpos > lc->cut_size) {
+        fseek(lc->f, fpos - 3, SEEK_SET);
+        fprintf(lc->f, "...");
+        fflush(lc->f);
+        ftruncate(fileno(lc->f), lc->cut_size);
+    }
+    fclose(lc->f);
+    lc->f = NULL;
+    for(ii = lc->max; ii >= 1; ii--) {
+        char buf_from[LOG_MAX_PATH + 4];
+        char to[LOG_MAX_PATH + 4];
+        char *from;
+
+        snprintf(buf_from, sizeof(buf_from), "%s/%s",
+                ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
+                lc->name);
+        from = buf_from; // redundant
+        if(ii - 1 > 0) {
+            snprintf(buf_from, sizeof(buf_from), "%s/%s.%d",
+                     ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
+                     lc->name, ii - 1);
+            buf_from[sizeof(buf_from) - 1] = 0;
+            from = buf_from; // redundant
+        }
+        snprintf(to, sizeof(to), "%s/%s.%d",
+                 ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
+                 lc->name, ii);
+        to[sizeof(to) - 1] = 0;
+        rename(from, to);
+    }
+    lc->flags &= ~(LOG_FLAG_INIT_FAIL | LOG_FLAG_INIT_DONE);
+    fn_len = snprintf(fn, sizeof(fn), "%s/%s",
+                      ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
+                      lc->name);
+    if(fn_len > LOG_MAX_PATH) {
+        printf("%s: The log file name <%s> is too long",
+               __func__, lc->name);
+        return;
+    }
+    lc->f = fopen(fn, "a+");
+    if(lc->f) {
+        lc->flags |= LOG_FLAG_INIT_DONE;
+    } else {
+        printf("%s: failed to create <%s/%s> after rotation,"
+               "error:%s\n",
+               __func__,
+               ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
+               lc->name, strerror(errno));
+        lc->flags |= LOG_FLAG_INIT_FAIL;
+    }
+}
+#endif // LOG_FLAG_FILE
+
+// Log ring record
+typedef struct {
+    unsigned int seq; // record sequence number (see log_ring[] below)
+    int dst;          // log destination
+    int tid;          // ID of the thread that logged the message
+    time_t t;         // time the message was logged
+    int len;          // message length
+    char *big;        // allocated message buffer (if it did not fit msg[])
+    char msg[LOG_REC_MAX_LEN]; // the message
+} LOG_REC_t;
+
+// The ring is a bounded multiple producer single consumer queue. The record
+// sequence number tells its state: seq == pos - the record at the position
+// pos is free for a producer, seq == pos + 1 - the record is filled in and
+// ready for the writer. The producers reserve the records by advancing
+// ring_tail w/ CAS, only the writer thread advances ring_head.
+static LOG_REC_t log_ring[LOG_RING_SIZE];
+static volatile unsigned int ring_tail = 0;
+static volatile unsigned int ring_head = 0;
+
+// Set while the writer thread is running in this process
+static volatile int log_writer_on = FALSE;
+// Set by the writer thread when it is about to sleep
+static volatile int log_writer_idle = FALSE;
+// Set by log_flush() to make the writer write out the repeat counts
+static volatile int log_flush_req = FALSE;
+// Ring position the writer has written and flushed the files up to
+static volatile unsigned int log_flushed_pos = 0;
+// Pipe for waking up the writer thread
+static int log_wake_fd[2] = { -1, -1 };
+// Counters of the messages dropped because the ring was full
+static volatile unsigned int log_drops[LOG_DST_MAX];
+
+// Writer thread per destination state (for coalescing repeated messages
+// and batching the file flushes)
+typedef struct {
+    unsigned int repeats; // times the last message has been repeated
+    int tid;              // thread ID of the last repeat
+    time_t t;             // time of the last repeat
+    time_t first_t;       // time of the first repeat
+    int len;              // last message length (negative if none)
+    int dirty;            // TRUE if the file needs to be flushed
+    char last[LOG_REC_MAX_LEN]; // the last message
+} LOG_WRITER_DST_t;
+static LOG_WRITER_DST_t log_wdst[LOG_DST_MAX];
+
+// Wake up the writer thread
+static void log_wake_writer(void)
+{
+    char c = 0;
+    if(write(log_wake_fd[1], &c, 1) != 1) {
+        // The pipe is full, the writer is already being woken up
+    }
+}
+
+// Put the message into the ring for the writer thread
+// Returns: 0 - if successful, negative if the ring is full
+static int log_ring_put(LOG_DST_t dst, char *str, va_list ap)
+{
+    unsigned int pos;
+    LOG_REC_t *r;
+    va_list ap2;
+    int len, diff;
+
+    // Reserve a record
+    for(;;)
+    {
+        pos = ring_tail;
+        r = &(log_ring[pos & (LOG_RING_SIZE - 1)]);
+        diff = (int)(r->seq - pos);
+        if(diff == 0) {
+            if(__sync_bool_compare_and_swap(&ring_tail, pos, pos + 1)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // The writer has not yet freed the record, the ring is full
+            __sync_fetch_and_add(&(log_drops[dst]), 1);
+            return -1;
+        }
+        // Otherwise another producer has taken the record, try again
+    }
+
+    r->dst = dst;
+    r->tid = syscall(SYS_gettid);
+    r->t = time(NULL);
+    r->big = NULL;
+    va_copy(ap2, ap);
+    len = vsnprintf(r->msg, sizeof(r->msg), str, ap);
+    if(len < 0) {
+        *(r->msg) = 0;
+        len = 0;
+    } else if(len >= sizeof(r->msg)) {
+        r->big = UTIL_MALLOC(len + 1);
+        if(r->big != NULL) {
+            vsnprintf(r->big, len + 1, str, ap2);
+        } else {
+            len = sizeof(r->msg) - 1;
+        }
+    }
+    va_end(ap2);
+    r->len = len;
+
+    // Hand the record over to the writer, wake it up if it is sleeping
+    __sync_synchronize();
+    r->seq = pos + 1;
+    __sync_synchronize();
+    if(log_writer_idle) {
+        log_wake_writer();
+    }
+
+    return 0;
+}
+
+// Write out the last message repeat count (writer thread, the entry
+// mutex must be taken if the entry requires it)
+static void log_write_repeats(LOG_CONFIG_t *lc, LOG_WRITER_DST_t *wd)
+{
+    if(wd->repeats == 0) {
+        return;
+    }
+    if(lc->f != NULL) {
+        log_write_prefix(lc, wd->tid, wd->t);
+        fprintf(lc->f, "last message repeated %u times\n", wd->repeats);
+        wd->dirty = TRUE;
+    }
+    wd->repeats = 0;
+}
+
+// Write the ring record to its log file (writer thread)
+static void log_write_rec(LOG_REC_t *r)
+{
+    LOG_CONFIG_t *lc = &(log_cfg[r->dst]);
+    LOG_WRITER_DST_t *wd = &(log_wdst[r->dst]);
+    char *msg = (r->big != NULL) ? r->big : r->msg;
+
+    // Coalesce the repeated messages
+    if(r->big == NULL && r->len == wd->len &&
+       memcmp(msg, wd->last, r->len) == 0)
+    {
+        if(wd->repeats++ == 0) {
+            wd->first_t = r->t;
+        }
+        wd->tid = r->tid;
+        wd->t = r->t;
+        return;
+    }
+
+    if((lc->flags & LOG_FLAG_MUTEX) != 0) {
+        UTIL_MUTEX_TAKE(&(lc->m));
+    }
+    log_write_repeats(lc, wd);
+    if(lc->f != NULL && (lc->flags & LOG_FLAG_INIT_DONE) != 0) {
+        log_write_prefix(lc, r->tid, r->t);
+        fwrite(msg, 1, r->len, lc->f);
+        wd->dirty = TRUE;
+#ifdef LOG_FLAG_FILE
+        log_rotate(lc);
+#endif // LOG_FLAG_FILE
+    }
+    if((lc->flags & LOG_FLAG_MUTEX) != 0) {
+        UTIL_MUTEX_GIVE(&(lc->m));
+    }
+
+    if(r->big == NULL) {
+        memcpy(wd->last, msg, r->len);
+        wd->len = r->len;
+    } else {
+        wd->len = -1;
+    }
+}
+
+// Write out the drop counters, the repeat counts held for too long
+// (or all if 'force' is set) and flush the files written to (writer thread)
+static void log_flush_files(int force)
+{
+    int ii;
+    unsigned int drops;
+    time_t now = time(NULL);
+
+    for(ii = 0; ii < LOG_DST_MAX; ii++)
+    {
+        LOG_CONFIG_t *lc = &(log_cfg[ii]);
+        LOG_WRITER_DST_t *wd = &(log_wdst[ii]);
+
+        drops = __sync_fetch_and_and(&(log_drops[ii]), 0);
+        if(drops == 0 && !wd->dirty &&
+           (wd->repeats == 0 ||
+            (!force && now - wd->first_t < LOG_REPEAT_FLUSH_SEC)))
+        {
+            continue;
+        }
+        if((lc->flags & LOG_FLAG_MUTEX) != 0) {
+            UTIL_MUTEX_TAKE(&(lc->m));
+        }
+        if(wd->repeats > 0 &&
+           (force || drops > 0 || now - wd->first_t >= LOG_REPEAT_FLUSH_SEC))
+        {
+            log_write_repeats(lc, wd);
+        }
+        if(drops > 0 && lc->f != NULL) {
+            log_write_prefix(lc, syscall(SYS_gettid), now);
+            fprintf(lc->f, "log ring is full, %u messages dropped\n", drops);
+            // The next message should not be coalesced w/ the one before
+            // the drops
+            wd->len = -1;
+            wd->dirty = TRUE;
+        }
+        if(wd->dirty && lc->f != NULL) {
+            fflush(lc->f);
+        }
+        wd->dirty = FALSE;
+        if((lc->flags & LOG_FLAG_MUTEX) != 0) {
+            UTIL_MUTEX_GIVE(&(lc->m));
+        }
+    }
+}
+
+// Log writer thread
+static void log_writer(THRD_PARAM_t *p)
+{
+    unsigned int pos, batch = 0;
+    LOG_REC_t *r;
+    struct pollfd pfd;
+    char buf[64];
+
+    for(;;)
+    {
+        pos = ring_head;
+        r = &(log_ring[pos & (LOG_RING_SIZE - 1)]);
+        if(r->seq == pos + 1) {
+            __sync_synchronize();
+            log_write_rec(r);
+            if(r->big != NULL) {
+                UTIL_FREE(r->big);
+                r->big = NULL;
+            }
+            // Free the record for the producers
+            __sync_synchronize();
+            r->seq = pos + LOG_RING_SIZE;
+            ring_head = pos + 1;
+            // Do not keep the messages in the file buffers for too long
+            // if the ring never gets empty
+            if(++batch >= LOG_RING_SIZE) {
+                log_flush_files(FALSE);
+                batch = 0;
+            }
+            continue;
+        }
+
+        // Nothing to write, flush the files before going to sleep
+        if(log_flush_req) {
+            log_flush_files(TRUE);
+            log_flushed_pos = pos;
+            log_flush_req = FALSE;
+        } else {
+            log_flush_files(FALSE);
+            log_flushed_pos = pos;
+        }
+        batch = 0;
+
+        // Set the idle flag, then check the ring again, the producers
+        // check the flag after adding a record, so either they wake us up
+        // or we see the record here.
+        log_writer_idle = TRUE;
+        __sync_synchronize();
+        if(r->seq != pos + 1 && !log_flush_req) {
+            memset(&pfd, 0, sizeof(pfd));
+            pfd.fd = log_wake_fd[0];
+            pfd.events = POLLIN;
+            poll(&pfd, 1, LOG_WRITER_IDLE_MS);
+            while(read(log_wake_fd[0], buf, sizeof(buf)) > 0);
+        }
+        log_writer_idle = FALSE;
+    }
+}
+
+// Wait for the log writer thread to write out all the queued messages
+// (the agent exits w/ _exit(), so it has to be called before that)
+void log_flush(void)
+{
+    int ii;
+    unsigned int pos = ring_tail;
+
+    if(!log_writer_on) {
+        return;
+    }
+    log_flush_req = TRUE;
+    __sync_synchronize();
+    log_wake_writer();
+    for(ii = 0; ii < LOG_FLUSH_TMO_MS / 10; ii++) {
+        if(!log_flush_req && (int)(log_flushed_pos - pos) >= 0) {
+            break;
+        }
+        usleep(10000);
+    }
+}
+
+// The forked child processes do not have the writer thread, they
+// log directly to the files
+static void log_atfork_child(void)
+{
+    log_writer_on = FALSE;
+}
+
+// Start the log writer thread
+static int log_writer_start(void)
+{
+    int ii;
+
+    if(pipe(log_wake_fd) != 0) {
+        log("%s: pipe() failed: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    for(ii = 0; ii < 2; ii++) {
+        fcntl(log_wake_fd[ii], F_SETFL,
+              fcntl(log_wake_fd[ii], F_GETFL) | O_NONBLOCK);
+        fcntl(log_wake_fd[ii], F_SETFD, FD_CLOEXEC);
+    }
+    for(ii = 0; ii < LOG_RING_SIZE; ii++) {
+        log_ring[ii].seq = ii;
+    }
+    for(ii = 0; ii < LOG_DST_MAX; ii++) {
+        log_wdst[ii].len = -1;
+    }
+    ring_head = ring_tail = log_flushed_pos = 0;
+    __sync_synchronize();
+
+    if(util_start_thrd("log_writer", log_writer, NULL, NULL) != 0) {
+        log("%s: failed to start the log writer thread\n", __func__);
+        close(log_wake_fd[0]);
+        close(log_wake_fd[1]);
+        log_wake_fd[0] = log_wake_fd[1] = -1;
+        return -1;
+    }
+    pthread_atfork(NULL, NULL, log_atfork_child);
+    log_writer_on = TRUE;
+
+    return 0;
+}
+
 // Log print function
 void unum_log(LOG_DST_t dst, char *str, ...)
 {
     LOG_CONFIG_t *lc = NULL;
     int mutex_taken = FALSE;
-    long fpos;
     va_list ap;
 
     // If process log destination override is set, use it
@@ -270,6 +687,15 @@ void unum_log(LOG_DST_t dst, char *str, ...)
         return;
     }
 
+#ifdef LOG_FLAG_FILE
+    // If the writer thread is running, pass the file messages to it
+    if(log_writer_on && (lc->flags & LOG_FLAG_FILE) != 0) {
+        log_ring_put(dst, str, ap);
+        va_end(ap);
+        return;
+    }
+#endif // LOG_FLAG_FILE
+
     // Take mutex if required
     if((lc->flags & LOG_FLAG_MUTEX) != 0) {
         UTIL_MUTEX_TAKE(&(lc->m));
@@ -287,82 +713,13 @@ void unum_log(LOG_DST_t dst, char *str, ...)
         }
 #endif // LOG_FLAG_TTY
 #ifdef LOG_FLAG_FILE
-        if((lc->flags & LOG_FLAG_FILE) != 0)
+        if((lc->flags & LOG_FLAG_FILE) != 0 && lc->f != NULL)
         {
-            struct tm tm;
-            time_t now;
-            int tid = syscall(SYS_gettid);
-
-            time(&now);
-            gmtime_r(&now, &tm);
-            fprintf(lc->f, "%d %d.%02d.%02d %02d:%02d:%02d ",
-                    tid, 1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday,
-                    tm.tm_hour, tm.tm_min, tm.tm_sec);
+            log_write_prefix(lc, syscall(SYS_gettid), time(NULL));
             vfprintf(lc->f, str, ap);
             fflush(lc->f);
             // Check the file size and rotate if necessary.
-            // Note (TBD): in order to support long messages on platforms where
-            // storing into very limited persistent storage is allowed this has
-            // to be rewritten to print into temporary buffer, stripping off the
-            // excess length of the long messages and then writing to the log.
-            // That will also allow to handle duplicate messages.
-            fpos = ftell(lc->f);
-            if(lc->max_size && fpos >= lc->max_size)
-            {
-                int ii;
-                if(lc->cut_size && fpos > lc->cut_size) {
-                    fseek(lc->f, fpos - 3, SEEK_SET);
-                    fprintf(lc->f, "...");
-                    fflush(lc->f);
-                    ftruncate(fileno(lc->f), lc->cut_size);
-                }
-                fclose(lc->f);
-                for(ii = lc->max; ii >= 1; ii--) {
-                    char buf_from[LOG_MAX_PATH + 4];
-                    char to[LOG_MAX_PATH + 4];
-                    char *from;
-
-                    snprintf(buf_from, sizeof(buf_from), "%s/%s",
-                            ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
-                            lc->name);
-                    from = buf_from; // redundant
-                    if(ii - 1 > 0) {
-                        snprintf(buf_from, sizeof(buf_from), "%s/%s.%d",
-                                 ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
-                                 lc->name, ii - 1);
-                        buf_from[sizeof(buf_from) - 1] = 0;
-                        from = buf_from; // redundant
-                    }
-                    snprintf(to, sizeof(to), "%s/%s.%d", 
-                             ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
-                             lc->name, ii);
-                    to[sizeof(to) - 1] = 0;
-                    rename(from, to);
-                }
-                lc->flags &= ~(LOG_FLAG_INIT_FAIL | LOG_FLAG_INIT_DONE);
-                char fn[LOG_MAX_PATH + 1];
-                int fn_len =
-                    snprintf(fn, sizeof(fn), "%s/%s",
-                         ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
-                         lc->name);
-
-                if(fn_len > LOG_MAX_PATH) {
-                    printf("%s: The log file name <%s> is too long",
-                       __func__, lc->name);
-                    break;
-                }
-                lc->f = fopen(fn, "a+");
-                if(lc->f) {
-                    lc->flags |= LOG_FLAG_INIT_DONE;
-                } else {
-                    printf("%s: failed to create <%s/%s> after rotation,"
-                           "error:%s\n",
-                           __func__,
-                           ((*(lc->name) != '/') ? unum_config.logs_dir : ""),
-                           lc->name, strerror(errno));
-                    lc->flags |= LOG_FLAG_INIT_FAIL;
-                }
-            }
+            log_rotate(lc);
         }
 #endif // LOG_FLAG_FILE
         break;
@@ -387,6 +744,12 @@ int log_init(int level)
             init_log_entry(ii);
         }
     }
+    // The threads can be started from INIT_LEVEL_THREADS, but the jobs
+    // subsystem is set up at that level too, so wait for the next one.
+    // Until the writer is started the messages are written directly.
+    if(level == INIT_LEVEL_THREADS + 1) {
+        log_writer_start();
+    }
 
     // Always return 0 to avoid app error if any of the log entries init fails
     return 0;
@@ -79,6 +79,22 @@ typedef enum {
 // sprintf() parameters are the log name and the integer file number.
 #define LOG_ROTATE_TEMPLATE "%s.%d"
 
+// Asynchronous file logging. Once the log writer thread is started the
+// messages for the file destinations are formatted into the records of
+// a lock-free ring and written to the files by the writer thread (along
+// w/ the rotation), so the threads that log never wait for the file I/O.
+// Number of the records in the ring (must be a power of 2)
+#define LOG_RING_SIZE 256
+// Max message length the ring record holds, the longer messages are
+// formatted into an allocated buffer
+#define LOG_REC_MAX_LEN 240
+// How long (in milliseconds) the writer sleeps if there is nothing to write
+#define LOG_WRITER_IDLE_MS 1000
+// Max time (in seconds) to hold off writing the repeated message count
+#define LOG_REPEAT_FLUSH_SEC 30
+// Max time (in milliseconds) log_flush() waits for the ring to drain
+#define LOG_FLUSH_TMO_MS 2000
+
 // Log rotation cleanup number (if log setup changes from
 // X to Y, and Y < X log_init will clean up all the old
 // log names from Y to LOG_ROTATE_CLEANUP_MAX)
@@ -119,6 +135,9 @@ void clear_proc_log_dst();
 // Set disabled log destinations bitmask. Takes bitmask with
 // bits for the logs that should be disabled set.
 void set_disabled_log_dst_mask(unsigned long mask);
+// Wait for the log writer thread to write out all the queued messages
+// (must be called before _exit() to not lose the tail of the log)
+void log_flush(void);
 // Log subsystem init function
 int log_init(int level);
 
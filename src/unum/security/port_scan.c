@@ -42,30 +42,61 @@ static PORT_SCAN_DEVICE_t g_devices_a[PORT_SCAN_QUEUE_LIMIT];
 // Mutex for protecting fetch URLs globals and the queue
 static UTIL_MUTEX_t g_port_scan_mutex = UTIL_MUTEX_INITIALIZER;
 
-// ACK to syn capturing rule
+// ACK to syn capturing rule (one rule for all the devices being scanned,
+// the callback finds the device by the source IP)
 static PKT_PROC_ENTRY_t tcp_ack_pkt_proc = {
     0,
     {},
-    PKT_MATCH_IP_A1_SRC |
     PKT_MATCH_IP_MY_DST, // only receive responses (unicast) to our scan
-    { .a1 = { .i = 0 }}, // from the IP we are scanning (will be set later)
+    { .a1 = { .i = 0 }},
     PKT_MATCH_TCPUDP_TCP_ONLY | PKT_MATCH_TCPUDP_P1_DST,
     { .p1 = 0 },         // the port will be set by the scanner later
     NULL, scan_ack_rcv_cb, NULL, NULL,
     "ACK for security TCP port scanner"
 };
 
-// Global scan data (set by scanner before tcp_ack_pkt_proc
-// and the sender are activated)
-static struct {
-    int s;            // socket the sender uses for transmitting SYNs
-    IPV4_ADDR_t ipv4_src; // source IP address for transmitting
-    unsigned short sport; // source port for sending SYNs (net byte order)
-    IPV4_ADDR_t ipv4_dst; // destination IP address for transmitting
+// SYN frame length (Ethernet + IP + TCP headers, padded to the min
+// Ethernet frame length)
+#define SCAN_FRAME_LEN ETH_ZLEN
+// Offsets of the IP and TCP headers in the SYN frame
+#define SCAN_FRAME_IP_OFF  sizeof(struct ether_header)
+#define SCAN_FRAME_TCP_OFF (sizeof(struct ether_header) + sizeof(struct iphdr))
+
+// Token bucket units per packet (the tokens are in millionths of a packet,
+// so the bucket can be refilled every microsecond)
+#define SCAN_TB_PKT 1000000ULL
+
+// Device being scanned
+typedef struct {
+    PORT_SCAN_DEVICE_t item;     // the queue item w/ the device JSON
+    const char *mac;             // device MAC string (from the JSON)
+    IPV4_ADDR_t ipv4_dst;        // device IP address
+    int s;                       // raw socket (if TX ring can't be used)
+    UTIL_TXRING_t *ring;         // TX ring for sending SYNs (or NULL)
     PORT_RANGE_MAP_t *to_scan;   // port range w/ ports to scan
     PORT_RANGE_MAP_t *from_scan; // port range to map open ports in
-    unsigned int seq; // sequence # to use in SYNs (ACKs should be +1)
-} scan_params;
+    unsigned long wait_time;     // msec to wait after each scan pass
+    unsigned long retries;       // how many scan retries to make
+    unsigned long pps;           // SYN send rate limit
+    unsigned long long tokens;   // the device token bucket
+    unsigned int cursor;         // next port index to send SYN to
+    int sent;                    // SYNs sent in the current pass
+    int failed;                  // SYNs failed to send in the current pass
+    int active;                  // still sending in the current pass
+    unsigned char frame[SCAN_FRAME_LEN]; // SYN frame template (dport 0)
+} PORT_SCAN_SLOT_t;
+
+// The devices being scanned (set by scanner before tcp_ack_pkt_proc
+// and the sender are activated)
+static PORT_SCAN_SLOT_t scan_slots[PORT_SCAN_PARALLEL];
+static int scan_slots_num;
+
+// TX rings of the interfaces used for scanning the devices
+static struct {
+    char ifname[IFNAMSIZ];
+    UTIL_TXRING_t ring;
+} scan_rings[PORT_SCAN_PARALLEL];
+static int scan_rings_num;
 
 
 // TCP ACK packets receive callback for the port scanner, called by tpcap
@@ -81,6 +112,8 @@ static void scan_ack_rcv_cb(TPCAP_IF_t *tpif,
 {
     //struct ethhdr *ehdr = (struct ethhdr *)((void *)thdr + thdr->tp_mac);
     struct tcphdr *tcph = ((void *)iph) + sizeof(struct iphdr);
+    PORT_SCAN_SLOT_t *sl = NULL;
+    int ii;
 
     // Set the port as open in the port map
     unsigned short port = ntohs(tcph->source);
@@ -91,11 +124,22 @@ static void scan_ack_rcv_cb(TPCAP_IF_t *tpif,
         return;
     }
 
+    // Find the device the response is from
+    for(ii = 0; ii < scan_slots_num; ++ii) {
+        if(scan_slots[ii].ipv4_dst.i == iph->saddr) {
+            sl = &scan_slots[ii];
+            break;
+        }
+    }
+    if(sl == NULL) {
+        return;
+    }
+
     // We should have SYN and ACK bits set in the response if the port
     // is open. If RST is set instead of SYN, then the port is closed.
     if(tcph->ack && tcph->syn) {
-        UTIL_PORT_RANGE_SET(scan_params.from_scan, port);
-        UTIL_PORT_RANGE_CLEAR(scan_params.to_scan, port);
+        UTIL_PORT_RANGE_SET(sl->from_scan, port);
+        UTIL_PORT_RANGE_CLEAR(sl->to_scan, port);
 
         DPRINTF("%s: IP:" IP_PRINTF_FMT_TPL "->" IP_PRINTF_FMT_TPL
                 " ports:%d->%d SYN:%d ACK:%d\n", __func__,
@@ -104,7 +148,7 @@ static void scan_ack_rcv_cb(TPCAP_IF_t *tpif,
                 tcph->syn, tcph->ack);
 
     } else if(tcph->ack && tcph->rst) {
-        UTIL_PORT_RANGE_CLEAR(scan_params.to_scan, port);
+        UTIL_PORT_RANGE_CLEAR(sl->to_scan, port);
     }
 
     return;
@@ -188,23 +232,57 @@ static int report_device_scan(json_t *device, const char *mac,
     return ret;
 }
 
-// Probe port on a IPv4 address (by sendig SYN pkt)
-//  scan_delay - msecs to wait between each send
-//  wait_time - msecs to wait after each send cycle (all probed ports)
-//  retries - how many scan retries to make
-// Returns: 0 - if successful, negative if fails
-// Note: The to_scan port range is updated by the receiver on the fly
-//       (no locking) to clear the ports we no longer need to scan.
-//       This should work as long as we do not try to change it as well.
-static int probe_ports(unsigned long scan_delay, unsigned long wait_time,
-                       unsigned long retries)
+// Get the TX ring for sending on the interface (the rings are shared
+// by all the devices reachable through the same interface)
+// Returns: the ring pointer or NULL if the ring cannot be set up
+static UTIL_TXRING_t *scan_get_ring(char *ifname)
+{
+    int ii;
+
+    for(ii = 0; ii < scan_rings_num; ++ii) {
+        if(strcmp(scan_rings[ii].ifname, ifname) == 0) {
+            return &(scan_rings[ii].ring);
+        }
+    }
+    if(scan_rings_num >= PORT_SCAN_PARALLEL) {
+        return NULL;
+    }
+    if(util_txring_open(&(scan_rings[ii].ring), ifname,
+                        PORT_SCANNER_TX_FRAME_SIZE,
+                        PORT_SCANNER_TX_FRAMES, 0) != 0)
+    {
+        log("%s: unable to set up TX ring on %s\n", __func__, ifname);
+        return NULL;
+    }
+    strncpy(scan_rings[ii].ifname, ifname, IFNAMSIZ);
+    scan_rings[ii].ifname[IFNAMSIZ - 1] = 0;
+    ++scan_rings_num;
+
+    return &(scan_rings[ii].ring);
+}
+
+// Release all the TX rings
+static void scan_close_rings(void)
 {
-    int i, ii, ret = 0;
-    int s = scan_params.s;                    // socket
-    unsigned short sport = scan_params.sport; // src port (net order)
-    unsigned int seq = scan_params.seq;       // sequence #
-    PORT_RANGE_MAP_t *to_scan = scan_params.to_scan; // ports to scan
+    int ii;
+
+    for(ii = 0; ii < scan_rings_num; ++ii) {
+        util_txring_close(&(scan_rings[ii].ring));
+    }
+    memset(scan_rings, 0, sizeof(scan_rings));
+    scan_rings_num = 0;
+}
 
+// Build the SYN frame template for the device. The template has dport 0
+// w/ the TCP checksum calculated for it, the sender patches both for
+// every port it probes.
+static void scan_build_frame(PORT_SCAN_SLOT_t *sl, unsigned char *smac,
+                             unsigned char *dmac, IPV4_ADDR_t *src,
+                             unsigned short sport, unsigned int seq)
+{
+    struct ethhdr *eth = (struct ethhdr *)sl->frame;
+    struct iphdr *iph = (struct iphdr *)(sl->frame + SCAN_FRAME_IP_OFF);
+    struct tcphdr *tcph = (struct tcphdr *)(sl->frame + SCAN_FRAME_TCP_OFF);
     struct pseudo_header {
         unsigned int source_address;
         unsigned int dest_address;
@@ -212,81 +290,207 @@ static int probe_ports(unsigned long scan_delay, unsigned long wait_time,
         unsigned char protocol;
         unsigned short tcp_length;
         struct tcphdr tcp;
-    } *psh; // pseudoheader for TCP checksum
-    char pkt[(sizeof(struct pseudo_header) + 15) & (~0xf)]; // data buf
-
-    // Set pointers to the pseudo and TCP header within the buffer
-    psh = (struct pseudo_header *)pkt;
-    struct tcphdr *tcph = &(psh->tcp);
-
-    // Prepare the data preset for all sends
-    memset(pkt, 0, sizeof(pkt));
+    } psh; // pseudoheader for TCP checksum
+
+    memset(sl->frame, 0, sizeof(sl->frame));
+
+    // Ethernet header (the MACs are only used when sending through
+    // the TX ring)
+    memcpy(eth->h_dest, dmac, ETH_ALEN);
+    memcpy(eth->h_source, smac, ETH_ALEN);
+    eth->h_proto = htons(ETH_P_IP);
+
+    // IP header
+    iph->version = 4;
+    iph->ihl = sizeof(struct iphdr) / 4;
+    iph->tot_len = htons(sizeof(struct iphdr) + sizeof(struct tcphdr));
+    iph->id = htons(rand() & 0xffff);    //SW-2108 Verified rand is used safely
+    iph->frag_off = htons(IP_DF);
+    iph->ttl = 64;
+    iph->protocol = IPPROTO_TCP;
+    iph->saddr = src->i;
+    iph->daddr = sl->ipv4_dst.i;
+    iph->check = util_ip_cksum((unsigned short *)iph, sizeof(struct iphdr));
 
     // TCP Header
-    tcph->source = sport;
+    tcph->source = htons(sport);
     //tcph->dest = 0;
     tcph->seq = seq;
-    //tcph->ack_seq = 0;
     tcph->doff = sizeof(struct tcphdr) / 4;
-    //tcph->fin=0;
-    tcph->syn=1;
-    //tcph->rst=0;
-    //tcph->psh=0;
-    //tcph->ack=0;
-    //tcph->urg=0;
+    tcph->syn = 1;
     tcph->window = htons(14600);
-    //tcph->check = 0;
-    //tcph->urg_ptr = 0;
-
-    // Prepare fields in the pseudoheader
-    psh->source_address = scan_params.ipv4_src.i;
-    psh->dest_address = scan_params.ipv4_dst.i;
-    //psh->placeholder = 0;
-    psh->protocol = IPPROTO_TCP;
-    psh->tcp_length = htons(sizeof(struct tcphdr));
 
     // Initial checksum (for dport == 0)
-    tcph->check = util_ip_cksum((unsigned short *)psh, sizeof(*psh));
+    memset(&psh, 0, sizeof(psh));
+    psh.source_address = src->i;
+    psh.dest_address = sl->ipv4_dst.i;
+    psh.protocol = IPPROTO_TCP;
+    psh.tcp_length = htons(sizeof(struct tcphdr));
+    memcpy(&psh.tcp, tcph, sizeof(struct tcphdr));
+    tcph->check = util_ip_cksum((unsigned short *)&psh, sizeof(psh));
+}
+
+// Send SYN to the next port of the device that is still to be scanned
+// Returns: 1 - SYN sent (or failed to send), 0 - no ports left to probe,
+//          negative - the TX ring is full (try again later)
+static int scan_send_syn(PORT_SCAN_SLOT_t *sl)
+{
+    struct tpacket_hdr *tph = NULL;
+    unsigned char buf[SCAN_FRAME_LEN];
+    unsigned char *frame = buf;
+    struct tcphdr *tcph;
+    unsigned short port = 0;
+    unsigned long sum;
+
+    // Find the next port to probe
+    for(; sl->cursor < sl->to_scan->len; ++(sl->cursor)) {
+        port = sl->to_scan->start + sl->cursor;
+        if(UTIL_PORT_RANGE_GET(sl->to_scan, port)) {
+            break;
+        }
+    }
+    if(sl->cursor >= sl->to_scan->len) {
+        return 0;
+    }
 
-    // Send the SYN pkts
-    for(ii = 0; ii <= retries; ++ii)
+    if(sl->ring != NULL) {
+        tph = util_txring_get(sl->ring, FALSE);
+        if(tph == NULL) {
+            return -1;
+        }
+        frame = UTIL_TXRING_DATA(tph);
+    }
+    memcpy(frame, sl->frame, SCAN_FRAME_LEN);
+    tcph = (struct tcphdr *)(frame + SCAN_FRAME_TCP_OFF);
+
+    // Update checksum (RFC1141), the template has dport 0
+    tcph->dest = htons(port);
+    sum = (~port & 0xffff);
+    sum += ntohs(tcph->check);
+    sum = (sum & 0xffff) + (sum >> 16);
+    tcph->check = htons(sum + (sum >> 16));
+
+    if(sl->ring != NULL) {
+        util_txring_queue(sl->ring, tph, SCAN_FRAME_LEN);
+    } else if(send(sl->s, tcph, sizeof(struct tcphdr), 0) < 0) {
+        ++(sl->failed);
+    }
+    ++(sl->sent);
+    ++(sl->cursor);
+
+    return 1;
+}
+
+// Probe ports on the devices being scanned (by sendig SYN pkts). The SYNs
+// are sent round robin to all the devices, one at a time, each device
+// has its own token bucket limiting its SYN rate, and there is also
+// a bucket for the total rate. The sender refills the buckets and kicks
+// the TX rings every PORT_SCANNER_TICK_US.
+// Returns: 0 - if successful, negative if fails
+// Note: The to_scan port ranges are updated by the receiver on the fly
+//       (no locking) to clear the ports we no longer need to scan.
+//       This should work as long as we do not try to change them as well.
+static int probe_ports(void)
+{
+    int ii, jj, kk, ret = 0;
+    int start = 0; // the device the round robin starts from
+    unsigned long pass, passes = 0, wait_time = 0;
+    unsigned long long now, last, tokens;
+
+    for(jj = 0; jj < scan_slots_num; ++jj) {
+        passes = UTIL_MAX(passes, scan_slots[jj].retries + 1);
+    }
+
+    for(pass = 0; pass < passes; ++pass)
     {
-        unsigned long sum;
-        int count, count_failed;
-        unsigned short port, port_old;
-
-        DPRINTF("Scan pass %d, send delay %lu\n", ii + 1, scan_delay);
-
-        // Send the SYN pkts updating the dport and checksum
-        // only for each send
-        count = count_failed = 0;
-        for(i = 0; i < to_scan->len; i++) {
-            port = to_scan->start + i;
-            if(!UTIL_PORT_RANGE_GET(to_scan, port)) {
-                continue;
+        int active = 0;
+
+        // Prepare the devices for the pass
+        for(jj = 0; jj < scan_slots_num; ++jj) {
+            PORT_SCAN_SLOT_t *sl = &scan_slots[jj];
+            sl->active = (pass <= sl->retries);
+            sl->cursor = 0;
+            sl->sent = sl->failed = 0;
+            sl->tokens = PORT_SCANNER_BURST * SCAN_TB_PKT;
+            if(sl->active) {
+                ++active;
+                wait_time = UTIL_MAX(wait_time, sl->wait_time);
             }
-            ++count;
-
-            // Update checksum (RFC1141)
-            port_old = ntohs(tcph->dest);
-            tcph->dest = htons(port);
-            sum = port_old + (~port & 0xffff);
-            sum += ntohs(tcph->check);
-            sum = (sum & 0xffff) + (sum >> 16);
-            tcph->check = htons(sum + (sum >> 16));
-
-            if(send(s, tcph, sizeof(struct tcphdr), 0) < 0) {
-                ++count_failed;
+        }
+        tokens = PORT_SCANNER_BURST * SCAN_TB_PKT;
+        last = util_time(1000000);
+
+        DPRINTF("Scan pass %lu, %d device(s)\n", pass + 1, active);
+
+        while(active > 0)
+        {
+            int sent, more = TRUE;
+
+            // Refill the buckets
+            now = util_time(1000000);
+            for(jj = 0; jj < scan_slots_num; ++jj) {
+                PORT_SCAN_SLOT_t *sl = &scan_slots[jj];
+                sl->tokens += (now - last) * sl->pps;
+                sl->tokens = UTIL_MIN(sl->tokens,
+                                      PORT_SCANNER_BURST * SCAN_TB_PKT);
+            }
+            tokens += (now - last) * PORT_SCANNER_DEFAULT_PPS;
+            tokens = UTIL_MIN(tokens, PORT_SCANNER_BURST * SCAN_TB_PKT);
+            last = now;
+
+            // Send SYNs round robin while there are tokens. When the
+            // global bucket runs out mid round, the next round continues
+            // from the device after the last one served, so the devices
+            // at the start of the table do not take all the tokens.
+            while(more && tokens >= SCAN_TB_PKT)
+            {
+                more = FALSE;
+                for(kk = 0; kk < scan_slots_num; ++kk) {
+                    jj = (start + kk) % scan_slots_num;
+                    PORT_SCAN_SLOT_t *sl = &scan_slots[jj];
+                    if(!sl->active || sl->tokens < SCAN_TB_PKT) {
+                        continue;
+                    }
+                    if(tokens < SCAN_TB_PKT) {
+                        break;
+                    }
+                    sent = scan_send_syn(sl);
+                    if(sent == 0) {
+                        sl->active = FALSE;
+                        --active;
+                        DPRINTF("Scan pass %lu for " IP_PRINTF_FMT_TPL
+                                " complete, sent %d, failed %d\n", pass + 1,
+                                IP_PRINTF_ARG_TPL(sl->ipv4_dst.b),
+                                sl->sent, sl->failed);
+                        if(sl->failed > 0) {
+                            ret = -1;
+                        }
+                        continue;
+                    }
+                    if(sent < 0) {
+                        // The ring is full, retry on the next tick
+                        continue;
+                    }
+                    sl->tokens -= SCAN_TB_PKT;
+                    tokens -= SCAN_TB_PKT;
+                    start = (jj + 1) % scan_slots_num;
+                    more = TRUE;
+                }
             }
 
-            util_msleep(scan_delay);
-        }
-        if(count_failed > 0) {
-            ret = -1;
+            // Have the kernel send out the queued SYNs
+            for(ii = 0; ii < scan_rings_num; ++ii) {
+                if(util_txring_send(&(scan_rings[ii].ring)) != 0) {
+                    ret = -2;
+                }
+            }
+
+            if(active > 0) {
+                usleep(PORT_SCANNER_TICK_US);
+            }
         }
 
-        DPRINTF("Scan pass %d complete, sent %d, failed %d, waiting %lu\n",
-                ii + 1, count, count_failed, wait_time);
+        DPRINTF("Scan pass %lu complete, waiting %lu\n", pass + 1, wait_time);
 
         // Wait for the results
         util_msleep(wait_time);
@@ -295,7 +499,7 @@ static int probe_ports(unsigned long scan_delay, unsigned long wait_time,
     return ret;
 }
 
-// Interface IP check callback for scan_device(). It returns
+// Interface IP check callback for scan_slot_init(). It returns
 // non-0 value if the interface IP matches to the IPv4 addr passed in
 // through the 'ipv4' pointer. The util_enum_ifs() then returns
 // the number of times a non-0 valie was reported by the callback and we
@@ -315,217 +519,275 @@ static int check_if_ip(const char *ifname, void *ipv4)
     return 0;
 }
 
-// Try to handle the server's request to scan an ip address
-// Returns: 0 if successful, error code otherwise
-static int scan_device(PORT_SCAN_DEVICE_t *port_scan_device)
+// Set up the raw IP socket for sending SYNs to the device (used if the
+// device cannot be reached through a TX ring)
+// sl - the device slot
+// src - the source IP address the system will use is returned here
+// Returns: 0 if successful, negative if fails
+static int scan_slot_raw_socket(PORT_SCAN_SLOT_t *sl, IPV4_ADDR_t *src)
 {
-    int s, ret = -1;
-    unsigned long scan_delay, wait_time, retries;
+    struct sockaddr_in saddr;
+    struct sockaddr_in daddr;
+    socklen_t addrlen = sizeof(saddr);
 
-    // Set up socket for sending SYN pkts
-    s = socket(AF_INET, SOCK_RAW , IPPROTO_TCP);
-    if(s < 0) {
+    sl->s = socket(AF_INET, SOCK_RAW , IPPROTO_TCP);
+    if(sl->s < 0) {
         log("%s: failed to create socket, error: %s\n",
             __func__, strerror(errno));
-        return ret;
+        return -1;
     }
 
-    PORT_RANGE_MAP_t *to_scan = NULL;
-    PORT_RANGE_MAP_t *from_scan = NULL;
+    // We need to know source IP address the system will use for
+    // calcualting the TCP header checksum, try to figure it out
+    // by attempting connect on the socket we will use.
+    memset(&daddr, 0, sizeof(daddr));
+    daddr.sin_family = AF_INET;
+    daddr.sin_addr.s_addr = sl->ipv4_dst.i;
+    if(connect(sl->s, (struct sockaddr *)&daddr, sizeof(daddr)) != 0 ||
+       getsockname(sl->s, (struct sockaddr *)&saddr, &addrlen) != 0)
+    {
+        log("%s: unable to connect to %s\n",
+            __func__, inet_ntoa(daddr.sin_addr));
+        return -2;
+    }
+    log_dbg("%s: scanning from src IP: %s\n",
+            __func__, inet_ntoa(saddr.sin_addr));
+    // Make sure it is one of our LAN IPs
+    if(util_enum_ifs(UTIL_IF_ENUM_RTR_LAN,
+                     check_if_ip, &saddr.sin_addr) <= 0)
+    {
+        log("%s: no source IP %s is configured on LAN interfaces\n",
+            __func__, inet_ntoa(saddr.sin_addr));
+        return -3;
+    }
+    src->i = saddr.sin_addr.s_addr;
 
-    for(;;) {
-        log("%s: scanning device\n", __func__);
+    return 0;
+}
 
-        json_t *mac_obj = json_object_get(port_scan_device->device, "mac");
-        if(!mac_obj) {
-            log("%s: missing MAC address in scan device JSON\n", __func__);
-            break;
-        }
-        size_t mac_len = json_string_length(mac_obj);
-        const char *mac = json_string_value(mac_obj);
-        if(mac_len <= 0 || !mac) {
-            log("%s: invalid MAC string in scan device JSON\n", __func__);
-            break;
-        }
+// Free the device slot resources
+static void scan_slot_free(PORT_SCAN_SLOT_t *sl)
+{
+    if(sl->s >= 0) {
+        close(sl->s);
+    }
+    if(sl->to_scan != NULL) {
+        UTIL_PORT_RANGE_FREE(sl->to_scan);
+    }
+    if(sl->from_scan != NULL) {
+        UTIL_PORT_RANGE_FREE(sl->from_scan);
+    }
+    memset(sl, 0, sizeof(PORT_SCAN_SLOT_t));
+    sl->s = -1;
+}
 
-        json_t *ipv4_obj = json_object_get(port_scan_device->device, "ipv4");
-        if(!ipv4_obj) {
-            log("%s: missing IPv4 address in scan device JSON\n", __func__);
-            break;
-        }
-        IPV4_ADDR_t ipv4;
-        const char *ipv4_str = json_string_value(ipv4_obj);
-        if(!ipv4_str || (ipv4.i = inet_addr(ipv4_str)) == INADDR_NONE) {
-            log("%s: invalid IPv4 address in scan device JSON\n", __func__);
-            break;
-        }
+// Prepare the device slot for scanning the device
+// sl - the device slot (should be zeroed out, the item is already in it)
+// sport - source port for sending SYNs
+// Returns: 0 if successful, error code otherwise
+static int scan_slot_init(PORT_SCAN_SLOT_t *sl, unsigned short sport)
+{
+    json_t *device = sl->item.device;
+    unsigned long scan_delay;
+    char ifname[IFNAMSIZ];
+    unsigned char smac[ETH_ALEN], dmac[ETH_ALEN];
+    IPV4_ADDR_t src;
+    DEV_IP_CFG_t ipcfg;
 
-        // Get optional scan time value (in sec)
-        json_t *scan_delay_obj =
-            json_object_get(port_scan_device->device, "scan_delay");
-        if(!scan_delay_obj || !json_is_integer(scan_delay_obj))
-        {
-            scan_delay = PORT_SCANNER_DEFAULT_SCAN_DELAY;
-        } else {
-            scan_delay = json_integer_value(scan_delay_obj);
-        }
+    sl->s = -1;
 
-        // Get optional scan results wait time value (in sec)
-        json_t *wait_time_obj =
-            json_object_get(port_scan_device->device, "wait_time");
-        if(!wait_time_obj || !json_is_integer(wait_time_obj))
-        {
-            wait_time = PORT_SCANNER_DEFAULT_WAIT_TIME;
-        } else {
-            wait_time = json_integer_value(wait_time_obj);
-        }
+    json_t *mac_obj = json_object_get(device, "mac");
+    if(!mac_obj) {
+        log("%s: missing MAC address in scan device JSON\n", __func__);
+        return -1;
+    }
+    size_t mac_len = json_string_length(mac_obj);
+    sl->mac = json_string_value(mac_obj);
+    if(mac_len <= 0 || !sl->mac) {
+        log("%s: invalid MAC string in scan device JSON\n", __func__);
+        return -1;
+    }
 
-        // How many times to retry the scan (0 - scan only once)
-        json_t *retries_obj =
-            json_object_get(port_scan_device->device, "retries");
-        if(!retries_obj || !json_is_integer(retries_obj))
-        {
-            retries = PORT_SCANNER_DEFAULT_SYN_RETRIES;
-        } else {
-            retries = json_integer_value(retries_obj);
-        }
+    json_t *ipv4_obj = json_object_get(device, "ipv4");
+    if(!ipv4_obj) {
+        log("%s: missing IPv4 address in scan device JSON\n", __func__);
+        return -1;
+    }
+    const char *ipv4_str = json_string_value(ipv4_obj);
+    if(!ipv4_str || (sl->ipv4_dst.i = inet_addr(ipv4_str)) == INADDR_NONE) {
+        log("%s: invalid IPv4 address in scan device JSON\n", __func__);
+        return -1;
+    }
 
-        json_t *ports_obj = json_object_get(port_scan_device->device, "ports");
-        if(!ports_obj || (to_scan = util_json_to_port_range(ports_obj)) == NULL)
-        {
-            log("%s: unable to process ports un scan device JSON\n", __func__);
-            break;
-        }
+    // Get optional delay between SYN sends (in msec, translated to the
+    // rate limit)
+    json_t *scan_delay_obj = json_object_get(device, "scan_delay");
+    if(!scan_delay_obj || !json_is_integer(scan_delay_obj))
+    {
+        scan_delay = PORT_SCANNER_DEFAULT_SCAN_DELAY;
+    } else {
+        scan_delay = json_integer_value(scan_delay_obj);
+    }
+    sl->pps = PORT_SCANNER_DEFAULT_DEV_PPS;
+    if(scan_delay > 0) {
+        sl->pps = UTIL_MAX(1000 / scan_delay, 1);
+    }
 
-        // We need to know source IP address the system will use for
-        // calcualting the TCP header checksum, try to figure it out
-        // by attempting connect on the socket we will use.
-        struct sockaddr_in saddr;
-        struct sockaddr_in daddr;
-        memset(&daddr, 0, sizeof(daddr));
-        socklen_t addrlen = sizeof(saddr);
-        daddr.sin_family = AF_INET;
-        daddr.sin_addr.s_addr = ipv4.i;
-        if(connect(s, (struct sockaddr *)&daddr, sizeof(daddr)) != 0 ||
-           getsockname(s, (struct sockaddr *)&saddr, &addrlen) != 0)
-        {
-            log("%s: unable to connect to %s\n",
-                __func__, inet_ntoa(daddr.sin_addr));
-            break;
-        }
-        log_dbg("%s: scanning from src IP: %s\n",
-                __func__, inet_ntoa(saddr.sin_addr));
-        // Make sure it is one of our LAN IPs
-        if(util_enum_ifs(UTIL_IF_ENUM_RTR_LAN,
-                         check_if_ip, &saddr.sin_addr) <= 0)
-        {
-            log("%s: no source IP %s is configured on LAN interfaces\n",
-                __func__, inet_ntoa(saddr.sin_addr));
-            break;
-        }
+    // Get optional SYN send rate (pps, overrides the scan_delay)
+    json_t *rate_obj = json_object_get(device, "rate");
+    if(rate_obj && json_is_integer(rate_obj) &&
+       json_integer_value(rate_obj) > 0)
+    {
+        sl->pps = UTIL_MIN(json_integer_value(rate_obj),
+                           PORT_SCANNER_DEFAULT_PPS);
+    }
 
-        // Prepare the port range map the receiver will use
-        from_scan = UTIL_PORT_RANGE_ALLOC(to_scan->start, to_scan->len);
-        UTIL_PORT_RANGE_RESET(from_scan);
-
-        // Pick random source port (if we inadvertently pick one that is in use)
-        // it will mean a performance hit, but should not cause any major issue.
-        unsigned short sport_h = 0x7fff + (rand() & 0x7fff);    //SW-2108 Verified rand is used safely
-        unsigned short sport = htons(sport_h);
-
-        log_dbg("%s: scanning " IP_PRINTF_FMT_TPL " from port %d\n",
-                __func__, IP_PRINTF_ARG_TPL(ipv4.b), sport_h);
-
-        // Prepare the scan parameters structure
-        scan_params.s = s;
-        scan_params.ipv4_src.i = saddr.sin_addr.s_addr;
-        scan_params.sport = sport;
-        scan_params.ipv4_dst.i = ipv4.i;
-        scan_params.to_scan = to_scan;
-        scan_params.from_scan = from_scan;
-        scan_params.seq = (rand() << 16) ^ rand();    //SW-2108 Verified rand is used safely
-
-        // Prepare and activate the receiving callback handling the
-        // scan responses
-        tcp_ack_pkt_proc.ip.a1.i = ipv4.i;
-        tcp_ack_pkt_proc.tcpudp.p1 = sport_h;
-        if(tpcap_add_proc_entry(&tcp_ack_pkt_proc) != 0)
-        {
-            log("%s: tpcap_add_proc_entry() failed for: %s\n",
-                __func__, tcp_ack_pkt_proc.desc);
-            break;
-        }
+    // Get optional scan results wait time value (in msec)
+    json_t *wait_time_obj = json_object_get(device, "wait_time");
+    if(!wait_time_obj || !json_is_integer(wait_time_obj))
+    {
+        sl->wait_time = PORT_SCANNER_DEFAULT_WAIT_TIME;
+    } else {
+        sl->wait_time = json_integer_value(wait_time_obj);
+    }
 
-        // Scan the ports
-        probe_ports(scan_delay, wait_time, retries);
+    // How many times to retry the scan (0 - scan only once)
+    json_t *retries_obj = json_object_get(device, "retries");
+    if(!retries_obj || !json_is_integer(retries_obj))
+    {
+        sl->retries = PORT_SCANNER_DEFAULT_SYN_RETRIES;
+    } else {
+        sl->retries = json_integer_value(retries_obj);
+    }
 
-        // Stop the receiver
-        tpcap_del_proc_entry(&tcp_ack_pkt_proc);
-        memset(&scan_params, 0, sizeof(scan_params));
+    json_t *ports_obj = json_object_get(device, "ports");
+    if(!ports_obj || (sl->to_scan = util_json_to_port_range(ports_obj)) == NULL)
+    {
+        log("%s: unable to process ports un scan device JSON\n", __func__);
+        return -1;
+    }
 
-        // No longer need the to_scan range
-        UTIL_PORT_RANGE_FREE(to_scan);
-        to_scan = NULL;
+    // Send through the TX ring of the LAN interface the device is on, fall
+    // back to the raw IP socket if it does not work out
+    if(util_find_if_by_ip(&sl->ipv4_dst, ifname) == 0 &&
+       ether_aton_r(sl->mac, (struct ether_addr *)dmac) != NULL &&
+       util_get_mac(ifname, smac) == 0 &&
+       util_get_ipcfg(ifname, &ipcfg) == 0)
+    {
+        sl->ring = scan_get_ring(ifname);
+        src.i = ipcfg.ipv4.i;
+    }
+    if(sl->ring == NULL) {
+        memset(smac, 0, sizeof(smac));
+        memset(dmac, 0, sizeof(dmac));
+        if(scan_slot_raw_socket(sl, &src) != 0) {
+            return -2;
+        }
+    }
 
-        // Report back the collected results
-        report_device_scan(port_scan_device->device, mac, from_scan);
+    // Prepare the port range map the receiver will use
+    sl->from_scan = UTIL_PORT_RANGE_ALLOC(sl->to_scan->start, sl->to_scan->len);
+    UTIL_PORT_RANGE_RESET(sl->from_scan);
 
-        ret = 0;
-        break;
-    }
+    scan_build_frame(sl, smac, dmac, &src, sport,
+                     (rand() << 16) ^ rand()); //SW-2108 Verified rand is used safely
 
-    // Remove packet capturing filter (no harm if not set)
-    tpcap_del_proc_entry(&tcp_ack_pkt_proc);
+    log_dbg("%s: scanning " IP_PRINTF_FMT_TPL " from port %d, %s, %lu pps\n",
+            __func__, IP_PRINTF_ARG_TPL(sl->ipv4_dst.b), sport,
+            (sl->ring ? ifname : "raw socket"), sl->pps);
 
-    // Cleanup the scan params structure
-    memset(&scan_params, 0, sizeof(scan_params));
+    return 0;
+}
 
-    // Done w/ the socket
-    if(s >= 0) {
-        close(s);
-        s = -1;
+// Scan the devices in scan_slots[]
+static void scan_batch(void)
+{
+    int ii, jj;
+
+    // Pick random source port (if we inadvertently pick one that is in use)
+    // it will mean a performance hit, but should not cause any major issue.
+    unsigned short sport = 0x7fff + (rand() & 0x7fff);    //SW-2108 Verified rand is used safely
+
+    log("%s: scanning %d device(s)\n", __func__, scan_slots_num);
+
+    // Prepare the devices, drop the ones we cannot scan
+    for(ii = jj = 0; ii < scan_slots_num; ++ii) {
+        PORT_SCAN_DEVICE_t item = scan_slots[ii].item;
+        memset(&scan_slots[ii], 0, sizeof(PORT_SCAN_SLOT_t));
+        scan_slots[jj].item = item;
+        if(scan_slot_init(&scan_slots[jj], sport) != 0) {
+            json_decref(scan_slots[jj].item.devices);
+            scan_slot_free(&scan_slots[jj]);
+            continue;
+        }
+        ++jj;
     }
+    scan_slots_num = jj;
 
-    // Free the port ranges if still allocated
-    if(to_scan != NULL) {
-        UTIL_PORT_RANGE_FREE(to_scan);
-        to_scan = NULL;
+    // Prepare and activate the receiving callback handling the
+    // scan responses
+    tcp_ack_pkt_proc.tcpudp.p1 = sport;
+    if(scan_slots_num > 0 && tpcap_add_proc_entry(&tcp_ack_pkt_proc) != 0)
+    {
+        log("%s: tpcap_add_proc_entry() failed for: %s\n",
+            __func__, tcp_ack_pkt_proc.desc);
     }
-    if(from_scan != NULL) {
-        UTIL_PORT_RANGE_FREE(from_scan);
-        from_scan = NULL;
+    else if(scan_slots_num > 0)
+    {
+        // Scan the ports
+        probe_ports();
+
+        // Stop the receiver
+        tpcap_del_proc_entry(&tcp_ack_pkt_proc);
+
+        // Report back the collected results
+        for(ii = 0; ii < scan_slots_num; ++ii) {
+            report_device_scan(scan_slots[ii].item.device,
+                               scan_slots[ii].mac, scan_slots[ii].from_scan);
+        }
     }
 
-    return ret;
+    // Cleanup
+    for(ii = 0; ii < scan_slots_num; ++ii) {
+        json_decref(scan_slots[ii].item.devices);
+        scan_slot_free(&scan_slots[ii]);
+    }
+    scan_slots_num = 0;
+    scan_close_rings();
 }
 
 // Port scan thread entry point
 static void scan_devices(THRD_PARAM_t *p)
 {
-    PORT_SCAN_DEVICE_t item, *p_item;
+    PORT_SCAN_DEVICE_t *p_item;
 
     for(;;)
     {
-        // Pull item out from the scan queue, make a local copy and free
-        // the cell it was using
+        // Pull up to PORT_SCAN_PARALLEL items out from the scan queue,
+        // make local copies and free the cells they were using
         UTIL_MUTEX_TAKE(&g_port_scan_mutex);
-        UTIL_Q_REM(&g_queue, p_item);
-        if(p_item == NULL) {
+        scan_slots_num = 0;
+        while(scan_slots_num < PORT_SCAN_PARALLEL) {
+            UTIL_Q_REM(&g_queue, p_item);
+            if(p_item == NULL) {
+                break;
+            }
+            // Store the info in local data structure
+            memcpy(&(scan_slots[scan_slots_num].item), p_item,
+                   sizeof(PORT_SCAN_DEVICE_t));
+            ++scan_slots_num;
+            // Free the cell
+            p_item->devices = p_item->device = NULL;
+        }
+        if(scan_slots_num == 0) {
             // Done with all the queued items, can terminate the thread
             UTIL_MUTEX_GIVE(&g_port_scan_mutex);
             break;
         }
-        // Store the info in local data structure
-        memcpy(&item, p_item, sizeof(item));
-        // Free the cell
-        p_item->devices = p_item->device = NULL;
         UTIL_MUTEX_GIVE(&g_port_scan_mutex);
 
-        // Make the request
-        scan_device(&item);
-
-        // Decrement the reference count
-        json_decref(item.devices);
+        // Scan the devices (decrements the JSON reference counts)
+        scan_batch();
     }
 
     g_port_scan_in_progress = FALSE;
@@ -17,6 +17,27 @@
 // Default number of retries for the scan (0 - no retry, scan only once)
 #define PORT_SCANNER_DEFAULT_SYN_RETRIES 1
 
+// Max number of devices scanned in parallel
+#define PORT_SCAN_PARALLEL 8
+
+// Default SYN send rate (packets per second) for all the devices
+// being scanned in parallel
+#define PORT_SCANNER_DEFAULT_PPS 20000
+
+// Default per device SYN send rate (pps), keeps the scan from overrunning
+// cheap client NICs (can be changed by "rate" or "scan_delay" options)
+#define PORT_SCANNER_DEFAULT_DEV_PPS 5000
+
+// Max number of SYNs sent back to back to a device (token bucket depth)
+#define PORT_SCANNER_BURST 16
+
+// Sender pacing interval (in microseconds)
+#define PORT_SCANNER_TICK_US 1000
+
+// TX ring frame size and number of frames for sending SYNs
+#define PORT_SCANNER_TX_FRAME_SIZE 128
+#define PORT_SCANNER_TX_FRAMES 256
+
 
 // Download URL queue item data structure
 typedef struct _PORT_SCAN_DEVICE {
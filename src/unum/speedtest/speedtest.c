@@ -70,6 +70,15 @@
 
 #define MAX_LATENCY 9999
 
+// Warm-up time (in ms) excluded from the transfer speed calculation (lets
+// the TCP connections ramp up before the measurement starts)
+#define SPEEDTEST_WARMUP_MS 1000
+// Transfer byte counters sampling interval (in ms), it is increased if
+// needed to fit the whole transfer time into HTTP_XFER_MAX_SAMPLES
+#define SPEEDTEST_SAMPLE_MS 200
+// Number of the transfer speed percentiles reported (see speedtest_pct[])
+#define SPEEDTEST_PCT_COUNT 3
+
 // Ping Endpoint Struct
 // Contains the domain (or IP), # of samples
 // and then storage of the latency result 
@@ -105,6 +114,9 @@ typedef struct speedtest_settings
     // Used as the basis for how large each transfer should be.
     // This parameter is called "ookla_size" in the speedtest settings payload.
     int transfer_size_base;
+    // Size of each upload request body (defaults to the transfer_size_base
+    // squared, i.e. the size of the download image).
+    int transfer_upload_size;
     // Base limit in seconds for how long the speedtest is allowed to run.
     // Note that this is not a hard limit and the whole speedtest normally
     // takes between 1.5x and 2x this value.
@@ -135,15 +147,12 @@ static char ifname_buf[IFNAMSIZ];
 static char endpoint_settings_url[256];
 static char endpoint_telemetry_url[256];
 
-// All concurrent reads and writes of any static state should be guarded by
-// the "state_m" mutex.
-static UTIL_MUTEX_t state_m = UTIL_MUTEX_INITIALIZER;
-static UTIL_EVENT_t all_workers_started = UTIL_EVENT_INITIALIZER;
-static UTIL_EVENT_t all_workers_finished = UTIL_EVENT_INITIALIZER;
-
 // Current speedtest results
 static int download_speed_kbps = -1;
 static int upload_speed_kbps = -1;
+// Percentiles of the per-interval transfer speeds (see speedtest_pct[])
+static int download_pct_kbps[SPEEDTEST_PCT_COUNT] = { -1, -1, -1 };
+static int upload_pct_kbps[SPEEDTEST_PCT_COUNT] = { -1, -1, -1 };
 static int latency_ms = -1;
 static int complete = 0;
 
@@ -152,13 +161,11 @@ static int test_id = 0;
 
 // Speedtest settings
 static speedtest_settings settings;
-// Contains the state of the currently running speedtest.
-// Values below are modified in concurrent operations.
-static int running_workers;
-static int worker_error;
-static size_t total_bytes_transferred;
-static unsigned long start_time_in_ms;
-static unsigned long end_time_in_ms;
+
+// Transfer speed percentiles reported
+static int speedtest_pct[SPEEDTEST_PCT_COUNT] = { 10, 50, 90 };
+// Parameters and byte counter samples of the current transfer test
+static HTTP_XFER_TEST_t xfer_test;
 
 
 // Pointer to a function that performs a portion of an overall speedtest.
@@ -208,6 +215,9 @@ static speedtest *speedtests;
 #define MAX_TRANSFER_SIZE_BASE 10000
 #define DEFAULT_TRANSFER_SIZE_BASE 4000
 
+#define MIN_UPLOAD_SIZE (1024 * 1024)
+#define MAX_UPLOAD_SIZE (128 * 1024 * 1024)
+
 #define MIN_TIME_LIMIT 5
 #define MAX_TIME_LIMIT 120
 #define DEFAULT_TIME_LIMIT 20
@@ -228,6 +238,8 @@ static speedtest_settings speedtest_default_settings() {
         .transfer_samples = DEFAULT_TRANSFER_SAMPLES,
         .transfer_concurrency = DEFAULT_TRANSFER_CONCURRENCY,
         .transfer_size_base = DEFAULT_TRANSFER_SIZE_BASE,
+        .transfer_upload_size = DEFAULT_TRANSFER_SIZE_BASE *
+                                DEFAULT_TRANSFER_SIZE_BASE,
         .time_limit_sec = DEFAULT_TIME_LIMIT,
         .transfer_time_limit_sec = DEFAULT_XFER_TIME_LIMIT,
         .endpoints = {
@@ -326,23 +338,20 @@ static int snprint_upload_url(char *res, size_t sz)
 // Not thread safe. Only call this from the main speedtest thread.
 static void reset_results()
 {
+    int ii;
+
     download_speed_kbps = -1;
     upload_speed_kbps = -1;
+    for(ii = 0; ii < SPEEDTEST_PCT_COUNT; ++ii) {
+        download_pct_kbps[ii] = -1;
+        upload_pct_kbps[ii] = -1;
+    }
     latency_ms = -1;
     complete = 0;
     endpoint = NULL;
     test_id = 0;
 }
 
-// Reset shared static state.
-// Not thread safe. Only call this from the main speedtest thread.
-static void reset_counters()
-{
-    total_bytes_transferred = 0;
-    running_workers = 0;
-    worker_error = 0;
-}
-
 // Populates ping endpoint from JSON data
 static void read_ping_endpoint_entry(speedtest_settings *cfg, const json_t *root,
                                      const char *domain, const char *samples,
@@ -453,9 +462,18 @@ static int speedtest_read_settings(json_t *data_root, speedtest_settings *cfg)
         cfg->transfer_size_base = json_integer_value(val) & 0xFFFF;
         UTIL_RANGE_CHECK(cfg->transfer_size_base, MIN_TRANSFER_SIZE_BASE,
                          MAX_TRANSFER_SIZE_BASE);
+        cfg->transfer_upload_size = cfg->transfer_size_base *
+                                    cfg->transfer_size_base;
     } else {
         return -1;
     }
+    if((val = json_object_get(data_root, "upload_size")) != NULL) {
+        cfg->transfer_upload_size = json_integer_value(val) & 0x7FFFFFFF;
+        UTIL_RANGE_CHECK(cfg->transfer_upload_size, MIN_UPLOAD_SIZE,
+                         MAX_UPLOAD_SIZE);
+    } else {
+        // This field is optional
+    }
     if((val = json_object_get(data_root, "num_sizes")) != NULL) {
         cfg->transfer_samples = json_integer_value(val) & 0xFFFF;
         UTIL_RANGE_CHECK(cfg->transfer_samples, MIN_TRANSFER_SAMPLES,
@@ -522,7 +540,7 @@ static int speedtest_read_settings(json_t *data_root, speedtest_settings *cfg)
 // Attempts to retrieve speedtest settings from the Minim API.
 // If the device is not activated or does not have SSL certificates
 // configured correctly, this call will fail, returning < 0.
-// Not thread safe. Only call this before starting any worker threads.
+// Not thread safe. Only call this before starting the tests.
 static int speedtest_fetch_settings(speedtest_settings *cfg)
 {
     if(cfg == NULL) {
@@ -582,6 +600,7 @@ static void speedtest_print_settings()
     log("%s: time_limit(%isec)\n", __func__, settings.time_limit_sec);
     log("%s: download_image_size(%ix%i)\n",
         __func__, settings.transfer_size_base, settings.transfer_size_base);
+    log("%s: upload_size(%i)\n", __func__, settings.transfer_upload_size);
     log("%s: per_test_time_limit(%isec)\n",
         __func__, settings.transfer_time_limit_sec);
     int ii = 0;
@@ -609,7 +628,7 @@ static void speedtest_print_settings()
 }
 
 // Resolve the IP address for the configured speedtest endpoint domain.
-// Not thread safe. Should be called before starting any worker threads.
+// Not thread safe. Should be called before starting the transfers.
 static int resolve_server_addr()
 {
     s_addr_in_ptr = (struct sockaddr_in*)&s_addr;
@@ -627,17 +646,43 @@ static int resolve_server_addr()
     return 0;
 }
 
-// Generic test procedure for initiating a multiple concurrent transfers and
-// measuring the cumulative bytes transferred.
-// This function spawns transfer_concurrency-1 number of threads using workfn
-// as the thread entry point.
+// Bytes transferred by all the streams of the transfer test by the time
+// of the sample (0 if the sample index is negative)
+static unsigned long long xfer_total(HTTP_XFER_TEST_t *xt, int sample)
+{
+    unsigned long long total = 0;
+    int ii;
+
+    if(sample < 0) {
+        return 0;
+    }
+    for(ii = 0; ii < xt->streams; ++ii) {
+        total += xt->bytes[sample][ii];
+    }
+    return total;
+}
+
+// Compare function for sorting the interval speeds
+static int cmp_kbps(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// Generic test procedure for running multiple concurrent transfers and
+// measuring the speed. All the transfers are driven from the calling
+// thread by http_xfer_test(), which samples the per-stream byte counters
+// every sample interval. The speed is calculated from the bytes transferred
+// after the warm-up, the per-interval speeds give the percentiles.
 // If the test fails, the return value will be < 0.
-static int speedtest_transfer(const char *descriptor, THRD_FUNC_t workfn,
-    int *speed_kbps)
+static int speedtest_transfer(const char *descriptor, int upload,
+                              int *speed_kbps, int *pct_kbps)
 {
-    reset_counters();
-    UTIL_EVENT_RESET(&all_workers_started);
-    UTIL_EVENT_RESET(&all_workers_finished);
+    HTTP_XFER_TEST_t *xt = &xfer_test;
+    char url[256];
+    int rates[HTTP_XFER_MAX_SAMPLES];
+    unsigned long long bytes;
+    unsigned int t0, dt;
+    int ii, first, count, speed;
 
     // Resolve Server Address for target
     if(resolve_server_addr() < 0) {
@@ -647,145 +692,83 @@ static int speedtest_transfer(const char *descriptor, THRD_FUNC_t workfn,
        return -1;
     }
 
-    // Used as the parameter to the main thread's worker function.
-    THRD_PARAM_t t_param = {{.int_val = TRUE}};
-
-    int starting_workers = 0;
-    while(starting_workers < settings.transfer_concurrency-1) {
-        // Start individual worker threads.
-        // NULL is used as the THRD_PARAM_t and can be subsequently checked
-        // for inside the function workfn points to.
-        // The function pointed at should wait to start its transfer until a
-        // signal from the master worker indicates all workers are ready.
-        // See the speedtest_transfer_worker function for an example.
-        if(util_start_thrd("speedtest_transfer_worker", workfn, NULL, NULL) == 0) {
-            ++starting_workers;
-        } else {
-            log("%s: speedtest worker failed to start\n", __func__);
-            return -1;
-        }
+    if(upload) {
+        snprint_upload_url(url, sizeof(url));
+    } else {
+        snprint_download_url(url, sizeof(url));
     }
-
-    // Give the other threads time to start and ready themselves.
-    while(running_workers < starting_workers) {
-        sleep(1);
+    memset(xt, 0, sizeof(HTTP_XFER_TEST_t));
+    xt->url = url;
+    xt->ifname = ifname;
+    xt->upload = upload;
+    xt->streams = settings.transfer_concurrency;
+    xt->max_requests = settings.transfer_samples;
+    xt->upload_size = settings.transfer_upload_size;
+    xt->time_limit_ms = settings.transfer_time_limit_sec * 1000;
+    xt->sample_ms = UTIL_MAX(SPEEDTEST_SAMPLE_MS,
+                             xt->time_limit_ms / (HTTP_XFER_MAX_SAMPLES - 1) + 1);
+
+    log("%s: %s %s, %d streams\n", __func__, descriptor, url, xt->streams);
+
+    ii = http_xfer_test(xt);
+    if(xt->num_samples > 0) {
+        bytes = xfer_total(xt, xt->num_samples - 1);
+    } else {
+        bytes = 0;
     }
-
-    // Call workfn in the current thread, this is our master worker.
-    // Notice that this invocation of workfn receives a valid pointer
-    // to THRD_PARAM_t instead of NULL.
-    // The function pointed at should signal to all the worker threads
-    // to start their individual transfers.
-    // This call should block until all worker threads are done processing.
-    (*workfn)(&t_param);
-
-    log("%s: %s complete after %lums and %lubytes\n",
-        __func__, descriptor,
-        (unsigned long)(end_time_in_ms - start_time_in_ms),
-        (unsigned long)total_bytes_transferred);
-
-    if(worker_error < 0) {
+    log("%s: %s complete after %ums and %llubytes\n",
+        __func__, descriptor, xt->duration_ms, bytes);
+    if(ii < 0 || xt->num_samples <= 0) {
         log("%s: %s finished with errors, discarding result\n",
             __func__, descriptor);
         return -1;
     }
-    // Test was successful, calculate the speed in kbps.
-    unsigned long duration_in_mseconds = end_time_in_ms - start_time_in_ms;
-    int speed = (total_bytes_transferred / duration_in_mseconds) * 8;
-
-    *speed_kbps = speed;
-
-    log("%s: %s speed: %ikbps\n", __func__, descriptor, speed);
-
-    return 0;
-}
 
-// A function pointer type for http_download_test and http_upload_test.
-// Parameters, in order: the URL to fetch, the timeout in seconds, and finally,
-// the size_t out parameter which is populated with the number of bytes
-// transferred during the test.
-typedef int (*transfer_func)(char*, char*, long, size_t*);
-
-// Performs one set of transfers generically by delegating most
-// of the work to the transfer_func function pointer, which should be
-// either http_download_test or http_upload_test.
-static void speedtest_transfer_worker(const char *descriptor,
-    transfer_func transfer_fn, char *url, THRD_PARAM_t *p)
-{
-    UTIL_MUTEX_TAKE(&state_m);
-    int worker_id = ++running_workers;
-    UTIL_MUTEX_GIVE(&state_m);
-
-    // Kick off all workers if we are the main worker thread, otherwise
-    // wait for the kick off.
-    if(p && p->int_val) {
-        // Set the start time from only the main worker thread.
-        // Note that the end time is set by the last worker to finish.
-        start_time_in_ms = util_time(1000);
-
-        UTIL_EVENT_SETALL(&all_workers_started);
-
-        // Print the target URL, but only once.
-        log("%s: %s %s\n", __func__, descriptor, url);
-    } else {
-        UTIL_EVENT_WAIT(&all_workers_started);
+    // Skip the warm-up samples (unless the test was too short for that)
+    for(first = 0; first < xt->num_samples &&
+                   xt->sample_t[first] <= SPEEDTEST_WARMUP_MS; ++first);
+    if(first >= xt->num_samples) {
+        first = 0;
     }
+    t0 = (first > 0) ? xt->sample_t[first - 1] : 0;
+    dt = xt->sample_t[xt->num_samples - 1] - t0;
+    if(dt == 0) {
+        log("%s: %s took no time, discarding result\n", __func__, descriptor);
+        return -1;
+    }
+    // Test was successful, calculate the speed in kbps.
+    bytes -= xfer_total(xt, first - 1);
+    speed = (int)((bytes * 8) / dt);
+    *speed_kbps = speed;
 
-    unsigned long start_ms = util_time(1000);
-    unsigned long checkpoint_ms = 0;
-    int x;
-    for(x = 0; x < settings.transfer_samples; ++x)
-    {
-        // Break if any worker has hit an error.
-        if(worker_error < 0) {
-            break;
-        }
-        log("%s(#%i): starting %s %i of %i \n",
-            __func__, worker_id, descriptor, x+1, settings.transfer_samples);
-
-        // Invoke the received transfer_func.
-        size_t bytes_transferred;
-        if((*transfer_fn)(ifname, url,
-            settings.transfer_time_limit_sec, &bytes_transferred) < 0)
-        {
-            log("%s(#%i): %s of chunk failed\n",
-                __func__, worker_id, descriptor);
-
-            __sync_synchronize();
-            worker_error = -1;
+    // Per-interval speeds, ignoring too short intervals (the last one
+    // is typically cut short by the end of the test)
+    for(count = 0, ii = first; ii < xt->num_samples; ++ii) {
+        t0 = (ii > 0) ? xt->sample_t[ii - 1] : 0;
+        dt = xt->sample_t[ii] - t0;
+        if(dt < xt->sample_ms / 2) {
+            continue;
         }
-
-        UTIL_MUTEX_TAKE(&state_m);
-        total_bytes_transferred += bytes_transferred;
-        UTIL_MUTEX_GIVE(&state_m);
-
-        // Break if we are within 1 second of hitting our deadline.
-        checkpoint_ms = util_time(1000);
-        if(checkpoint_ms - start_ms >
-            (settings.transfer_time_limit_sec - 1) * 1000)
-        {
-            break;
+        bytes = xfer_total(xt, ii) - xfer_total(xt, ii - 1);
+        rates[count++] = (int)((bytes * 8) / dt);
+    }
+    if(count > 0) {
+        qsort(rates, count, sizeof(int), cmp_kbps);
+        for(ii = 0; ii < SPEEDTEST_PCT_COUNT; ++ii) {
+            pct_kbps[ii] = rates[(speedtest_pct[ii] * (count - 1) + 50) / 100];
         }
     }
 
-    // Wind down this worker.
-    UTIL_MUTEX_TAKE(&state_m);
-    --running_workers;
-    if(running_workers == 0) {
-        // The last worker (the current thread) finished; record the end time
-        end_time_in_ms = checkpoint_ms;
-        // and signal to all threads that the transfer test is complete.
-        UTIL_EVENT_SETALL(&all_workers_finished);
+    log("%s: %s speed: %ikbps, p%d/p%d/p%d: %i/%i/%ikbps\n",
+        __func__, descriptor, speed,
+        speedtest_pct[0], speedtest_pct[1], speedtest_pct[2],
+        pct_kbps[0], pct_kbps[1], pct_kbps[2]);
+    for(ii = 0; ii < xt->streams; ++ii) {
+        log("%s: %s stream #%d: %llubytes\n", __func__, descriptor, ii,
+            xt->bytes[xt->num_samples - 1][ii]);
     }
-    UTIL_MUTEX_GIVE(&state_m);
-
-    // Wait till all workers are done before shutting any of them down.
-    // This is necessary to avoid negatively impacting any active transfers
-    // still running on other threads by causing a potentially expensive
-    // thread cleanup operation.
-    UTIL_EVENT_TIMEDWAIT(&all_workers_finished, 60000);
 
-    return;
+    return 0;
 }
 
 // Serializes the current speedtest results as a JSON string.
@@ -797,6 +780,8 @@ static int speedtest_results_to_json(char *out, int len)
     int download = download_speed_kbps;
     int upload = upload_speed_kbps;
     int latency = latency_ms;
+    int *dp = download_pct_kbps;
+    int *up = upload_pct_kbps;
 
     // Template array for latency
     static JSON_VAL_TPL_t ping_latency_result_tpl[MAX_ENDPOINTS + 1] = {
@@ -830,6 +815,18 @@ static int speedtest_results_to_json(char *out, int len)
             {.type = JSON_VAL_PINT, {.pi = download >= 0 ? &download : NULL}}},
         { "upload_speed_kbps",
             {.type = JSON_VAL_PINT, {.pi = upload   >= 0 ? &upload : NULL}}},
+        { "download_p10_kbps",
+            {.type = JSON_VAL_PINT, {.pi = dp[0] >= 0 ? &dp[0] : NULL}}},
+        { "download_p50_kbps",
+            {.type = JSON_VAL_PINT, {.pi = dp[1] >= 0 ? &dp[1] : NULL}}},
+        { "download_p90_kbps",
+            {.type = JSON_VAL_PINT, {.pi = dp[2] >= 0 ? &dp[2] : NULL}}},
+        { "upload_p10_kbps",
+            {.type = JSON_VAL_PINT, {.pi = up[0] >= 0 ? &up[0] : NULL}}},
+        { "upload_p50_kbps",
+            {.type = JSON_VAL_PINT, {.pi = up[1] >= 0 ? &up[1] : NULL}}},
+        { "upload_p90_kbps",
+            {.type = JSON_VAL_PINT, {.pi = up[2] >= 0 ? &up[2] : NULL}}},
         { "latency_ms",
             {.type = JSON_VAL_PINT, {.pi = latency  >= 0 ? &latency : NULL}}},
         { "ping_endpoints",
@@ -888,7 +885,7 @@ static int speedtest_do_upload_results(const char *jstr, char short_timeout)
 // Upload the current test results, but timeout quickly and do not retry.
 static int speedtest_upload_results_failfast()
 {
-    char jstr[256];
+    char jstr[512];
     speedtest_results_to_json(jstr, sizeof(jstr));
     return speedtest_do_upload_results(jstr, TRUE);
 }
@@ -904,7 +901,7 @@ static int speedtest_upload_results()
     }
     log("%s: uploading results to the Minim API\n", __func__);
 
-    char jstr[256];
+    char jstr[512];
     speedtest_results_to_json(jstr, sizeof(jstr));
     // Short timeout on the first try.
     if(speedtest_do_upload_results(jstr, TRUE) < 0) {
@@ -921,24 +918,6 @@ static int speedtest_upload_results()
     return 0;
 }
 
-// Individual worker thread procedure for the download speed test.
-static void speedtest_download_worker(THRD_PARAM_t *p)
-{
-    char url[255];
-    snprint_download_url(url, sizeof(url));
-    // Delegate most work to the generic speedtest_transfer_worker.
-    speedtest_transfer_worker("download", http_download_test, url, p);
-}
-
-// Individual worker thread procedure for the upload speed test.
-static void speedtest_upload_worker(THRD_PARAM_t *p)
-{
-    char url[255];
-    snprint_upload_url(url, sizeof(url));
-    // Delegate most work to the generic speedtest_transfer_worker.
-    speedtest_transfer_worker("upload", http_upload_test, url, p);
-}
-
 // Connects to sa on specified port and returns the time
 // it took to connect in milliseconds
 static int get_conn_time(struct sockaddr *sa, short port)
@@ -1083,22 +1062,22 @@ static int speedtest_latency()
 // Download speed test procedure.
 static int speedtest_download()
 {
-    return speedtest_transfer("download",
-        speedtest_download_worker, &download_speed_kbps);
+    return speedtest_transfer("download", FALSE,
+                              &download_speed_kbps, download_pct_kbps);
 }
 
 // Upload speed test procedure.
 static int speedtest_upload()
 {
     // Attempt transfer on requested port
-    int result = speedtest_transfer("upload", speedtest_upload_worker,
-                                    &upload_speed_kbps);
+    int result = speedtest_transfer("upload", TRUE,
+                                    &upload_speed_kbps, upload_pct_kbps);
 
     // Fallback to port 80 on failure
     if(result < 0 && endpoint->port != DEFAULT_PORT) {
         endpoint->port = DEFAULT_PORT;
-        result = speedtest_transfer("upload", speedtest_upload_worker,
-                                    &upload_speed_kbps);
+        result = speedtest_transfer("upload", TRUE,
+                                    &upload_speed_kbps, upload_pct_kbps);
     }
 
     return result;
@@ -1244,7 +1223,7 @@ void speedtest_perform(THRD_PARAM_t *p)
         log("%s: agent is not activated, not uploading results\n", __func__);
     }
 
-    char results[256];
+    char results[512];
     speedtest_results_to_json(results, sizeof(results));
     log("%s: results: %s\n", __func__, results);
 }
@@ -1258,3 +1237,229 @@ void cmd_speedtest(char * cmd)
     util_start_thrd("speedtest_perform", speedtest_perform, &t_param, NULL);
 }
 
+
+#ifdef DEBUG
+
+// Loopback test server rate limit (bytes per second per connection)
+#define TEST_LO_RATE (2 * 1024 * 1024)
+// Loopback test server download response body size
+#define TEST_LO_GET_SIZE (3 * 1024 * 1024)
+// Loopback test server receive buffer size
+#define TEST_LO_RCVBUF (64 * 1024)
+// Max connections the loopback test server handles
+#define TEST_LO_MAX_CONN (MAX_TRANSFER_CONCURRENCY + 1)
+
+// Loopback test server connection
+typedef struct {
+    int fd;        // connection socket, -1 if not in use
+    int get;       // TRUE - sending the download body, FALSE - receiving upload
+    size_t left;   // body bytes left to transfer (0 - reading the headers)
+    size_t done;   // body bytes transferred (for the rate limiting)
+    unsigned long long t_start; // time (ms) the body transfer started
+    int hdr_len;   // length of the request headers received so far
+    char hdr[1024];// request headers
+} TEST_LO_CONN_t;
+
+// Loopback test server listening socket and stop flag
+static int test_lo_srv_fd = -1;
+static volatile int test_lo_stop;
+
+// Start transferring the request body (upload) or the response (download)
+// after receiving the request headers
+static void test_lo_request(TEST_LO_CONN_t *c, char *hdr_end)
+{
+    char rsp[128];
+    char *cl;
+    int len, extra;
+
+    extra = c->hdr_len - (hdr_end + 4 - c->hdr);
+    *hdr_end = 0;
+    c->get = (strncmp(c->hdr, "GET ", 4) == 0);
+    c->t_start = util_time(1000);
+    c->done = 0;
+    c->hdr_len = 0;
+    if(c->get) {
+        c->left = TEST_LO_GET_SIZE;
+        len = snprintf(rsp, sizeof(rsp), "HTTP/1.1 200 OK\r\n"
+                       "Content-Length: %d\r\n\r\n", TEST_LO_GET_SIZE);
+        send(c->fd, rsp, len, MSG_NOSIGNAL);
+        return;
+    }
+    cl = strcasestr(c->hdr, "\r\nContent-Length:");
+    c->left = (cl != NULL) ? strtoul(cl + 17, NULL, 10) : 0;
+    // The body bytes received along w/ the headers
+    c->done = UTIL_MIN(extra, c->left);
+    c->left -= c->done;
+    if(c->left == 0) {
+        send(c->fd, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n", 38,
+             MSG_NOSIGNAL);
+    }
+}
+
+// Loopback test server thread, serves keep-alive GET and PUT requests
+// on all the connections from a single thread limiting each connection
+// transfer rate to TEST_LO_RATE
+static void test_lo_server(THRD_PARAM_t *p)
+{
+    static TEST_LO_CONN_t c[TEST_LO_MAX_CONN];
+    static char buf[64 * 1024];
+    struct pollfd pfd;
+    unsigned long long now;
+    size_t allow;
+    int ii, rc;
+
+    for(ii = 0; ii < TEST_LO_MAX_CONN; ++ii) {
+        c[ii].fd = -1;
+    }
+    while(!test_lo_stop)
+    {
+        pfd.fd = test_lo_srv_fd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, 2) > 0) {
+            int fd = accept(test_lo_srv_fd, NULL, NULL);
+            for(ii = 0; fd >= 0 && ii < TEST_LO_MAX_CONN; ++ii) {
+                if(c[ii].fd < 0) {
+                    memset(&c[ii], 0, sizeof(TEST_LO_CONN_t));
+                    c[ii].fd = fd;
+                    fd = -1;
+                }
+            }
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+        now = util_time(1000);
+        for(ii = 0; ii < TEST_LO_MAX_CONN; ++ii)
+        {
+            TEST_LO_CONN_t *cc = &c[ii];
+            if(cc->fd < 0) {
+                continue;
+            }
+            if(cc->left == 0) {
+                char *end;
+                rc = recv(cc->fd, cc->hdr + cc->hdr_len,
+                          sizeof(cc->hdr) - 1 - cc->hdr_len, MSG_DONTWAIT);
+                if(rc == 0 || (rc < 0 && errno != EAGAIN)) {
+                    close(cc->fd);
+                    cc->fd = -1;
+                    continue;
+                }
+                if(rc > 0) {
+                    cc->hdr_len += rc;
+                    cc->hdr[cc->hdr_len] = 0;
+                    if((end = strstr(cc->hdr, "\r\n\r\n")) != NULL) {
+                        test_lo_request(cc, end);
+                    }
+                }
+                continue;
+            }
+            allow = (now - cc->t_start) * TEST_LO_RATE / 1000;
+            if(allow <= cc->done) {
+                continue;
+            }
+            allow = UTIL_MIN(allow - cc->done, cc->left);
+            allow = UTIL_MIN(allow, sizeof(buf));
+            if(cc->get) {
+                rc = send(cc->fd, buf, allow, MSG_DONTWAIT | MSG_NOSIGNAL);
+            } else {
+                rc = recv(cc->fd, buf, allow, MSG_DONTWAIT);
+            }
+            if(rc == 0 || (rc < 0 && errno != EAGAIN)) {
+                close(cc->fd);
+                cc->fd = -1;
+                continue;
+            }
+            if(rc > 0) {
+                cc->done += rc;
+                cc->left -= rc;
+                if(cc->left == 0 && !cc->get) {
+                    send(cc->fd, "HTTP/1.1 200 OK\r\n"
+                         "Content-Length: 0\r\n\r\n", 38, MSG_NOSIGNAL);
+                }
+            }
+        }
+    }
+    for(ii = 0; ii < TEST_LO_MAX_CONN; ++ii) {
+        if(c[ii].fd >= 0) {
+            close(c[ii].fd);
+        }
+    }
+    close(test_lo_srv_fd);
+    test_lo_srv_fd = -1;
+}
+
+// Test the speedtest transfers against the loopback server, the measured
+// speeds should be close to the server rate limit times the streams
+int test_speedtest_lo(void)
+{
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    int ii, expected, ret = 0;
+    char results[512];
+
+    test_lo_srv_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(test_lo_srv_fd < 0) {
+        printf("%s: socket() error: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    // Keep the receive buffer small (as on a real link), otherwise the
+    // loopback connections swallow the whole upload body at once
+    ii = TEST_LO_RCVBUF;
+    setsockopt(test_lo_srv_fd, SOL_SOCKET, SO_RCVBUF, &ii, sizeof(ii));
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(test_lo_srv_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+       listen(test_lo_srv_fd, TEST_LO_MAX_CONN) != 0 ||
+       getsockname(test_lo_srv_fd, (struct sockaddr *)&sa, &sa_len) != 0)
+    {
+        printf("%s: error setting up server: %s\n", __func__, strerror(errno));
+        close(test_lo_srv_fd);
+        return -1;
+    }
+    test_lo_stop = FALSE;
+    if(util_start_thrd("test_lo_srv", test_lo_server, NULL, NULL) != 0) {
+        printf("%s: failed to start the server thread\n", __func__);
+        close(test_lo_srv_fd);
+        return -1;
+    }
+
+    reset_results();
+    settings = speedtest_default_settings();
+    settings.transfer_samples = MAX_TRANSFER_SAMPLES;
+    settings.transfer_time_limit_sec = 4;
+    // Small enough for the upload requests to complete and restart
+    settings.transfer_upload_size = MIN_UPLOAD_SIZE * 2;
+    strcpy(settings.endpoints[0].domain, "127.0.0.1");
+    settings.endpoints[0].port = ntohs(sa.sin_port);
+    ifname = NULL;
+    expected = settings.transfer_concurrency * (TEST_LO_RATE / 1000) * 8;
+
+    printf("%s: %d streams, expected speed %dkbps\n", __func__,
+           settings.transfer_concurrency, expected);
+    if(speedtest_download() != 0 || speedtest_upload() != 0) {
+        printf("%s: transfer test has failed\n", __func__);
+        ret = -1;
+    }
+    test_lo_stop = TRUE;
+
+    speedtest_results_to_json(results, sizeof(results));
+    printf("%s: results: %s\n", __func__, results);
+    for(ii = 0; ii < xfer_test.num_samples; ++ii) {
+        printf("%ums: %llu\n", xfer_test.sample_t[ii],
+               xfer_total(&xfer_test, ii));
+    }
+    if(download_speed_kbps < expected * 8 / 10 ||
+       download_speed_kbps > expected * 12 / 10 ||
+       upload_speed_kbps < expected * 8 / 10 ||
+       upload_speed_kbps > expected * 12 / 10)
+    {
+        printf("%s: measured speeds are too far from expected\n", __func__);
+        ret = -1;
+    }
+    sleep(1);
+
+    return ret;
+}
+
+#endif // DEBUG
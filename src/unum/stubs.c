@@ -16,3 +16,7 @@ void __attribute__((weak)) fp_reset_tables(void)
 {
     return;
 }
+void __attribute__((weak)) fp_epoch_swap(void)
+{
+    return;
+}
@@ -341,144 +341,143 @@ static void process_telemetry_response(json_t *obj)
     return;
 }
 
-static void telemetry(THRD_PARAM_t *p)
+// Router telemetry task step (runs in the reactor worker pool)
+static int telemetry(THRD_PARAM_t *p)
 {
-    unsigned long no_rsp_t = 0;
+    static unsigned long no_rsp_t = 0;
+    static char url[256];
     http_rsp *rsp = NULL;
-    char *my_mac = util_device_mac();
-    char url[256];
+    json_t *rsp_root = NULL;
+    char *jstr = NULL;
+    json_error_t jerr;
 
-    log("%s: started\n", __func__);
+    // Wait for activate to complete
+    if(!is_agent_activated()) {
+        return ACTIVATE_TASK_POLL;
+    }
 
-    log("%s: waiting for activate to complete\n", __func__);
-    wait_for_activate();
-    log("%s: done waiting for activate\n", __func__);
+    // First step after the activation
+    if(*url == 0) {
+        log("%s: done waiting for activate\n", __func__);
 
 #if FEATURE_UBUS_TELEMETRY
-    telemetry_ubus_init();
+        telemetry_ubus_init();
 #endif // FEATURE_UBUS_TELEMETRY
 
-    util_wd_set_timeout(HTTP_REQ_MAX_TIME + unum_config.telemetry_period);
+        util_wd_set_timeout(HTTP_REQ_MAX_TIME + unum_config.telemetry_period);
 
-    memset(&last_sent, '\0', sizeof(last_sent));
+        memset(&last_sent, '\0', sizeof(last_sent));
 
-    // Prepare the URL string
-    util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API, url, sizeof(url),
-                   TELEMETRY_PATH, my_mac);
+        // Prepare the URL string
+        util_build_url(RESOURCE_PROTO_HTTPS, RESOURCE_TYPE_API,
+                       url, sizeof(url), TELEMETRY_PATH, util_device_mac());
+    }
 
     for(;;) {
-        json_t *rsp_root = NULL;
-        char *jstr = NULL;
-        json_error_t jerr;
-
-        for(;;) {
 
-            // Prepare the telemetry data JSON
-            jstr = router_telemetry_json();
-            if(!jstr) {
-                log("%s: JSON encode failed\n", __func__);
-                break;
-            }
+        // Prepare the telemetry data JSON
+        jstr = router_telemetry_json();
+        if(!jstr) {
+            log("%s: JSON encode failed\n", __func__);
+            break;
+        }
 #ifdef DEBUG
-            if(get_test_num() == U_TEST_RTR_TELE) {
-                printf("%s: JSON for <%s>:\n%s\n", __func__, url, jstr);
-                if(rand() % 100 > 50) {
-                    printf("Emulating %s request\n", "failed");
-                } else {
-                    printf("Emulating %s request\n", "successful");
-                    // Pretend request was sent successfully
-                    if(telemetry_seq_num == 0) {
-                        ++telemetry_seq_num;
-                    }
-                    router_telemetry_sent();
+        if(get_test_num() == U_TEST_RTR_TELE) {
+            printf("%s: JSON for <%s>:\n%s\n", __func__, url, jstr);
+            if(rand() % 100 > 50) {
+                printf("Emulating %s request\n", "failed");
+            } else {
+                printf("Emulating %s request\n", "successful");
+                // Pretend request was sent successfully
+                if(telemetry_seq_num == 0) {
+                    ++telemetry_seq_num;
                 }
-            } else // send request (function call below) only if not a test
+                router_telemetry_sent();
+            }
+        } else // send request (function call below) only if not a test
 #endif // DEBUG
 
-            // Send the telemetry info
-            rsp = http_post_no_retry(url,
-                                     "Content-Type: application/json\0"
-                                     "Accept: application/json\0",
-                                     jstr, strlen(jstr));
-
-            // While the sequence number is 0 we will not bump it up until
-            // know that the request is processed by the server. After that
-            // bump it up after each attempt to send the router telemetry.
-            if(telemetry_seq_num > 0) {
-                ++telemetry_seq_num;
-            }
+        // Send the telemetry info
+        rsp = http_post_no_retry(url,
+                                 "Content-Type: application/json\0"
+                                 "Accept: application/json\0",
+                                 jstr, strlen(jstr));
+
+        // While the sequence number is 0 we will not bump it up until
+        // know that the request is processed by the server. After that
+        // bump it up after each attempt to send the router telemetry.
+        if(telemetry_seq_num > 0) {
+            ++telemetry_seq_num;
+        }
 
-            if(rsp == NULL)
-            {
-                log("%s: no response\n", __func__);
-                // If no response for over CONNCHECK_OFFLINE_RESTART time period
-                // try to restart the conncheck (this will restart the agent)
-                if(no_rsp_t == 0) {
-                    no_rsp_t = util_time(1);
-                } else if(util_time(1) - no_rsp_t > CONNCHECK_OFFLINE_RESTART) {
-                    log("%s: restarting conncheck...\n", __func__);
-                    restart_conncheck();
-                }
-                break;
-            }
-            no_rsp_t = 0;
-
-            if((rsp->code / 100) != 2)
-            {
-                log("%s: request error, code %d\n", __func__, rsp->code);
-                // If the response code is 400 trigger re-provisioning.
-                if(rsp->code == 400) {
-                    log("%s: restarting device provisioning...\n", __func__);
-                    restart_provision();
-                }
-                break;
+        if(rsp == NULL)
+        {
+            log("%s: no response\n", __func__);
+            // If no response for over CONNCHECK_OFFLINE_RESTART time period
+            // try to restart the conncheck (this will restart the agent)
+            if(no_rsp_t == 0) {
+                no_rsp_t = util_time(1);
+            } else if(util_time(1) - no_rsp_t > CONNCHECK_OFFLINE_RESTART) {
+                log("%s: restarting conncheck...\n", __func__);
+                restart_conncheck();
             }
+            break;
+        }
+        no_rsp_t = 0;
 
-            // The request has been processed by the server. If it had
-            // sequence number 0 start incrementing it.
-            if(telemetry_seq_num == 0) {
-                ++telemetry_seq_num;
+        if((rsp->code / 100) != 2)
+        {
+            log("%s: request error, code %d\n", __func__, rsp->code);
+            // If the response code is 400 trigger re-provisioning.
+            if(rsp->code == 400) {
+                log("%s: restarting device provisioning...\n", __func__);
+                restart_provision();
             }
+            break;
+        }
 
-            // Update telemetry data cache
-            router_telemetry_sent();
+        // The request has been processed by the server. If it had
+        // sequence number 0 start incrementing it.
+        if(telemetry_seq_num == 0) {
+            ++telemetry_seq_num;
+        }
 
-            // Process the incoming JSON (commands)
-            rsp_root = json_loads(rsp->data, JSON_REJECT_DUPLICATES, &jerr);
-            if(!rsp_root) {
-                log("%s: error at l:%d c:%d parsing response, msg: '%s'\n",
-                    __func__, jerr.line, jerr.column, jerr.text);
-                break;
-            }
+        // Update telemetry data cache
+        router_telemetry_sent();
 
-            process_telemetry_response(rsp_root);
+        // Process the incoming JSON (commands)
+        rsp_root = json_loads(rsp->data, JSON_REJECT_DUPLICATES, &jerr);
+        if(!rsp_root) {
+            log("%s: error at l:%d c:%d parsing response, msg: '%s'\n",
+                __func__, jerr.line, jerr.column, jerr.text);
             break;
         }
 
-        if(jstr) {
-            util_free_json_str(jstr);
-            jstr = NULL;
-        }
+        process_telemetry_response(rsp_root);
+        break;
+    }
 
-        if(rsp) {
-            free_rsp(rsp);
-            rsp = NULL;
-        }
+    if(jstr) {
+        util_free_json_str(jstr);
+        jstr = NULL;
+    }
 
-        if(rsp_root) {
-            json_decref(rsp_root);
-            rsp_root = NULL;
-        }
+    if(rsp) {
+        free_rsp(rsp);
+        rsp = NULL;
+    }
 
-        util_wd_poll();
+    if(rsp_root) {
+        json_decref(rsp_root);
+        rsp_root = NULL;
+    }
+
+    util_wd_poll();
 #ifdef FEATURE_UBUS_TELEMETRY
-        telemetry_ubus_refresh();
+    telemetry_ubus_refresh();
 #endif // FEATURE_UBUS_TELEMETRY
-        sleep(unum_config.telemetry_period);
-    }
 
-    // Never reaches here
-    log("%s: done\n", __func__);
+    return unum_config.telemetry_period * 1000;
 }
 
 // Subsystem init fuction
@@ -486,8 +485,10 @@ int telemetry_init(int level)
 {
     int ret = 0;
     if(level == INIT_LEVEL_TELEMETRY) {
-        // Start the telemetry reporting job
-        ret = util_start_thrd("telemetry", telemetry, NULL, NULL);
+        // Start the telemetry reporting task
+        ret = util_reactor_task_add("telemetry", telemetry, NULL, 0,
+                                    REACTOR_TASK_F_BLOCKING);
+        ret = (ret < 0) ? ret : 0;
     }
     return ret;
 }
@@ -496,6 +497,8 @@ int telemetry_init(int level)
 void test_telemetry(void)
 {
     set_activate_event();
-    telemetry(NULL);
+    for(;;) {
+        util_msleep(telemetry(NULL));
+    }
 }
 #endif // DEBUG
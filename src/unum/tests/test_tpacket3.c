@@ -0,0 +1,130 @@
+// (c) 2022 minim.co
+// unum packet capturing tests, TPACKET_V3 block ring
+
+#include "unum.h"
+
+// Compile only in debug version
+#ifdef DEBUG
+
+#ifdef FEATURE_TPCAP_TPACKET_V3
+
+// How long to capture for (in seconds)
+#define TPKT3_TEST_TIME 30
+
+// Max packets to print the info for
+#define TPKT3_TEST_PRINT_PKTS 16
+
+// Forward declarations
+static void tpkt3_pkt_rcv_cb(TPCAP_IF_t *tpif,
+                             PKT_PROC_ENTRY_t *pe,
+                             struct tpacket2_hdr *thdr,
+                             struct ethhdr *ehdr);
+
+// Hook receiving all the Ethernet II packets (the type is never 0)
+static PKT_PROC_ENTRY_t tpkt3_hook = {
+    PKT_MATCH_ETH_TYPE | PKT_MATCH_ETH_TYPE_NEG,
+    { {}, 0 },
+    0,
+    {},
+    0,
+    {},
+    tpkt3_pkt_rcv_cb, NULL, NULL, NULL,
+    "Any Ethernet II pkt"
+};
+
+// Counters updated by the hook
+static unsigned long tpkt3_pkts = 0;
+static unsigned long tpkt3_bytes = 0;
+static unsigned long tpkt3_oversized = 0;
+
+
+// Ethernet function for the test hook, it checks the snap length
+// and prints the info for the first TPKT3_TEST_PRINT_PKTS packets
+static void tpkt3_pkt_rcv_cb(TPCAP_IF_t *tpif,
+                             PKT_PROC_ENTRY_t *pe,
+                             struct tpacket2_hdr *thdr,
+                             struct ethhdr *ehdr)
+{
+    if(thdr->tp_snaplen > TPCAP_SNAP_LEN) {
+        printf("Packet on interface: %s, snaplen %d exceeds %d\n",
+               tpif->name, thdr->tp_snaplen, TPCAP_SNAP_LEN);
+        ++tpkt3_oversized;
+    }
+    if(tpkt3_pkts < TPKT3_TEST_PRINT_PKTS) {
+        printf("Packet on interface: %s, len %d\n", tpif->name, thdr->tp_len);
+        tpkt_print_pkt_info(thdr, ehdr, NULL);
+    }
+    ++tpkt3_pkts;
+    tpkt3_bytes += thdr->tp_snaplen;
+}
+
+// Runs packet capturing for the test in a separate thread
+static void tpkt3_launch_tpcap(THRD_PARAM_t *p)
+{
+    TPCAP_RUN_TEST(TPCAP_TEST_V3);
+}
+#endif // FEATURE_TPCAP_TPACKET_V3
+
+// Test TPACKET_V3 block ring capturing. It runs the packet capturing
+// thread (the ring setup, filters and block processing are the same as
+// in the agent) w/ a hook receiving all the packets for TPKT3_TEST_TIME
+// seconds. The capturing code prints the descriptors of the processed
+// blocks, the hook checks that the packets are cut to the snap length.
+int tpcap_test_v3(void)
+{
+#ifdef FEATURE_TPCAP_TPACKET_V3
+    int ii, count = 0;
+    TPCAP_IF_t *tpif = tpcap_get_if_table();
+    struct tpacket_stats_v3 stats;
+    socklen_t len;
+
+    printf("Ring of %d blocks of %d bytes, %d bytes (TPACKET_V2 ring: "
+           "%d bytes)\n", TPCAP_V3_NUM_BLOCKS, TPCAP_V3_BLOCK_SIZE,
+           TPCAP_V3_NUM_BLOCKS * TPCAP_V3_BLOCK_SIZE,
+           TPCAP_SNAP_LEN * TPCAP_NUM_PACKETS);
+
+    printf("Starting the packet capturing thread...\n");
+    util_start_thrd("tpcap", tpkt3_launch_tpcap, NULL, NULL);
+    sleep(1);
+    if(tpcap_add_proc_entry(&tpkt3_hook) != 0) {
+        printf("Failed to add the packet processing entry\n");
+        return -1;
+    }
+    printf("Capturing for %d sec...\n", TPKT3_TEST_TIME);
+    sleep(TPKT3_TEST_TIME);
+    tpcap_del_proc_entry(&tpkt3_hook);
+
+    // The interface table belongs to the capturing thread, here it is
+    // only used to get the kernel stats for the capturing sockets.
+    for(ii = 0; ii < TPCAP_IF_MAX; ii++)
+    {
+        if((tpif[ii].flags & TPCAP_IF_FD_READY) == 0) {
+            continue;
+        }
+        memset(&stats, 0, sizeof(stats));
+        len = sizeof(stats);
+        getsockopt(tpif[ii].fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len);
+        printf("Kernel stats for %s: packets %u, drops %u, "
+               "queue freezes %u\n", tpif[ii].name,
+               stats.tp_packets, stats.tp_drops, stats.tp_freeze_q_cnt);
+        ++count;
+    }
+
+    printf("Done: %d interfaces, %lu packets, %lu bytes captured, "
+           "%lu over the snap length\n",
+           count, tpkt3_pkts, tpkt3_bytes, tpkt3_oversized);
+
+    if(count == 0 || tpkt3_pkts == 0 || tpkt3_oversized != 0) {
+        printf("FAILED\n");
+        return -1;
+    }
+    printf("PASSED\n");
+
+    return 0;
+#else  // FEATURE_TPCAP_TPACKET_V3
+    printf("The agent is built w/o FEATURE_TPCAP_TPACKET_V3\n");
+    return -1;
+#endif // FEATURE_TPCAP_TPACKET_V3
+}
+
+#endif // DEBUG
@@ -90,6 +90,24 @@ static void print_tests_info()
            "- test zip subsystem\n");
     printf(UTIL_STR(U_TEST_IPTABLES)
            "- test iptables telemetry\n");
+    printf(UTIL_STR(U_TEST_TPCAP_V3)
+           "- test TPACKET_V3 block ring capturing\n");
+    printf(UTIL_STR(U_TEST_CMD_PUSH)
+           "- test command push channel\n");
+    printf(UTIL_STR(U_TEST_SPEEDTEST_LO)
+           "- test speedtest transfers against loopback server\n");
+    printf(UTIL_STR(U_TEST_FP_USERAGENT)
+           "- test UserAgent header scanner\n");
+    printf(UTIL_STR(U_TEST_SPOOL)
+           "- test telemetry spool\n");
+#ifdef FW_UPDATER_RUN_MODE
+    printf(UTIL_STR(U_TEST_FW_STREAM)
+           "- test firmware image streaming\n");
+#endif // FW_UPDATER_RUN_MODE
+    printf(UTIL_STR(U_TEST_IF_CACHE)
+           "- test interface configuration cache\n");
+    printf(UTIL_STR(U_TEST_REACTOR)
+           "- test event loop tasks and fd watchers\n");
     printf(UTIL_STR(U_TEST_UNUSED)
            "- unused\n");
     printf("...\n");
@@ -185,6 +203,36 @@ static int run_platform_tests(int test_num, char *test_num_str)
             test_iptables();
             return 0;
 
+        case U_TEST_TPCAP_V3:
+            return tpcap_test_v3();
+
+        case U_TEST_CMD_PUSH:
+            if(test_cmd_push != NULL) {
+                return test_cmd_push();
+            }
+            printf("This test is not supported on this platform\n");
+            return 0;
+
+        case U_TEST_SPEEDTEST_LO:
+            return test_speedtest_lo();
+
+        case U_TEST_FP_USERAGENT:
+            return test_fp_useragent();
+
+        case U_TEST_SPOOL:
+            return test_spool();
+
+#ifdef FW_UPDATER_RUN_MODE
+        case U_TEST_FW_STREAM:
+            return test_fw_stream();
+#endif // FW_UPDATER_RUN_MODE
+
+        case U_TEST_IF_CACHE:
+            return test_if_cache();
+
+        case U_TEST_REACTOR:
+            return test_reactor();
+
         default:
             printf("There is no test %d\n", test_num);
             break;
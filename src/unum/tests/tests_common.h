@@ -31,7 +31,15 @@
 #define U_TEST_DNS          22 // test dns subsystem
 #define U_TEST_ZIP          23 // test dns subsystem
 #define U_TEST_IPTABLES     24 // test iptables telemetry
-#define U_TEST_UNUSED       25 // next available entry
+#define U_TEST_TPCAP_V3     25 // TPACKET_V3 block ring capturing
+#define U_TEST_CMD_PUSH     26 // command push channel
+#define U_TEST_SPEEDTEST_LO 27 // speedtest transfers against loopback server
+#define U_TEST_FP_USERAGENT 28 // UserAgent header scanner
+#define U_TEST_SPOOL        29 // telemetry spool
+#define U_TEST_FW_STREAM    30 // firmware image streaming
+#define U_TEST_IF_CACHE     31 // interface configuration cache
+#define U_TEST_REACTOR      32 // event loop tasks and fd watchers
+#define U_TEST_UNUSED       33 // next available entry
 
 // Test load cfg (stubbed)
 int test_loadCfg(void);
@@ -65,6 +73,9 @@ void tpkt_print_pkt_info(struct tpacket2_hdr *thdr,
 // Test packet capturing filters and callback hooks
 int tpcap_test_filters(char *filters_file);
 
+// Test TPACKET_V3 block ring capturing
+int tpcap_test_v3(void);
+
 // Test DNS Subsystem
 int test_dns(void);
 
@@ -74,6 +85,12 @@ int __attribute__((weak)) test_zip(void);
 // Test iptables telemetry Subsystem
 void test_iptables(void);
 
+// Test command push channel (if FEATURE_CMD_PUSH is enabled)
+int __attribute__((weak)) test_cmd_push(void);
+
+// Test speedtest transfers against the loopback server
+int test_speedtest_lo(void);
+
 // Returns the running test number (0 if no test running)
 int get_test_num(void);
 
@@ -8,7 +8,7 @@ CPPFLAGS += -I$(UNUM_PATH)/tests/$(MODEL)
 
 # Add common code file(s)
 OBJECTS += ./tests/tests.o ./tests/tests_stubs.o ./tests/test_tpacket2.o \
-           ./tests/test_crashes.o
+           ./tests/test_tpacket3.o ./tests/test_crashes.o
 
 # Add model code file(s)
 OBJECTS += ./tests/$(MODEL)/tests_platform.o 
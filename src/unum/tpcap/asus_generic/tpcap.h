@@ -18,6 +18,10 @@
 #undef TPCAP_NUM_PACKETS
 #define TPCAP_NUM_PACKETS 1024
 
+// The TPACKET_V3 ring of the same size (32 32KB blocks).
+#undef TPCAP_V3_NUM_BLOCKS
+#define TPCAP_V3_NUM_BLOCKS 32
+
 
 // Set up packet capturing socket to use hardware timestamps
 // (for platforms with no support make it empty inline returning 0)
@@ -21,6 +21,10 @@
 #undef TPCAP_NUM_PACKETS
 #define TPCAP_NUM_PACKETS 2048
 
+// The TPACKET_V3 ring of the same size (64 32KB blocks, 2MB per interface).
+#undef TPCAP_V3_NUM_BLOCKS
+#define TPCAP_V3_NUM_BLOCKS 64
+
 
 // Set up packet capturing socket to use hardware timestamps
 // (for platforms with no support make it empty inline returning 0).
@@ -11,12 +11,241 @@
 //#define LOG_DBG_DST LOG_DST_CONSOLE
 
 
-// Magic pointer replacing ptbl entry pointer while it is in use
-PKT_PROC_ENTRY_t null_entry = {};
-#define PTBL_IN_USE_MAGIC (&null_entry)
-
-// Packet processing table
+// Packet processing table entries bitmask (bit N is ptbl[N])
+typedef uint64_t PTBL_MASK_t;
+#if MAX_PKT_PROC_ENTRIES > 64
+#  error MAX_PKT_PROC_ENTRIES does not fit PTBL_MASK_t
+#endif
+
+// Size of the ethertype and port index hash tables (power of 2, it has to
+// be larger than MAX_PKT_PROC_ENTRIES)
+#define PTBL_HASH_SIZE 128
+
+// Index hash table slot (the slot is free if the mask is 0)
+typedef struct _PTBL_HASH_SLOT {
+    uint16_t key;
+    PTBL_MASK_t mask;
+} PTBL_HASH_SLOT_t;
+
+// Packet dispatch structure built from the packet processing table.
+// The entries are indexed by the ethertype, IP protocol and TCP/UDP port
+// they require. For a captured packet the masks are looked up at each
+// level and ANDed together, leaving only the candidate entries to run the
+// full match for, so the per-packet cost does not grow w/ the number of
+// entries that can't match it.
+typedef struct _PKT_DISPATCH {
+    PKT_PROC_ENTRY_t *pe[MAX_PKT_PROC_ENTRIES]; // copy of ptbl[]
+    PTBL_MASK_t all;      // all the entries that can match
+    PTBL_MASK_t eth_any;  // entries not indexed by ethertype
+    PTBL_HASH_SLOT_t eth[PTBL_HASH_SIZE]; // ethertype index
+    PTBL_MASK_t l3_none;  // entries not looking at the IP header
+    PTBL_MASK_t ip_any;   // entries not indexed by IP protocol
+    PTBL_MASK_t ip_proto[256]; // IP protocol index
+    PTBL_MASK_t l4_none;  // entries not looking at the TCP/UDP header
+    PTBL_MASK_t l4_any;   // entries not indexed by port
+    PTBL_HASH_SLOT_t port[PTBL_HASH_SIZE]; // TCP/UDP port index
+} PKT_DISPATCH_t;
+
+// Packet descriptor, the captured packet headers are parsed once into it
+// and then used for matching all the candidate entries
+typedef struct _PKT_DESC {
+    struct tpacket2_hdr *thdr; // tpacket metadata header
+    struct ethhdr *ehdr;  // Ethernet header
+    struct iphdr *iph;    // IP header (NULL if none)
+    struct ipv6hdr *ip6h; // IPv6 header (NULL if none)
+    uint8_t ip_proto;     // IPv4 protocol or IPv6 next header
+    uint8_t l4_proto;     // IPPROTO_TCP, IPPROTO_UDP or 0 (no TCP/UDP header)
+    uint16_t sp;          // TCP/UDP source port (host byte order)
+    uint16_t dp;          // TCP/UDP destination port (host byte order)
+} PKT_DESC_t;
+
+// Packet processing table (changed under ptbl_m only)
 static PKT_PROC_ENTRY_t *ptbl[MAX_PKT_PROC_ENTRIES];
+// Mutex protecting ptbl[] and serializing the dispatch structure updates
+static UTIL_MUTEX_t ptbl_m = UTIL_MUTEX_INITIALIZER;
+
+// The dispatch structures are double buffered. The tpcap thread uses
+// the one dsp_cur points to, while the other is rebuilt when the table
+// changes. The new one is then swapped in and the old one is not touched
+// till the tpcap thread stops using it (it sets dsp_in_use to the structure
+// it is working with, the same way as the hazard pointers work).
+static PKT_DISPATCH_t dsp_buf[2];
+static PKT_DISPATCH_t * volatile dsp_cur = &dsp_buf[0];
+static PKT_DISPATCH_t * volatile dsp_in_use = NULL;
+
+// Time to sleep between checks if the old dispatch structure is still in use
+#define PTBL_GRACE_CHECK_MS 1
+
+
+// Find the index hash table slot for the key, returns the slot
+// the key is in or the free slot where it should be added
+static PTBL_HASH_SLOT_t *ptbl_hash_slot(PTBL_HASH_SLOT_t *tbl, uint16_t key)
+{
+    unsigned int ii, idx = (key ^ (key >> 7)) & (PTBL_HASH_SIZE - 1);
+
+    for(ii = 0; ii < PTBL_HASH_SIZE; ii++)
+    {
+        PTBL_HASH_SLOT_t *slot = &tbl[(idx + ii) & (PTBL_HASH_SIZE - 1)];
+        if(slot->mask == 0 || slot->key == key) {
+            return slot;
+        }
+    }
+
+    // Can't happen, there are fewer keys than the slots
+    return NULL;
+}
+
+// Get the index hash table mask for the key
+static PTBL_MASK_t ptbl_hash_mask(PTBL_HASH_SLOT_t *tbl, uint16_t key)
+{
+    PTBL_HASH_SLOT_t *slot = ptbl_hash_slot(tbl, key);
+    return (slot != NULL && slot->mask != 0) ? slot->mask : 0;
+}
+
+// Add the entry bit to the index hash table mask for the key
+static void ptbl_hash_add(PTBL_HASH_SLOT_t *tbl, uint16_t key, PTBL_MASK_t bit)
+{
+    PTBL_HASH_SLOT_t *slot = ptbl_hash_slot(tbl, key);
+    if(slot != NULL) {
+        slot->key = key;
+        slot->mask |= bit;
+    }
+}
+
+// Build the dispatch structure from the current ptbl[] contents
+// (the caller must hold ptbl_m)
+static void ptbl_build_dispatch(PKT_DISPATCH_t *d)
+{
+    int ii;
+
+    memset(d, 0, sizeof(*d));
+    for(ii = 0; ii < MAX_PKT_PROC_ENTRIES; ii++)
+    {
+        PKT_PROC_ENTRY_t *pe = ptbl[ii];
+        PTBL_MASK_t bit = ((PTBL_MASK_t)1) << ii;
+        unsigned int ef, ipf, tuf;
+
+        d->pe[ii] = pe;
+        if(!pe) {
+            continue;
+        }
+        ef = pe->flags_eth;
+        ipf = pe->flags_ip;
+        tuf = pe->flags_tcpudp;
+        // The entries w/ no flags never match
+        if((ef | ipf | tuf) == 0) {
+            continue;
+        }
+        d->all |= bit;
+
+        // Ethertype
+        if((ef & PKT_MATCH_ETH_TYPE) != 0 && (ef & PKT_MATCH_ETH_TYPE_NEG) == 0)
+        {
+            ptbl_hash_add(d->eth, pe->eth.proto, bit);
+        } else {
+            d->eth_any |= bit;
+        }
+
+        // IP protocol
+        if((ipf | tuf) == 0) {
+            d->l3_none |= bit;
+        } else if((ipf & PKT_MATCH_IP_PROTO) != 0 &&
+                  (ipf & PKT_MATCH_IP_PROTO_NEG) == 0)
+        {
+            d->ip_proto[pe->ip.proto] |= bit;
+        } else {
+            d->ip_any |= bit;
+        }
+
+        // TCP/UDP ports (all the port flags have to match, so indexing
+        // by the first port the entry needs is enough)
+        if(tuf == 0) {
+            d->l4_none |= bit;
+        } else if((tuf & PKT_MATCH_TCPUDP_PORT_NEG) != 0) {
+            d->l4_any |= bit;
+        } else if((tuf & (PKT_MATCH_TCPUDP_P1_SRC |
+                          PKT_MATCH_TCPUDP_P1_DST |
+                          PKT_MATCH_TCPUDP_P1_ANY)) != 0)
+        {
+            ptbl_hash_add(d->port, pe->tcpudp.p1, bit);
+        } else if((tuf & (PKT_MATCH_TCPUDP_P2_SRC |
+                          PKT_MATCH_TCPUDP_P2_DST |
+                          PKT_MATCH_TCPUDP_P2_ANY)) != 0)
+        {
+            ptbl_hash_add(d->port, pe->tcpudp.p2, bit);
+        } else {
+            d->l4_any |= bit;
+        }
+    }
+
+    return;
+}
+
+// Rebuild the dispatch structure after ptbl[] change and swap it in.
+// Returns after the tpcap thread stops using the old one, so none of the
+// removed entries are in use when it returns.
+// (the caller must hold ptbl_m)
+static void ptbl_update_dispatch(void)
+{
+    PKT_DISPATCH_t *old = dsp_cur;
+    PKT_DISPATCH_t *d = (old == &dsp_buf[0]) ? &dsp_buf[1] : &dsp_buf[0];
+
+    ptbl_build_dispatch(d);
+    __sync_synchronize();
+    dsp_cur = d;
+    __sync_synchronize();
+
+    // Wait for the tpcap thread to finish w/ the old structure
+    while(dsp_in_use == old) {
+        util_msleep(PTBL_GRACE_CHECK_MS);
+    }
+
+    return;
+}
+
+// Get the current dispatch structure for the use by the tpcap thread,
+// it stays valid till dispatch_release() is called.
+static PKT_DISPATCH_t *dispatch_get(void)
+{
+    PKT_DISPATCH_t *d;
+
+    do {
+        d = dsp_cur;
+        dsp_in_use = d;
+        __sync_synchronize();
+    } while(d != dsp_cur);
+
+    return d;
+}
+
+// Release the dispatch structure taken w/ dispatch_get()
+static void dispatch_release(void)
+{
+    __sync_synchronize();
+    dsp_in_use = NULL;
+}
+
+#ifdef FEATURE_TPCAP_USES_CBPF
+// Get the list of the entries in the packet processing table
+// pe_arr - array to store the entry pointers in
+// max - max number of entries the array can hold
+// Returns: number of entries stored in the array
+int tpcap_get_proc_entries(PKT_PROC_ENTRY_t **pe_arr, int max)
+{
+    int ii, count = 0;
+
+    UTIL_MUTEX_TAKE(&ptbl_m);
+    for(ii = 0; ii < MAX_PKT_PROC_ENTRIES && count < max; ii++)
+    {
+        if(ptbl[ii] != NULL) {
+            pe_arr[count++] = ptbl[ii];
+        }
+    }
+    UTIL_MUTEX_GIVE(&ptbl_m);
+
+    return count;
+}
+#endif // FEATURE_TPCAP_USES_CBPF
 
 
 // Adds entry to the packet processing table
@@ -28,15 +257,25 @@ int tpcap_add_proc_entry(PKT_PROC_ENTRY_t *pe)
 {
     int ii, ret = -1;
 
-    // Try to add the entry
+    UTIL_MUTEX_TAKE(&ptbl_m);
     for(ii = 0; ii < MAX_PKT_PROC_ENTRIES; ii++)
     {
-        if(__sync_bool_compare_and_swap(&(ptbl[ii]), NULL, pe))
-        {
+        if(ptbl[ii] == NULL) {
+            ptbl[ii] = pe;
+            ptbl_update_dispatch();
             ret = 0;
             break;
         }
     }
+    UTIL_MUTEX_GIVE(&ptbl_m);
+
+#ifdef FEATURE_TPCAP_USES_CBPF
+    // Rebuild the filters outside of ptbl_m (the filters mutex is taken
+    // first when compiling them)
+    if(ret == 0) {
+        tpcap_refresh_filters();
+    }
+#endif // FEATURE_TPCAP_USES_CBPF
 
     return ret;
 }
@@ -47,32 +286,81 @@ int tpcap_add_proc_entry(PKT_PROC_ENTRY_t *pe)
 void tpcap_del_proc_entry(PKT_PROC_ENTRY_t *pe)
 {
     int ii;
-    int magic_found;
-    int entry_found;
 
-    for(;;)
+    UTIL_MUTEX_TAKE(&ptbl_m);
+    for(ii = 0; ii < MAX_PKT_PROC_ENTRIES; ii++)
     {
-        magic_found = FALSE;
-        entry_found = FALSE;
-        for(ii = 0; ii < MAX_PKT_PROC_ENTRIES; ii++)
-        {
-            if(__sync_bool_compare_and_swap(&(ptbl[ii]), pe, NULL))
-            {
-                entry_found = TRUE;
-                break;
-            }
-            if(ptbl[ii] == PTBL_IN_USE_MAGIC) {
-                magic_found = TRUE;
-            }
-        }
-        // Continue trying until we either remove the entry or for
-        // sure cannot find (not in the table and no entries are in use)
-        if(entry_found || ! magic_found) {
+        if(ptbl[ii] == pe) {
+            ptbl[ii] = NULL;
+            ptbl_update_dispatch();
             break;
         }
-        // Sleep a little bit and try again
-        util_msleep(100);
     }
+    UTIL_MUTEX_GIVE(&ptbl_m);
+
+#ifdef FEATURE_TPCAP_USES_CBPF
+    if(ii < MAX_PKT_PROC_ENTRIES) {
+        tpcap_refresh_filters();
+    }
+#endif // FEATURE_TPCAP_USES_CBPF
+
+    return;
+}
+
+// Parse the captured packet headers into the descriptor
+static void tpcap_parse_packet(PKT_DESC_t *pd, struct tpacket2_hdr *thdr,
+                               struct ethhdr *ehdr)
+{
+    unsigned int l3_len = thdr->tp_snaplen - (thdr->tp_net - thdr->tp_mac);
+    int minlen;
+
+    memset(pd, 0, sizeof(*pd));
+    pd->thdr = thdr;
+    pd->ehdr = ehdr;
+
+    // No IP header if snap len is too short
+    if(l3_len < sizeof(struct iphdr) ||
+       (ehdr->h_proto != htons(ETH_P_IP) && ehdr->h_proto != htons(ETH_P_IPV6)))
+    {
+        return;
+    }
+    pd->iph = (void *)thdr + thdr->tp_net;
+    pd->ip6h = (void *)thdr + thdr->tp_net;
+#ifdef FEATURE_IPV6_TELEMETRY
+    pd->ip_proto = (pd->iph->version == 6) ?
+                   pd->ip6h->nexthdr : pd->iph->protocol;
+#else  // FEATURE_IPV6_TELEMETRY
+    pd->ip_proto = pd->iph->protocol;
+#endif // FEATURE_IPV6_TELEMETRY
+
+    // TCP/UDP header is expected right after the IPv4 header
+    if(pd->iph->protocol == IPPROTO_TCP) {
+#ifdef FEATURE_IPV6_TELEMETRY
+        minlen = sizeof(struct tcphdr) + (pd->iph->version == 6) ? sizeof(struct ipv6hdr) : sizeof(struct iphdr);
+#else
+        minlen = sizeof(struct tcphdr) + sizeof(struct iphdr);
+#endif // FEATURE_IPV6_TELEMETRY
+    } else if(pd->iph->protocol == IPPROTO_UDP) {
+#ifdef FEATURE_IPV6_TELEMETRY
+        minlen = sizeof(struct udphdr) + (pd->iph->version == 6) ? sizeof(struct ipv6hdr) : sizeof(struct iphdr);
+#else
+        minlen = sizeof(struct udphdr) + sizeof(struct iphdr);
+#endif // FEATURE_IPV6_TELEMETRY
+    } else {
+        return;
+    }
+    // Make sure we have full header worth of data
+    if(l3_len < minlen) {
+        return;
+    }
+
+    // TCP & UDP store ports in the same place. We use host
+    // byte order for specifying ports, so will be doing all the
+    // checking in the host byte order
+    struct udphdr* udph = ((void *)pd->iph) + sizeof(struct iphdr);
+    pd->l4_proto = pd->iph->protocol;
+    pd->sp = ntohs(udph->source);
+    pd->dp = ntohs(udph->dest);
 
     return;
 }
@@ -80,11 +368,14 @@ void tpcap_del_proc_entry(PKT_PROC_ENTRY_t *pe)
 // Check packet against the pkt proc table entry
 // Returns: TRUE if match (processing function(s) called),
 //          FALSE otherwise
-static int tpcap_match_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
-                              struct ethhdr *ehdr, PKT_PROC_ENTRY_t *pe)
+static int tpcap_match_packet(TPCAP_IF_t *tpif, PKT_DESC_t *pd,
+                              PKT_PROC_ENTRY_t *pe)
 {
     unsigned int ef, ipf, tuf;
     int match, m;
+    struct ethhdr *ehdr = pd->ehdr;
+    struct iphdr *iph = pd->iph;
+    struct ipv6hdr *ip6h = pd->ip6h;
 
     // Store flags for reasy access
     ef = pe->flags_eth;
@@ -138,17 +429,6 @@ static int tpcap_match_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
         }
     }
 
-    // Matching IP header
-    struct iphdr *iph = (void *)thdr + thdr->tp_net;
-    struct ipv6hdr *ip6h = (void *)thdr + thdr->tp_net;
-
-    // No IP header if snap len is too short
-    if(thdr->tp_snaplen - (thdr->tp_net-thdr->tp_mac) < sizeof(struct iphdr) ||
-        (ehdr->h_proto != htons(ETH_P_IP) && ehdr->h_proto != htons(ETH_P_IPV6)))
-    {
-        iph = NULL;
-        ip6h = NULL;
-    }
     // Make sure we have IP header if checking it or TCP/UDP
     if((ipf | tuf) != 0 && !iph && !ip6h)
     {
@@ -220,40 +500,15 @@ static int tpcap_match_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
         }
     }
 
-    struct tcphdr* tcph = ((void *)iph) + sizeof(struct iphdr);
-    struct udphdr* udph = ((void *)iph) + sizeof(struct iphdr);
-
     // Match TCP/UDP header
     if(tuf != 0)
     {
-        int minlen;
-        // Fail immediately if IP packet is not TCP or UDP
-        if(iph->protocol == IPPROTO_TCP) {
-#ifdef FEATURE_IPV6_TELEMETRY
-            minlen = sizeof(*tcph) + (iph->version == 6) ? sizeof(struct ipv6hdr) : sizeof(struct iphdr);
-#else
-            minlen = sizeof(*tcph) + sizeof(struct iphdr);
-#endif // FEATURE_IPV6_TELEMETRY
-        } else if(iph->protocol == IPPROTO_UDP) {
-#ifdef FEATURE_IPV6_TELEMETRY
-            minlen = sizeof(*udph) + (iph->version == 6) ? sizeof(struct ipv6hdr) : sizeof(struct iphdr);
-#else
-            minlen = sizeof(*udph) + sizeof(struct iphdr);
-#endif // FEATURE_IPV6_TELEMETRY
-        } else {
-            return FALSE;
-        }
-        // Make sure we have full header worth of data
-        if(thdr->tp_snaplen - (thdr->tp_net - thdr->tp_mac) < minlen)
-        {
+        // Fail immediately if no TCP or UDP header
+        if(pd->l4_proto == 0) {
             return FALSE;
         }
-
-        // TCP & UDP store ports in the same place. We use host
-        // byte order for specifying ports, so will be doing all the
-        // checking in the host byte order
-        uint16_t sp = ntohs(udph->source);
-        uint16_t dp = ntohs(udph->dest);
+        uint16_t sp = pd->sp;
+        uint16_t dp = pd->dp;
 
         m = TRUE;
         m &= ((tuf & PKT_MATCH_TCPUDP_P1_SRC) == 0 || sp == pe->tcpudp.p1);
@@ -274,8 +529,10 @@ static int tpcap_match_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
         // Negate the port match
         match &= ((tuf & PKT_MATCH_TCPUDP_PORT_NEG) == 0) ? (m) : (!m);
         // Filter specific TCP or UDP
-        match &= (!(tuf & PKT_MATCH_TCPUDP_TCP_ONLY) || iph->protocol == 6);
-        match &= (!(tuf & PKT_MATCH_TCPUDP_UDP_ONLY) || iph->protocol == 17);
+        match &= (!(tuf & PKT_MATCH_TCPUDP_TCP_ONLY) ||
+                  pd->l4_proto == IPPROTO_TCP);
+        match &= (!(tuf & PKT_MATCH_TCPUDP_UDP_ONLY) ||
+                  pd->l4_proto == IPPROTO_UDP);
         // return if matching has failed
         if(!match) {
             return FALSE;
@@ -285,13 +542,13 @@ static int tpcap_match_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
     // The match must be TRUE, call the functions and/or
     // follow to the chained processing structure.
     if(pe->eth_func) {
-        pe->eth_func(tpif, pe, thdr, ehdr);
+        pe->eth_func(tpif, pe, pd->thdr, ehdr);
     }
     if(pe->ip_func && iph) {
-        pe->ip_func(tpif, pe, thdr, iph, ip6h);
+        pe->ip_func(tpif, pe, pd->thdr, iph, ip6h);
     }
     if(pe->chain) {
-        return tpcap_match_packet(tpif, thdr, ehdr, pe->chain);
+        return tpcap_match_packet(tpif, pd, pe->chain);
     }
 
     return match;
@@ -308,6 +565,9 @@ int tpcap_process_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
                          struct ethhdr *ehdr)
 {
     int ii;
+    PKT_DESC_t pd;
+    PKT_DISPATCH_t *d;
+    PTBL_MASK_t m;
 
 #ifdef DEBUG
     // Test 1, print captured packets info
@@ -317,23 +577,34 @@ int tpcap_process_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
     }
 #endif // DEBUG
 
-    for(ii = 0; ii < MAX_PKT_PROC_ENTRIES; ii++)
-    {
-        PKT_PROC_ENTRY_t *pe = ptbl[ii];
+    tpcap_parse_packet(&pd, thdr, ehdr);
 
-        if(!pe) {
-            continue;
-        }
-        if(!__sync_bool_compare_and_swap(&(ptbl[ii]),
-                                         pe, PTBL_IN_USE_MAGIC))
-        {
-            continue;
-        }
-        tpcap_match_packet(tpif, thdr, ehdr, pe);
-        __sync_synchronize();
-        ptbl[ii] = pe;
+    d = dispatch_get();
+
+    // Narrow down to the candidate entries level by level
+    m = d->all & (d->eth_any | ptbl_hash_mask(d->eth, ehdr->h_proto));
+    if(pd.iph == NULL) {
+        m &= d->l3_none;
+    } else {
+        m &= (d->l3_none | d->ip_any | d->ip_proto[pd.ip_proto]);
+    }
+    if(pd.l4_proto == 0) {
+        m &= d->l4_none;
+    } else {
+        m &= (d->l4_none | d->l4_any |
+              ptbl_hash_mask(d->port, pd.sp) | ptbl_hash_mask(d->port, pd.dp));
     }
 
+    // Run the candidates in the table order
+    while(m != 0)
+    {
+        ii = __builtin_ctzll(m);
+        m &= m - 1;
+        tpcap_match_packet(tpif, &pd, d->pe[ii]);
+    }
+
+    dispatch_release();
+
     return 0;
 }
 
@@ -342,25 +613,18 @@ int tpcap_process_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
 int tpcap_cycle_complete()
 {
     int ii;
+    PKT_DISPATCH_t *d = dispatch_get();
 
     for(ii = 0; ii < MAX_PKT_PROC_ENTRIES; ii++)
     {
-        PKT_PROC_ENTRY_t *pe = ptbl[ii];
+        PKT_PROC_ENTRY_t *pe = d->pe[ii];
 
-        if(!pe) {
-            continue;
-        }
-        if(!__sync_bool_compare_and_swap(&(ptbl[ii]),
-                                         pe, PTBL_IN_USE_MAGIC))
-        {
-            continue;
-        }
-        if(pe->stats_func) {
+        if(pe && pe->stats_func) {
             pe->stats_func(tpcap_get_if_stats());
         }
-        __sync_synchronize();
-        ptbl[ii] = pe;
     }
 
+    dispatch_release();
+
     return 0;
 }
@@ -139,5 +139,28 @@ int tpcap_process_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *thdr,
 // Returns: 0 if successful
 int tpcap_cycle_complete(void);
 
+#ifdef FEATURE_TPCAP_USES_CBPF
+// Get the list of the entries in the packet processing table
+// pe_arr - array to store the entry pointers in
+// max - max number of entries the array can hold
+// Returns: number of entries stored in the array
+int tpcap_get_proc_entries(PKT_PROC_ENTRY_t **pe_arr, int max);
+
+// Compile the packet processing table entries into the BPF socket
+// filter program for the interface.
+// tpif - the interface the program is for (the interface MAC and IP
+//        are needed for the PKT_MATCH_ETH_MYMAC_DST and PKT_MATCH_IP_MY_DST)
+// prog - (OUT) the program
+// Returns: 0 - if successful, negative if the table can't be compiled
+//          (the caller should then capture w/ no filter)
+// Note: the program is stored in a static buffer, the caller has to
+//       serialize the calls and use the program before the next call
+int tpcap_bpf_compile(TPCAP_IF_t *tpif, struct sock_fprog *prog);
+
+// Rebuild and re-attach the BPF filters for all the interfaces we
+// capture on (called when the packet processing table changes)
+void tpcap_refresh_filters(void);
+#endif // FEATURE_TPCAP_USES_CBPF
+
 #endif // _PROCESS_PKT_H
 
@@ -17,62 +17,96 @@ static TPCAP_IF_t tp_ifs[TPCAP_IF_MAX];
 // Array of stats for monitored interfaces plus the WAN interface
 static TPCAP_IF_STATS_t tp_if_stats[TPCAP_STAT_IF_MAX];
 
+#ifdef FEATURE_TPCAP_TPACKET_V3
+// TPACKET_V3 only limits the frame size by the block size, attach the
+// filter cutting the captured packets to the snap length to the capturing
+// socket 'fd' (for capturing w/o the compiled packet filter)
+// Returns: 0 - if successful
+static int tpcap_attach_snap_filter(TPCAP_IF_t *tpif, int fd)
+{
+    struct sock_filter snap_code[] = {
+        { BPF_RET | BPF_K, 0, 0, TPCAP_SNAP_LEN }
+    };
+    struct sock_fprog snap_prog = {
+        .len = sizeof(snap_code) / sizeof(snap_code[0]),
+        .filter = snap_code
+    };
+
+    if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                  &snap_prog, sizeof(snap_prog)) != 0)
+    {
+        log("%s: error setting SO_ATTACH_FILTER for %s, %s\n",
+            __func__, tpif->name, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+#endif // FEATURE_TPCAP_TPACKET_V3
+
 #ifdef FEATURE_TPCAP_USES_CBPF
-// SW-3453 hard coded BPF filter containing all protocols currently of interest. WIP.
-static struct sock_filter bpf_hardcoded_bytecode[] = {
-    // tcpdump -dd -i lo udp port 67 or udp port 68 or udp port 5353 or udp port 53 or udp port 1900 or tcp port 80
-    { 0x28, 0, 0, 0x0000000c },
-    { 0x15, 0, 15, 0x000086dd },
-    { 0x30, 0, 0, 0x00000014 },
-    { 0x15, 0, 8, 0x00000011 },
-    { 0x28, 0, 0, 0x00000036 },
-    { 0x15, 37, 0, 0x00000043 },
-    { 0x15, 36, 0, 0x00000044 },
-    { 0x15, 35, 0, 0x000014e9 },
-    { 0x15, 34, 0, 0x00000035 },
-    { 0x15, 33, 0, 0x0000076c },
-    { 0x28, 0, 0, 0x00000038 },
-    { 0x15, 31, 19, 0x00000043 },
-    { 0x15, 0, 31, 0x00000006 },
-    { 0x28, 0, 0, 0x00000036 },
-    { 0x15, 28, 0, 0x00000050 },
-    { 0x28, 0, 0, 0x00000038 },
-    { 0x15, 26, 27, 0x00000050 },
-    { 0x15, 0, 26, 0x00000800 },
-    { 0x30, 0, 0, 0x00000017 },
-    { 0x15, 0, 15, 0x00000011 },
-    { 0x28, 0, 0, 0x00000014 },
-    { 0x45, 22, 0, 0x00001fff },
-    { 0xb1, 0, 0, 0x0000000e },
-    { 0x48, 0, 0, 0x0000000e },
-    { 0x15, 18, 0, 0x00000043 },
-    { 0x15, 17, 0, 0x00000044 },
-    { 0x15, 16, 0, 0x000014e9 },
-    { 0x15, 15, 0, 0x00000035 },
-    { 0x15, 14, 0, 0x0000076c },
-    { 0x48, 0, 0, 0x00000010 },
-    { 0x15, 12, 0, 0x00000043 },
-    { 0x15, 11, 0, 0x00000044 },
-    { 0x15, 10, 0, 0x000014e9 },
-    { 0x15, 9, 0, 0x00000035 },
-    { 0x15, 8, 9, 0x0000076c },
-    { 0x15, 0, 8, 0x00000006 },
-    { 0x28, 0, 0, 0x00000014 },
-    { 0x45, 6, 0, 0x00001fff },
-    { 0xb1, 0, 0, 0x0000000e },
-    { 0x48, 0, 0, 0x0000000e },
-    { 0x15, 2, 0, 0x00000050 },
-    { 0x48, 0, 0, 0x00000010 },
-    { 0x15, 0, 1, 0x00000050 },
-    { 0x6, 0, 0, 0x00040000 },
-    { 0x6, 0, 0, 0x00000000 },
-};
-
-static struct sock_fprog bpf_hardcoded_program = {
-    .len = ARRAY_SIZE(bpf_hardcoded_bytecode),
-    .filter = bpf_hardcoded_bytecode,
-};
-#endif
+// Mutex serializing the BPF filters compilation and attaching w/ the
+// capturing sockets setup and cleanup
+static UTIL_MUTEX_t tpcap_bpf_m = UTIL_MUTEX_INITIALIZER;
+
+// Compile the packet processing table into the BPF program for the
+// interface and attach it to the capturing socket 'fd'. If the table
+// can't be compiled the filter is removed (i.e. capturing everything),
+// for TPACKET_V3 it is replaced w/ the snap length only filter.
+// Returns: 0 - if successful
+static int tpcap_attach_filter(TPCAP_IF_t *tpif, int fd)
+{
+    struct sock_fprog prog;
+    int ret = 0;
+
+    UTIL_MUTEX_TAKE(&tpcap_bpf_m);
+
+    if(tpcap_bpf_compile(tpif, &prog) != 0) {
+        log("%s: capturing on %s w/ no filter\n", __func__, tpif->name);
+#ifdef FEATURE_TPCAP_TPACKET_V3
+        ret = tpcap_attach_snap_filter(tpif, fd);
+#else  // FEATURE_TPCAP_TPACKET_V3
+        setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+#endif // FEATURE_TPCAP_TPACKET_V3
+    } else if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                         &prog, sizeof(prog)) != 0)
+    {
+        log("%s: error setting SO_ATTACH_FILTER for %s, %s\n",
+            __func__, tpif->name, strerror(errno));
+        ret = -1;
+    }
+#ifdef DEBUG
+    else if(tpcap_test_param.int_val == TPCAP_TEST_FILTERS)
+    {
+        printf("%s: %s filter updated, %d instructions\n",
+               __func__, tpif->name, prog.len);
+    }
+#endif // DEBUG
+
+    UTIL_MUTEX_GIVE(&tpcap_bpf_m);
+
+    return ret;
+}
+
+// Rebuild and re-attach the BPF filters for all the interfaces we
+// capture on (called when the packet processing table changes)
+void tpcap_refresh_filters(void)
+{
+    int ii;
+
+    UTIL_MUTEX_TAKE(&tpcap_bpf_m);
+    for(ii = 0; ii < TPCAP_IF_MAX; ii++)
+    {
+        TPCAP_IF_t *tpif = &(tp_ifs[ii]);
+        if((tpif->flags & TPCAP_IF_FD_READY) != 0) {
+            tpcap_attach_filter(tpif, tpif->fd);
+        }
+    }
+    UTIL_MUTEX_GIVE(&tpcap_bpf_m);
+
+    return;
+}
+#endif // FEATURE_TPCAP_USES_CBPF
 
 // Initialize interface stats data structure
 // (stores timestamp and inital values of the counters)
@@ -126,7 +160,7 @@ int tpcap_add_if(const char *ifname, void *data)
             // The interface is already listed, but it might have been
             // removed and added again, so verify its ifindex is the same.
             // If ifindex is not the same consider it no longer valid.
-            if(tp_ifs[ii].ifidx != if_nametoindex(ifname)) {
+            if(tp_ifs[ii].ifidx != util_get_ifindex(ifname)) {
                 tp_ifs[ii].flags &= ~TPCAP_IF_VALID;
                 break;
             }
@@ -140,6 +174,12 @@ int tpcap_add_if(const char *ifname, void *data)
             else if(memcmp(&tp_ifs[ii].ipcfg, &new_ipcfg, sizeof(new_ipcfg))) {
                 log("%s: updating IP configuration for %s\n", __func__, ifname);
                 memcpy(&tp_ifs[ii].ipcfg, &new_ipcfg, sizeof(tp_ifs[ii].ipcfg));
+#ifdef FEATURE_TPCAP_USES_CBPF
+                // The filter might be matching the interface IP address
+                if((tp_ifs[ii].flags & TPCAP_IF_FD_READY) != 0) {
+                    tpcap_attach_filter(&tp_ifs[ii], tp_ifs[ii].fd);
+                }
+#endif // FEATURE_TPCAP_USES_CBPF
             }
             return 0;
         }
@@ -160,9 +200,9 @@ int tpcap_add_if(const char *ifname, void *data)
 
     strncpy(tp_ifs[ii].name, ifname, IFNAMSIZ - 1);
     tp_ifs[ii].name[IFNAMSIZ - 1] = 0;
-    tp_ifs[ii].ifidx = if_nametoindex(ifname);
+    tp_ifs[ii].ifidx = util_get_ifindex(ifname);
     if(tp_ifs[ii].ifidx <= 0) {
-        log("%s: if_nametoindex(%s) error, %s\n",
+        log("%s: util_get_ifindex(%s) error, %s\n",
             __func__, ifname, strerror(errno));
         return -2;
     }
@@ -194,17 +234,28 @@ static void tpcap_cleanup_if(TPCAP_IF_t *tpif)
         return;
     }
 
+#ifdef FEATURE_TPCAP_USES_CBPF
+    // Make sure the filters are not being updated while we clean up
+    UTIL_MUTEX_TAKE(&tpcap_bpf_m);
+#endif // FEATURE_TPCAP_USES_CBPF
+
     if(munmap(tpif->ring, tpif->ring_len) != 0) {
         log("%s: error unmapping memory at %p, len %d\n",
             __func__, tpif->ring, tpif->ring_len);
     }
     tpif->ring = NULL;
     tpif->ring_len = 0;
+    tpif->idx = 0;
 
     close(tpif->fd);
     tpif->fd = -1;
 
     tpif->flags &= ~(TPCAP_IF_FD_READY);
+
+#ifdef FEATURE_TPCAP_USES_CBPF
+    UTIL_MUTEX_GIVE(&tpcap_bpf_m);
+#endif // FEATURE_TPCAP_USES_CBPF
+
     return;
 }
 
@@ -216,7 +267,11 @@ static int tpcap_setup_if(TPCAP_IF_t *tpif)
     unsigned char *ring;
     unsigned int ring_len;
     struct sockaddr_ll addr;
+#ifdef FEATURE_TPCAP_TPACKET_V3
+    struct tpacket_req3 req;
+#else  // FEATURE_TPCAP_TPACKET_V3
     struct tpacket_req req;
+#endif // FEATURE_TPCAP_TPACKET_V3
 
     if((tpif->flags & TPCAP_IF_FD_READY) != 0) {
         log("%s: interface %s already set up\n", __func__, tpif->name);
@@ -231,7 +286,11 @@ static int tpcap_setup_if(TPCAP_IF_t *tpif)
         return -1;
     }
 
+#ifdef FEATURE_TPCAP_TPACKET_V3
+    val = TPACKET_V3;
+#else  // FEATURE_TPCAP_TPACKET_V3
     val = TPACKET_V2;
+#endif // FEATURE_TPCAP_TPACKET_V3
     if(setsockopt(fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val))) {
         log("%s: error setting PACKET_VERSION, %s\n",
             __func__, strerror(errno));
@@ -239,13 +298,16 @@ static int tpcap_setup_if(TPCAP_IF_t *tpif)
         return -2;
     }
 #ifdef FEATURE_TPCAP_USES_CBPF
-    if(setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &bpf_hardcoded_program, sizeof(bpf_hardcoded_program))) {
-        log("%s: error setting SO_ATTACH_FILTER, %s\n",
-            __func__, strerror(errno));
+    if(tpcap_attach_filter(tpif, fd) != 0) {
         close(fd);
         return -2;
     }
-#endif
+#elif defined(FEATURE_TPCAP_TPACKET_V3)
+    if(tpcap_attach_snap_filter(tpif, fd) != 0) {
+        close(fd);
+        return -2;
+    }
+#endif // FEATURE_TPCAP_TPACKET_V3
 
     memset(&addr, 0, sizeof(addr));
     addr.sll_family = PF_PACKET;
@@ -276,11 +338,22 @@ static int tpcap_setup_if(TPCAP_IF_t *tpif)
     }
 
     memset(&req, 0, sizeof(req));
+#ifdef FEATURE_TPCAP_TPACKET_V3
+    // The frame size is only used by the kernel for the sanity checks,
+    // the frames are variable length and packed into the blocks
+    req.tp_block_size = TPCAP_V3_BLOCK_SIZE;
+    req.tp_block_nr   = TPCAP_V3_NUM_BLOCKS;
+    req.tp_frame_size = TPCAP_SNAP_LEN;
+    req.tp_frame_nr   = (TPCAP_V3_BLOCK_SIZE * TPCAP_V3_NUM_BLOCKS) /
+                        req.tp_frame_size;
+    req.tp_retire_blk_tov = TPCAP_V3_BLOCK_TMO;
+#else  // FEATURE_TPCAP_TPACKET_V3
     req.tp_frame_size = TPCAP_SNAP_LEN;
     req.tp_frame_nr   = TPCAP_NUM_PACKETS;
     req.tp_block_size = getpagesize();
     req.tp_block_nr   = (TPCAP_SNAP_LEN * TPCAP_NUM_PACKETS) /
                         req.tp_block_size;
+#endif // FEATURE_TPCAP_TPACKET_V3
     if(setsockopt(fd, SOL_PACKET, PACKET_RX_RING,
                   (void*) &req, sizeof(req)))
     {
@@ -299,11 +372,23 @@ static int tpcap_setup_if(TPCAP_IF_t *tpif)
         return -4;
     }
 
+#ifdef FEATURE_TPCAP_USES_CBPF
+    // The packet processing table might have changed since the filter
+    // was attached, re-attach it while holding the filters mutex to make
+    // sure the interface is marked ready before any further changes.
+    UTIL_MUTEX_TAKE(&tpcap_bpf_m);
+    tpcap_attach_filter(tpif, fd);
+#endif // FEATURE_TPCAP_USES_CBPF
+
     tpif->fd = fd;
     tpif->ring = ring;
     tpif->ring_len = ring_len;
     tpif->flags |= TPCAP_IF_FD_READY;
 
+#ifdef FEATURE_TPCAP_USES_CBPF
+    UTIL_MUTEX_GIVE(&tpcap_bpf_m);
+#endif // FEATURE_TPCAP_USES_CBPF
+
     return 0;
 }
 
@@ -333,15 +418,23 @@ static int update_stats()
     TPCAP_IF_t *tpif = NULL;
     unsigned long new_t;
     struct timespec ts;
+    // Counters of all the interfaces, collected w/ a single netlink
+    // request (static to keep it off the stack, tpcap thread only)
+    static NET_DEV_STATS_SNAP_t snap;
 #ifndef FEATURE_LAN_ONLY
     TPCAP_IF_t tpwan = { TPCAP_IF_VALID | TPCAP_IF_FD_READY };
     strncpy(tpwan.name, GET_MAIN_WAN_NET_DEV(), sizeof(tpwan.name) - 1);
 #endif // !FEATURE_LAN_ONLY
 
+    if(util_get_all_dev_stats(&snap) != 0) {
+        // Fall back to getting the counters for each interface
+        snap.count = 0;
+    }
+
     ifcount = 0;
     for(ii = 0; ii < TPCAP_STAT_IF_MAX; ii++)
     {
-        NET_DEV_STATS_t st;
+        NET_DEV_STATS_t st, *pst;
         struct tpacket_stats stats;
 
         if(ii < TPCAP_IF_MAX) {
@@ -366,7 +459,16 @@ static int update_stats()
             continue;
         }
 
-        err = util_get_dev_stats(tpif->name, &st);
+        // The WAN entry does not have the interface index
+        pst = (tpif->ifidx > 0) ?
+              util_dev_stats_by_index(&snap, tpif->ifidx) :
+              util_dev_stats_by_name(&snap, tpif->name);
+        if(pst != NULL) {
+            st = *pst;
+            err = 0;
+        } else {
+            err = util_get_dev_stats(tpif->name, &st);
+        }
         if(err != 0) {
             log("%s: failed to get counters for %s\n", __func__, tpif->name);
             memset(tpst, 0, sizeof(TPCAP_IF_STATS_t));
@@ -429,6 +531,100 @@ static int update_stats()
     return ifcount;
 }
 
+// Check the captured packet and pass it to the processing function
+static void process_one_packet(TPCAP_IF_t *tpif, struct tpacket2_hdr *hdr)
+{
+    struct ethhdr *eth = (struct ethhdr *)((char *)hdr + hdr->tp_mac);
+    uint16_t eth_proto = ntohs(eth->h_proto);
+
+    // Ignore incomplete and frames w/ low ethtype (only need Ethernet II)
+    if(hdr->tp_snaplen >= sizeof(struct ethhdr) &&
+       eth_proto >= TPCAP_ETHTYPE_MIN)
+    {
+        tpcap_process_packet(tpif, hdr, eth);
+    }
+}
+
+#ifdef FEATURE_TPCAP_TPACKET_V3
+// Walk through the retired blocks in the ring calling processing function
+// for each packet in the block and releasing the block to be reused by
+// the kernel.
+// Returns: the number of processed packets
+static int process_packets(TPCAP_IF_t *tpif)
+{
+    int count, blk_count;
+    unsigned int ii, num_pkts, next_off;
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *h3;
+    int idx = tpif->idx;
+
+#ifdef DEBUG
+    if(tpcap_test_param.int_val == TPCAP_TEST_BASIC)
+    {
+        printf("%llu: Starting proocessing packets, ring block idx %d\n",
+               util_time(1000), idx);
+    }
+#endif // DEBUG
+
+    // Process up to max blocks in the ring to avoid non-stop looping
+    // if they are fed in faster than we can handle them.
+    count = 0;
+    for(blk_count = 0; blk_count < TPCAP_V3_NUM_BLOCKS; blk_count++)
+    {
+        bd = (struct tpacket_block_desc *)
+             (tpif->ring + (idx * TPCAP_V3_BLOCK_SIZE));
+        // Reached the block that has not been retired yet
+        if(!(bd->hdr.bh1.block_status & TP_STATUS_USER)) {
+            break;
+        }
+        __sync_synchronize();
+
+#ifdef DEBUG
+        if(tpcap_test_param.int_val == TPCAP_TEST_V3)
+        {
+            printf("%llu: %s block %d, seq %llu, status 0x%x%s, "
+                   "packets %d, len %d\n", util_time(1000), tpif->name, idx,
+                   (unsigned long long)bd->hdr.bh1.seq_num,
+                   bd->hdr.bh1.block_status,
+                   (bd->hdr.bh1.block_status & TP_STATUS_BLK_TMO) ?
+                     "(timeout)" : "",
+                   bd->hdr.bh1.num_pkts, bd->hdr.bh1.blk_len);
+        }
+#endif // DEBUG
+
+        num_pkts = bd->hdr.bh1.num_pkts;
+        h3 = (struct tpacket3_hdr *)
+             ((unsigned char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for(ii = 0; ii < num_pkts; ii++)
+        {
+            next_off = h3->tp_next_offset;
+            process_one_packet(tpif, tpcap_v3_to_v2_hdr(h3));
+            h3 = (struct tpacket3_hdr *)((unsigned char *)h3 + next_off);
+        }
+        count += num_pkts;
+
+        __sync_synchronize();
+        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        idx = (idx + 1) % TPCAP_V3_NUM_BLOCKS;
+    }
+
+    // Update block index in the interface structure
+    tpif->idx = idx;
+
+    // Update processed packet counter
+    tpif->proc_pkt_count += count;
+
+#ifdef DEBUG
+    if(tpcap_test_param.int_val == TPCAP_TEST_BASIC)
+    {
+        printf("%llu: Processed %d packets in %d blocks, new ring idx %d\n",
+               util_time(1000), count, blk_count, idx);
+    }
+#endif // DEBUG
+
+    return count;
+}
+#else  // FEATURE_TPCAP_TPACKET_V3
 // Walk through captured packets in the ring calling processing function
 // for each one and releasing to be reused by the kernel.
 // Returns: the number of processed packets
@@ -456,15 +652,7 @@ static int process_packets(TPCAP_IF_t *tpif)
             break;
         }
 
-        struct ethhdr *eth = (struct ethhdr *)((char *)hdr + hdr->tp_mac);
-        uint16_t eth_proto = ntohs(eth->h_proto);
-
-        // Ignore incomplete and frames w/ low ethtype (only need Ethernet II)
-        if(hdr->tp_snaplen >= sizeof(struct ethhdr) &&
-           eth_proto >= TPCAP_ETHTYPE_MIN)
-        {
-            tpcap_process_packet(tpif, hdr, eth);
-        }
+        process_one_packet(tpif, hdr);
 
         __sync_synchronize();
         hdr->tp_status = TP_STATUS_KERNEL;
@@ -487,6 +675,7 @@ static int process_packets(TPCAP_IF_t *tpif)
 
     return count;
 }
+#endif // FEATURE_TPCAP_TPACKET_V3
 
 // Packets capture and processing for up to 'timeout'.
 // timeout - how long to run, in milliseconds
@@ -0,0 +1,546 @@
+// (c) 2022 minim.co
+// packet processing table to classic BPF socket filter compiler
+
+#include "unum.h"
+
+// Compile only if the platform captures packets through the BPF filter
+#ifdef FEATURE_TPCAP_USES_CBPF
+
+/* Temporary, log to console from here */
+//#undef LOG_DST
+//#undef LOG_DBG_DST
+//#define LOG_DST LOG_DST_CONSOLE
+//#define LOG_DBG_DST LOG_DST_CONSOLE
+
+
+// The filter is built to accept a superset of the packets matching the
+// top level PKT_PROC_ENTRY_t entries (the chained entries are only examined
+// if the top level entry matches, so they do not affect filtering). Each
+// entry becomes a block of instructions that on any mismatch jumps to the
+// next entry block and on match returns TPCAP_BPF_ACCEPT. The matching
+// logic follows tpcap_match_packet() closely. Classic BPF is used
+// since it is available on all the kernels we run on.
+
+// Max number of instructions and labels in the program
+#define TPCAP_BPF_MAX_INSNS  BPF_MAXINSNS
+#define TPCAP_BPF_MAX_LABELS (TPCAP_BPF_MAX_INSNS / 2)
+
+// Return value for the accepted packets (max bytes to capture), nothing
+// past the snap length is looked at, so it is cut off here (TPACKET_V3
+// ring does not truncate the frames to the snap length)
+#define TPCAP_BPF_ACCEPT TPCAP_SNAP_LEN
+
+// Label ID meaning "jump to the next instruction"
+#define LBL_NEXT 0
+
+// Offsets of the packet fields the filter examines
+#define OFF_ETH_DST    0
+#define OFF_ETH_SRC    ETH_ALEN
+#define OFF_ETH_PROTO  (2 * ETH_ALEN)
+#define OFF_IP         (sizeof(struct ethhdr))
+#define OFF_IP_PROTO   (OFF_IP + UTIL_OFFSETOF(struct iphdr, protocol))
+#define OFF_IP_SRC     (OFF_IP + UTIL_OFFSETOF(struct iphdr, saddr))
+#define OFF_IP_DST     (OFF_IP + UTIL_OFFSETOF(struct iphdr, daddr))
+#define OFF_IP6_NEXTHDR (OFF_IP + 6)
+#define OFF_L4         (OFF_IP + sizeof(struct iphdr))
+#define OFF_L4_SRC     (OFF_L4 + UTIL_OFFSETOF(struct udphdr, source))
+#define OFF_L4_DST     (OFF_L4 + UTIL_OFFSETOF(struct udphdr, dest))
+
+// Program compilation context
+typedef struct {
+    int len;   // number of instructions in the program
+    int lbl_count; // number of allocated labels
+    int err;   // set to TRUE if the program can't be built
+    struct sock_filter insn[TPCAP_BPF_MAX_INSNS]; // the program
+    uint16_t jt[TPCAP_BPF_MAX_INSNS]; // jump if true labels (unresolved)
+    uint16_t jf[TPCAP_BPF_MAX_INSNS]; // jump if false labels (unresolved)
+    int lbl[TPCAP_BPF_MAX_LABELS]; // label -> instruction index
+} BPF_CTX_t;
+
+// The compilation context, it is also the storage for the last
+// compiled program. The caller has to serialize the calls.
+static BPF_CTX_t bpf_ctx;
+
+
+// Allocate new label
+static int new_label(BPF_CTX_t *ctx)
+{
+    if(ctx->lbl_count >= TPCAP_BPF_MAX_LABELS) {
+        ctx->err = TRUE;
+        return LBL_NEXT;
+    }
+    ctx->lbl[ctx->lbl_count] = -1;
+    return ctx->lbl_count++;
+}
+
+// Place label at the current position in the program
+static void place_label(BPF_CTX_t *ctx, int l)
+{
+    ctx->lbl[l] = ctx->len;
+}
+
+// Add instruction to the program
+static void emit(BPF_CTX_t *ctx, uint16_t code, uint32_t k, int jt, int jf)
+{
+    if(ctx->len >= TPCAP_BPF_MAX_INSNS) {
+        ctx->err = TRUE;
+        return;
+    }
+    ctx->insn[ctx->len].code = code;
+    ctx->insn[ctx->len].k = k;
+    ctx->jt[ctx->len] = jt;
+    ctx->jf[ctx->len] = jf;
+    ++(ctx->len);
+}
+
+// Shortcuts for the instructions we use
+#define LD_LEN(c)         emit((c), BPF_LD|BPF_W|BPF_LEN, 0, 0, 0)
+#define LD_W(c, o)        emit((c), BPF_LD|BPF_W|BPF_ABS, (o), 0, 0)
+#define LD_H(c, o)        emit((c), BPF_LD|BPF_H|BPF_ABS, (o), 0, 0)
+#define LD_B(c, o)        emit((c), BPF_LD|BPF_B|BPF_ABS, (o), 0, 0)
+#define AND(c, k)         emit((c), BPF_ALU|BPF_AND|BPF_K, (k), 0, 0)
+#define RSH(c, k)         emit((c), BPF_ALU|BPF_RSH|BPF_K, (k), 0, 0)
+#define JA(c, l)          emit((c), BPF_JMP|BPF_JA, 0, (l), (l))
+#define JEQ(c, k, t, f)   emit((c), BPF_JMP|BPF_JEQ|BPF_K, (k), (t), (f))
+#define JGE(c, k, t, f)   emit((c), BPF_JMP|BPF_JGE|BPF_K, (k), (t), (f))
+#define JGT(c, k, t, f)   emit((c), BPF_JMP|BPF_JGT|BPF_K, (k), (t), (f))
+#define JSET(c, k, t, f)  emit((c), BPF_JMP|BPF_JSET|BPF_K, (k), (t), (f))
+#define RET(c, k)         emit((c), BPF_RET|BPF_K, (k), 0, 0)
+
+// Resolve labels to the jump offsets
+// Returns: 0 - if successful
+static int resolve_labels(BPF_CTX_t *ctx)
+{
+    int ii, t, f;
+
+    for(ii = 0; ii < ctx->len; ii++) {
+        struct sock_filter *ins = &(ctx->insn[ii]);
+        if(BPF_CLASS(ins->code) != BPF_JMP) {
+            continue;
+        }
+        t = (ctx->jt[ii] == LBL_NEXT) ? 0 : ctx->lbl[ctx->jt[ii]] - (ii + 1);
+        f = (ctx->jf[ii] == LBL_NEXT) ? 0 : ctx->lbl[ctx->jf[ii]] - (ii + 1);
+        if(BPF_OP(ins->code) == BPF_JA) {
+            if(t < 0) {
+                return -1;
+            }
+            ins->k = t;
+            ins->jt = ins->jf = 0;
+            continue;
+        }
+        // Conditional jumps are forward only and limited to 8 bits
+        if(t < 0 || t > 255 || f < 0 || f > 255) {
+            return -2;
+        }
+        ins->jt = t;
+        ins->jf = f;
+    }
+
+    return 0;
+}
+
+// Compare 6 bytes of the MAC address at the offset 'off', jump to 't' if
+// equal to 'mac' or to 'f' otherwise.
+static void cmp_mac(BPF_CTX_t *ctx, int off, unsigned char *mac, int t, int f)
+{
+    LD_W(ctx, off);
+    JEQ(ctx, ((uint32_t)mac[0] << 24) | ((uint32_t)mac[1] << 16) |
+             ((uint32_t)mac[2] << 8) | mac[3], LBL_NEXT, f);
+    LD_H(ctx, off + 4);
+    JEQ(ctx, ((uint32_t)mac[4] << 8) | mac[5], t, f);
+}
+
+// Compare the value at 'off' (of the load size 'ld') to 'k' masked w/ 'm'
+// (if 'm' is not 0), jump to 't' if equal or to 'f' otherwise.
+static void cmp_val(BPF_CTX_t *ctx, uint16_t ld, int off,
+                    uint32_t k, uint32_t m, int t, int f)
+{
+    emit(ctx, BPF_LD|ld|BPF_ABS, off, 0, 0);
+    if(m != 0) {
+        AND(ctx, m);
+    }
+    JEQ(ctx, k, t, f);
+}
+
+// Check the value at 'off' (of the load size 'ld') is in the 'lo'-'hi'
+// range, jump to 't' if it is or to 'f' otherwise.
+static void cmp_rng(BPF_CTX_t *ctx, uint16_t ld, int off,
+                    uint32_t lo, uint32_t hi, int t, int f)
+{
+    emit(ctx, BPF_LD|ld|BPF_ABS, off, 0, 0);
+    JGE(ctx, lo, LBL_NEXT, f);
+    JGT(ctx, hi, f, t);
+}
+
+// Either of the two values (at 'off1' or 'off2') are equal to 'k' when
+// masked w/ 'm' (if not 0), go to the next instruction if match or to 'f'.
+static void cmp_val_any(BPF_CTX_t *ctx, uint16_t ld, int off1, int off2,
+                        uint32_t k, uint32_t m, int f)
+{
+    int l_ok = new_label(ctx);
+    int l_try = new_label(ctx);
+    cmp_val(ctx, ld, off1, k, m, l_ok, l_try);
+    place_label(ctx, l_try);
+    cmp_val(ctx, ld, off2, k, m, LBL_NEXT, f);
+    place_label(ctx, l_ok);
+}
+
+// Either of the two values (at 'off1' or 'off2') are in the 'lo'-'hi'
+// range, go to the next instruction if match or to 'f'.
+static void cmp_rng_any(BPF_CTX_t *ctx, uint16_t ld, int off1, int off2,
+                        uint32_t lo, uint32_t hi, int f)
+{
+    int l_ok = new_label(ctx);
+    int l_try = new_label(ctx);
+    cmp_rng(ctx, ld, off1, lo, hi, l_ok, l_try);
+    place_label(ctx, l_try);
+    cmp_rng(ctx, ld, off2, lo, hi, LBL_NEXT, f);
+    place_label(ctx, l_ok);
+}
+
+// Emit code for Ethernet addresses match, jump to 'f' if no match.
+static void eth_addr_match(BPF_CTX_t *ctx, TPCAP_IF_t *tpif,
+                           PKT_PROC_ENTRY_t *pe, int f)
+{
+    unsigned int ef = pe->flags_eth;
+    int l_ok, l_try;
+
+    if((ef & PKT_MATCH_ETH_MAC_SRC) != 0) {
+        cmp_mac(ctx, OFF_ETH_SRC, pe->eth.mac, LBL_NEXT, f);
+    }
+    if((ef & PKT_MATCH_ETH_MYMAC_DST) != 0) {
+        cmp_mac(ctx, OFF_ETH_DST, tpif->mac, LBL_NEXT, f);
+    }
+    if((ef & PKT_MATCH_ETH_MAC_DST) != 0) {
+        cmp_mac(ctx, OFF_ETH_DST, pe->eth.mac, LBL_NEXT, f);
+    }
+    if((ef & PKT_MATCH_ETH_MAC_ANY) != 0) {
+        l_ok = new_label(ctx);
+        l_try = new_label(ctx);
+        cmp_mac(ctx, OFF_ETH_SRC, pe->eth.mac, l_ok, l_try);
+        place_label(ctx, l_try);
+        cmp_mac(ctx, OFF_ETH_DST, pe->eth.mac, LBL_NEXT, f);
+        place_label(ctx, l_ok);
+    }
+    // The group bit is the LSB of the first address byte
+    if((ef & PKT_MATCH_ETH_UCAST_SRC) != 0) {
+        LD_B(ctx, OFF_ETH_SRC);
+        JSET(ctx, 1, f, LBL_NEXT);
+    }
+    if((ef & PKT_MATCH_ETH_UCAST_DST) != 0) {
+        LD_B(ctx, OFF_ETH_DST);
+        JSET(ctx, 1, f, LBL_NEXT);
+    }
+    if((ef & PKT_MATCH_ETH_UCAST_ANY) != 0) {
+        l_ok = new_label(ctx);
+        LD_B(ctx, OFF_ETH_SRC);
+        JSET(ctx, 1, LBL_NEXT, l_ok);
+        LD_B(ctx, OFF_ETH_DST);
+        JSET(ctx, 1, f, LBL_NEXT);
+        place_label(ctx, l_ok);
+    }
+    if((ef & PKT_MATCH_ETH_MCAST_SRC) != 0) {
+        LD_B(ctx, OFF_ETH_SRC);
+        JSET(ctx, 1, LBL_NEXT, f);
+    }
+    if((ef & PKT_MATCH_ETH_MCAST_DST) != 0) {
+        LD_B(ctx, OFF_ETH_DST);
+        JSET(ctx, 1, LBL_NEXT, f);
+    }
+    if((ef & PKT_MATCH_ETH_MCAST_ANY) != 0) {
+        l_ok = new_label(ctx);
+        LD_B(ctx, OFF_ETH_SRC);
+        JSET(ctx, 1, l_ok, LBL_NEXT);
+        LD_B(ctx, OFF_ETH_DST);
+        JSET(ctx, 1, LBL_NEXT, f);
+        place_label(ctx, l_ok);
+    }
+}
+
+// Emit code for IPv4 addresses match, jump to 'f' if no match.
+static void ip_addr_match(BPF_CTX_t *ctx, TPCAP_IF_t *tpif,
+                          PKT_PROC_ENTRY_t *pe, int f)
+{
+    unsigned int ipf = pe->flags_ip;
+    // BPF loads the packet data in the host byte order
+    uint32_t a1 = ntohl(pe->ip.a1.i);
+    uint32_t a2 = ntohl(pe->ip.a2.i);
+
+    if((ipf & PKT_MATCH_IP_A1_SRC) != 0) {
+        cmp_val(ctx, BPF_W, OFF_IP_SRC, a1, 0, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_A1_DST) != 0) {
+        cmp_val(ctx, BPF_W, OFF_IP_DST, a1, 0, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_A1_ANY) != 0) {
+        cmp_val_any(ctx, BPF_W, OFF_IP_SRC, OFF_IP_DST, a1, 0, f);
+    }
+    if((ipf & PKT_MATCH_IP_A2_SRC) != 0) {
+        cmp_val(ctx, BPF_W, OFF_IP_SRC, a2, 0, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_A2_DST) != 0) {
+        cmp_val(ctx, BPF_W, OFF_IP_DST, a2, 0, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_A2_ANY) != 0) {
+        cmp_val_any(ctx, BPF_W, OFF_IP_SRC, OFF_IP_DST, a2, 0, f);
+    }
+    if((ipf & PKT_MATCH_IP_MY_DST) != 0) {
+        cmp_val(ctx, BPF_W, OFF_IP_DST, ntohl(tpif->ipcfg.ipv4.i), 0,
+                LBL_NEXT, f);
+    }
+    // The subnet mask of 0 matches any address
+    if((ipf & PKT_MATCH_IP_NET_SRC) != 0 && a2 != 0) {
+        cmp_val(ctx, BPF_W, OFF_IP_SRC, a1 & a2, a2, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_NET_DST) != 0 && a2 != 0) {
+        cmp_val(ctx, BPF_W, OFF_IP_DST, a1 & a2, a2, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_NET_ANY) != 0 && a2 != 0) {
+        cmp_val_any(ctx, BPF_W, OFF_IP_DST, OFF_IP_SRC, a1 & a2, a2, f);
+    }
+    if((ipf & PKT_MATCH_IP_RNG_SRC) != 0) {
+        cmp_rng(ctx, BPF_W, OFF_IP_SRC, a1, a2, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_RNG_DST) != 0) {
+        cmp_rng(ctx, BPF_W, OFF_IP_DST, a1, a2, LBL_NEXT, f);
+    }
+    if((ipf & PKT_MATCH_IP_RNG_ANY) != 0) {
+        cmp_rng_any(ctx, BPF_W, OFF_IP_SRC, OFF_IP_DST, a1, a2, f);
+    }
+}
+
+// Emit code for TCP/UDP ports match, jump to 'f' if no match.
+static void port_match(BPF_CTX_t *ctx, PKT_PROC_ENTRY_t *pe, int f)
+{
+    unsigned int tuf = pe->flags_tcpudp;
+    uint16_t p1 = pe->tcpudp.p1;
+    uint16_t p2 = pe->tcpudp.p2;
+
+    if((tuf & PKT_MATCH_TCPUDP_P1_SRC) != 0) {
+        cmp_val(ctx, BPF_H, OFF_L4_SRC, p1, 0, LBL_NEXT, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_P1_DST) != 0) {
+        cmp_val(ctx, BPF_H, OFF_L4_DST, p1, 0, LBL_NEXT, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_P1_ANY) != 0) {
+        cmp_val_any(ctx, BPF_H, OFF_L4_SRC, OFF_L4_DST, p1, 0, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_P2_SRC) != 0) {
+        cmp_val(ctx, BPF_H, OFF_L4_SRC, p2, 0, LBL_NEXT, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_P2_DST) != 0) {
+        cmp_val(ctx, BPF_H, OFF_L4_DST, p2, 0, LBL_NEXT, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_P2_ANY) != 0) {
+        cmp_val_any(ctx, BPF_H, OFF_L4_SRC, OFF_L4_DST, p2, 0, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_RNG_SRC) != 0) {
+        cmp_rng(ctx, BPF_H, OFF_L4_SRC, p1, p2, LBL_NEXT, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_RNG_DST) != 0) {
+        cmp_rng(ctx, BPF_H, OFF_L4_DST, p1, p2, LBL_NEXT, f);
+    }
+    if((tuf & PKT_MATCH_TCPUDP_RNG_ANY) != 0) {
+        cmp_rng_any(ctx, BPF_H, OFF_L4_SRC, OFF_L4_DST, p1, p2, f);
+    }
+}
+
+// Start a match group w/ optional negation. The group code jumps to the
+// returned label on mismatch. If not negated that is the next entry
+// label 'l_next', if negated the mismatch continues w/ the code after
+// the group (see group_end()) and the match jumps to 'l_next'.
+static int group_begin(BPF_CTX_t *ctx, int neg, int l_next)
+{
+    return neg ? new_label(ctx) : l_next;
+}
+
+// Complete the match group started by group_begin()
+static void group_end(BPF_CTX_t *ctx, int neg, int l_next, int f)
+{
+    if(neg) {
+        JA(ctx, l_next);
+        place_label(ctx, f);
+    }
+}
+
+// Emit code block for the packet processing entry
+static void compile_entry(BPF_CTX_t *ctx, TPCAP_IF_t *tpif,
+                          PKT_PROC_ENTRY_t *pe)
+{
+    unsigned int ef = pe->flags_eth;
+    unsigned int ipf = pe->flags_ip;
+    unsigned int tuf = pe->flags_tcpudp;
+    int l_next, l_ok, neg, f;
+
+    // The entries w/ no flags set never match
+    if((ef | ipf | tuf) == 0) {
+        return;
+    }
+    l_next = new_label(ctx);
+
+    // Ethernet header
+    if(ef != 0)
+    {
+        neg = ((ef & PKT_MATCH_ETH_MAC_NEG) != 0);
+        f = group_begin(ctx, neg, l_next);
+        eth_addr_match(ctx, tpif, pe, f);
+        group_end(ctx, neg, l_next, f);
+
+        neg = ((ef & PKT_MATCH_ETH_TYPE_NEG) != 0);
+        f = group_begin(ctx, neg, l_next);
+        if((ef & PKT_MATCH_ETH_TYPE) != 0) {
+            cmp_val(ctx, BPF_H, OFF_ETH_PROTO, ntohs(pe->eth.proto), 0,
+                    LBL_NEXT, f);
+        }
+        group_end(ctx, neg, l_next, f);
+    }
+
+    // IP header has to be there if checking IP or TCP/UDP
+    if((ipf | tuf) != 0)
+    {
+        l_ok = new_label(ctx);
+        LD_H(ctx, OFF_ETH_PROTO);
+        JEQ(ctx, ETH_P_IP, l_ok, LBL_NEXT);
+        JEQ(ctx, ETH_P_IPV6, LBL_NEXT, l_next);
+        place_label(ctx, l_ok);
+        LD_LEN(ctx);
+        JGE(ctx, OFF_IP + sizeof(struct iphdr), LBL_NEXT, l_next);
+    }
+
+    // IP header (the version is taken from the header the same way
+    // tpcap_match_packet() does it)
+    if(ipf != 0)
+    {
+        int l_v6 = new_label(ctx);
+        int l_done = new_label(ctx);
+
+        LD_B(ctx, OFF_IP);
+        RSH(ctx, 4);
+        JEQ(ctx, 4, LBL_NEXT, l_v6);
+
+        neg = ((ipf & PKT_MATCH_IP_ADDR_NEG) != 0);
+        f = group_begin(ctx, neg, l_next);
+        ip_addr_match(ctx, tpif, pe, f);
+        group_end(ctx, neg, l_next, f);
+
+        neg = ((ipf & PKT_MATCH_IP_PROTO_NEG) != 0);
+        f = group_begin(ctx, neg, l_next);
+        if((ipf & PKT_MATCH_IP_PROTO) != 0) {
+            cmp_val(ctx, BPF_B, OFF_IP_PROTO, pe->ip.proto, 0, LBL_NEXT, f);
+        }
+        group_end(ctx, neg, l_next, f);
+
+        JA(ctx, l_done);
+        place_label(ctx, l_v6);
+#ifdef FEATURE_IPV6_TELEMETRY
+        // The version is still in the accumulator
+        JEQ(ctx, 6, LBL_NEXT, l_next);
+
+        neg = ((ipf & PKT_MATCH_IP_PROTO_NEG) != 0);
+        f = group_begin(ctx, neg, l_next);
+        if((ipf & PKT_MATCH_IP_PROTO) != 0) {
+            cmp_val(ctx, BPF_B, OFF_IP6_NEXTHDR, pe->ip.proto, 0,
+                    LBL_NEXT, f);
+        }
+        group_end(ctx, neg, l_next, f);
+
+        // The IPv6 version match is always true here
+        if((ipf & PKT_MATCH_IP_V6_NEG) != 0) {
+            JA(ctx, l_next);
+        }
+#else  // FEATURE_IPV6_TELEMETRY
+        JA(ctx, l_next);
+#endif // FEATURE_IPV6_TELEMETRY
+        place_label(ctx, l_done);
+    }
+
+    // TCP/UDP header (tpcap_match_packet() checks the IPv4 protocol
+    // field and ports offsets regardless of the IP version)
+    if(tuf != 0)
+    {
+        l_ok = new_label(ctx);
+        LD_B(ctx, OFF_IP_PROTO);
+        JEQ(ctx, IPPROTO_TCP, l_ok, LBL_NEXT);
+        JEQ(ctx, IPPROTO_UDP, LBL_NEXT, l_next);
+        place_label(ctx, l_ok);
+        LD_LEN(ctx);
+        JGE(ctx, OFF_L4 + 2 * sizeof(uint16_t), LBL_NEXT, l_next);
+
+        neg = ((tuf & PKT_MATCH_TCPUDP_PORT_NEG) != 0);
+        f = group_begin(ctx, neg, l_next);
+        port_match(ctx, pe, f);
+        group_end(ctx, neg, l_next, f);
+
+        if((tuf & PKT_MATCH_TCPUDP_TCP_ONLY) != 0) {
+            cmp_val(ctx, BPF_B, OFF_IP_PROTO, IPPROTO_TCP, 0,
+                    LBL_NEXT, l_next);
+        }
+        if((tuf & PKT_MATCH_TCPUDP_UDP_ONLY) != 0) {
+            cmp_val(ctx, BPF_B, OFF_IP_PROTO, IPPROTO_UDP, 0,
+                    LBL_NEXT, l_next);
+        }
+    }
+
+    RET(ctx, TPCAP_BPF_ACCEPT);
+    place_label(ctx, l_next);
+}
+
+// Compile the packet processing table entries into the BPF socket
+// filter program for the interface.
+// tpif - the interface the program is for (the interface MAC and IP
+//        are needed for the PKT_MATCH_ETH_MYMAC_DST and PKT_MATCH_IP_MY_DST)
+// prog - (OUT) the program
+// Returns: 0 - if successful, negative if the table can't be compiled
+//          (the caller should then capture w/ no filter)
+// Note: the program is stored in a static buffer, the caller has to
+//       serialize the calls and use the program before the next call
+int tpcap_bpf_compile(TPCAP_IF_t *tpif, struct sock_fprog *prog)
+{
+    BPF_CTX_t *ctx = &bpf_ctx;
+    PKT_PROC_ENTRY_t *pe_arr[MAX_PKT_PROC_ENTRIES];
+    int ii, count, l_ok, err;
+
+    memset(prog, 0, sizeof(*prog));
+    ctx->len = 0;
+    ctx->err = FALSE;
+    ctx->lbl_count = 0;
+    // Label 0 is reserved for LBL_NEXT
+    new_label(ctx);
+
+    count = tpcap_get_proc_entries(pe_arr, UTIL_ARRAY_SIZE(pe_arr));
+
+    // Drop the frames tpcap does not process (see process_packets())
+    l_ok = new_label(ctx);
+    LD_LEN(ctx);
+    JGE(ctx, sizeof(struct ethhdr), l_ok, LBL_NEXT);
+    RET(ctx, 0);
+    place_label(ctx, l_ok);
+    l_ok = new_label(ctx);
+    LD_H(ctx, OFF_ETH_PROTO);
+    JGE(ctx, TPCAP_ETHTYPE_MIN, l_ok, LBL_NEXT);
+    RET(ctx, 0);
+    place_label(ctx, l_ok);
+
+    for(ii = 0; ii < count; ii++) {
+        compile_entry(ctx, tpif, pe_arr[ii]);
+    }
+
+    // None of the entries matched
+    RET(ctx, 0);
+
+    if(ctx->err) {
+        log("%s: %s: the program is too large\n", __func__, tpif->name);
+        return -1;
+    }
+    if((err = resolve_labels(ctx)) != 0) {
+        log("%s: %s: error %d resolving jumps\n", __func__, tpif->name, err);
+        return -2;
+    }
+
+    prog->len = ctx->len;
+    prog->filter = ctx->insn;
+
+    return 0;
+}
+
+#endif // FEATURE_TPCAP_USES_CBPF
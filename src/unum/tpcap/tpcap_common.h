@@ -25,6 +25,24 @@
 // we are extracting from the captured packets.
 #define TPCAP_SNAP_LEN 1024
 
+// TPACKET_V3 ring defaults (used if FEATURE_TPCAP_TPACKET_V3 is defined).
+// The ring is the same size as the TPACKET_V2 one (512KB, the platforms
+// overriding TPCAP_NUM_PACKETS scale the number of blocks accordingly).
+// The captured frames are packed back to back into the blocks, so it holds
+// more of the small packets, but the frames cut at the snap length take
+// about the same space as the TPACKET_V2 slots (~1070B w/ the headers).
+// The block is passed to the user when it is full or when its retire
+// timeout expires. The snap length is enforced by the socket filter.
+
+// Block size (has to be a multiple of PAGE_SIZE)
+#define TPCAP_V3_BLOCK_SIZE (1 << 15)
+
+// Number of blocks in the ring
+#define TPCAP_V3_NUM_BLOCKS 16
+
+// Block retire timeout (in milliseconds)
+#define TPCAP_V3_BLOCK_TMO 100
+
 // Ethernet II types min ID (we will ignore any ethtype less)
 #define TPCAP_ETHTYPE_MIN 1536
 
@@ -50,7 +68,7 @@ typedef struct _TPCAP_IF {
     int fd; // packet capturing socket descriptor
     unsigned char *ring;   // packet capturing ring address
     unsigned int ring_len; // ring size in bytes
-    unsigned int idx;      // last read packet index in the ring
+    unsigned int idx;      // last read packet (block for TPACKET_V3) index
     unsigned long long proc_pkt_count; // processed packets counter
 } TPCAP_IF_t;
 
@@ -72,6 +90,32 @@ typedef struct _TPCAP_IF_STATS {
 } TPCAP_IF_STATS_t;
 
 
+// Convert TPACKET_V3 frame header to the TPACKET_V2 header in place,
+// the packet processing code works with the TPACKET_V2 headers only.
+// Both headers are at the start of the frame and the tp_mac and tp_net
+// offsets are relative to it, so they stay valid. The v3 header is larger
+// than v2, the conversion does not touch the packet data.
+// Note: the tp_next_offset is lost, read it before the conversion
+static __inline__ struct tpacket2_hdr *
+tpcap_v3_to_v2_hdr(struct tpacket3_hdr *h3)
+{
+    struct tpacket3_hdr h = *h3;
+    struct tpacket2_hdr *h2 = (struct tpacket2_hdr *)h3;
+
+    memset(h2, 0, sizeof(*h2));
+    h2->tp_status = h.tp_status;
+    h2->tp_len = h.tp_len;
+    h2->tp_snaplen = h.tp_snaplen;
+    h2->tp_mac = h.tp_mac;
+    h2->tp_net = h.tp_net;
+    h2->tp_sec = h.tp_sec;
+    h2->tp_nsec = h.tp_nsec;
+    h2->tp_vlan_tci = h.hv1.tp_vlan_tci;
+    h2->tp_vlan_tpid = h.hv1.tp_vlan_tpid;
+
+    return h2;
+}
+
 // Get the pointer to the interface stats table
 // Should only be used in the the tpcap thread
 TPCAP_IF_STATS_t *tpcap_get_if_stats(void);
@@ -100,6 +144,7 @@ int tpcap_init(int level);
 #define TPCAP_TEST_DT      5 // test devices & connection info collection
 #define TPCAP_TEST_DT_JSON 6 // test building JSON from devices telemetry data
 #define TPCAP_TEST_FP_JSON 7 // test fingerprinting info collection and JSON
+#define TPCAP_TEST_V3      8 // test TPACKET_V3 block ring capturing
 
 // TPCAP test invocation macro
 #define TPCAP_RUN_TEST(_id) (     \
@@ -8,6 +8,7 @@ CPPFLAGS += -I$(UNUM_PATH)/tpcap/$(MODEL)
 OBJECTS += \
   ./tpcap/tpcap.o       \
   ./tpcap/process_pkt.o \
+  ./tpcap/tpcap_bpf.o   \
   ./tpcap/$(MODEL)/tpcap_platform.o
 
 # Add subsystem initializer function
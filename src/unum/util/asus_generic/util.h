@@ -15,8 +15,17 @@
 #include "../jobs.h"
 // Timers
 #include "../util_timer.h"
+// Event loop
+#include "../util_reactor.h"
+// Arena allocator
+#include "../util_arena.h"
+#include "../util_rht.h"
 // Networking
 #include "../util_net.h"
+// Packet socket TX ring
+#include "../util_txring.h"
+// Store-and-forward request spool
+#include "../util_spool.h"
 // JSON
 #include "../util_json.h"
 // Crash handling
@@ -67,7 +76,7 @@
 // The format string for scanning device counters for the platform
 // and the minimum number of values sscanf should return to accept it.
 #define UTIL_NET_DEV_CNTRS_FORMAT \
-  "%llu%llu%lu%lu%lu%lu%lu%lu%llu%llu%lu%lu%lu%lu%lu%lu"
+  "%llu%llu%llu%llu%llu%llu%llu%llu%llu%llu%llu%llu%llu%llu%llu%llu"
 #define UTIL_NET_DEV_CNTRS_FORMAT_COUNT 16
 // Get Interface kind
 // Parameters:
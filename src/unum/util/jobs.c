@@ -110,9 +110,10 @@ int util_start_thrd(const char *name, THRD_FUNC_t f,
             thrd_ptr->param = *p;
         }
         if(ctl) {
-            thrd_ptr->wd_timeout = ctl->wd_timeout;
+            thrd_ptr->wd.timeout = ctl->wd_timeout;
         }
-        thrd_ptr->wd_uptime = util_time(1);
+        thrd_ptr->wd.uptime = util_time(1);
+        thrd_ptr->wd_ptr = &(thrd_ptr->wd);
         // Start the thread
         ret = pthread_create(&(thrd_ptr->thread), p_attr,
                              thread_start_wrapper, thrd_ptr);
@@ -171,6 +172,7 @@ int util_set_main_thrd()
         thrd_ptr->tid = syscall(SYS_gettid);
         thrd_ptr->flags |= THRD_FLAG_STARTED;
         thrd_ptr->flags |= THRD_FLAG_BUSY;
+        thrd_ptr->wd_ptr = &(thrd_ptr->wd);
         snprintf(thrd_ptr->name, MAX_THRD_NAME_LEN, "main");
         main_thrd_ptr = thrd_ptr;
         break;
@@ -191,12 +193,13 @@ int util_wd_set_timeout(unsigned int timeout)
             __func__, thrd_ptr);
         return -1;
     }
-    log_dbg("%s: setting watchdog timeout to %d sec for %s\n",
-            __func__, timeout, thrd_ptr->name);
+    log_dbg("%s: setting watchdog timeout to %d sec for %s%s\n",
+            __func__, timeout, thrd_ptr->name,
+            (thrd_ptr->wd_ptr != &(thrd_ptr->wd) ? " task" : ""));
     __sync_synchronize();
-    thrd_ptr->wd_uptime = util_time(1);
+    thrd_ptr->wd_ptr->uptime = util_time(1);
     __sync_synchronize();
-    thrd_ptr->wd_timeout = timeout;
+    thrd_ptr->wd_ptr->timeout = timeout;
     return 0;
 }
 
@@ -210,19 +213,47 @@ int util_wd_poll(void)
         return -1;
     }
     __sync_synchronize();
-    thrd_ptr->wd_uptime = util_time(1);
+    thrd_ptr->wd_ptr->uptime = util_time(1);
     return 0;
 }
 
+// Make the calling thread util_wd_set_timeout() and util_wd_poll() calls
+// update the specified watchdog, NULL switches back to the thread's own.
+// Returns 0 if successful.
+int util_wd_attach(UTIL_WD_t *wd)
+{
+    UTIL_THRD_t *thrd_ptr = (UTIL_THRD_t *)pthread_getspecific(thrd_key);
+    if(thrd_ptr < threads || thrd_ptr >= &(threads[MAX_THRD_COUNT])) {
+        log("%s: error, invalid thread info pointer %p\n",
+            __func__, thrd_ptr);
+        return -1;
+    }
+    thrd_ptr->wd_ptr = (wd ? wd : &(thrd_ptr->wd));
+    return 0;
+}
+
+// Returns the number of seconds the watchdog is late for, 0 if it is ok
+// or not enabled
+int util_wd_late(UTIL_WD_t *wd)
+{
+    unsigned long timeout = wd->timeout;
+    unsigned long uptime = wd->uptime;
+    int late;
+
+    if(timeout == 0) {
+        return 0; // wd is not enabled
+    }
+    late = (util_time(1) - uptime) - timeout;
+
+    return (late > 0) ? late : 0;
+}
+
 // Check the specified thread watchdog for expiration
 // Returns 0 if the thread is ok, or the number of the seconds it is late for.
 // Returns negative number if the thread is not started or not found.
 static int util_wd_check(UTIL_THRD_t *thrd_ptr)
 {
     int late, ret = 0;
-    unsigned long wd_timeout;
-    unsigned long wd_uptime;
-    unsigned long cur_uptime;
 
     UTIL_MUTEX_TAKE(&thrd_m);
     for(;;)
@@ -238,16 +269,11 @@ static int util_wd_check(UTIL_THRD_t *thrd_ptr)
             ret = -2;
             break;
         }
-        wd_timeout = thrd_ptr->wd_timeout;
-        wd_uptime = thrd_ptr->wd_uptime;
-        cur_uptime = util_time(1);
-        if(wd_timeout == 0) {
-            break; // wd is not enabled
-        }
-        late = (cur_uptime - wd_uptime) - wd_timeout;
+        late = util_wd_late(&(thrd_ptr->wd));
         if(late > 0) {
-            log("%s: thread %s (%d) is %d sec late polling wd, timeout %lu\n",
-                __func__, thrd_ptr->name, thrd_ptr->tid, late, wd_timeout);
+            log("%s: thread %s (%d) is %d sec late polling wd, timeout %u\n",
+                __func__, thrd_ptr->name, thrd_ptr->tid, late,
+                thrd_ptr->wd.timeout);
             ret = late;
             break;
         }
@@ -273,4 +299,10 @@ void util_wd_check_all(void)
             // Should never reach this point
         }
     }
+    // The reactor tasks
+    if(util_reactor_wd_check() > 0) {
+        log("%s: restarting due to task wd timeout\n", __func__);
+        util_restart(UNUM_START_REASON_WD_TIMEOUT);
+        // Should never reach this point
+    }
 }
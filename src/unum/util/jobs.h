@@ -35,6 +35,12 @@ typedef struct {
     unsigned int wd_timeout; // Watchdog timeout in seconds (0 - off)
 } THRD_CTL_t;
 
+// Watchdog state (each thread and each reactor task has one)
+typedef struct {
+    unsigned long volatile uptime; // Uptime of the last watchdog poll
+    unsigned int volatile timeout; // Watchdog timeout in seconds (0 - off)
+} UTIL_WD_t;
+
 // Thread info type
 typedef struct {
     int flags;    // thread flags
@@ -43,8 +49,8 @@ typedef struct {
     char name[MAX_THRD_NAME_LEN]; // thread name
     THRD_FUNC_t func;  // job function pointer
     THRD_PARAM_t param; // job function parameter
-    unsigned long volatile wd_uptime; // Uptime of the last watchdog poll
-    unsigned int volatile wd_timeout; // Watchdog timeout in seconds (0 - off)
+    UTIL_WD_t wd; // thread watchdog
+    UTIL_WD_t *volatile wd_ptr; // watchdog the util_wd_*() calls update
 } UTIL_THRD_t;
 
 
@@ -75,6 +81,16 @@ int util_wd_set_timeout(unsigned int timeout);
 // Update the calling thread wd, returns 0 if successful
 int util_wd_poll(void);
 
+// Make the calling thread util_wd_set_timeout() and util_wd_poll() calls
+// update the specified watchdog (the reactor uses it to apply them to the
+// task which step it is running), NULL switches back to the thread's own
+// watchdog. Returns 0 if successful.
+int util_wd_attach(UTIL_WD_t *wd);
+
+// Returns the number of seconds the watchdog is late for, 0 if it is ok
+// or not enabled
+int util_wd_late(UTIL_WD_t *wd);
+
 // Checks all the threads for watchdog timeout
 // Restarts the agent if fails.
 void util_wd_check_all(void);
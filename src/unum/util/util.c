@@ -710,9 +710,13 @@ int util_init(int level)
         util_init_thrd_key();
         ret |= util_set_main_thrd();
     }
-    // Init timers subsystem (Note: requires threads)
+    // Start the reactor running the timers and the tasks (Note: requires
+    // threads), open the telemetry spool (start the uploader thread) and
+    // start the interface configuration cache (runs in the reactor)
     if(level == INIT_LEVEL_TIMERS) {
         ret |= util_timers_init();
+        ret |= util_spool_init();
+        ret |= util_net_if_cache_init();
     }
 
     return ret;
@@ -0,0 +1,90 @@
+// (c) 2022 minim.co
+// unum fixed size items arena allocator
+
+#include "unum.h"
+
+
+/* Temporary, log to console from here */
+//#undef LOG_DST
+//#undef LOG_DBG_DST
+//#define LOG_DST LOG_DST_CONSOLE
+//#define LOG_DBG_DST LOG_DST_CONSOLE
+
+
+// Initialize the arena
+// a - the arena structure
+// item_size - size of the items to allocate
+// max - max number of items
+// Returns: 0 - if successful
+int util_arena_init(UTIL_ARENA_t *a, unsigned int item_size, unsigned int max)
+{
+    memset(a, 0, sizeof(UTIL_ARENA_t));
+
+    // Slots have to be large enough for the free list link
+    if(item_size < sizeof(unsigned int)) {
+        item_size = sizeof(unsigned int);
+    }
+    item_size = (item_size + UTIL_ARENA_ALIGN - 1) & ~(UTIL_ARENA_ALIGN - 1);
+
+    // Use calloc() so the pages we never get to are not touched
+    a->mem = UTIL_CALLOC(max, item_size);
+    if(a->mem == NULL) {
+        log("%s: failed to allocate %u items of %u bytes\n",
+            __func__, max, item_size);
+        return -1;
+    }
+    a->item_size = item_size;
+    a->max = max;
+
+    return 0;
+}
+
+// Free the arena memory (all the items are released)
+void util_arena_destroy(UTIL_ARENA_t *a)
+{
+    if(a->mem != NULL) {
+        UTIL_FREE(a->mem);
+    }
+    memset(a, 0, sizeof(UTIL_ARENA_t));
+}
+
+// Allocate an item (the item memory is not zeroed)
+// Returns: the item pointer or NULL if no more free slots (the failure
+//          is counted in the arena alloc_fails)
+void *util_arena_alloc(UTIL_ARENA_t *a)
+{
+    void *item;
+
+    if(a->free_head != 0) {
+        item = UTIL_ARENA_ITEM(a, a->free_head - 1);
+        memcpy(&a->free_head, item, sizeof(a->free_head));
+    } else if(a->used < a->max) {
+        item = UTIL_ARENA_ITEM(a, a->used);
+        ++(a->used);
+    } else {
+        ++(a->alloc_fails);
+        return NULL;
+    }
+    ++(a->count);
+
+    return item;
+}
+
+// Return the item to the arena
+void util_arena_free(UTIL_ARENA_t *a, void *item)
+{
+    if(item == NULL) {
+        return;
+    }
+    memcpy(item, &a->free_head, sizeof(a->free_head));
+    a->free_head = UTIL_ARENA_IDX(a, item) + 1;
+    --(a->count);
+}
+
+// Release all the items (the memory stays allocated)
+void util_arena_reset(UTIL_ARENA_t *a)
+{
+    a->used = 0;
+    a->free_head = 0;
+    a->count = 0;
+}
@@ -0,0 +1,59 @@
+// (c) 2022 minim.co
+// unum fixed size items arena allocator include file
+
+#ifndef _UTIL_ARENA_H
+#define _UTIL_ARENA_H
+
+
+// Items alignment in the arena (the data table structures are packed,
+// but we still want each item to start at the aligned address)
+#define UTIL_ARENA_ALIGN 8
+
+// The arena is a single preallocated block of memory divided into
+// 'max' slots of the same size. The slots are handed out by index,
+// the never used ones first, then the ones that were freed (the free
+// slots are chained through their first 4 bytes). It is meant for
+// the tables that would otherwise malloc() each entry on first use
+// (from the packet processing path). It is not thread safe, the users
+// are expected to access it from the thread owning the table.
+typedef struct _UTIL_ARENA {
+    unsigned char *mem;       // slots memory (NULL if not initialized)
+    unsigned int item_size;   // slot size (aligned item size)
+    unsigned int max;         // max number of slots
+    unsigned int used;        // number of slots ever handed out
+    unsigned int free_head;   // first freed slot index + 1 (0 if none)
+    unsigned int count;       // number of currently allocated slots
+    unsigned long alloc_fails;// failed allocation attempts counter
+} UTIL_ARENA_t;
+
+
+// Initialize the arena
+// a - the arena structure
+// item_size - size of the items to allocate
+// max - max number of items
+// Returns: 0 - if successful
+int util_arena_init(UTIL_ARENA_t *a, unsigned int item_size, unsigned int max);
+
+// Free the arena memory (all the items are released)
+void util_arena_destroy(UTIL_ARENA_t *a);
+
+// Allocate an item (the item memory is not zeroed)
+// Returns: the item pointer or NULL if no more free slots (the failure
+//          is counted in the arena alloc_fails)
+void *util_arena_alloc(UTIL_ARENA_t *a);
+
+// Return the item to the arena
+void util_arena_free(UTIL_ARENA_t *a, void *item);
+
+// Release all the items (the memory stays allocated)
+void util_arena_reset(UTIL_ARENA_t *a);
+
+// Get the item slot index (the item must be from the arena)
+#define UTIL_ARENA_IDX(_a, _p) \
+    ((unsigned int)(((unsigned char *)(_p) - (_a)->mem) / (_a)->item_size))
+
+// Get the item pointer by its slot index
+#define UTIL_ARENA_ITEM(_a, _i) \
+    ((void *)((_a)->mem + (unsigned long)(_i) * (_a)->item_size))
+
+#endif // _UTIL_ARENA_H
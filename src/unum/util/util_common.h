@@ -129,6 +129,12 @@ enum RADIO_KIND {
         VAL = MIN;\
     }\
 };
+// Swap values of two variables of the same type
+#define UTIL_SWAP(a, b) {\
+    __typeof__(a) _swap_tmp = (a);\
+    (a) = (b);\
+    (b) = _swap_tmp;\
+}
 
 // FIFO Queue macros (_h - queue head var ptr, _i - item var ptr),
 // declare head as: UTIL_QI_t head = { &head; &head };
@@ -5,7 +5,9 @@
 OBJECTS += ./util/util.o ./util/jobs.o ./util/util_event.o ./util/util_net.o
 OBJECTS += ./util/util_json.o ./util/util_timer.o ./util/util_crashinfo.o
 OBJECTS += ./util/$(MODEL)/util_platform.o ./util/util_stubs.o ./util/util_dns.o
-OBJECTS += ./util/util_kind.o ./util/util_stime.o
+OBJECTS += ./util/util_kind.o ./util/util_stime.o ./util/util_arena.o
+OBJECTS += ./util/util_rht.o ./util/util_txring.o
+OBJECTS += ./util/util_spool.o ./util/util_reactor.o
 
 # Add zlib files
 OBJECTS += ./util/util_zlib.o
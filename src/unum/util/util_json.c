@@ -6,6 +6,27 @@
 // Max length of json value to print in logs
 #define MAX_JSON_VAL_LOG 512
 
+// Size of the template JSON writer output staging buffer
+#define TPL_WR_BUF_SIZE 512
+
+// Template JSON writer state
+typedef struct {
+    json_dump_callback_t cb; // output callback
+    void *data;              // output callback data
+    size_t flags;            // jansson json_dump*() flags
+    int len;                 // number of bytes in the staging buffer
+    char buf[TPL_WR_BUF_SIZE]; // staging buffer
+} TPL_WR_t;
+
+// Growable buffer for util_tpl_to_json_str() and caller's buffer
+// for util_tpl_to_json_buf()
+typedef struct {
+    char *buf; // buffer pointer
+    int size;  // buffer size
+    int len;   // data length
+    int grow;  // TRUE if the buffer can be reallocated
+} TPL_WR_STR_t;
+
 
 // Function for building libjansson JSON value from a template.
 // The created value must be freed by json_decref() libjansson function.
@@ -284,30 +305,527 @@ char *util_json_obj_to_str(json_t *obj)
 {
     char *jstr;
 
-#ifdef DEBUG
-    jstr = json_dumps(obj, JSON_INDENT(2));
-#else  // DEBUG
-    jstr = json_dumps(obj, JSON_COMPACT);
-#endif // DEBUG
+    jstr = json_dumps(obj, UTIL_JSON_DUMP_FLAGS);
 
     return jstr;
 }
 
+// Pass the template writer staging buffer content to the output callback
+// Returns: 0 - success, negative - error
+static int tpl_wr_flush(TPL_WR_t *w)
+{
+    if(w->len > 0 && w->cb(w->buf, w->len, w->data) != 0) {
+        return -1;
+    }
+    w->len = 0;
+    return 0;
+}
+
+// Add data to the template writer output
+// Returns: 0 - success, negative - error
+static int tpl_wr_put(TPL_WR_t *w, const char *str, int len)
+{
+    if(w->len + len > TPL_WR_BUF_SIZE) {
+        if(tpl_wr_flush(w) != 0) {
+            return -1;
+        }
+        if(len > TPL_WR_BUF_SIZE) {
+            return (w->cb(str, len, w->data) != 0) ? -1 : 0;
+        }
+    }
+    memcpy(w->buf + w->len, str, len);
+    w->len += len;
+    return 0;
+}
+
+// Add a new line and indentation for the depth (or the space
+// between the items) to the template writer output (does the same
+// as dump_indent() in jansson)
+// Returns: 0 - success, negative - error
+static int tpl_wr_indent(TPL_WR_t *w, int depth, int space)
+{
+    int ii, indent = w->flags & JSON_MAX_INDENT;
+    static const char whitespace[] = "                                ";
+
+    if(indent > 0) {
+        if(tpl_wr_put(w, "\n", 1) != 0) {
+            return -1;
+        }
+        for(ii = 0; ii < depth; ii++) {
+            if(tpl_wr_put(w, whitespace, indent) != 0) {
+                return -1;
+            }
+        }
+    } else if(space && (w->flags & JSON_COMPACT) == 0) {
+        return tpl_wr_put(w, " ", 1);
+    }
+    return 0;
+}
+
+// Get the next UTF-8 character code point from the string
+// (validates the same way as jansson)
+// Returns: the number of bytes taken by the character or 0 if invalid
+static int tpl_wr_utf8(const unsigned char *str, int32_t *cp)
+{
+    int ii, len;
+    int32_t val;
+    unsigned char u = str[0];
+
+    if(u < 0x80) {
+        *cp = u;
+        return 1;
+    } else if(u >= 0xC2 && u <= 0xDF) {
+        len = 2;
+        val = u & 0x1F;
+    } else if(u >= 0xE0 && u <= 0xEF) {
+        len = 3;
+        val = u & 0xF;
+    } else if(u >= 0xF0 && u <= 0xF4) {
+        len = 4;
+        val = u & 0x7;
+    } else {
+        return 0;
+    }
+    for(ii = 1; ii < len; ii++) {
+        // Also stops at the string terminating 0
+        if(str[ii] < 0x80 || str[ii] > 0xBF) {
+            return 0;
+        }
+        val = (val << 6) + (str[ii] & 0x3F);
+    }
+    if(val > 0x10FFFF || (val >= 0xD800 && val <= 0xDFFF) ||
+       (len == 2 && val < 0x80) || (len == 3 && val < 0x800) ||
+       (len == 4 && val < 0x10000))
+    {
+        return 0;
+    }
+    *cp = val;
+
+    return len;
+}
+
+// Add quoted and escaped string to the template writer output (the escaping
+// is the same as jansson does in dump_string())
+// Returns: 0 - success, negative - error (including invalid UTF-8)
+static int tpl_wr_string(TPL_WR_t *w, const char *str)
+{
+    const unsigned char *ptr = (const unsigned char *)str;
+    const unsigned char *run = ptr;
+    int32_t cp;
+    int len;
+    char seq[13];
+    const char *text;
+
+    if(tpl_wr_put(w, "\"", 1) != 0) {
+        return -1;
+    }
+    for(;;)
+    {
+        // Skip over the characters that do not need escaping
+        for(len = 1; *ptr != 0; ptr += len) {
+            if(*ptr < 0x80) {
+                cp = *ptr;
+                len = 1;
+            } else if((len = tpl_wr_utf8(ptr, &cp)) == 0) {
+                return -1;
+            }
+            if(cp == '\\' || cp == '"' || cp < 0x20 ||
+               ((w->flags & JSON_ESCAPE_SLASH) != 0 && cp == '/') ||
+               ((w->flags & JSON_ENSURE_ASCII) != 0 && cp > 0x7F))
+            {
+                break;
+            }
+        }
+        if(ptr != run &&
+           tpl_wr_put(w, (const char *)run, ptr - run) != 0)
+        {
+            return -1;
+        }
+        if(*ptr == 0) {
+            break;
+        }
+        switch(cp)
+        {
+            case '\\': text = "\\\\"; break;
+            case '\"': text = "\\\""; break;
+            case '\b': text = "\\b"; break;
+            case '\f': text = "\\f"; break;
+            case '\n': text = "\\n"; break;
+            case '\r': text = "\\r"; break;
+            case '\t': text = "\\t"; break;
+            case '/':  text = "\\/"; break;
+            default:
+                if(cp < 0x10000) {
+                    sprintf(seq, "\\u%04X", cp);
+                } else {
+                    cp -= 0x10000;
+                    sprintf(seq, "\\u%04X\\u%04X",
+                            0xD800 | ((cp & 0xffc00) >> 10),
+                            0xDC00 | (cp & 0x003ff));
+                }
+                text = seq;
+                break;
+        }
+        if(tpl_wr_put(w, text, strlen(text)) != 0) {
+            return -1;
+        }
+        ptr += len;
+        run = ptr;
+    }
+
+    return tpl_wr_put(w, "\"", 1);
+}
+
+// Add integer to the template writer output
+// Returns: 0 - success, negative - error
+static int tpl_wr_int(TPL_WR_t *w, json_int_t val)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%" JSON_INTEGER_FORMAT, val);
+    return tpl_wr_put(w, buf, len);
+}
+
+static int tpl_wr_obj(TPL_WR_t *w, JSON_KEYVAL_TPL_t *tpl, int depth);
+
+// Add value from the template to the template writer output. The value
+// is preceded by the item separator (unless it is the first item) and
+// the key (if it is an object item).
+// It takes the same values util_tpl_to_json_val() does, calling
+// the template functions in the same order.
+// val - pointer to the value template
+// key - name of the value key (array key for arrays)
+// okey - the object key to write (NULL for array items)
+// depth - the value depth (for indentation)
+// pcount - ptr to the number of items already written to the
+//          object or array (incremented if the value is written)
+// Returns: 1 - value is written, 0 - nothing to write, negative - error
+static int tpl_wr_val(TPL_WR_t *w, JSON_VAL_TPL_t *val, char *key,
+                      char *okey, int depth, int *pcount)
+{
+    int ii, count, vtype;
+    int *pi;
+    char *s = NULL;
+    json_int_t jint = 0;
+    JSON_KEYVAL_TPL_t *o = NULL;
+
+    // Get the value (calling the template functions if needed), return
+    // if nothing to write.
+    switch(val->type) {
+        case JSON_VAL_STR:
+            if((s = val->s) == NULL) {
+                return 0;
+            }
+            vtype = JSON_STRING;
+            break;
+        case JSON_VAL_INT:
+            jint = val->i;
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_UL:
+            jint = val->ul;
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_PINT:
+            if(!val->pi) {
+                return 0;
+            }
+            jint = *(val->pi);
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_PUL:
+            if(!val->pul) {
+                return 0;
+            }
+            jint = *(val->pul);
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_PUINT:
+            if(!val->pui) {
+                return 0;
+            }
+            jint = *(val->pui);
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_PJINT:
+            if(!val->pji) {
+                return 0;
+            }
+            jint = *(val->pji);
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_OBJ:
+            if((o = val->o) == NULL) {
+                return 0;
+            }
+            vtype = JSON_OBJECT;
+            break;
+        case JSON_VAL_FSTR:
+            if(!val->fs || (s = val->fs(key)) == NULL) {
+                return 0;
+            }
+            vtype = JSON_STRING;
+            break;
+        case JSON_VAL_FINT:
+            if(!val->fi) {
+                return 0;
+            }
+            jint = val->fi(key);
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_PFINT:
+            if(!val->fpi || (pi = val->fpi(key)) == NULL) {
+                return 0;
+            }
+            jint = *pi;
+            vtype = JSON_INTEGER;
+            break;
+        case JSON_VAL_FOBJ:
+            if(!val->fo || (o = val->fo(key)) == NULL) {
+                return 0;
+            }
+            vtype = JSON_OBJECT;
+            break;
+        case JSON_VAL_ARRAY:
+        case JSON_VAL_FARRAY:
+            if(!val->a) {
+                return 0;
+            }
+            vtype = JSON_ARRAY;
+            break;
+        default:
+            log("%s: value type %d is not supported\n",
+                __func__, val->type);
+            return -1;
+    }
+
+    // Item separator and the key
+    if(*pcount > 0 && tpl_wr_put(w, ",", 1) != 0) {
+        return -1;
+    }
+    if(tpl_wr_indent(w, depth, (*pcount > 0)) != 0) {
+        return -1;
+    }
+    ++(*pcount);
+    if(okey) {
+        if(tpl_wr_string(w, okey) != 0 ||
+           tpl_wr_put(w, ":", 1) != 0 ||
+           ((w->flags & JSON_COMPACT) == 0 && tpl_wr_put(w, " ", 1) != 0))
+        {
+            log("%s: error adding key '%s'\n", __func__, okey);
+            return -1;
+        }
+    }
+
+    // The value
+    switch(vtype) {
+        case JSON_STRING:
+            if(tpl_wr_string(w, s) != 0) {
+                log("%s: error adding '%s' value '%.*s%s'\n", __func__,
+                    key, MAX_JSON_VAL_LOG, s,
+                    (strlen(s) > MAX_JSON_VAL_LOG ? "..." : ""));
+                return -1;
+            }
+            break;
+        case JSON_INTEGER:
+            if(tpl_wr_int(w, jint) != 0) {
+                return -1;
+            }
+            break;
+        case JSON_OBJECT:
+            if(tpl_wr_obj(w, o, depth) != 0) {
+                log("%s: error adding '%s' object\n", __func__, key);
+                return -1;
+            }
+            break;
+        case JSON_ARRAY:
+            if(tpl_wr_put(w, "[", 1) != 0) {
+                return -1;
+            }
+            count = 0;
+            for(ii = 0; ii < MAX_JSON_ARRAY_ELEMENTS; ii++)
+            {
+                JSON_VAL_TPL_t *v;
+                if(val->type == JSON_VAL_ARRAY) {
+                    v = &(val->a[ii]);
+                } else {
+                    v = val->fa(key, ii);
+                }
+                if(!v || v->type == JSON_VAL_END) {
+                    break;
+                }
+                if(v->type == JSON_VAL_SKIP) {
+                    continue;
+                }
+                if(tpl_wr_val(w, v, key, NULL, depth + 1, &count) <= 0) {
+                    log("%s: error adding item %d to array '%s'\n",
+                        __func__, ii, key);
+                    return -1;
+                }
+            }
+            if((count > 0 && tpl_wr_indent(w, depth, 0) != 0) ||
+               tpl_wr_put(w, "]", 1) != 0)
+            {
+                return -1;
+            }
+            break;
+    }
+
+    return 1;
+}
+
+// Add object from the template to the template writer output
+// Returns: 0 - success, negative - error
+static int tpl_wr_obj(TPL_WR_t *w, JSON_KEYVAL_TPL_t *tpl, int depth)
+{
+    JSON_KEYVAL_TPL_t *kv;
+    int count = 0;
+
+    if(tpl_wr_put(w, "{", 1) != 0) {
+        return -1;
+    }
+    for(kv = tpl; kv && kv->key; kv++)
+    {
+        if(tpl_wr_val(w, &kv->val, kv->key, kv->key, depth + 1, &count) < 0) {
+            return -1;
+        }
+    }
+    if(count > 0 && tpl_wr_indent(w, depth, 0) != 0) {
+        return -1;
+    }
+
+    return tpl_wr_put(w, "}", 1);
+}
+
+// Function for generating JSON from a template w/o building the libjansson
+// objects. The output is passed to the callback in chunks as it is
+// generated. It is the same as dumping the util_tpl_to_json_obj() object
+// with json_dump_callback() and JSON_PRESERVE_ORDER flag (the template
+// keys must be unique).
+// tpl - the template
+// flags - jansson json_dump*() flags, JSON_INDENT(n), JSON_COMPACT,
+//         JSON_ENSURE_ASCII and JSON_ESCAPE_SLASH are supported
+// cb - output callback, returns non-0 to abort
+// data - the callback data pointer
+// Returns: 0 - success, negative - error
+int util_tpl_to_json_cb(JSON_OBJ_TPL_t tpl, size_t flags,
+                        json_dump_callback_t cb, void *data)
+{
+    TPL_WR_t w;
+
+    w.cb = cb;
+    w.data = data;
+    w.flags = flags;
+    w.len = 0;
+
+    if(tpl_wr_obj(&w, tpl, 0) != 0 || tpl_wr_flush(&w) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Output callback for util_tpl_to_json_str() and util_tpl_to_json_buf()
+// Returns: 0 - success, -1 - no memory or no space in the buffer
+static int tpl_wr_str_cb(const char *buf, size_t len, void *data)
+{
+    TPL_WR_STR_t *ws = (TPL_WR_STR_t *)data;
+
+    // Always keep space for the terminating 0
+    if(ws->len + len + 1 > ws->size) {
+        int new_size = ws->size;
+        char *new_buf;
+        if(!ws->grow) {
+            return -1;
+        }
+        while(ws->len + len + 1 > new_size) {
+            new_size *= 2;
+        }
+        new_buf = realloc(ws->buf, new_size);
+        if(!new_buf) {
+            return -1;
+        }
+        ws->buf = new_buf;
+        ws->size = new_size;
+    }
+    memcpy(ws->buf + ws->len, buf, len);
+    ws->len += len;
+
+    return 0;
+}
+
+// Function for generating JSON string from a template in the
+// caller supplied buffer (see util_tpl_to_json_cb()).
+// Returns: the JSON string length, negative if error or the buffer
+//          is too small
+int util_tpl_to_json_buf(JSON_OBJ_TPL_t tpl, size_t flags,
+                         char *buf, int size)
+{
+    TPL_WR_STR_t ws;
+
+    ws.buf = buf;
+    ws.size = size;
+    ws.len = 0;
+    ws.grow = FALSE;
+
+    if(size <= 0 || util_tpl_to_json_cb(tpl, flags, tpl_wr_str_cb, &ws) != 0)
+    {
+        return -1;
+    }
+    buf[ws.len] = 0;
+
+    return ws.len;
+}
+
 // Function for building JSON string from a template.
 // The string must be freed by util_free_json_str().
+// The JSON is written directly from the template (see util_tpl_to_json_cb()).
 char *util_tpl_to_json_str(JSON_OBJ_TPL_t tpl)
 {
-    json_t *obj = util_tpl_to_json_obj(tpl);
+    TPL_WR_STR_t ws;
 
-    if(!obj) {
+    // Using malloc() since the string is freed by util_free_json_str()
+    ws.buf = malloc(UTIL_JSON_STR_BUF_SIZE);
+    if(!ws.buf) {
         return NULL;
     }
-    char *jstr = util_json_obj_to_str(obj);
+    ws.size = UTIL_JSON_STR_BUF_SIZE;
+    ws.len = 0;
+    ws.grow = TRUE;
 
-    json_decref(obj);
-    return jstr;
+    if(util_tpl_to_json_cb(tpl, UTIL_JSON_DUMP_FLAGS, tpl_wr_str_cb, &ws) != 0)
+    {
+        free(ws.buf);
+        return NULL;
+    }
+    ws.buf[ws.len] = 0;
+
+    return ws.buf;
 }
 
+#ifdef FEATURE_GZIP_REQUESTS
+// Build gzip compressed JSON from a template. The JSON is fed to the
+// compressor as it is generated, so only the compressed data is kept.
+// Returns: finished compressor (see util_zlib.h) to be freed with
+//          util_gz_free() or NULL if fails
+UTIL_GZ_t *util_tpl_to_json_gz(JSON_OBJ_TPL_t tpl)
+{
+    UTIL_GZ_t *gz;
+
+    gz = util_gz_start();
+    if(!gz) {
+        return NULL;
+    }
+    if(util_tpl_to_json_cb(tpl, UTIL_JSON_DUMP_FLAGS, util_gz_write, gz) != 0 ||
+       util_gz_finish(gz) != 0)
+    {
+        util_gz_free(gz);
+        return NULL;
+    }
+
+    return gz;
+}
+#endif // FEATURE_GZIP_REQUESTS
+
 // Function for freeing JSON string built by util_tpl_to_json_str().
 void util_free_json_str(char *jstr)
 {
@@ -475,3 +993,83 @@ json_t *util_port_range_to_json(PORT_RANGE_MAP_t *pr)
 
     return port_array;
 }
+
+#ifdef DEBUG
+// Get the current and the peak resident set size (in KB) of the process
+static void tpl_bench_rss(unsigned long *rss, unsigned long *hwm)
+{
+    char line[128];
+    FILE *f = fopen("/proc/self/status", "r");
+
+    *rss = *hwm = 0;
+    if(!f) {
+        return;
+    }
+    while(fgets(line, sizeof(line), f)) {
+        sscanf(line, "VmRSS: %lu", rss);
+        sscanf(line, "VmHWM: %lu", hwm);
+    }
+    fclose(f);
+}
+
+// Reset the peak resident set size of the process to the current RSS
+static void tpl_bench_rss_reset(void)
+{
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if(f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+// Compare the JSON generated from the template by util_tpl_to_json_str()
+// and through libjansson objects, print time and memory used by each.
+// The direct writer runs first, so the memory it frees and the jansson
+// run can reuse is not counted for the jansson run.
+void util_tpl_json_bench(JSON_OBJ_TPL_t tpl)
+{
+    unsigned long long t_start, t_wr, t_jn;
+    unsigned long rss, hwm, wr_kb, jn_kb;
+    char *wr_str, *jn_str = NULL;
+    json_t *obj;
+    int ii;
+
+    tpl_bench_rss_reset();
+    tpl_bench_rss(&rss, &hwm);
+    t_start = util_time(1000000);
+    wr_str = util_tpl_to_json_str(tpl);
+    t_wr = util_time(1000000) - t_start;
+    tpl_bench_rss(&wr_kb, &hwm);
+    wr_kb = hwm - rss;
+
+    tpl_bench_rss_reset();
+    tpl_bench_rss(&rss, &hwm);
+    t_start = util_time(1000000);
+    obj = util_tpl_to_json_obj(tpl);
+    if(obj) {
+        jn_str = json_dumps(obj, UTIL_JSON_DUMP_FLAGS | JSON_PRESERVE_ORDER);
+        json_decref(obj);
+    }
+    t_jn = util_time(1000000) - t_start;
+    tpl_bench_rss(&jn_kb, &hwm);
+    jn_kb = hwm - rss;
+
+    printf("JSON writer:  %llu usec, peak RSS +%lu KB, %d bytes\n",
+           t_wr, wr_kb, (wr_str ? (int)strlen(wr_str) : -1));
+    printf("JSON jansson: %llu usec, peak RSS +%lu KB, %d bytes\n",
+           t_jn, jn_kb, (jn_str ? (int)strlen(jn_str) : -1));
+    if(!wr_str || !jn_str) {
+        printf("JSON writer and jansson results: %s %s\n",
+               (wr_str ? "OK" : "FAILED"), (jn_str ? "OK" : "FAILED"));
+    } else if(strcmp(wr_str, jn_str) != 0) {
+        for(ii = 0; wr_str[ii] == jn_str[ii]; ii++);
+        printf("JSON writer and jansson results differ at %d: '%.32s'\n",
+               ii, wr_str + ii);
+    } else {
+        printf("JSON writer and jansson results match\n");
+    }
+
+    util_free_json_str(wr_str);
+    util_free_json_str(jn_str);
+}
+#endif // DEBUG
@@ -8,6 +8,17 @@
 // serialization through templates
 #define MAX_JSON_ARRAY_ELEMENTS 8192
 
+// Flags for generating JSON strings (jansson json_dump*() flags)
+#ifdef DEBUG
+#define UTIL_JSON_DUMP_FLAGS JSON_INDENT(2)
+#else  // DEBUG
+#define UTIL_JSON_DUMP_FLAGS JSON_COMPACT
+#endif // DEBUG
+
+// Initial size of the buffer util_tpl_to_json_str() generates JSON in,
+// it is doubled every time the JSON does not fit
+#define UTIL_JSON_STR_BUF_SIZE 4096
+
 // Forward declaration of the template structures
 struct _JSON_KEYVAL_TPL;
 struct _JSON_VAL_TPL;
@@ -89,7 +100,34 @@ json_t *util_tpl_to_json_obj(JSON_OBJ_TPL_t tpl);
 char *util_json_obj_to_str(json_t *obj);
 // Function for building JSON string from a template.
 // The string must be freed by util_free_json_str().
+// The JSON is written directly from the template (see util_tpl_to_json_cb()).
 char *util_tpl_to_json_str(JSON_OBJ_TPL_t tpl);
+// Function for generating JSON from a template w/o building the libjansson
+// objects. The output is passed to the callback in chunks as it is
+// generated. It is the same as dumping the util_tpl_to_json_obj() object
+// with json_dump_callback() and JSON_PRESERVE_ORDER flag (the template
+// keys must be unique).
+// tpl - the template
+// flags - jansson json_dump*() flags, JSON_INDENT(n), JSON_COMPACT,
+//         JSON_ENSURE_ASCII and JSON_ESCAPE_SLASH are supported
+// cb - output callback, returns non-0 to abort
+// data - the callback data pointer
+// Returns: 0 - success, negative - error
+int util_tpl_to_json_cb(JSON_OBJ_TPL_t tpl, size_t flags,
+                        json_dump_callback_t cb, void *data);
+// Function for generating JSON string from a template in the
+// caller supplied buffer (see util_tpl_to_json_cb()).
+// Returns: the JSON string length, negative if error or the buffer
+//          is too small
+int util_tpl_to_json_buf(JSON_OBJ_TPL_t tpl, size_t flags,
+                         char *buf, int size);
+#ifdef FEATURE_GZIP_REQUESTS
+// Build gzip compressed JSON from a template. The JSON is fed to the
+// compressor as it is generated, so only the compressed data is kept.
+// Returns: finished compressor (see util_zlib.h) to be freed with
+//          util_gz_free() or NULL if fails
+UTIL_GZ_t *util_tpl_to_json_gz(JSON_OBJ_TPL_t tpl);
+#endif // FEATURE_GZIP_REQUESTS
 // Function for freeing JSON string built by util_tpl_to_json_str()
 // or util_json_obj_to_str()
 void util_free_json_str(char *jstr);
@@ -108,6 +146,12 @@ PORT_RANGE_MAP_t *util_json_to_port_range(json_t *ports_obj);
 json_t *util_port_range_to_json(PORT_RANGE_MAP_t *pr);
 
 
+#ifdef DEBUG
+// Compare the JSON generated from the template by util_tpl_to_json_str()
+// and through libjansson objects, print time and memory used by each.
+void util_tpl_json_bench(JSON_OBJ_TPL_t tpl);
+#endif // DEBUG
+
 // Note: for parsing and retrieving JSON data use libjansson APIs directly.
 
 #endif // _UTIL_JSON_H
@@ -6,6 +6,36 @@
 static int nl_sock(NL_SOCK_t *s, int type);
 static int nl_recv(NL_SOCK_t *s, char *buf, unsigned int len, int seq_num, int tout);
 
+// Interface configuration cache entry
+typedef struct {
+    char name[IFNAMSIZ];  // interface name
+    int ifindex;          // interface index
+    unsigned int flags;   // IFF_* flags
+    int has_mac;          // TRUE if the interface has the MAC address
+    unsigned char mac[6]; // MAC address
+    int has_ipv4;         // TRUE if the interface has the IPv4 address
+    DEV_IP_CFG_t ipcfg;   // IPv4 address (the primary one) and netmask
+    int ipv6_count;       // number of the IPv6 addresses
+    DEV_IPV6_CFG_t ipv6cfg[MAX_IPV6_ADDRESSES_PER_MAC]; // IPv6 addresses
+} IF_CACHE_ENTRY_t;
+
+// Interface configuration cache (see util_net_if_cache_init()). It is
+// rebuilt by the reactor task only, the readers copy the entries out
+// w/o locking and retry if the generation has changed while copying.
+static struct {
+    volatile unsigned int gen; // generation (0 - not ready, odd - updating)
+    unsigned long t;           // uptime (sec) the table was captured at
+    int count;                 // number of the entries
+    IF_CACHE_ENTRY_t e[UTIL_NET_IF_CACHE_MAX];
+} if_cache;
+
+static int if_cache_get(const char *dev, IF_CACHE_ENTRY_t *ife);
+
+#ifdef DEBUG
+// Set to make the lookups query the kernel (for comparing w/ the cache)
+static int if_cache_bypass = FALSE;
+#endif // DEBUG
+
 #define	INFINITY_LIFE_TIME	0xFFFFFFFF
 #define IS_ADDR_LINKLOCAL(a) (((a) & htonl(0xffc00000)) == htonl(0xfe800000))
 #define IS_ADDR_SITELOCAL(a) (((a) & htonl(0xffc00000)) == htonl(0xfec00000))
@@ -20,6 +50,12 @@ static int util_net_dev_get_flags(const char *ifname, int *flags)
 {
     int ret, sockfd;
     struct ifreq ifr;
+    IF_CACHE_ENTRY_t ife;
+
+    if(if_cache_get(ifname, &ife) == 0) {
+        *flags = ife.flags;
+        return 0;
+    }
 
     if((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         return FALSE;
@@ -175,6 +211,15 @@ int util_get_ipv4(const char *dev, char *buf)
     struct ifreq ifr;
     int fd = -1;
     int ret = -1;
+    IF_CACHE_ENTRY_t ife;
+
+    if(if_cache_get(dev, &ife) == 0 && ife.has_ipv4) {
+        if(buf != NULL) {
+            snprintf(buf, INET_ADDRSTRLEN, IP_PRINTF_FMT_TPL,
+                     IP_PRINTF_ARG_TPL(ife.ipcfg.ipv4.b));
+        }
+        return 0;
+    }
 
     memset(&ifr, 0, sizeof(ifr));
     ifr.ifr_addr.sa_family = AF_INET;
@@ -209,6 +254,14 @@ int util_get_mac(const char *dev, unsigned char *mac)
     struct ifreq ifr;
     int fd = -1;
     int ret = -1;
+    IF_CACHE_ENTRY_t ife;
+
+    if(if_cache_get(dev, &ife) == 0 && ife.has_mac) {
+        if(mac) {
+            memcpy(mac, ife.mac, 6);
+        }
+        return 0;
+    }
 
     memset(&ifr, 0, sizeof(ifr));
     ifr.ifr_addr.sa_family = AF_INET;
@@ -401,6 +454,12 @@ int util_get_ipcfg(const char *dev, DEV_IP_CFG_t *ipcfg)
     struct ifreq ifr;
     int fd = -1;
     int ret = -1;
+    IF_CACHE_ENTRY_t ife;
+
+    if(if_cache_get(dev, &ife) == 0 && ife.has_ipv4) {
+        memcpy(ipcfg, &ife.ipcfg, sizeof(*ipcfg));
+        return 0;
+    }
 
     fd = socket(AF_INET, SOCK_DGRAM, 0);
     for(;;)
@@ -435,6 +494,45 @@ int util_get_ipcfg(const char *dev, DEV_IP_CFG_t *ipcfg)
     return ret;
 }
 
+#ifdef FEATURE_IPV6_TELEMETRY
+// Flag the first global address w/ the longest, but limited lifetime as
+// primary (or the first w/ the infinite lifetime if none)
+static void ipv6cfg_set_primary(DEV_IPV6_CFG_t *ipcfg)
+{
+    uint32_t longest_lifetime_secs  = 0;
+    int      longest_lifetime_index = -1;
+
+    for(unsigned ix=0; ix < MAX_IPV6_ADDRESSES_PER_MAC && ipcfg[ix].addr.b[0] != 0; ix++) {
+        if (!IS_ADDR_SITELOCAL(ipcfg[ix].addr.s.h) &&
+            !IS_ADDR_LINKLOCAL(ipcfg[ix].addr.s.h) &&
+            !IS_ADDR_ULA(ipcfg[ix].addr.s.h)) {
+            if (ipcfg[ix].ifa_preferred != INFINITY_LIFE_TIME &&
+                ipcfg[ix].ifa_preferred > longest_lifetime_secs) {
+                longest_lifetime_secs = ipcfg[ix].ifa_preferred;
+                longest_lifetime_index = ix;
+            }
+        }
+    }
+    // nothing found, look for first infinite lifetime
+    if (longest_lifetime_index == -1) {
+      for(unsigned ix=0; ix < MAX_IPV6_ADDRESSES_PER_MAC && ipcfg[ix].addr.b[0] != 0; ix++) {
+        if (!IS_ADDR_SITELOCAL(ipcfg[ix].addr.s.h) &&
+            !IS_ADDR_LINKLOCAL(ipcfg[ix].addr.s.h) &&
+            !IS_ADDR_ULA(ipcfg[ix].addr.s.h)) {
+	    if (ipcfg[ix].ifa_preferred == INFINITY_LIFE_TIME) {
+                longest_lifetime_index = ix;
+		break;
+            }
+        }
+      }
+    }
+    // add primary flag to appropriate address
+    if (longest_lifetime_index != -1) {
+        ipcfg[longest_lifetime_index].flags |= DEV_IPV6_CFG_FLAG_PRIMARY;
+    }
+}
+#endif /* FEATURE_IPV6_TELEMETRY */
+
 // Get the IPv6 configuration of a network device.
 // Requires a pointer to an array with room for
 // MAX_IPV6_ADDRESSES_PER_MAC addresses
@@ -442,6 +540,25 @@ int util_get_ipcfg(const char *dev, DEV_IP_CFG_t *ipcfg)
 int util_get_ipv6cfg(const char *dev, DEV_IPV6_CFG_t *ipcfg) {
     int ret = -1;
 #ifdef FEATURE_IPV6_TELEMETRY
+    IF_CACHE_ENTRY_t ife;
+    if(if_cache_get(dev, &ife) == 0) {
+        // The lifetimes in the cache are counting down from when it
+        // was captured
+        unsigned long age = util_time(1) - if_cache.t;
+        for(int ix = 0; ix < ife.ipv6_count; ix++) {
+            DEV_IPV6_CFG_t *c = &ife.ipv6cfg[ix];
+            if(c->ifa_valid != INFINITY_LIFE_TIME) {
+                c->ifa_valid -= UTIL_MIN(c->ifa_valid, age);
+            }
+            if(c->ifa_preferred != INFINITY_LIFE_TIME) {
+                c->ifa_preferred -= UTIL_MIN(c->ifa_preferred, age);
+            }
+        }
+        memcpy(ipcfg, ife.ipv6cfg, sizeof(ife.ipv6cfg));
+        ipv6cfg_set_primary(ipcfg);
+        return 0;
+    }
+
     // Create socket
     NL_SOCK_t nl_socket = { .s = -1 };
     int buf_index = 0;
@@ -530,38 +647,7 @@ int util_get_ipv6cfg(const char *dev, DEV_IPV6_CFG_t *ipcfg) {
         break;
     } // for(;;)
 
-    // flag first address with longest but limited lifetime as primary
-    uint32_t longest_lifetime_secs  = 0;
-    int      longest_lifetime_index = -1;
-
-    for(unsigned ix=0; ipcfg[ix].addr.b[0] != 0; ix++) {
-        if (!IS_ADDR_SITELOCAL(ipcfg[ix].addr.s.h) &&
-            !IS_ADDR_LINKLOCAL(ipcfg[ix].addr.s.h) &&
-            !IS_ADDR_ULA(ipcfg[ix].addr.s.h)) {
-            if (ipcfg[ix].ifa_preferred != INFINITY_LIFE_TIME &&
-                ipcfg[ix].ifa_preferred > longest_lifetime_secs) {
-                longest_lifetime_secs = ipcfg[ix].ifa_preferred;
-                longest_lifetime_index = ix;
-            }
-        }
-    }
-    // nothing found, look for first infinite lifetime
-    if (longest_lifetime_index == -1) {
-      for(unsigned ix=0; ipcfg[ix].addr.b[0] != 0; ix++) {
-        if (!IS_ADDR_SITELOCAL(ipcfg[ix].addr.s.h) &&
-            !IS_ADDR_LINKLOCAL(ipcfg[ix].addr.s.h) &&
-            !IS_ADDR_ULA(ipcfg[ix].addr.s.h)) {
-	    if (ipcfg[ix].ifa_preferred == INFINITY_LIFE_TIME) {
-                longest_lifetime_index = ix;
-		break;
-            }
-        }
-      }
-    }
-    // add primary flag to appropriate address
-    if (longest_lifetime_index != -1) {
-        ipcfg[longest_lifetime_index].flags |= DEV_IPV6_CFG_FLAG_PRIMARY;
-    }
+    ipv6cfg_set_primary(ipcfg);
 
     if(nl_socket.s >= 0) {
         close(nl_socket.s);
@@ -571,9 +657,10 @@ int util_get_ipv6cfg(const char *dev, DEV_IPV6_CFG_t *ipcfg) {
     return ret;
 }
 
-// Get network device statistics/counters.
+// Get network device statistics/counters from /proc/net/dev
+// (the fallback for the kernels w/o IFLA_STATS64 support).
 // Returns 0 if successful, error code if fails.
-int util_get_dev_stats(const char *dev, NET_DEV_STATS_t *st)
+static int dev_stats_proc(const char *dev, NET_DEV_STATS_t *st)
 {
     int ret;
     FILE *f;
@@ -637,6 +724,302 @@ int util_get_dev_stats(const char *dev, NET_DEV_STATS_t *st)
     return ret;
 }
 
+// Fill in the device counters from the link stats attribute the same
+// way the kernel does it for /proc/net/dev (so the values do not change
+// if we have to fall back to reading the counters from there).
+// rta - IFLA_STATS64 or IFLA_STATS attribute
+// st - the counters structure to fill in
+// Returns: 0 - ok, negative - the attribute is not usable
+static int dev_stats_from_rta(struct rtattr *rta, NET_DEV_STATS_t *st)
+{
+    struct rtnl_link_stats64 s;
+
+    memset(&s, 0, sizeof(s));
+    if(rta->rta_type == IFLA_STATS64) {
+        if(RTA_PAYLOAD(rta) < offsetof(struct rtnl_link_stats64,
+                                       rx_compressed))
+        {
+            return -1;
+        }
+        memcpy(&s, RTA_DATA(rta), UTIL_MIN(RTA_PAYLOAD(rta), sizeof(s)));
+    } else {
+        struct rtnl_link_stats s32;
+        if(RTA_PAYLOAD(rta) < offsetof(struct rtnl_link_stats,
+                                       rx_compressed))
+        {
+            return -1;
+        }
+        memset(&s32, 0, sizeof(s32));
+        memcpy(&s32, RTA_DATA(rta), UTIL_MIN(RTA_PAYLOAD(rta), sizeof(s32)));
+        s.rx_packets = s32.rx_packets;
+        s.tx_packets = s32.tx_packets;
+        s.rx_bytes = s32.rx_bytes;
+        s.tx_bytes = s32.tx_bytes;
+        s.rx_errors = s32.rx_errors;
+        s.tx_errors = s32.tx_errors;
+        s.rx_dropped = s32.rx_dropped;
+        s.tx_dropped = s32.tx_dropped;
+        s.multicast = s32.multicast;
+        s.collisions = s32.collisions;
+        s.rx_length_errors = s32.rx_length_errors;
+        s.rx_over_errors = s32.rx_over_errors;
+        s.rx_crc_errors = s32.rx_crc_errors;
+        s.rx_frame_errors = s32.rx_frame_errors;
+        s.rx_fifo_errors = s32.rx_fifo_errors;
+        s.rx_missed_errors = s32.rx_missed_errors;
+        s.tx_aborted_errors = s32.tx_aborted_errors;
+        s.tx_carrier_errors = s32.tx_carrier_errors;
+        s.tx_fifo_errors = s32.tx_fifo_errors;
+        s.tx_heartbeat_errors = s32.tx_heartbeat_errors;
+        s.tx_window_errors = s32.tx_window_errors;
+        s.rx_compressed = s32.rx_compressed;
+        s.tx_compressed = s32.tx_compressed;
+    }
+
+    st->rx_packets = s.rx_packets;
+    st->tx_packets = s.tx_packets;
+    st->rx_bytes = s.rx_bytes;
+    st->tx_bytes = s.tx_bytes;
+    st->rx_errors = s.rx_errors;
+    st->tx_errors = s.tx_errors;
+    st->rx_dropped = s.rx_dropped + s.rx_missed_errors;
+    st->tx_dropped = s.tx_dropped;
+    st->rx_multicast = s.multicast;
+    st->rx_compressed = s.rx_compressed;
+    st->tx_compressed = s.tx_compressed;
+    st->collisions = s.collisions;
+    st->rx_fifo_errors = s.rx_fifo_errors;
+    st->tx_fifo_errors = s.tx_fifo_errors;
+    st->rx_frame_errors = s.rx_length_errors + s.rx_over_errors +
+                          s.rx_crc_errors + s.rx_frame_errors;
+    st->tx_carrier_errors = s.tx_carrier_errors + s.tx_aborted_errors +
+                            s.tx_window_errors + s.tx_heartbeat_errors;
+
+    return 0;
+}
+
+// Parse RTM_NEWLINK message
+// nlmsg - the message
+// e - the snapshot entry to fill in
+// Returns: 0 - ok, negative - not a link message or no counters in it
+static int dev_stats_parse_link(struct nlmsghdr *nlmsg,
+                                NET_DEV_STATS_ENTRY_t *e)
+{
+    struct ifinfomsg *ifi;
+    struct rtattr *rta, *rta_st = NULL;
+    int len;
+
+    if(nlmsg->nlmsg_type != RTM_NEWLINK ||
+       nlmsg->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+    {
+        return -1;
+    }
+    ifi = (struct ifinfomsg *)NLMSG_DATA(nlmsg);
+
+    memset(e, 0, sizeof(NET_DEV_STATS_ENTRY_t));
+    e->ifindex = ifi->ifi_index;
+    rta = IFLA_RTA(ifi);
+    len = IFLA_PAYLOAD(nlmsg);
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if(rta->rta_type == IFLA_IFNAME) {
+            strncpy(e->name, RTA_DATA(rta),
+                    UTIL_MIN(RTA_PAYLOAD(rta), sizeof(e->name) - 1));
+        } else if(rta->rta_type == IFLA_STATS64) {
+            rta_st = rta;
+        } else if(rta->rta_type == IFLA_STATS && rta_st == NULL) {
+            rta_st = rta;
+        }
+    }
+    if(rta_st == NULL || *(e->name) == 0) {
+        return -2;
+    }
+
+    return dev_stats_from_rta(rta_st, &(e->st));
+}
+
+// Send RTM_GETLINK request and read the response
+// s - the netlink socket
+// ifindex - interface to get the info for, 0 - dump all the interfaces
+// seq - the request sequence number
+// buf - where to store the response
+// buf_len - the buffer length
+// Returns: the response length, negative if error (see nl_recv())
+static int dev_stats_get_link(NL_SOCK_t *s, int ifindex, int seq,
+                              char *buf, unsigned int buf_len)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nlh.nlmsg_type = RTM_GETLINK;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | (ifindex == 0 ? NLM_F_DUMP : 0);
+    req.nlh.nlmsg_seq = seq;
+    req.nlh.nlmsg_pid = s->pid;
+    req.ifi.ifi_family = AF_UNSPEC;
+    req.ifi.ifi_index = ifindex;
+    if(send(s->s, &req, req.nlh.nlmsg_len, 0) < 0) {
+        log("%s: send() error: %s\n", __func__, strerror(errno));
+        return -7;
+    }
+
+    // Read the response, allow 10sec till timeout
+    return nl_recv(s, buf, buf_len, seq, 10);
+}
+
+// Get network device statistics/counters.
+// Returns 0 if successful, error code if fails.
+int util_get_dev_stats(const char *dev, NET_DEV_STATS_t *st)
+{
+    NL_SOCK_t s = { .s = -1 };
+    NET_DEV_STATS_ENTRY_t e;
+    struct nlmsghdr *nlmsg;
+    char buf[4096];
+    int ifindex, len;
+    int ret = -1;
+
+    memset(st, 0, sizeof(NET_DEV_STATS_t));
+    ifindex = if_nametoindex(dev);
+    if(ifindex == 0) {
+        return -3;
+    }
+    for(;;)
+    {
+        if(nl_sock(&s, NETLINK_ROUTE) < 0) {
+            log("%s: socket() error: %s\n", __func__, strerror(errno));
+            break;
+        }
+        len = dev_stats_get_link(&s, ifindex, 1, buf, sizeof(buf));
+        if(len < 0) {
+            break;
+        }
+        nlmsg = (struct nlmsghdr *)buf;
+        for(; NLMSG_OK(nlmsg, len); nlmsg = NLMSG_NEXT(nlmsg, len))
+        {
+            if(dev_stats_parse_link(nlmsg, &e) == 0 &&
+               e.ifindex == ifindex)
+            {
+                memcpy(st, &(e.st), sizeof(NET_DEV_STATS_t));
+                ret = 0;
+                break;
+            }
+        }
+        break;
+    }
+    if(s.s >= 0) {
+        close(s.s);
+    }
+
+    // Fall back to /proc/net/dev if netlink did not work
+    if(ret != 0) {
+        ret = dev_stats_proc(dev, st);
+    }
+
+    return ret;
+}
+
+// Get statistics/counters of all the network devices in one netlink
+// request (use it instead of util_get_dev_stats() when the counters
+// of several devices are needed).
+// snap - the snapshot structure to fill in
+// Returns 0 if successful, error code if fails.
+int util_get_all_dev_stats(NET_DEV_STATS_SNAP_t *snap)
+{
+    NL_SOCK_t s = { .s = -1 };
+    struct nlmsghdr *nlmsg;
+    int len, seq = 0;
+    int ret = -1;
+    // Start w/ the buffer that fits a few dozens of interfaces and
+    // grow it if the dump does not fit
+    unsigned int buf_len = 32 * 1024;
+    char *buf = NULL;
+
+    snap->count = 0;
+    for(;;)
+    {
+        buf = UTIL_MALLOC(buf_len);
+        if(!buf) {
+            log("%s: out of memory\n", __func__);
+            ret = -2;
+            break;
+        }
+        // New socket for each attempt, so the leftovers of the
+        // previous dump are not in the way
+        if(nl_sock(&s, NETLINK_ROUTE) < 0) {
+            log("%s: socket() error: %s\n", __func__, strerror(errno));
+            ret = -3;
+            break;
+        }
+        len = dev_stats_get_link(&s, 0, ++seq, buf, buf_len);
+        if((len == -4 || len == -6) && buf_len < 256 * 1024) {
+            close(s.s);
+            s.s = -1;
+            UTIL_FREE(buf);
+            buf_len *= 2;
+            continue;
+        }
+        if(len < 0) {
+            ret = -4;
+            break;
+        }
+
+        nlmsg = (struct nlmsghdr *)buf;
+        for(; NLMSG_OK(nlmsg, len); nlmsg = NLMSG_NEXT(nlmsg, len))
+        {
+            if(snap->count >= UTIL_NET_DEV_STATS_MAX) {
+                log("%s: more than %d interfaces, ignoring the rest\n",
+                    __func__, UTIL_NET_DEV_STATS_MAX);
+                break;
+            }
+            if(dev_stats_parse_link(nlmsg, &(snap->e[snap->count])) == 0) {
+                ++(snap->count);
+            }
+        }
+        ret = 0;
+        break;
+    }
+
+    if(buf) {
+        UTIL_FREE(buf);
+    }
+    if(s.s >= 0) {
+        close(s.s);
+    }
+
+    return ret;
+}
+
+// Find network device counters in the snapshot by the device name.
+// Returns: pointer to the counters or NULL if not found
+NET_DEV_STATS_t *util_dev_stats_by_name(NET_DEV_STATS_SNAP_t *snap,
+                                        const char *dev)
+{
+    int ii;
+    for(ii = 0; ii < snap->count; ii++) {
+        if(strncmp(snap->e[ii].name, dev, IFNAMSIZ) == 0) {
+            return &(snap->e[ii].st);
+        }
+    }
+    return NULL;
+}
+
+// Find network device counters in the snapshot by the interface index.
+// Returns: pointer to the counters or NULL if not found
+NET_DEV_STATS_t *util_dev_stats_by_index(NET_DEV_STATS_SNAP_t *snap,
+                                         int ifindex)
+{
+    int ii;
+    for(ii = 0; ii < snap->count; ii++) {
+        if(snap->e[ii].ifindex == ifindex) {
+            return &(snap->e[ii].st);
+        }
+    }
+    return NULL;
+}
+
 // Extract name from the DNS packet data (can handle references)
 // Parameters:
 // pkt - the pointer to the DNS packet (DNS header)
@@ -1041,16 +1424,31 @@ static int nl_recv(NL_SOCK_t *s, char *buf, unsigned int len,
             break;
         }
 
-        // Update message length
-        msg_len += r_len;
-
         // Check if a multi part message
         if((nlhdr->nlmsg_flags & NLM_F_MULTI) == 0)
         {
             // not multipart, done
+            msg_len += r_len;
+            break;
+        }
+
+        // The kernel might put NLMSG_DONE right after the last part
+        // of the dump (in the same chunk), do not wait for more then
+        int r_left = r_len;
+        struct nlmsghdr *h = nlhdr;
+        for(; NLMSG_OK(h, r_left); h = NLMSG_NEXT(h, r_left)) {
+            if(h->nlmsg_type == NLMSG_DONE) {
+                break;
+            }
+        }
+        if(NLMSG_OK(h, r_left)) {
+            msg_len += (char *)h - (char *)nlhdr;
             break;
         }
 
+        // Update message length
+        msg_len += r_len;
+
         // If we run out of the buffer, but still not done
         if(msg_len >= len)
         {
@@ -1361,3 +1759,515 @@ int util_enum_ifs(int flags, UTIL_IF_ENUM_CB_t f, void *data)
 
     return failed;
 }
+
+// Look up the interface in the configuration cache
+// dev - the interface name
+// ife - where to copy the cache entry to
+// Returns: 0 - found, negative - not in the cache or the cache is not
+//          ready (the caller has to query the kernel then)
+static int if_cache_get(const char *dev, IF_CACHE_ENTRY_t *ife)
+{
+    unsigned int gen;
+    int ii, found;
+
+#ifdef DEBUG
+    if(if_cache_bypass) {
+        return -1;
+    }
+#endif // DEBUG
+
+    do {
+        gen = if_cache.gen;
+        if(gen == 0) {
+            return -1;
+        }
+        __sync_synchronize();
+        found = FALSE;
+        for(ii = 0; (gen & 1) == 0 && ii < if_cache.count; ii++) {
+            if(strncmp(if_cache.e[ii].name, dev, IFNAMSIZ) == 0) {
+                memcpy(ife, &(if_cache.e[ii]), sizeof(*ife));
+                found = TRUE;
+                break;
+            }
+        }
+        __sync_synchronize();
+    } while((gen & 1) != 0 || gen != if_cache.gen);
+
+    return found ? 0 : -2;
+}
+
+// Returns the interface configuration generation, 0 if the cache is
+// not running
+unsigned int util_net_if_gen(void)
+{
+    unsigned int gen = if_cache.gen;
+    // Report the generation that is being built as the next one
+    return (gen & 1) ? gen + 1 : gen;
+}
+
+// Get the interface index (from the cache if possible)
+// Returns: the interface index, 0 if not found
+int util_get_ifindex(const char *dev)
+{
+    IF_CACHE_ENTRY_t ife;
+
+    if(if_cache_get(dev, &ife) == 0) {
+        return ife.ifindex;
+    }
+
+    return if_nametoindex(dev);
+}
+
+// Send RTM_GETADDR dump request and read the response
+// s - the netlink socket
+// seq - the request sequence number
+// buf - where to store the response
+// buf_len - the buffer length
+// Returns: the response length, negative if error (see nl_recv())
+static int if_cache_get_addrs(NL_SOCK_t *s, int seq,
+                              char *buf, unsigned int buf_len)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifaddrmsg ifa;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    req.nlh.nlmsg_type = RTM_GETADDR;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = seq;
+    req.nlh.nlmsg_pid = s->pid;
+    req.ifa.ifa_family = AF_UNSPEC;
+    if(send(s->s, &req, req.nlh.nlmsg_len, 0) < 0) {
+        log("%s: send() error: %s\n", __func__, strerror(errno));
+        return -7;
+    }
+
+    // Read the response, allow 10sec till timeout
+    return nl_recv(s, buf, buf_len, seq, 10);
+}
+
+// Dump the interface links or addresses, grows the buffer if the dump
+// does not fit
+// addrs - TRUE to dump the addresses, FALSE - the links
+// buf, buf_len - the buffer (allocated by the caller) and its length
+// Returns: the dump length, negative if error
+static int if_cache_dump(int addrs, char **buf, unsigned int *buf_len)
+{
+    NL_SOCK_t s = { .s = -1 };
+    static int seq = 0;
+    int len;
+
+    for(;;)
+    {
+        // New socket for each attempt, so the leftovers of the
+        // previous dump are not in the way
+        if(nl_sock(&s, NETLINK_ROUTE) < 0) {
+            log("%s: socket() error: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+        if(addrs) {
+            len = if_cache_get_addrs(&s, ++seq, *buf, *buf_len);
+        } else {
+            len = dev_stats_get_link(&s, 0, ++seq, *buf, *buf_len);
+        }
+        close(s.s);
+        s.s = -1;
+        if((len == -4 || len == -6) && *buf_len < 256 * 1024) {
+            char *new_buf = UTIL_REALLOC(*buf, *buf_len * 2);
+            if(!new_buf) {
+                log("%s: out of memory\n", __func__);
+                return -2;
+            }
+            *buf = new_buf;
+            *buf_len *= 2;
+            continue;
+        }
+        break;
+    }
+
+    return len;
+}
+
+// Find the cache table entry by the interface index
+static IF_CACHE_ENTRY_t *if_cache_find(IF_CACHE_ENTRY_t *tbl, int count,
+                                       int ifindex)
+{
+    int ii;
+    for(ii = 0; ii < count; ii++) {
+        if(tbl[ii].ifindex == ifindex) {
+            return &(tbl[ii]);
+        }
+    }
+    return NULL;
+}
+
+// Capture the interface configuration from the RTM_NEWADDR message
+static void if_cache_parse_addr(struct nlmsghdr *nlmsg,
+                                IF_CACHE_ENTRY_t *tbl, int count)
+{
+    struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(nlmsg);
+    struct rtattr *rta = IFA_RTA(ifa);
+    int len = IFA_PAYLOAD(nlmsg);
+    void *addr = NULL, *local = NULL;
+    char *label = NULL;
+    struct ifa_cacheinfo *ci = NULL;
+    IF_CACHE_ENTRY_t *e;
+
+    e = if_cache_find(tbl, count, ifa->ifa_index);
+    if(!e) {
+        return;
+    }
+    for(; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if(rta->rta_type == IFA_ADDRESS) {
+            addr = RTA_DATA(rta);
+        } else if(rta->rta_type == IFA_LOCAL) {
+            local = RTA_DATA(rta);
+        } else if(rta->rta_type == IFA_LABEL) {
+            label = RTA_DATA(rta);
+        } else if(rta->rta_type == IFA_CACHEINFO) {
+            ci = (struct ifa_cacheinfo *)RTA_DATA(rta);
+        }
+    }
+    if(ifa->ifa_family == AF_INET && (local || addr) && !e->has_ipv4 &&
+       (label == NULL || strncmp(label, e->name, IFNAMSIZ) == 0))
+    {
+        // The first address labeled w/ the interface name is the one
+        // SIOCGIFADDR reports (IFA_LOCAL is the local end of p-t-p links)
+        memcpy(&(e->ipcfg.ipv4), (local ? local : addr), 4);
+        e->ipcfg.ipv4mask.i = (ifa->ifa_prefixlen == 0) ? 0 :
+                              htonl(0xffffffff << (32 - ifa->ifa_prefixlen));
+        e->has_ipv4 = TRUE;
+    }
+    else if(ifa->ifa_family == AF_INET6 && addr &&
+            e->ipv6_count < MAX_IPV6_ADDRESSES_PER_MAC)
+    {
+        DEV_IPV6_CFG_t *c = &(e->ipv6cfg[e->ipv6_count]);
+        memcpy(&(c->addr), addr, sizeof(c->addr));
+        c->prefix_len = ifa->ifa_prefixlen;
+        if(ci) {
+            c->ifa_preferred = ci->ifa_prefered;
+            c->ifa_valid = ci->ifa_valid;
+        }
+        ++(e->ipv6_count);
+    }
+}
+
+// Rebuild the interface configuration cache from the kernel dumps
+// buf, buf_len - the dump buffer (allocated by the caller) and its length
+// Returns: 0 - success, negative - error
+static int if_cache_sync(char **buf, unsigned int *buf_len)
+{
+    static IF_CACHE_ENTRY_t tbl[UTIL_NET_IF_CACHE_MAX];
+    struct nlmsghdr *nlmsg;
+    struct ifinfomsg *ifi;
+    struct rtattr *rta;
+    int len, rta_len, count = 0;
+    IF_CACHE_ENTRY_t *e;
+
+    memset(tbl, 0, sizeof(tbl));
+
+    // Links
+    len = if_cache_dump(FALSE, buf, buf_len);
+    if(len < 0) {
+        return -1;
+    }
+    nlmsg = (struct nlmsghdr *)*buf;
+    for(; NLMSG_OK(nlmsg, len); nlmsg = NLMSG_NEXT(nlmsg, len))
+    {
+        if(nlmsg->nlmsg_type != RTM_NEWLINK ||
+           nlmsg->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+        {
+            continue;
+        }
+        if(count >= UTIL_NET_IF_CACHE_MAX) {
+            log("%s: more than %d interfaces, ignoring the rest\n",
+                __func__, UTIL_NET_IF_CACHE_MAX);
+            break;
+        }
+        ifi = (struct ifinfomsg *)NLMSG_DATA(nlmsg);
+        e = &(tbl[count]);
+        e->ifindex = ifi->ifi_index;
+        e->flags = ifi->ifi_flags;
+        rta = IFLA_RTA(ifi);
+        rta_len = IFLA_PAYLOAD(nlmsg);
+        for(; RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len))
+        {
+            if(rta->rta_type == IFLA_IFNAME) {
+                strncpy(e->name, RTA_DATA(rta),
+                        UTIL_MIN(RTA_PAYLOAD(rta), sizeof(e->name) - 1));
+            } else if(rta->rta_type == IFLA_ADDRESS &&
+                      RTA_PAYLOAD(rta) == sizeof(e->mac))
+            {
+                memcpy(e->mac, RTA_DATA(rta), sizeof(e->mac));
+                e->has_mac = TRUE;
+            }
+        }
+        if(*(e->name) != 0) {
+            ++count;
+        }
+    }
+
+    // Addresses
+    len = if_cache_dump(TRUE, buf, buf_len);
+    if(len < 0) {
+        return -2;
+    }
+    nlmsg = (struct nlmsghdr *)*buf;
+    for(; NLMSG_OK(nlmsg, len); nlmsg = NLMSG_NEXT(nlmsg, len))
+    {
+        if(nlmsg->nlmsg_type == RTM_NEWADDR &&
+           nlmsg->nlmsg_len >= NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+        {
+            if_cache_parse_addr(nlmsg, tbl, count);
+        }
+    }
+
+    // Publish the new table
+    ++(if_cache.gen);
+    __sync_synchronize();
+    memcpy(if_cache.e, tbl, count * sizeof(IF_CACHE_ENTRY_t));
+    if_cache.count = count;
+    if_cache.t = util_time(1);
+    __sync_synchronize();
+    ++(if_cache.gen);
+
+    return 0;
+}
+
+// Netlink socket receiving the interface change notifications and the
+// cache rebuild task ID (-1 if not running)
+static int if_cache_fd = -1;
+static int if_cache_tid = -1;
+
+// Interface configuration cache rebuild task (runs in the reactor thread
+// once a burst of the change notifications has settled)
+static int if_cache_task(THRD_PARAM_t *p)
+{
+    static unsigned int buf_len = 32 * 1024;
+    static char *buf = NULL;
+
+    if(!buf && (buf = UTIL_MALLOC(buf_len)) == NULL) {
+        log("%s: out of memory\n", __func__);
+        return UTIL_NET_IF_CACHE_RETRY * 1000;
+    }
+    if(if_cache_sync(&buf, &buf_len) != 0) {
+        log("%s: failed to capture the interfaces\n", __func__);
+        return UTIL_NET_IF_CACHE_RETRY * 1000;
+    }
+
+    return REACTOR_TASK_SLEEP;
+}
+
+// Interface change notifications handler (reactor fd callback). It drains
+// the socket and schedules the cache rebuild if anything has changed.
+static void if_cache_rx(int fd, unsigned int events, THRD_PARAM_t *p)
+{
+    struct nlmsghdr *nlmsg;
+    char ev_buf[8192];
+    int len, dirty = FALSE;
+
+    for(;;)
+    {
+        len = recv(fd, ev_buf, sizeof(ev_buf), MSG_DONTWAIT);
+        if(len < 0) {
+            if(errno == ENOBUFS) {
+                // Lost some notifications, rebuild the cache
+                dirty = TRUE;
+                continue;
+            } else if(errno == EINTR) {
+                continue;
+            } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            log("%s: recv() error: %s\n", __func__, strerror(errno));
+            // Stop using the cache
+            util_reactor_fd_del(fd);
+            close(fd);
+            if_cache_fd = -1;
+            if_cache.gen = 0;
+            return;
+        }
+        nlmsg = (struct nlmsghdr *)ev_buf;
+        for(; NLMSG_OK(nlmsg, len); nlmsg = NLMSG_NEXT(nlmsg, len))
+        {
+            if(nlmsg->nlmsg_type == RTM_NEWLINK ||
+               nlmsg->nlmsg_type == RTM_DELLINK ||
+               nlmsg->nlmsg_type == RTM_NEWADDR ||
+               nlmsg->nlmsg_type == RTM_DELADDR)
+            {
+                dirty = TRUE;
+            }
+        }
+    }
+
+    // Let the burst of notifications settle before the rebuild
+    if(dirty) {
+        util_reactor_task_wake(if_cache_tid, UTIL_NET_IF_CACHE_SETTLE);
+    }
+}
+
+// Start the interface configuration cache (requires the reactor). The
+// lookups fall back to querying the kernel for the interfaces and the
+// data not in the cache (i.e. MAC of the p-t-p links).
+// Returns: 0 - success, negative - error
+int util_net_if_cache_init(void)
+{
+    struct sockaddr_nl nladdr;
+    int fd;
+
+    if(if_cache_fd >= 0) {
+        return 0;
+    }
+
+    fd = socket(PF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    nladdr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if(fd < 0 || bind(fd, (struct sockaddr *)&nladdr, sizeof(nladdr)) < 0) {
+        log("%s: netlink socket error: %s\n", __func__, strerror(errno));
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    if(util_reactor_fd_add(fd, EPOLLIN, if_cache_rx, NULL) != 0) {
+        close(fd);
+        return -2;
+    }
+    if_cache_fd = fd;
+
+    // Build the cache right away
+    if(if_cache_tid < 0) {
+        if_cache_tid = util_reactor_task_add("ifcache", if_cache_task,
+                                             NULL, 0, 0);
+    } else {
+        util_reactor_task_wake(if_cache_tid, 0);
+    }
+    if(if_cache_tid < 0) {
+        util_reactor_fd_del(fd);
+        close(fd);
+        if_cache_fd = -1;
+        return -3;
+    }
+
+    return 0;
+}
+
+#ifdef DEBUG
+// Test the interface configuration cache against the kernel queries
+int test_if_cache(void)
+{
+    struct if_nameindex *ifs, *ifn;
+    IF_CACHE_ENTRY_t ife;
+    DEV_IP_CFG_t ipcfg;
+    DEV_IPV6_CFG_t ipv6cfg[MAX_IPV6_ADDRESSES_PER_MAC];
+    unsigned char mac[6];
+    unsigned long long t;
+    int ii, jj, flags, count, failed = 0;
+
+    if(util_net_if_gen() == 0 &&
+       (util_reactor_init() != 0 || util_net_if_cache_init() != 0))
+    {
+        printf("Failed to start the interface cache\n");
+        return -1;
+    }
+    for(ii = 0; ii < 50 && util_net_if_gen() == 0; ii++) {
+        util_msleep(100);
+    }
+    if(util_net_if_gen() == 0) {
+        printf("The interface cache is not ready\n");
+        return -1;
+    }
+    printf("Generation %u, %d interfaces\n", util_net_if_gen(), if_cache.count);
+
+    ifs = if_nameindex();
+    for(ifn = ifs; ifn != NULL && ifn->if_index != 0; ifn++)
+    {
+        if(if_cache_get(ifn->if_name, &ife) != 0) {
+            printf("%s: not in the cache\n", ifn->if_name);
+            ++failed;
+            continue;
+        }
+        printf("%s: index %d, flags 0x%x, MAC " MAC_PRINTF_FMT_TPL
+               ", IPv4 " IP_PRINTF_FMT_TPL "/" IP_PRINTF_FMT_TPL
+               ", %d IPv6\n", ife.name, ife.ifindex, ife.flags,
+               MAC_PRINTF_ARG_TPL(ife.mac), IP_PRINTF_ARG_TPL(ife.ipcfg.ipv4.b),
+               IP_PRINTF_ARG_TPL(ife.ipcfg.ipv4mask.b), ife.ipv6_count);
+
+        // Compare w/ what the kernel reports
+        if_cache_bypass = TRUE;
+        if(ife.ifindex != ifn->if_index) {
+            printf("%s: index mismatch\n", ife.name);
+            ++failed;
+        }
+        if(util_net_dev_get_flags(ife.name, &flags) != 0 ||
+           (flags & 0xffff) != (ife.flags & 0xffff))
+        {
+            printf("%s: flags mismatch\n", ife.name);
+            ++failed;
+        }
+        if(ife.has_mac &&
+           (util_get_mac(ife.name, mac) != 0 || memcmp(mac, ife.mac, 6) != 0))
+        {
+            printf("%s: MAC mismatch\n", ife.name);
+            ++failed;
+        }
+        memset(&ipcfg, 0, sizeof(ipcfg));
+        if((util_get_ipcfg(ife.name, &ipcfg) == 0) != ife.has_ipv4 ||
+           (ife.has_ipv4 && memcmp(&ipcfg, &ife.ipcfg, sizeof(ipcfg)) != 0))
+        {
+            printf("%s: IPv4 configuration mismatch\n", ife.name);
+            ++failed;
+        }
+#ifdef FEATURE_IPV6_TELEMETRY
+        memset(ipv6cfg, 0, sizeof(ipv6cfg));
+        util_get_ipv6cfg(ife.name, ipv6cfg);
+        for(count = 0; count < MAX_IPV6_ADDRESSES_PER_MAC &&
+                       ipv6cfg[count].prefix_len != 0; count++)
+        {
+            for(jj = 0; jj < ife.ipv6_count; jj++) {
+                if(memcmp(&ipv6cfg[count].addr, &ife.ipv6cfg[jj].addr,
+                          sizeof(IPV6_ADDR_t)) == 0)
+                {
+                    break;
+                }
+            }
+            if(jj >= ife.ipv6_count) {
+                break;
+            }
+        }
+        if(count != ife.ipv6_count) {
+            printf("%s: IPv6 configuration mismatch\n", ife.name);
+            ++failed;
+        }
+#endif // FEATURE_IPV6_TELEMETRY
+        if_cache_bypass = FALSE;
+    }
+
+    // Lookup time w/ and w/o the cache
+    if(ifs != NULL && ifs->if_index != 0) {
+        for(jj = 0; jj < 2; jj++) {
+            if_cache_bypass = (jj != 0);
+            t = util_time(1000000);
+            for(ii = 0; ii < 10000; ii++) {
+                util_get_ipcfg(ifs->if_name, &ipcfg);
+                util_get_mac(ifs->if_name, mac);
+            }
+            t = util_time(1000000) - t;
+            printf("%s lookup: %llu ns\n", (jj ? "Kernel" : "Cache"), t / 10);
+        }
+        if_cache_bypass = FALSE;
+    }
+    if(ifs != NULL) {
+        if_freenameindex(ifs);
+    }
+
+    printf("%s\n", (failed == 0) ? "PASSED" : "FAILED");
+
+    return (failed == 0) ? 0 : -1;
+}
+#endif // DEBUG
@@ -169,25 +169,43 @@ typedef struct _NL_SOCK {
 } NL_SOCK_t;
 
 // Network device stats
+// Note: all the counters are 64 bit, the ones reported by the kernel
+//       in unsigned long wrap around at 4G on the 32 bit platforms.
 typedef struct _NET_DEV_STATS {
     unsigned long long rx_packets;  // packets received
     unsigned long long tx_packets;  // packets transmitted
     unsigned long long rx_bytes;    // bytes received
     unsigned long long tx_bytes;    // bytes transmitted
-    unsigned long rx_errors;        // bad packets received
-    unsigned long tx_errors;        // packet transmit problems
-    unsigned long rx_dropped;       // no space in linux buffers
-    unsigned long tx_dropped;       // no space available in linux
-    unsigned long rx_multicast;     // multicast packets received
-    unsigned long rx_compressed;    // compressed packets received
-    unsigned long tx_compressed;    // compressed packets sent
-    unsigned long collisions;       // collisions detected
-    unsigned long rx_fifo_errors;   // recv'r fifo overrun
-    unsigned long tx_fifo_errors;   // tx fifo overrun
-    unsigned long rx_frame_errors;  // recv'd frame alignment error
-    unsigned long tx_carrier_errors;// no carrier errors
+    unsigned long long rx_errors;   // bad packets received
+    unsigned long long tx_errors;   // packet transmit problems
+    unsigned long long rx_dropped;  // no space in linux buffers
+    unsigned long long tx_dropped;  // no space available in linux
+    unsigned long long rx_multicast;     // multicast packets received
+    unsigned long long rx_compressed;    // compressed packets received
+    unsigned long long tx_compressed;    // compressed packets sent
+    unsigned long long collisions;       // collisions detected
+    unsigned long long rx_fifo_errors;   // recv'r fifo overrun
+    unsigned long long tx_fifo_errors;   // tx fifo overrun
+    unsigned long long rx_frame_errors;  // recv'd frame alignment error
+    unsigned long long tx_carrier_errors;// no carrier errors
 } NET_DEV_STATS_t;
 
+// Max number of network devices in the counters snapshot
+#define UTIL_NET_DEV_STATS_MAX 64
+
+// Network device counters snapshot entry
+typedef struct _NET_DEV_STATS_ENTRY {
+    int ifindex;           // interface index
+    char name[IFNAMSIZ];   // interface name
+    NET_DEV_STATS_t st;    // the counters
+} NET_DEV_STATS_ENTRY_t;
+
+// Counters snapshot of all the network devices
+typedef struct _NET_DEV_STATS_SNAP {
+    int count;             // number of the entries
+    NET_DEV_STATS_ENTRY_t e[UTIL_NET_DEV_STATS_MAX];
+} NET_DEV_STATS_SNAP_t;
+
 typedef struct _UDP_PAYLOAD {
     char *dip;
     int sport;
@@ -300,6 +318,54 @@ int util_ping(struct sockaddr *s_addr, int timeout_in_sec);
 // Returns 0 if successful, error code if fails.
 int util_get_dev_stats(const char *dev, NET_DEV_STATS_t *st);
 
+// Get statistics/counters of all the network devices in one netlink
+// request (use it instead of util_get_dev_stats() when the counters
+// of several devices are needed).
+// snap - the snapshot structure to fill in
+// Returns 0 if successful, error code if fails.
+int util_get_all_dev_stats(NET_DEV_STATS_SNAP_t *snap);
+
+// Find network device counters in the snapshot by the device name
+// or interface index.
+// Returns: pointer to the counters or NULL if not found
+NET_DEV_STATS_t *util_dev_stats_by_name(NET_DEV_STATS_SNAP_t *snap,
+                                        const char *dev);
+NET_DEV_STATS_t *util_dev_stats_by_index(NET_DEV_STATS_SNAP_t *snap,
+                                         int ifindex);
+
+// Max number of network devices in the interface configuration cache
+#define UTIL_NET_IF_CACHE_MAX 64
+// Time (in ms) to let a burst of the interface change notifications
+// settle before rebuilding the cache
+#define UTIL_NET_IF_CACHE_SETTLE 100
+// Delay (in sec) before retrying if failed to rebuild the cache
+#define UTIL_NET_IF_CACHE_RETRY 5
+
+// Start the interface configuration cache (requires the reactor, see
+// util_reactor.h). It is built from the netlink dumps and rebuilt on
+// the RTM_NEWLINK/RTM_DELLINK/RTM_NEWADDR/RTM_DELADDR notifications.
+// Once it is ready util_get_mac(), util_get_ipcfg(), util_get_ipv6cfg(),
+// util_get_ipv4(), util_get_ifindex() and the util_net_dev_is_...() flag
+// checks are answered from it w/o the syscalls.
+// Returns: 0 - success, negative - error
+int util_net_if_cache_init(void);
+
+// Returns the interface configuration generation. It changes every time
+// the kernel reports a change of the interface links or addresses. The
+// callers can skip re-reading the interface configuration while it is
+// the same. It is 0 if the cache is not running (the configuration has
+// to be re-read every time then).
+unsigned int util_net_if_gen(void);
+
+// Get the interface index (from the cache if possible)
+// Returns: the interface index, 0 if not found
+int util_get_ifindex(const char *dev);
+
+#ifdef DEBUG
+// Test the interface configuration cache against the kernel queries
+int test_if_cache(void);
+#endif // DEBUG
+
 // Send ARP query (just sends the packet)
 int util_send_arp_query(const char *ifname, IPV4_ADDR_t *tgt);
 
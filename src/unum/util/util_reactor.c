@@ -0,0 +1,778 @@
+// (c) 2022 minim.co
+// unum event loop (reactor) code
+
+#include "unum.h"
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+
+/* Temporary, log to console from here */
+//#undef LOG_DST
+//#undef LOG_DBG_DST
+//#define LOG_DST LOG_DST_CONSOLE
+//#define LOG_DBG_DST LOG_DST_CONSOLE
+
+
+// Max number of the events to take from epoll at once
+#define REACTOR_MAX_EVENTS 8
+
+// epoll event tags of the reactor's own descriptors (the watched ones
+// are tagged w/ their index in the fds[] array)
+#define REACTOR_TAG_TIMER UTIL_REACTOR_MAX_FDS
+#define REACTOR_TAG_WAKE  (UTIL_REACTOR_MAX_FDS + 1)
+
+// The "never" time for the tasks not to run till woken up
+#define REACTOR_NEVER (~0ULL)
+
+// Task states
+#define TASK_IDLE    0 // waiting for its time or a wakeup
+#define TASK_QUEUED  1 // waiting for a worker
+#define TASK_RUNNING 2 // the step is running
+
+// Task entry
+typedef struct {
+    const char *name;          // task name (NULL if unused)
+    REACTOR_TASK_FUNC_t f;     // step function
+    THRD_PARAM_t param;        // param for the step function call
+    unsigned long long msecs;  // uptime in msec when the next step is due
+    unsigned long long wake;   // wakeup time requested while not idle
+    int tid;                   // task ID (index + 1, generation on top)
+    int flags;                 // REACTOR_TASK_F_* flags
+    int state;                 // TASK_* state
+    UTIL_WD_t wd;              // task watchdog
+} REACTOR_TASK_t;
+
+// Watched file descriptor entry
+typedef struct {
+    int fd;                    // file descriptor (-1 if unused)
+    REACTOR_FD_FUNC_t f;       // callback function
+    THRD_PARAM_t param;        // param for the callback
+} REACTOR_FD_t;
+
+// Tasks and the watched descriptors
+static REACTOR_TASK_t tasks[UTIL_REACTOR_MAX_TASKS];
+static REACTOR_FD_t fds[UTIL_REACTOR_MAX_FDS];
+
+// The worker pool queue (indices in tasks[], each task is queued at most
+// once, so it cannot overflow)
+static int pool_q[UTIL_REACTOR_MAX_TASKS];
+static int pool_start = 0;
+static int pool_len = 0;
+
+// Task ID generation counter
+static int tid_gen = 0;
+
+// Reactor stats
+static REACTOR_STATS_t reactor_st;
+
+// epoll, timerfd and eventfd descriptors (-1 until initialized)
+static int ep_fd = -1;
+static int tm_fd = -1;
+static int ev_fd = -1;
+
+// Mutex for protecting all the above
+static UTIL_MUTEX_t reactor_m = UTIL_MUTEX_INITIALIZER;
+
+// Event waking up the pool workers
+static UTIL_EVENT_t pool_ready = UTIL_EVENT_INITIALIZER;
+
+
+// Find the task by ID, has to be called w/ the mutex taken
+static REACTOR_TASK_t *task_find(int tid)
+{
+    int idx = (tid & 0xff) - 1;
+
+    if(idx < 0 || idx >= UTIL_REACTOR_MAX_TASKS ||
+       !tasks[idx].name || tasks[idx].tid != tid)
+    {
+        return NULL;
+    }
+    return &(tasks[idx]);
+}
+
+// Add a task
+// name - pointer to a constant string naming the task
+// f - the task step function
+// p - pointer to parameters structure to store and pass to the step
+//     function (by a pointer) when it is called (can be NULL)
+// msecs - milliseconds till the first step
+// flags - REACTOR_TASK_F_* flags
+// Returns: task ID (positive) if OK or negative if fails
+int util_reactor_task_add(const char *name, REACTOR_TASK_FUNC_t f,
+                          THRD_PARAM_t *p, unsigned int msecs, int flags)
+{
+    REACTOR_TASK_t *t = NULL;
+    int ii, ret = -1;
+
+    if(!f || !name) {
+        log("%s: invalid parameters\n", __func__);
+        return -1;
+    }
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    for(ii = 0; ii < UTIL_REACTOR_MAX_TASKS; ii++) {
+        if(!tasks[ii].name) {
+            t = &(tasks[ii]);
+            break;
+        }
+    }
+    if(t) {
+        memset(t, 0, sizeof(REACTOR_TASK_t));
+        t->name = name;
+        t->f = f;
+        if(p) {
+            memcpy(&t->param, p, sizeof(THRD_PARAM_t));
+        }
+        t->msecs = util_time(1000) + msecs;
+        t->wake = REACTOR_NEVER;
+        t->flags = flags;
+        t->state = TASK_IDLE;
+        if(++tid_gen > 0x7fffff) {
+            tid_gen = 1;
+        }
+        t->tid = (tid_gen << 8) | (ii + 1);
+        ret = t->tid;
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    if(ret < 0) {
+        log("%s: error, no free slot for task <%s>\n", __func__, name);
+    } else {
+        util_reactor_wake();
+    }
+
+    return ret;
+}
+
+// Wake up the task to run its next step in msecs (or earlier if it was
+// already due earlier)
+// tid - the task ID
+// msecs - milliseconds till the step (0 - as soon as possible)
+// Returns: 0 - if successful, negative if the task is not found
+int util_reactor_task_wake(int tid, unsigned int msecs)
+{
+    REACTOR_TASK_t *t;
+    unsigned long long at = util_time(1000) + msecs;
+    int ret = -1, wake = FALSE;
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    t = task_find(tid);
+    if(t) {
+        if(t->state != TASK_IDLE) {
+            // Applied when the step completes
+            if(at < t->wake) {
+                t->wake = at;
+            }
+        } else if(at < t->msecs) {
+            t->msecs = at;
+            wake = TRUE;
+        }
+        ret = 0;
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    if(wake) {
+        util_reactor_wake();
+    }
+
+    return ret;
+}
+
+// Update the task state after the step has completed
+static void task_done(REACTOR_TASK_t *t, int ret)
+{
+    unsigned long long next;
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    if(ret == REACTOR_TASK_DONE) {
+        log("%s: task <%s> is done\n", __func__, t->name);
+        t->name = NULL;
+        t->f = NULL;
+    } else {
+        next = (ret >= 0) ? util_time(1000) + ret : REACTOR_NEVER;
+        t->msecs = UTIL_MIN(next, t->wake);
+        t->wake = REACTOR_NEVER;
+    }
+    t->state = TASK_IDLE;
+    UTIL_MUTEX_GIVE(&reactor_m);
+}
+
+// Run the task step in the calling thread
+static void task_step(REACTOR_TASK_t *t)
+{
+    int ret;
+
+    util_wd_attach(&t->wd);
+    ret = t->f(&t->param);
+    util_wd_attach(NULL);
+
+    task_done(t, ret);
+}
+
+// Dispatch the due tasks, the blocking ones are queued for the workers,
+// one of the others is run right here.
+// Returns: msec till the next task is due (0 if a step has run),
+//          negative if none is scheduled
+static long reactor_run_tasks(void)
+{
+    REACTOR_TASK_t *t, *t_run = NULL;
+    unsigned long long cur_t = util_time(1000);
+    long delay = -1;
+    int ii, queued = 0;
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    for(ii = 0; ii < UTIL_REACTOR_MAX_TASKS; ii++)
+    {
+        t = &(tasks[ii]);
+        if(!t->name || t->state != TASK_IDLE || t->msecs == REACTOR_NEVER) {
+            continue;
+        }
+        if(t->msecs > cur_t) {
+            if(delay < 0 || t->msecs - cur_t < delay) {
+                delay = t->msecs - cur_t;
+            }
+            continue;
+        }
+        if(!(t->flags & REACTOR_TASK_F_BLOCKING) && t_run) {
+            delay = 0; // next time around
+            continue;
+        }
+        // The task is on time, poll its watchdog
+        t->wd.uptime = util_time(1);
+        if(t->flags & REACTOR_TASK_F_BLOCKING) {
+            t->state = TASK_QUEUED;
+            pool_q[(pool_start + pool_len) % UTIL_REACTOR_MAX_TASKS] = ii;
+            ++pool_len;
+            if(pool_len > reactor_st.pool_depth_max) {
+                reactor_st.pool_depth_max = pool_len;
+            }
+            ++queued;
+        } else {
+            t->state = TASK_RUNNING;
+            t_run = t;
+            ++(reactor_st.steps);
+        }
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    if(queued > 0) {
+        UTIL_EVENT_SETALL(&pool_ready);
+    }
+    if(t_run) {
+        task_step(t_run);
+        delay = 0;
+    }
+
+    return delay;
+}
+
+// Worker pool thread, runs the blocking task steps
+static void reactor_worker(THRD_PARAM_t *p)
+{
+    REACTOR_TASK_t *t;
+
+    log("%s: started\n", __func__);
+
+    for(;;)
+    {
+        t = NULL;
+        UTIL_MUTEX_TAKE(&reactor_m);
+        if(pool_len > 0) {
+            t = &(tasks[pool_q[pool_start]]);
+            pool_start = (pool_start + 1) % UTIL_REACTOR_MAX_TASKS;
+            --pool_len;
+            t->state = TASK_RUNNING;
+            ++(reactor_st.pool_steps);
+        } else {
+            UTIL_EVENT_RESET(&pool_ready);
+        }
+        UTIL_MUTEX_GIVE(&reactor_m);
+
+        if(!t) {
+            UTIL_EVENT_WAIT(&pool_ready);
+            continue;
+        }
+
+        task_step(t);
+        util_reactor_wake();
+    }
+
+    log("%s: done\n", __func__);
+}
+
+// Start watching the file descriptor
+// fd - the file descriptor
+// events - EPOLL* events to watch for (level triggered)
+// f - the callback to call when the events are reported
+// p - pointer to parameters structure to store and pass to the
+//     callback (by a pointer) when it is called (can be NULL)
+// Returns: 0 - if successful, negative if fails
+int util_reactor_fd_add(int fd, unsigned int events,
+                        REACTOR_FD_FUNC_t f, THRD_PARAM_t *p)
+{
+    struct epoll_event ev;
+    int ii, ret = -1;
+
+    if(fd < 0 || !f) {
+        log("%s: invalid parameters\n", __func__);
+        return -1;
+    }
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    for(;;)
+    {
+        if(ep_fd < 0) {
+            log("%s: error, the reactor is not running\n", __func__);
+            break;
+        }
+        for(ii = 0; ii < UTIL_REACTOR_MAX_FDS; ii++) {
+            if(fds[ii].fd < 0) {
+                break;
+            }
+        }
+        if(ii >= UTIL_REACTOR_MAX_FDS) {
+            log("%s: error, no free slot for fd %d\n", __func__, fd);
+            break;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.u64 = ((unsigned long long)fd << 32) | ii;
+        if(epoll_ctl(ep_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            log("%s: epoll_ctl() for fd %d failed: %s\n",
+                __func__, fd, strerror(errno));
+            break;
+        }
+        fds[ii].fd = fd;
+        fds[ii].f = f;
+        if(p) {
+            memcpy(&fds[ii].param, p, sizeof(THRD_PARAM_t));
+        } else {
+            memset(&fds[ii].param, 0, sizeof(THRD_PARAM_t));
+        }
+        ret = 0;
+        break;
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    return ret;
+}
+
+// Stop watching the file descriptor (can be called from its callback)
+// Returns: 0 - if successful, negative if the descriptor is not watched
+int util_reactor_fd_del(int fd)
+{
+    int ii, ret = -1;
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    for(ii = 0; fd >= 0 && ii < UTIL_REACTOR_MAX_FDS; ii++) {
+        if(fds[ii].fd == fd) {
+            epoll_ctl(ep_fd, EPOLL_CTL_DEL, fd, NULL);
+            fds[ii].fd = -1;
+            fds[ii].f = NULL;
+            ret = 0;
+            break;
+        }
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    return ret;
+}
+
+// Call the watched descriptor callback for the epoll event
+static void reactor_fd_event(struct epoll_event *ev)
+{
+    int idx = ev->data.u64 & 0xffffffff;
+    int fd = ev->data.u64 >> 32;
+    REACTOR_FD_FUNC_t f = NULL;
+    THRD_PARAM_t param;
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    // Skip if deleted (or replaced) by a callback run before
+    if(fds[idx].fd == fd) {
+        f = fds[idx].f;
+        memcpy(&param, &fds[idx].param, sizeof(THRD_PARAM_t));
+        ++(reactor_st.fd_events);
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    if(f) {
+        f(fd, ev->events, &param);
+    }
+}
+
+// Make the reactor re-check its schedule
+void util_reactor_wake(void)
+{
+    uint64_t val = 1;
+
+    if(ev_fd >= 0 && write(ev_fd, &val, sizeof(val)) < 0 &&
+       errno != EAGAIN)
+    {
+        log("%s: eventfd write error: %s\n", __func__, strerror(errno));
+    }
+}
+
+// Arm the timerfd to fire in msec (negative - disarm)
+static void reactor_arm(long msec)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if(msec >= 0) {
+        its.it_value.tv_sec = msec / 1000;
+        its.it_value.tv_nsec = (msec % 1000) * 1000000 + 1;
+    }
+    if(timerfd_settime(tm_fd, 0, &its, NULL) != 0) {
+        log("%s: timerfd_settime() error: %s\n", __func__, strerror(errno));
+    }
+}
+
+// Reactor thread function
+static void reactor(THRD_PARAM_t *p)
+{
+    struct epoll_event ev[REACTOR_MAX_EVENTS];
+    long delay, t_delay;
+    uint64_t val;
+    int ii, n;
+
+    log("%s: started\n", __func__);
+
+    // The reactor thread watchdog is polled every time around the loop,
+    // the loop wakes up at least twice per the timeout.
+    util_wd_set_timeout(UTIL_REACTOR_EXE_TIMEOUT);
+
+    for(;;)
+    {
+        util_wd_poll();
+
+        // Run what is due and figure out when to check again
+        delay = util_timers_run();
+        t_delay = reactor_run_tasks();
+        if(t_delay >= 0 && (delay < 0 || t_delay < delay)) {
+            delay = t_delay;
+        }
+        if(delay < 0 || delay > UTIL_REACTOR_EXE_TIMEOUT * 500) {
+            delay = UTIL_REACTOR_EXE_TIMEOUT * 500;
+        }
+        if(delay > 0) {
+            reactor_arm(delay);
+        }
+
+        n = epoll_wait(ep_fd, ev, REACTOR_MAX_EVENTS, (delay == 0) ? 0 : -1);
+        if(n < 0) {
+            if(errno != EINTR) {
+                log("%s: epoll_wait() error: %s\n", __func__, strerror(errno));
+                util_msleep(100);
+            }
+            continue;
+        }
+        if(n > 0) {
+            ++(reactor_st.wakeups);
+        }
+
+        for(ii = 0; ii < n; ii++)
+        {
+            if(ev[ii].data.u64 == REACTOR_TAG_TIMER) {
+                if(read(tm_fd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+                    log("%s: timerfd read error: %s\n",
+                        __func__, strerror(errno));
+                }
+            } else if(ev[ii].data.u64 == REACTOR_TAG_WAKE) {
+                if(read(ev_fd, &val, sizeof(val)) < 0 && errno != EAGAIN) {
+                    log("%s: eventfd read error: %s\n",
+                        __func__, strerror(errno));
+                }
+            } else {
+                reactor_fd_event(&ev[ii]);
+            }
+        }
+    }
+
+    log("%s: done\n", __func__);
+}
+
+// Get the reactor stats
+// st - where to store the stats
+// reset - TRUE to reset the counters
+void util_reactor_get_stats(REACTOR_STATS_t *st, int reset)
+{
+    UTIL_MUTEX_TAKE(&reactor_m);
+    memcpy(st, &reactor_st, sizeof(REACTOR_STATS_t));
+    if(reset) {
+        memset(&reactor_st, 0, sizeof(REACTOR_STATS_t));
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+}
+
+// Check the tasks' watchdogs
+// Returns: 0 if all are ok or the max number of seconds a task is late for
+int util_reactor_wd_check(void)
+{
+    int ii, late, ret = 0;
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    for(ii = 0; ii < UTIL_REACTOR_MAX_TASKS; ii++)
+    {
+        if(!tasks[ii].name) {
+            continue;
+        }
+        late = util_wd_late(&(tasks[ii].wd));
+        if(late > 0) {
+            log("%s: task %s is %d sec late polling wd, timeout %u\n",
+                __func__, tasks[ii].name, late, tasks[ii].wd.timeout);
+            if(late > ret) {
+                ret = late;
+            }
+        }
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    return ret;
+}
+
+// Start the reactor and the worker pool threads (does nothing if
+// already started)
+// Returns: 0 - success or an error code
+int util_reactor_init(void)
+{
+    struct epoll_event ev;
+    int ii, ret = 0;
+
+    UTIL_MUTEX_TAKE(&reactor_m);
+    for(;;)
+    {
+        if(ep_fd >= 0) {
+            break; // already running
+        }
+        for(ii = 0; ii < UTIL_REACTOR_MAX_FDS; ii++) {
+            fds[ii].fd = -1;
+        }
+
+        ep_fd = epoll_create1(EPOLL_CLOEXEC);
+        tm_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ev_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(ep_fd < 0 || tm_fd < 0 || ev_fd < 0) {
+            log("%s: failed to create descriptors: %s\n",
+                __func__, strerror(errno));
+            ret = -1;
+            break;
+        }
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = REACTOR_TAG_TIMER;
+        if(epoll_ctl(ep_fd, EPOLL_CTL_ADD, tm_fd, &ev) != 0) {
+            ret = -2;
+        }
+        ev.data.u64 = REACTOR_TAG_WAKE;
+        if(epoll_ctl(ep_fd, EPOLL_CTL_ADD, ev_fd, &ev) != 0) {
+            ret = -2;
+        }
+        if(ret != 0) {
+            log("%s: epoll_ctl() failed: %s\n", __func__, strerror(errno));
+            break;
+        }
+
+        if(util_start_thrd("reactor", reactor, NULL, NULL) != 0) {
+            log("%s: failed to start the reactor thread\n", __func__);
+            ret = -3;
+            break;
+        }
+        for(ii = 0; ii < UTIL_REACTOR_WORKERS; ii++) {
+            char name[16];
+            snprintf(name, sizeof(name), "worker%d", ii);
+            if(util_start_thrd(name, reactor_worker, NULL, NULL) != 0) {
+                log("%s: failed to start %s\n", __func__, name);
+            }
+        }
+        break;
+    }
+    if(ret != 0) {
+        if(ep_fd >= 0) {
+            close(ep_fd);
+            ep_fd = -1;
+        }
+        if(tm_fd >= 0) {
+            close(tm_fd);
+            tm_fd = -1;
+        }
+        if(ev_fd >= 0) {
+            close(ev_fd);
+            ev_fd = -1;
+        }
+    }
+    UTIL_MUTEX_GIVE(&reactor_m);
+
+    return ret;
+}
+
+
+#ifdef DEBUG
+// Test task and fd watcher state
+static struct {
+    int fast;          // # of the fast task steps
+    int slow;          // # of the blocking task steps
+    int slow_in[2];    // # of the blocking task steps running
+    int overlap;       // # of times the step was re-entered
+    int woken;         // # of the sleeping task steps
+    int rx;            // # of the bytes the fd watcher has read
+    int wd;            // the watchdog task step number
+    unsigned long long late; // total fast task lateness (msec)
+    unsigned long long due;  // when the fast task is due next
+} test_st;
+
+// Inline task, every 20ms
+static int test_fast_task(THRD_PARAM_t *p)
+{
+    unsigned long long now = util_time(1000);
+
+    if(test_st.due != 0 && now > test_st.due) {
+        test_st.late += now - test_st.due;
+    }
+    test_st.due = now + 20;
+    ++test_st.fast;
+    return 20;
+}
+
+// Blocking task (two instances), 100ms per step
+static int test_slow_task(THRD_PARAM_t *p)
+{
+    if(__sync_add_and_fetch(&test_st.slow_in[p->int_val], 1) > 1) {
+        __sync_add_and_fetch(&test_st.overlap, 1);
+    }
+    util_msleep(100);
+    __sync_add_and_fetch(&test_st.slow, 1);
+    __sync_sub_and_fetch(&test_st.slow_in[p->int_val], 1);
+    return 0;
+}
+
+// Task running only when woken up
+static int test_sleep_task(THRD_PARAM_t *p)
+{
+    ++test_st.woken;
+    return (test_st.woken < 3) ? REACTOR_TASK_SLEEP : REACTOR_TASK_DONE;
+}
+
+// Task making its watchdog expire on the first step
+static int test_wd_task(THRD_PARAM_t *p)
+{
+    if(++test_st.wd == 1) {
+        util_wd_set_timeout(1);
+        return REACTOR_TASK_SLEEP;
+    }
+    util_wd_set_timeout(0);
+    return REACTOR_TASK_DONE;
+}
+
+// Pipe reader
+static void test_fd_cb(int fd, unsigned int events, THRD_PARAM_t *p)
+{
+    char buf[16];
+    int len = read(fd, buf, sizeof(buf));
+
+    if(len > 0) {
+        test_st.rx += len;
+    }
+    if(len == 0 || (events & (EPOLLHUP | EPOLLERR)) != 0) {
+        util_reactor_fd_del(fd);
+    }
+}
+
+// Test the tasks scheduling, the worker pool and the fd watchers
+int test_reactor(void)
+{
+    REACTOR_STATS_t st;
+    THRD_PARAM_t tp;
+    int t_sleep, t_wd, ii, failed = 0;
+    int pfd[2];
+
+    if(util_reactor_init() != 0) {
+        printf("Failed to start the reactor\n");
+        return -1;
+    }
+    memset(&test_st, 0, sizeof(test_st));
+
+    util_reactor_task_add("fast", test_fast_task, NULL, 0, 0);
+    for(ii = 0; ii < 2; ii++) {
+        tp.int_val = ii;
+        util_reactor_task_add((ii ? "slow2" : "slow1"), test_slow_task,
+                              &tp, 0, REACTOR_TASK_F_BLOCKING);
+    }
+    t_sleep = util_reactor_task_add("sleep", test_sleep_task, NULL,
+                                    0, 0);
+    t_wd = util_reactor_task_add("wd", test_wd_task, NULL, 0, 0);
+    if(pipe(pfd) != 0 ||
+       util_reactor_fd_add(pfd[0], EPOLLIN, test_fd_cb, NULL) != 0)
+    {
+        printf("Failed to set up the pipe watcher\n");
+        return -1;
+    }
+
+    for(ii = 0; ii < 10; ii++) {
+        util_msleep(100);
+        if(write(pfd[1], "0123456789", 10) != 10) {
+            printf("Pipe write error\n");
+        }
+        if(ii == 3 || ii == 6) {
+            util_reactor_task_wake(t_sleep, 0);
+        }
+    }
+    util_msleep(100);
+
+    printf("fast %d (avg late %llums), slow %d, woken %d, rx %d\n",
+           test_st.fast, test_st.fast ? test_st.late / test_st.fast : 0,
+           test_st.slow, test_st.woken, test_st.rx);
+    if(test_st.fast < 40) {
+        printf("The fast task has not run often enough\n");
+        ++failed;
+    }
+    if(test_st.slow < 12 || test_st.overlap > 0) {
+        printf("The blocking tasks have run %d times, overlapped %d\n",
+               test_st.slow, test_st.overlap);
+        ++failed;
+    }
+    if(test_st.woken != 3) {
+        printf("The sleeping task has run %d times\n", test_st.woken);
+        ++failed;
+    }
+    if(util_reactor_task_wake(t_sleep, 0) == 0) {
+        printf("The finished task can still be woken up\n");
+        ++failed;
+    }
+    if(test_st.rx != 100) {
+        printf("The fd watcher has read %d bytes\n", test_st.rx);
+        ++failed;
+    }
+
+    // The watchdog of the task sleeping after setting 1sec timeout
+    sleep(2);
+    if(util_reactor_wd_check() <= 0) {
+        printf("The task watchdog has not expired\n");
+        ++failed;
+    }
+    util_reactor_task_wake(t_wd, 0);
+    util_msleep(100);
+    if(util_reactor_wd_check() != 0) {
+        printf("The task watchdog has not been cleared\n");
+        ++failed;
+    }
+
+    // The watcher removes itself on EOF
+    close(pfd[1]);
+    util_msleep(100);
+    if(util_reactor_fd_del(pfd[0]) == 0) {
+        printf("The fd watcher has not been removed\n");
+        ++failed;
+    }
+    close(pfd[0]);
+
+    util_reactor_get_stats(&st, FALSE);
+    printf("Stats: wakeups %lu, steps %lu, pool steps %lu, fd events %lu, "
+           "pool depth max %u\n", st.wakeups, st.steps, st.pool_steps,
+           st.fd_events, st.pool_depth_max);
+
+    printf("%s\n", (failed == 0) ? "PASSED" : "FAILED");
+
+    return (failed == 0) ? 0 : -1;
+}
+#endif // DEBUG
@@ -0,0 +1,129 @@
+// (c) 2022 minim.co
+// unum event loop (reactor) include file
+
+#ifndef _UTIL_REACTOR_H
+#define _UTIL_REACTOR_H
+
+
+// The reactor is a single thread waiting in epoll_wait() for the file
+// descriptors it watches, for its timerfd to tell that a timer or a task
+// is due and for its eventfd to be poked by the other threads when they
+// change the schedule. It runs the util_timer.c timers, the fd watcher
+// callbacks and the cooperative tasks.
+// A task is a step function the reactor calls when the task is due, the
+// step returns the delay till it has to be called again. The steps that
+// might block (HTTP requests, scans, etc) are marked w/
+// REACTOR_TASK_F_BLOCKING and run by the small worker pool instead of
+// the reactor thread. A task step is never run concurrently w/ itself.
+// The util_wd_set_timeout()/util_wd_poll() calls made by a task step
+// apply to the task. The task watchdog is polled every time the task is
+// dispatched and checked along w/ the threads' ones, so the timeout is
+// the max time the step may take plus the max time the task may run late.
+
+// Max number of the tasks
+#define UTIL_REACTOR_MAX_TASKS 16
+
+// Max number of the watched file descriptors
+#define UTIL_REACTOR_MAX_FDS 8
+
+// Number of the worker pool threads running the blocking task steps
+// (platforms can override it in platform.h)
+#ifndef UTIL_REACTOR_WORKERS
+#  define UTIL_REACTOR_WORKERS 2
+#endif // UTIL_REACTOR_WORKERS
+
+// The reactor thread watchdog timeout (in seconds). The timer handlers,
+// the fd callbacks and the task steps running in the reactor thread
+// should finish within a second, this is just a catch for a grossly
+// misbehaving code.
+#define UTIL_REACTOR_EXE_TIMEOUT 20
+
+// Special task step return values (the non-negative ones are the delay
+// in milliseconds till the next step)
+#define REACTOR_TASK_DONE  (-1) // the task is finished, remove it
+#define REACTOR_TASK_SLEEP (-2) // run the next step only when woken up
+
+// Task flags
+#define REACTOR_TASK_F_BLOCKING 0x0001 // run the steps in the worker pool
+
+
+// Task step function type
+// p - the parameters structure the task was added with
+// Returns: delay in msec till the next step or REACTOR_TASK_* value
+typedef int (*REACTOR_TASK_FUNC_t)(THRD_PARAM_t *p);
+
+// File descriptor watcher callback type (runs in the reactor thread,
+// must not block)
+// fd - the file descriptor
+// events - EPOLL* events reported for the descriptor
+// p - the parameters structure the watcher was added with
+typedef void (*REACTOR_FD_FUNC_t)(int fd, unsigned int events,
+                                  THRD_PARAM_t *p);
+
+// Reactor stats (for profiling)
+typedef struct _REACTOR_STATS {
+    unsigned long wakeups;    // # of the reactor wakeups
+    unsigned long steps;      // # of the task steps run in the reactor
+    unsigned long pool_steps; // # of the task steps run by the pool
+    unsigned long fd_events;  // # of the fd watcher callbacks
+    unsigned int pool_depth_max; // max # of the tasks waiting for a worker
+} REACTOR_STATS_t;
+
+
+// Add a task
+// name - pointer to a constant string naming the task
+// f - the task step function
+// p - pointer to parameters structure to store and pass to the step
+//     function (by a pointer) when it is called (can be NULL)
+// msecs - milliseconds till the first step
+// flags - REACTOR_TASK_F_* flags
+// Returns: task ID (positive) if OK or negative if fails
+int util_reactor_task_add(const char *name, REACTOR_TASK_FUNC_t f,
+                          THRD_PARAM_t *p, unsigned int msecs, int flags);
+
+// Wake up the task to run its next step in msecs (or earlier if it was
+// already due earlier). If the task step is running it is run again in
+// msecs after it completes unless the step asks for it to be run sooner.
+// The task finishing w/ REACTOR_TASK_DONE drops the wakeup.
+// tid - the task ID
+// msecs - milliseconds till the step (0 - as soon as possible)
+// Returns: 0 - if successful, negative if the task is not found
+int util_reactor_task_wake(int tid, unsigned int msecs);
+
+// Start watching the file descriptor
+// fd - the file descriptor
+// events - EPOLL* events to watch for (level triggered)
+// f - the callback to call when the events are reported
+// p - pointer to parameters structure to store and pass to the
+//     callback (by a pointer) when it is called (can be NULL)
+// Returns: 0 - if successful, negative if fails
+int util_reactor_fd_add(int fd, unsigned int events,
+                        REACTOR_FD_FUNC_t f, THRD_PARAM_t *p);
+
+// Stop watching the file descriptor (can be called from its callback)
+// Returns: 0 - if successful, negative if the descriptor is not watched
+int util_reactor_fd_del(int fd);
+
+// Make the reactor re-check its schedule (used by the timers)
+void util_reactor_wake(void);
+
+// Get the reactor stats
+// st - where to store the stats
+// reset - TRUE to reset the counters
+void util_reactor_get_stats(REACTOR_STATS_t *st, int reset);
+
+// Check the tasks' watchdogs
+// Returns: 0 if all are ok or the max number of seconds a task is late for
+int util_reactor_wd_check(void);
+
+// Start the reactor and the worker pool threads (does nothing if
+// already started)
+// Returns: 0 - success or an error code
+int util_reactor_init(void);
+
+#ifdef DEBUG
+// Test the tasks scheduling, the worker pool and the fd watchers
+int test_reactor(void);
+#endif // DEBUG
+
+#endif // _UTIL_REACTOR_H
@@ -0,0 +1,202 @@
+// (c) 2022 minim.co
+// unum Robin Hood open addressing hash table
+
+#include "unum.h"
+
+
+/* Temporary, log to console from here */
+//#undef LOG_DST
+//#undef LOG_DBG_DST
+//#define LOG_DST LOG_DST_CONSOLE
+//#define LOG_DBG_DST LOG_DST_CONSOLE
+
+
+// Distance of the item w/ the hash _h in the slot _i from its home slot
+#define RHT_DIST(_t, _h, _i) (((_i) - (_h)) & (_t)->mask)
+
+// Ptr to the key in the item
+#define RHT_KEY(_t, _item) ((unsigned char *)(_item) + (_t)->key_off)
+
+
+// Initialize the hash table
+// t - the table structure
+// max - max number of items the table should be able to hold
+// key_off - offset of the key in the items
+// key_len - length of the key
+// Returns: 0 - if successful
+int util_rht_init(UTIL_RHT_t *t, unsigned int max,
+                  unsigned int key_off, unsigned int key_len)
+{
+    unsigned int size;
+
+    memset(t, 0, sizeof(UTIL_RHT_t));
+
+    for(size = 1; size < max * UTIL_RHT_LOAD_FACTOR; size <<= 1);
+
+    t->slots = UTIL_CALLOC(size, sizeof(UTIL_RHT_SLOT_t));
+    if(t->slots == NULL) {
+        log("%s: failed to allocate %u slots\n", __func__, size);
+        return -1;
+    }
+    t->mask = size - 1;
+    t->max = max;
+    t->key_off = key_off;
+    t->key_len = key_len;
+
+    return 0;
+}
+
+// Free the hash table memory
+void util_rht_destroy(UTIL_RHT_t *t)
+{
+    if(t->slots != NULL) {
+        UTIL_FREE(t->slots);
+    }
+    memset(t, 0, sizeof(UTIL_RHT_t));
+}
+
+// Find the slot of the item with the key
+// Returns: the slot index or negative if not found
+static int rht_find_slot(UTIL_RHT_t *t, const void *key, uint32_t hash,
+                         unsigned int *probes)
+{
+    unsigned int idx, dist;
+    int ret = -1;
+
+    idx = hash & t->mask;
+    for(dist = 0; dist <= t->max_dist; dist++)
+    {
+        UTIL_RHT_SLOT_t *s = &(t->slots[idx]);
+        // Stop at a free slot or at an item that is closer to its home
+        // slot than our key would be (it would have displaced that item)
+        if(s->item == NULL || RHT_DIST(t, s->hash, idx) < dist) {
+            break;
+        }
+        if(s->hash == hash &&
+           memcmp(RHT_KEY(t, s->item), key, t->key_len) == 0)
+        {
+            ret = idx;
+            break;
+        }
+        idx = (idx + 1) & t->mask;
+    }
+    if(probes) {
+        *probes = dist;
+    }
+
+    return ret;
+}
+
+// Find an item by its key
+// t - the table
+// key - ptr to the key
+// hash - the key hash (see util_rht_hash())
+// probes - if not NULL, the number of slots examined is stored there
+// Returns: the item pointer or NULL if not found
+void *util_rht_find(UTIL_RHT_t *t, const void *key, uint32_t hash,
+                    unsigned int *probes)
+{
+    int idx = rht_find_slot(t, key, hash, probes);
+    return (idx < 0) ? NULL : t->slots[idx].item;
+}
+
+// Add an item (the caller should make sure the item key is not in the table)
+// t - the table
+// item - the item pointer
+// hash - the item key hash (see util_rht_hash())
+// probes - if not NULL, the distance of the item from its home slot
+//          is stored there
+// Returns: 0 - if successful, negative if the table is full
+int util_rht_add(UTIL_RHT_t *t, void *item, uint32_t hash,
+                 unsigned int *probes)
+{
+    unsigned int idx, dist;
+    UTIL_RHT_SLOT_t cur, tmp;
+    int placed = FALSE;
+
+    if(t->count >= t->max) {
+        return -1;
+    }
+
+    cur.hash = hash;
+    cur.item = item;
+    idx = hash & t->mask;
+    for(dist = 0;; dist++)
+    {
+        UTIL_RHT_SLOT_t *s = &(t->slots[idx]);
+        unsigned int s_dist;
+
+        if(s->item == NULL) {
+            *s = cur;
+            break;
+        }
+        // Take the slot if its item is closer to home than the one we
+        // are placing, then continue placing the displaced item.
+        s_dist = RHT_DIST(t, s->hash, idx);
+        if(s_dist < dist) {
+            tmp = *s;
+            *s = cur;
+            cur = tmp;
+            if(dist > t->max_dist) {
+                t->max_dist = dist;
+            }
+            if(!placed && probes) {
+                *probes = dist;
+            }
+            placed = TRUE;
+            dist = s_dist;
+        }
+        idx = (idx + 1) & t->mask;
+    }
+    if(dist > t->max_dist) {
+        t->max_dist = dist;
+    }
+    if(!placed && probes) {
+        *probes = dist;
+    }
+    ++(t->count);
+
+    return 0;
+}
+
+// Remove an item by its key
+// t - the table
+// key - ptr to the key
+// hash - the key hash (see util_rht_hash())
+// Returns: the removed item pointer or NULL if not found
+void *util_rht_del(UTIL_RHT_t *t, const void *key, uint32_t hash)
+{
+    int ii;
+    unsigned int idx, next;
+    void *ret;
+
+    ii = rht_find_slot(t, key, hash, NULL);
+    if(ii < 0) {
+        return NULL;
+    }
+    idx = (unsigned int)ii;
+    ret = t->slots[idx].item;
+
+    // Shift back the following items until a free slot or an item
+    // in its home slot
+    next = (idx + 1) & t->mask;
+    while(t->slots[next].item != NULL &&
+          RHT_DIST(t, t->slots[next].hash, next) > 0)
+    {
+        t->slots[idx] = t->slots[next];
+        idx = next;
+        next = (next + 1) & t->mask;
+    }
+    t->slots[idx].item = NULL;
+    --(t->count);
+
+    return ret;
+}
+
+// Remove all the items
+void util_rht_clear(UTIL_RHT_t *t)
+{
+    memset(t->slots, 0, (t->mask + 1) * sizeof(UTIL_RHT_SLOT_t));
+    t->count = 0;
+    t->max_dist = 0;
+}
@@ -0,0 +1,92 @@
+// (c) 2022 minim.co
+// unum Robin Hood open addressing hash table include file
+
+#ifndef _UTIL_RHT_H
+#define _UTIL_RHT_H
+
+
+// The table does not store the items, only the pointers to them
+// (typically the items are taken from an arena, see util_arena.h).
+// The key is a fixed length sequence of bytes located at the same
+// offset in every item. The slots keep the 32 bit key hash (fingerprint)
+// next to the item pointer, so the keys are compared only when the
+// fingerprints match, and the distance of the item from its home slot
+// can be calculated without touching the item.
+// The insertions use the Robin Hood displacement (an item that is further
+// from its home slot takes the place of the one that is closer), that
+// keeps the probe sequences short and lets the lookups stop as soon as
+// they reach a slot with an item closer to its home than the key would be.
+// The deletions shift the following items back, so there are no
+// tombstones and the probe lengths do not degrade over time.
+// The table size is a power of 2 at least UTIL_RHT_LOAD_FACTOR times
+// the max number of items.
+// It is not thread safe, the users are expected to access it from the
+// thread owning the table.
+
+// Table size to max items ratio
+#define UTIL_RHT_LOAD_FACTOR 2
+
+// Hash table slot
+typedef struct _UTIL_RHT_SLOT {
+    uint32_t hash; // the item key hash
+    void *item;    // the item pointer (NULL if the slot is free)
+} UTIL_RHT_SLOT_t;
+
+// Hash table
+typedef struct _UTIL_RHT {
+    UTIL_RHT_SLOT_t *slots; // slots array (NULL if not initialized)
+    unsigned int mask;      // table size - 1
+    unsigned int max;       // max number of items
+    unsigned int count;     // number of items in the table
+    unsigned int max_dist;  // longest probe distance since last clear
+    unsigned int key_off;   // key offset in the items
+    unsigned int key_len;   // key length
+} UTIL_RHT_t;
+
+
+// Initialize the hash table
+// t - the table structure
+// max - max number of items the table should be able to hold
+// key_off - offset of the key in the items
+// key_len - length of the key
+// Returns: 0 - if successful
+int util_rht_init(UTIL_RHT_t *t, unsigned int max,
+                  unsigned int key_off, unsigned int key_len);
+
+// Free the hash table memory
+void util_rht_destroy(UTIL_RHT_t *t);
+
+// Calculate the key hash (to pass to the functions below, so it can be
+// done only once when the key lookup is followed by an add)
+#define util_rht_hash(_t, _key) util_hash((void *)(_key), (_t)->key_len)
+
+// Find an item by its key
+// t - the table
+// key - ptr to the key
+// hash - the key hash (see util_rht_hash())
+// probes - if not NULL, the number of slots examined is stored there
+// Returns: the item pointer or NULL if not found
+void *util_rht_find(UTIL_RHT_t *t, const void *key, uint32_t hash,
+                    unsigned int *probes);
+
+// Add an item (the caller should make sure the item key is not in the table)
+// t - the table
+// item - the item pointer
+// hash - the item key hash (see util_rht_hash())
+// probes - if not NULL, the distance of the item from its home slot
+//          is stored there
+// Returns: 0 - if successful, negative if the table is full
+int util_rht_add(UTIL_RHT_t *t, void *item, uint32_t hash,
+                 unsigned int *probes);
+
+// Remove an item by its key
+// t - the table
+// key - ptr to the key
+// hash - the key hash (see util_rht_hash())
+// Returns: the removed item pointer or NULL if not found
+void *util_rht_del(UTIL_RHT_t *t, const void *key, uint32_t hash);
+
+// Remove all the items
+void util_rht_clear(UTIL_RHT_t *t);
+
+#endif // _UTIL_RHT_H
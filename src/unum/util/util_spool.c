@@ -0,0 +1,843 @@
+// (c) 2022 minim.co
+// unum store-and-forward request spool
+
+#include "unum.h"
+
+
+/* Temporary, log to console from here */
+//#undef LOG_DST
+//#undef LOG_DBG_DST
+//#define LOG_DST LOG_DST_CONSOLE
+//#define LOG_DBG_DST LOG_DST_CONSOLE
+
+
+// Max length of the spool file pathnames
+#define SPOOL_PATH_LEN 128
+
+// Segment file name template (the parameter is the segment number)
+#define SPOOL_SEG_NAME "%08x.seg"
+#define SPOOL_SEG_NAME_LEN 12
+
+// Cursor file name (keeps the uploader read position) and the name of
+// the temporary file it is written to first
+#define SPOOL_CURSOR_NAME     "cursor"
+#define SPOOL_CURSOR_TMP_NAME "cursor.tmp"
+
+// Spool record header magic
+#define SPOOL_REC_MAGIC 0x55535031
+
+// Initial value for spool_csum()
+#define SPOOL_CSUM_INIT 2166136261U
+
+// Spool record header, it is followed by the URL (0-terminated) and the data
+typedef struct {
+    uint32_t csum;    // checksum of the rest of the header, URL and data
+    uint32_t magic;   // SPOOL_REC_MAGIC
+    uint32_t flags;   // UTIL_SPOOL_F_* flags
+    uint32_t url_len; // URL length (including the terminating 0)
+    uint32_t len;     // data length
+} SPOOL_REC_HDR_t;
+
+// Record URL, data and the whole record length
+#define SPOOL_REC_URL(_r)  ((char *)((_r) + 1))
+#define SPOOL_REC_DATA(_r) (SPOOL_REC_URL(_r) + (_r)->url_len)
+#define SPOOL_REC_LEN(_r)  \
+    (sizeof(SPOOL_REC_HDR_t) + (_r)->url_len + (_r)->len)
+
+// Spool state. The segments are numbered sequentially, the uploader reads
+// from the oldest one, the senders append to the newest one.
+static struct {
+    char *dir;          // spool directory (NULL if the spool is not open)
+    uint32_t rd_seg;    // oldest segment #
+    uint32_t rd_off;    // offset of the next record to upload in rd_seg
+    uint32_t wr_seg;    // newest segment #
+    uint32_t wr_off;    // size of wr_seg
+    int wr_fd;          // wr_seg file descriptor (-1 if not open)
+    unsigned long size; // total size of the segment files
+    unsigned int full_wait; // max time to wait for space (see spool_append())
+    unsigned int unsaved;   // # of acks not yet saved in the cursor file
+    unsigned long long saved_t; // time (in sec) the cursor was last saved
+} spool = { .wr_fd = -1, .full_wait = UTIL_SPOOL_FULL_WAIT };
+
+// Mutex protecting the spool state and files
+static UTIL_MUTEX_t spool_m = UTIL_MUTEX_INITIALIZER;
+
+// The event is set when a record is added (wakes up the uploader)
+static UTIL_EVENT_t spool_added = UTIL_EVENT_INITIALIZER;
+
+// The event is set when a segment is removed (wakes up the senders
+// waiting for space)
+static UTIL_EVENT_t spool_freed = UTIL_EVENT_INITIALIZER;
+
+
+// Checksum (FNV-1a) of the data. Unlike util_hash() it does not depend
+// on the per-process seed, so the records can be checked after the agent
+// restarts.
+static uint32_t spool_csum(uint32_t h, const void *ptr, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)ptr;
+
+    while(len-- > 0) {
+        h ^= *(p++);
+        h *= 16777619;
+    }
+
+    return h;
+}
+
+// Build the segment file pathname
+static char *spool_path(char *buf, size_t len, uint32_t seg)
+{
+    snprintf(buf, len, "%s/" SPOOL_SEG_NAME, spool.dir, seg);
+    return buf;
+}
+
+// Read the spool record
+// seg - the segment #
+// off - the record offset in the segment
+// hdr - where to store the record header
+// Returns: the buffer w/ the record URL and data (the caller frees it)
+//          or NULL if there is no valid record at the offset
+static char *spool_rec_read(uint32_t seg, uint32_t off, SPOOL_REC_HDR_t *hdr)
+{
+    char path[SPOOL_PATH_LEN];
+    char *buf = NULL;
+    size_t len;
+    uint32_t csum;
+    int fd;
+
+    fd = open(spool_path(path, sizeof(path), seg), O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+
+    for(;;)
+    {
+        if(pread(fd, hdr, sizeof(*hdr), off) != sizeof(*hdr) ||
+           hdr->magic != SPOOL_REC_MAGIC || hdr->url_len == 0 ||
+           hdr->url_len > UTIL_SPOOL_MAX_REC || hdr->len > UTIL_SPOOL_MAX_REC)
+        {
+            break;
+        }
+        len = hdr->url_len + hdr->len;
+        buf = UTIL_MALLOC(len);
+        if(!buf) {
+            log("%s: failed to allocate %zu bytes\n", __func__, len);
+            break;
+        }
+        csum = spool_csum(SPOOL_CSUM_INIT, &(hdr->magic),
+                          sizeof(*hdr) - sizeof(hdr->csum));
+        if(pread(fd, buf, len, off + sizeof(*hdr)) != len ||
+           spool_csum(csum, buf, len) != hdr->csum ||
+           buf[hdr->url_len - 1] != 0)
+        {
+            UTIL_FREE(buf);
+            buf = NULL;
+        }
+        break;
+    }
+
+    close(fd);
+
+    return buf;
+}
+
+// Save the uploader read position in the cursor file. The file is
+// replaced w/ the fully written (and synced) temporary one, so it is
+// either the old or the new position after a crash.
+// Call only while holding the spool mutex.
+static void spool_cursor_save(void)
+{
+    char path[SPOOL_PATH_LEN];
+    char tmp_path[SPOOL_PATH_LEN];
+    char str[32];
+    int fd, len, err = 0;
+
+    spool.unsaved = 0;
+    spool.saved_t = util_time(1);
+
+    snprintf(path, sizeof(path), "%s/" SPOOL_CURSOR_NAME, spool.dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/" SPOOL_CURSOR_TMP_NAME,
+             spool.dir);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0) {
+        log("%s: failed to create %s, %s\n",
+            __func__, tmp_path, strerror(errno));
+        return;
+    }
+    len = snprintf(str, sizeof(str), "%x %u\n", spool.rd_seg, spool.rd_off);
+    if(write(fd, str, len) != len || fsync(fd) != 0) {
+        log("%s: failed to write %s, %s\n",
+            __func__, tmp_path, strerror(errno));
+        err = -1;
+    }
+    close(fd);
+    if(err == 0 && rename(tmp_path, path) != 0) {
+        log("%s: failed to rename %s, %s\n",
+            __func__, tmp_path, strerror(errno));
+    }
+}
+
+// Save the cursor if there are acks not yet saved
+static void spool_cursor_flush(void)
+{
+    UTIL_MUTEX_TAKE(&spool_m);
+    if(spool.dir && spool.unsaved > 0) {
+        spool_cursor_save();
+    }
+    UTIL_MUTEX_GIVE(&spool_m);
+}
+
+// Remove the oldest segment (if it is the only one, the spool is emptied).
+// Call only while holding the spool mutex.
+static void spool_seg_drop(void)
+{
+    char path[SPOOL_PATH_LEN];
+    struct stat st;
+
+    spool_path(path, sizeof(path), spool.rd_seg);
+    if(spool.rd_seg == spool.wr_seg) {
+        // Start over w/ the new segment
+        if(spool.wr_fd >= 0) {
+            close(spool.wr_fd);
+            spool.wr_fd = -1;
+        }
+        ++(spool.wr_seg);
+        spool.wr_off = 0;
+        spool.size = 0;
+    } else if(stat(path, &st) == 0) {
+        spool.size -= UTIL_MIN(st.st_size, spool.size);
+    }
+    unlink(path);
+    ++(spool.rd_seg);
+    spool.rd_off = 0;
+
+    spool_cursor_save();
+    UTIL_EVENT_SETALL(&spool_freed);
+}
+
+// Get the next record to upload
+// hdr - where to store the record header
+// seg, off - where to store the record position (to pass to spool_ack())
+// Returns: the buffer w/ the record URL and data (the caller frees it)
+//          or NULL if the spool is empty
+static char *spool_next(SPOOL_REC_HDR_t *hdr, uint32_t *seg, uint32_t *off)
+{
+    char *buf = NULL;
+
+    UTIL_MUTEX_TAKE(&spool_m);
+
+    while(spool.dir &&
+          (spool.rd_seg != spool.wr_seg || spool.rd_off < spool.wr_off))
+    {
+        buf = spool_rec_read(spool.rd_seg, spool.rd_off, hdr);
+        if(buf) {
+            *seg = spool.rd_seg;
+            *off = spool.rd_off;
+            break;
+        }
+        // End of the segment (or the rest of it is not readable)
+        if(spool.rd_seg == spool.wr_seg) {
+            log("%s: bad record at %08x:%u, dropping the segment\n",
+                __func__, spool.rd_seg, spool.rd_off);
+        }
+        spool_seg_drop();
+    }
+
+    UTIL_MUTEX_GIVE(&spool_m);
+
+    return buf;
+}
+
+// Mark the record returned by spool_next() as uploaded (unless its
+// segment has been dropped while it was being sent). The cursor is saved
+// once per UTIL_SPOOL_CURSOR_ACKS acks or UTIL_SPOOL_CURSOR_TIME seconds
+// (and when a segment is dropped), so after a crash up to that many
+// records might be uploaded again.
+static void spool_ack(uint32_t seg, uint32_t off, SPOOL_REC_HDR_t *hdr)
+{
+    UTIL_MUTEX_TAKE(&spool_m);
+
+    if(spool.dir && seg == spool.rd_seg && off == spool.rd_off)
+    {
+        spool.rd_off += SPOOL_REC_LEN(hdr);
+        if(spool.rd_seg == spool.wr_seg && spool.rd_off >= spool.wr_off) {
+            // Everything is sent, remove the segment
+            spool_seg_drop();
+        } else if(++(spool.unsaved) >= UTIL_SPOOL_CURSOR_ACKS ||
+                  util_time(1) - spool.saved_t >= UTIL_SPOOL_CURSOR_TIME)
+        {
+            spool_cursor_save();
+        }
+    }
+
+    UTIL_MUTEX_GIVE(&spool_m);
+}
+
+// Append the record to the spool. If the spool is full, wait for the
+// uploader to free up space, drop the oldest segments if that does not
+// happen in spool.full_wait seconds.
+// rec - the record (header, URL and data)
+// len - the record length
+// Returns: 0 - if successful, negative if fails
+static int spool_append(void *rec, uint32_t len)
+{
+    char path[SPOOL_PATH_LEN];
+    unsigned long long now, until = util_time(1) + spool.full_wait;
+    ssize_t wlen;
+    int ret = 0;
+
+    UTIL_MUTEX_TAKE(&spool_m);
+
+    for(;;)
+    {
+        if(!spool.dir) {
+            ret = -1;
+            break;
+        }
+        if(spool.size + len <= UTIL_SPOOL_MAX_SIZE) {
+            break;
+        }
+        now = util_time(1);
+        if(now >= until) {
+            log("%s: the spool is full, dropping segment %08x\n",
+                __func__, spool.rd_seg);
+            spool_seg_drop();
+            continue;
+        }
+        // Hold back the sender till the uploader frees up space
+        UTIL_EVENT_RESET(&spool_freed);
+        UTIL_MUTEX_GIVE(&spool_m);
+        UTIL_EVENT_TIMEDWAIT(&spool_freed, (until - now) * 1000);
+        UTIL_MUTEX_TAKE(&spool_m);
+    }
+
+    // Start the next segment if the record does not fit the current one
+    if(ret == 0 && spool.wr_off > 0 &&
+       spool.wr_off + len > UTIL_SPOOL_SEG_SIZE)
+    {
+        if(spool.wr_fd >= 0) {
+            close(spool.wr_fd);
+            spool.wr_fd = -1;
+        }
+        ++(spool.wr_seg);
+        spool.wr_off = 0;
+    }
+    if(ret == 0 && spool.wr_fd < 0) {
+        spool.wr_fd = open(spool_path(path, sizeof(path), spool.wr_seg),
+                           O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if(spool.wr_fd < 0) {
+            log("%s: failed to open %s, %s\n",
+                __func__, path, strerror(errno));
+            ret = -2;
+        }
+    }
+    if(ret == 0) {
+        wlen = write(spool.wr_fd, rec, len);
+        if(wlen != len) {
+            log("%s: failed to write %u bytes to segment %08x, %s\n",
+                __func__, len, spool.wr_seg,
+                (wlen < 0) ? strerror(errno) : "short write");
+            // Cut off the partial record
+            if(wlen > 0 && ftruncate(spool.wr_fd, spool.wr_off) != 0) {
+                log("%s: failed to truncate segment %08x, %s\n",
+                    __func__, spool.wr_seg, strerror(errno));
+            }
+            ret = -3;
+        } else {
+            spool.wr_off += len;
+            spool.size += len;
+        }
+    }
+
+    UTIL_MUTEX_GIVE(&spool_m);
+
+    if(ret == 0) {
+        UTIL_EVENT_SETALL(&spool_added);
+    }
+
+    return ret;
+}
+
+// Allocate the spool record for the URL and the data of the given length.
+// The caller has to copy the data to SPOOL_REC_DATA(rec) and pass the
+// record to spool_rec_add().
+// Returns: the record pointer or NULL if fails
+static SPOOL_REC_HDR_t *spool_rec_alloc(char *url, uint32_t flags,
+                                        unsigned long len)
+{
+    SPOOL_REC_HDR_t *rec;
+    uint32_t url_len = strlen(url) + 1;
+    unsigned long rec_len = sizeof(SPOOL_REC_HDR_t) + url_len + len;
+
+    if(!spool.dir) {
+        return NULL;
+    }
+    if(rec_len > UTIL_SPOOL_MAX_REC) {
+        log("%s: %lu bytes request to <%s> is too large to spool\n",
+            __func__, rec_len, url);
+        return NULL;
+    }
+    rec = UTIL_MALLOC(rec_len);
+    if(!rec) {
+        log("%s: failed to allocate %lu bytes\n", __func__, rec_len);
+        return NULL;
+    }
+    rec->magic = SPOOL_REC_MAGIC;
+    rec->flags = flags;
+    rec->url_len = url_len;
+    rec->len = len;
+    memcpy(SPOOL_REC_URL(rec), url, url_len);
+
+    return rec;
+}
+
+// Checksum the record (allocated by spool_rec_alloc()), append it
+// to the spool and free it.
+// Returns: 0 - if successful, negative if fails
+static int spool_rec_add(SPOOL_REC_HDR_t *rec)
+{
+    int ret;
+
+    rec->csum = spool_csum(SPOOL_CSUM_INIT, &(rec->magic),
+                           SPOOL_REC_LEN(rec) - sizeof(rec->csum));
+    ret = spool_append(rec, SPOOL_REC_LEN(rec));
+    UTIL_FREE(rec);
+
+    return ret;
+}
+
+#ifdef FEATURE_GZIP_REQUESTS
+// Add the telemetry JSON POST request w/ the gzip compressed data (see
+// util_zlib.h) to the spool. The compressor must be finished, it is not
+// freed by the function.
+// Returns: 0 - if successful, negative if fails
+int util_spool_add_gz(char *url, UTIL_GZ_t *gz)
+{
+    SPOOL_REC_HDR_t *rec;
+
+    rec = spool_rec_alloc(url, UTIL_SPOOL_F_GZ, gz->len);
+    if(!rec) {
+        return -1;
+    }
+    if(util_gz_seek(gz, 0) != 0 ||
+       util_gz_read(gz, SPOOL_REC_DATA(rec), rec->len) != rec->len)
+    {
+        log("%s: failed to read the compressed data\n", __func__);
+        UTIL_FREE(rec);
+        return -2;
+    }
+
+    return spool_rec_add(rec);
+}
+#endif // FEATURE_GZIP_REQUESTS
+
+// Add the telemetry JSON POST request to the spool. The data is stored
+// compressed if the request compression is enabled and the data size
+// exceeds the threshold.
+// url - the URL to POST the data to
+// data - the request data
+// len - the data length
+// Returns: 0 - if successful, negative if fails
+int util_spool_add(char *url, char *data, int len)
+{
+    SPOOL_REC_HDR_t *rec;
+
+#ifdef FEATURE_GZIP_REQUESTS
+    // Compress the data the same way http_post() would
+    if(unum_config.gzip_requests && len > unum_config.gzip_requests)
+    {
+        UTIL_GZ_t *gz = util_gz_start();
+        int ret;
+
+        if(gz != NULL &&
+           util_gz_write(data, len, gz) == 0 && util_gz_finish(gz) == 0)
+        {
+            ret = util_spool_add_gz(url, gz);
+            util_gz_free(gz);
+            return ret;
+        }
+        if(gz != NULL) {
+            util_gz_free(gz);
+        }
+        // The compression has failed, spool the data uncompressed
+    }
+#endif // FEATURE_GZIP_REQUESTS
+
+    rec = spool_rec_alloc(url, 0, len);
+    if(!rec) {
+        return -1;
+    }
+    memcpy(SPOOL_REC_DATA(rec), data, len);
+
+    return spool_rec_add(rec);
+}
+
+// Returns TRUE if there are requests waiting in the spool (the senders
+// should add their requests to the spool rather than send them then,
+// see http_post_spool())
+int util_spool_pending(void)
+{
+    int ret;
+
+    UTIL_MUTEX_TAKE(&spool_m);
+    ret = (spool.dir != NULL &&
+           (spool.rd_seg != spool.wr_seg || spool.rd_off < spool.wr_off));
+    UTIL_MUTEX_GIVE(&spool_m);
+
+    return ret;
+}
+
+// Spool uploader thread, sends the spooled requests in batches oldest
+// first, backs off if the server is not reachable.
+static void spool_uploader(THRD_PARAM_t *p)
+{
+    unsigned int delay = 0; // retry delay (in seconds), 0 if not failing
+    SPOOL_REC_HDR_t hdr;
+    uint32_t seg, off;
+    http_rsp *rsp;
+    char *buf;
+    int count, code;
+
+    log("%s: started\n", __func__);
+
+    log("%s: waiting for activate to complete\n", __func__);
+    wait_for_activate();
+    log("%s: done waiting for activate\n", __func__);
+
+    for(;;)
+    {
+        // Save the position of the records sent so far before waiting
+        spool_cursor_flush();
+        if(delay > 0) {
+            sleep(delay);
+        } else {
+            UTIL_EVENT_WAIT(&spool_added);
+        }
+        UTIL_EVENT_RESET(&spool_added);
+
+        code = 200;
+        for(count = 0; count < UTIL_SPOOL_BATCH; count++)
+        {
+            buf = spool_next(&hdr, &seg, &off);
+            if(!buf) {
+                break;
+            }
+            rsp = http_post_no_retry(buf,
+                                     ((hdr.flags & UTIL_SPOOL_F_GZ) != 0) ?
+                                     HTTP_JSON_HEADERS
+                                     "Content-Encoding: gzip\0" :
+                                     HTTP_JSON_HEADERS,
+                                     buf + hdr.url_len, hdr.len);
+            code = rsp ? rsp->code : 0;
+            if(rsp) {
+                free_rsp(rsp);
+                rsp = NULL;
+            }
+            if((code / 100) != 2 && UTIL_SPOOL_RETRY_CODE(code)) {
+                UTIL_FREE(buf);
+                break;
+            }
+            if((code / 100) != 2) {
+                log("%s: <%s> rejected, code %d, dropping\n",
+                    __func__, buf, code);
+            }
+            spool_ack(seg, off, &hdr);
+            UTIL_FREE(buf);
+        }
+
+        if((code / 100) != 2 && UTIL_SPOOL_RETRY_CODE(code)) {
+            delay = (delay == 0) ? UTIL_SPOOL_RETRY_MIN :
+                                   UTIL_MIN(delay * 2, UTIL_SPOOL_RETRY_MAX);
+            log("%s: upload failed, code %d, retry in %u sec\n",
+                __func__, code, delay);
+            continue;
+        }
+        if(delay > 0) {
+            log("%s: upload resumed\n", __func__);
+            delay = 0;
+        }
+        if(count >= UTIL_SPOOL_BATCH) {
+            // Pause and continue w/ the next batch
+            util_msleep(UTIL_SPOOL_BATCH_PAUSE);
+            UTIL_EVENT_SETALL(&spool_added);
+        }
+    }
+
+    // Never reaches here
+    log("%s: done\n", __func__);
+}
+
+// Open the spool in the directory and recover its state from the files
+// Returns: 0 - if successful, negative if fails
+static int spool_open(char *dir)
+{
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    SPOOL_REC_HDR_t hdr;
+    char path[SPOOL_PATH_LEN];
+    unsigned long size = 0;
+    uint32_t seg, off, min = 0, max = 0;
+    int found = FALSE;
+    char *buf;
+    FILE *f;
+
+    if(mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        log("%s: failed to create %s, %s\n", __func__, dir, strerror(errno));
+        return -1;
+    }
+    d = opendir(dir);
+    if(!d) {
+        log("%s: failed to open %s, %s\n", __func__, dir, strerror(errno));
+        return -2;
+    }
+    while((de = readdir(d)) != NULL)
+    {
+        if(strlen(de->d_name) != SPOOL_SEG_NAME_LEN ||
+           strcmp(de->d_name + 8, ".seg") != 0 ||
+           sscanf(de->d_name, "%8x", &seg) != 1)
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if(stat(path, &st) != 0) {
+            continue;
+        }
+        size += st.st_size;
+        if(!found || seg < min) {
+            min = seg;
+        }
+        if(!found || seg > max) {
+            max = seg;
+        }
+        found = TRUE;
+    }
+    closedir(d);
+
+    UTIL_MUTEX_TAKE(&spool_m);
+
+    spool.dir = dir;
+    spool.size = size;
+    spool.rd_seg = spool.wr_seg = min;
+    spool.rd_off = spool.wr_off = 0;
+    spool.wr_fd = -1;
+    spool.unsaved = 0;
+    spool.saved_t = util_time(1);
+    for(;found;)
+    {
+        spool.wr_seg = max;
+        // Continue from the saved read position (if it is still valid)
+        snprintf(path, sizeof(path), "%s/" SPOOL_CURSOR_NAME, dir);
+        if((f = fopen(path, "r")) != NULL) {
+            if(fscanf(f, "%x %u", &seg, &off) == 2 &&
+               seg >= min && seg <= max)
+            {
+                spool.rd_seg = seg;
+                spool.rd_off = off;
+            }
+            fclose(f);
+        }
+        // Find the end of the last valid record in the newest segment and
+        // cut off whatever follows it (a record torn by a crash)
+        off = 0;
+        while((buf = spool_rec_read(max, off, &hdr)) != NULL) {
+            off += SPOOL_REC_LEN(&hdr);
+            UTIL_FREE(buf);
+        }
+        spool_path(path, sizeof(path), max);
+        if(stat(path, &st) == 0 && st.st_size > off) {
+            log("%s: discarding %lu bytes of bad records in %s\n",
+                __func__, (unsigned long)(st.st_size - off), path);
+            if(truncate(path, off) == 0) {
+                spool.size -= UTIL_MIN(st.st_size - off, spool.size);
+            }
+        }
+        spool.wr_off = off;
+        if(spool.rd_seg == spool.wr_seg && spool.rd_off >= spool.wr_off) {
+            // Everything has already been sent
+            spool.rd_off = spool.wr_off;
+            spool_seg_drop();
+        }
+        break;
+    }
+
+    UTIL_MUTEX_GIVE(&spool_m);
+
+    log("%s: %s, segments %08x-%08x, %lu bytes\n", __func__,
+        dir, spool.rd_seg, spool.wr_seg, spool.size);
+
+    return 0;
+}
+
+// Open the spool and start the uploader thread
+// Returns: 0 - if successful (failing to set up the spool directory
+//          is not an error, the senders just do not spool then)
+int util_spool_init(void)
+{
+    if(spool_open(UTIL_SPOOL_DIR) != 0) {
+        log("%s: failed to open the spool, not spooling\n", __func__);
+        return 0;
+    }
+
+    return util_start_thrd("spool", spool_uploader, NULL, NULL);
+}
+
+#ifdef DEBUG
+// Spool test directory
+#define SPOOL_TEST_DIR "/tmp/unum_spool_test"
+
+// Close the spool (for the test)
+static void spool_close(void)
+{
+    UTIL_MUTEX_TAKE(&spool_m);
+    if(spool.dir && spool.unsaved > 0) {
+        spool_cursor_save();
+    }
+    if(spool.wr_fd >= 0) {
+        close(spool.wr_fd);
+        spool.wr_fd = -1;
+    }
+    spool.dir = NULL;
+    UTIL_MUTEX_GIVE(&spool_m);
+}
+
+// Read the next record from the spool and check its URL and data,
+// acknowledge it if requested
+// Returns: 0 - if matches, negative if not
+static int test_spool_check(char *url, char *data, int ack)
+{
+    SPOOL_REC_HDR_t hdr;
+    uint32_t seg, off;
+    char *buf = spool_next(&hdr, &seg, &off);
+    int ret = 0;
+
+    if(!buf) {
+        printf("Expected <%s>, but the spool is empty\n", url);
+        return -1;
+    }
+    if(strcmp(buf, url) != 0) {
+        printf("Expected <%s>, got <%s>\n", url, buf);
+        ret = -2;
+    } else if((hdr.flags & UTIL_SPOOL_F_GZ) == 0 &&
+              (hdr.len != strlen(data) ||
+               memcmp(buf + hdr.url_len, data, hdr.len) != 0))
+    {
+        printf("Data mismatch for <%s>\n", url);
+        ret = -3;
+    }
+    if(ack) {
+        spool_ack(seg, off, &hdr);
+    }
+    UTIL_FREE(buf);
+
+    return ret;
+}
+
+// Test the spool records storage, recovery and the size cap
+int test_spool(void)
+{
+    char path[SPOOL_PATH_LEN];
+    char url[64];
+    char data[64];
+    char *big;
+    int ii, fd, big_len, count, failed = 0;
+
+    util_system("rm -rf " SPOOL_TEST_DIR, 10, NULL);
+    if(spool_open(SPOOL_TEST_DIR) != 0) {
+        printf("Failed to open the spool in %s\n", SPOOL_TEST_DIR);
+        return -1;
+    }
+
+    printf("Adding 3 records, uploading the first one\n");
+    for(ii = 0; ii < 3; ii++) {
+        snprintf(url, sizeof(url), "http://test/%d", ii);
+        snprintf(data, sizeof(data), "{\"record\":%d}", ii);
+        if(util_spool_add(url, data, strlen(data)) != 0) {
+            printf("Failed to add <%s>\n", url);
+            ++failed;
+        }
+    }
+    if(!util_spool_pending()) {
+        printf("The spool is empty after adding records\n");
+        ++failed;
+    }
+    failed += (test_spool_check("http://test/0", "{\"record\":0}", TRUE) != 0);
+
+    printf("Reopening w/ a torn record at the end\n");
+    spool_close();
+    spool.dir = SPOOL_TEST_DIR;
+    spool_path(path, sizeof(path), spool.wr_seg);
+    fd = open(path, O_WRONLY | O_APPEND);
+    if(fd < 0 || write(fd, "\x01\x02\x03\x04\x31\x50\x53\x55", 8) != 8) {
+        printf("Failed to append to %s\n", path);
+        ++failed;
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+    spool.dir = NULL;
+    spool_open(SPOOL_TEST_DIR);
+    failed += (test_spool_check("http://test/1", "{\"record\":1}", TRUE) != 0);
+    failed += (test_spool_check("http://test/2", "{\"record\":2}", TRUE) != 0);
+    if(util_spool_pending()) {
+        printf("The spool is not empty after uploading everything\n");
+        ++failed;
+    }
+
+    printf("Adding records over the size cap\n");
+    spool.full_wait = 0;
+    big_len = UTIL_SPOOL_MAX_REC / 2;
+    big = UTIL_MALLOC(big_len);
+    if(!big) {
+        printf("Failed to allocate %d bytes\n", big_len);
+        spool_close();
+        return -1;
+    }
+    for(ii = 0; ii < big_len; ii++) {
+        big[ii] = rand();
+    }
+    count = 2 * UTIL_SPOOL_MAX_SIZE / big_len;
+    for(ii = 0; ii < count; ii++) {
+        snprintf(url, sizeof(url), "http://test/big/%d", ii);
+        if(util_spool_add(url, big, big_len) != 0) {
+            printf("Failed to add <%s>\n", url);
+            ++failed;
+        }
+        if(spool.size > UTIL_SPOOL_MAX_SIZE) {
+            printf("The spool size %lu is over the cap\n", spool.size);
+            ++failed;
+        }
+    }
+    UTIL_FREE(big);
+    // The oldest records have to be gone, the newest one still there
+    url[0] = 0;
+    for(ii = 0; util_spool_pending(); ii++) {
+        SPOOL_REC_HDR_t hdr;
+        uint32_t seg, off;
+        char *buf = spool_next(&hdr, &seg, &off);
+        if(!buf) {
+            break;
+        }
+        strncpy(url, buf, sizeof(url) - 1);
+        url[sizeof(url) - 1] = 0;
+        spool_ack(seg, off, &hdr);
+        UTIL_FREE(buf);
+    }
+    printf("Uploaded %d of %d records, the last one <%s>\n", ii, count, url);
+    // ii < count means the oldest ones were dropped
+    snprintf(data, sizeof(data), "http://test/big/%d", count - 1);
+    if(ii <= 0 || ii >= count || strcmp(url, data) != 0) {
+        printf("The newest records are not in the spool\n");
+        ++failed;
+    }
+
+    spool.full_wait = UTIL_SPOOL_FULL_WAIT;
+    spool_close();
+    util_system("rm -rf " SPOOL_TEST_DIR, 10, NULL);
+
+    printf("%s\n", (failed == 0) ? "PASSED" : "FAILED");
+
+    return (failed == 0) ? 0 : -1;
+}
+#endif // DEBUG
@@ -0,0 +1,102 @@
+// (c) 2022 minim.co
+// unum store-and-forward request spool include file
+
+#ifndef _UTIL_SPOOL_H
+#define _UTIL_SPOOL_H
+
+
+// The spool keeps the telemetry POST requests the senders failed to
+// deliver (the server is slow or unreachable) in append-only segment
+// files and a single uploader thread drains them to the server oldest
+// first once it is reachable again. While the spool is not empty the
+// senders add their new requests to it too (instead of competing w/ the
+// uploader), so the server gets the data in order. Each record is
+// checksummed, a record torn by a crash (and the rest of its segment)
+// is discarded when the spool is reopened. The uploader keeps its read
+// position in a cursor file, so the records already sent are not resent
+// after the agent restarts. The requests are sent w/ the JSON content
+// type headers.
+// The spool size is capped, if it is full the sender adding a request
+// is held back till the uploader frees up space. If that does not happen
+// within UTIL_SPOOL_FULL_WAIT the oldest segment is dropped.
+
+// Spool directory (platforms can override it in platform.h). By default
+// it is in tmpfs (survives the agent restarts, but not the reboots),
+// pointing it to flash makes the spool survive reboots too.
+#ifndef UTIL_SPOOL_DIR
+#  define UTIL_SPOOL_DIR "/tmp/unum_spool"
+#endif // UTIL_SPOOL_DIR
+
+// Max total size of the spool segment files (platforms can override)
+#ifndef UTIL_SPOOL_MAX_SIZE
+#  define UTIL_SPOOL_MAX_SIZE (1024 * 1024)
+#endif // UTIL_SPOOL_MAX_SIZE
+
+// Segment file size, the next record starts a new segment once exceeded
+#define UTIL_SPOOL_SEG_SIZE (UTIL_SPOOL_MAX_SIZE / 8)
+
+// Max size of a single spool record (the larger requests are not spooled)
+#define UTIL_SPOOL_MAX_REC (UTIL_SPOOL_MAX_SIZE / 4)
+
+// Max time (in seconds) the sender adding to the full spool waits for
+// the uploader to free up space before the oldest segment is dropped
+#define UTIL_SPOOL_FULL_WAIT 15
+
+// Uploader retry delay (in seconds), doubled after each failed attempt
+// starting from the min till it reaches the max
+#define UTIL_SPOOL_RETRY_MIN 15
+#define UTIL_SPOOL_RETRY_MAX 240
+
+// Max number of the requests the uploader sends back-to-back (on the same
+// pooled connection) and the pause (in milliseconds) before the next batch
+#define UTIL_SPOOL_BATCH 16
+#define UTIL_SPOOL_BATCH_PAUSE 1000
+
+// The uploader read position is saved after this many acknowledged
+// records or this many seconds since the last save (whichever comes
+// first) and whenever the uploader goes idle
+#define UTIL_SPOOL_CURSOR_ACKS UTIL_SPOOL_BATCH
+#define UTIL_SPOOL_CURSOR_TIME 10
+
+// Spool record flags
+#define UTIL_SPOOL_F_GZ 0x0001 // the data is gzip compressed
+
+// The response codes the request is worth retrying for (0 - no response).
+// The other errors mean the server has rejected the data.
+#define UTIL_SPOOL_RETRY_CODE(_c) ((_c) == 0 || (_c) == 408 || \
+                                   (_c) == 429 || ((_c) / 100) == 5)
+
+
+// Add the telemetry JSON POST request to the spool. The data is stored
+// compressed if the request compression is enabled and the data size
+// exceeds the threshold.
+// url - the URL to POST the data to
+// data - the request data
+// len - the data length
+// Returns: 0 - if successful, negative if fails
+int util_spool_add(char *url, char *data, int len);
+
+#ifdef FEATURE_GZIP_REQUESTS
+// Add the telemetry JSON POST request w/ the gzip compressed data (see
+// util_zlib.h) to the spool. The compressor must be finished, it is not
+// freed by the function.
+// Returns: 0 - if successful, negative if fails
+int util_spool_add_gz(char *url, UTIL_GZ_t *gz);
+#endif // FEATURE_GZIP_REQUESTS
+
+// Returns TRUE if there are requests waiting in the spool (the senders
+// should add their requests to the spool rather than send them then,
+// see http_post_spool())
+int util_spool_pending(void);
+
+// Open the spool and start the uploader thread
+// Returns: 0 - if successful (failing to set up the spool directory
+//          is not an error, the senders just do not spool then)
+int util_spool_init(void);
+
+#ifdef DEBUG
+// Test the spool records storage, recovery and the size cap
+int test_spool(void);
+#endif // DEBUG
+
+#endif // _UTIL_SPOOL_H
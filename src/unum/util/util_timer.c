@@ -11,36 +11,94 @@
 //#define LOG_DBG_DST LOG_DST_CONSOLE
 
 
-// Timers queue list head
-static UTIL_QI_t head = { &head, &head };
-
 // Timers array
 static TIMER_CFG_t timer_a[UTIL_MAX_TIMERS];
 
-// Mutex for protecting timers array, counter and linked list
+// Min-heap of the active timers (indices in timer_a[], the earliest
+// to fire at [0]) and the number of the timers in it
+static int timer_heap[UTIL_MAX_TIMERS];
+static int heap_len = 0;
+
+// Stack of the free timer_a[] cells and the number of them (-1 until
+// initialized)
+static int timer_free[UTIL_MAX_TIMERS];
+static int free_len = -1;
+
+// Timers stats
+static TIMER_STATS_t timer_st;
+
+// Mutex for protecting timers array, heap, free cells stack and stats
 static UTIL_MUTEX_t timer_m = UTIL_MUTEX_INITIALIZER;
 
-// Event triggering rescan of the timers after changes
-static UTIL_EVENT_t timer_c = UTIL_EVENT_INITIALIZER;
 
+// Put the timer to the heap position pos
+static __inline__ void heap_set(int pos, int idx)
+{
+    timer_heap[pos] = idx;
+    timer_a[idx].hpos = pos;
+}
 
-// Sets a timer to fire after specified number of milliseconds.
-// The timer is automaticaly cancelled before the handler is called.
-// If you want it to continue firing make the handler re-set it at the end.
-// If the handler function is slow/might block use thread == TRUE.
-// Do not do it 'just to be safe' as the # of threads we can run
-// simultaneously is limited.
-// msec - milliseconds till the timer should fire
-// name - pointer to a constant string naming the timer
-// f - function to call when the timer fires
-// p - pointer to parameters structure to store and pass to the timer
-//     function (by a pointer) when it is called (can be NULL)
-// thread - TRUE if it has to run in its own thread
-// Returns: timer handle if OK or 0 if fails
-TIMER_HANDLE_t util_timer_set(unsigned int msecs, const char *name,
-                              TIMER_FUNC_t f, THRD_PARAM_t *p, int thread)
+// Move the timer at the heap position pos up or down the heap
+// to restore the heap order.
+static void heap_fix(int pos)
+{
+    int idx = timer_heap[pos];
+    unsigned long long msecs = timer_a[idx].msecs;
+    int child;
+
+    while(pos > 0 && msecs < timer_a[timer_heap[(pos - 1) / 2]].msecs) {
+        heap_set(pos, timer_heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    for(;;) {
+        child = pos * 2 + 1;
+        if(child >= heap_len) {
+            break;
+        }
+        if(child + 1 < heap_len &&
+           timer_a[timer_heap[child + 1]].msecs <
+           timer_a[timer_heap[child]].msecs)
+        {
+            ++child;
+        }
+        if(timer_a[timer_heap[child]].msecs >= msecs) {
+            break;
+        }
+        heap_set(pos, timer_heap[child]);
+        pos = child;
+    }
+    heap_set(pos, idx);
+}
+
+// Add timer to the heap
+static void heap_add(int idx)
+{
+    heap_set(heap_len++, idx);
+    heap_fix(heap_len - 1);
+    if(heap_len > timer_st.depth_max) {
+        timer_st.depth_max = heap_len;
+    }
+}
+
+// Remove timer from the heap
+static void heap_del(int idx)
+{
+    int pos = timer_a[idx].hpos;
+
+    if(--heap_len > pos) {
+        heap_set(pos, timer_heap[heap_len]);
+        heap_fix(pos);
+    }
+    timer_a[idx].hpos = -1;
+}
+
+// Set up a timer (see util_timer_set_periodic())
+static TIMER_HANDLE_t timer_set(unsigned int msecs, unsigned int period,
+                                const char *name, TIMER_FUNC_t f,
+                                THRD_PARAM_t *p, int thread)
 {
     TIMER_HANDLE_t th = 0;
+    int idx, ii;
 
     if(!f || !name) {
         log("%s: invalid parameters\n", __func__);
@@ -50,25 +108,25 @@ TIMER_HANDLE_t util_timer_set(unsigned int msecs, const char *name,
     UTIL_MUTEX_TAKE(&timer_m);
     for(;;)
     {
-        // Pick a cell (start at random spot)
-        int idx, ii;
-        idx = rand() % UTIL_MAX_TIMERS;    //SW-2108 Verified rand is used safely
-        for(ii = 0; ii < UTIL_MAX_TIMERS; ii++) {
-            if(!timer_a[idx].f) {
-                break;
+        // All cells are free initially
+        if(free_len < 0) {
+            for(ii = 0; ii < UTIL_MAX_TIMERS; ii++) {
+                timer_free[ii] = UTIL_MAX_TIMERS - 1 - ii;
             }
-            ++idx;
-            idx %= UTIL_MAX_TIMERS;
+            free_len = UTIL_MAX_TIMERS;
         }
-        if(timer_a[idx].f) {
+        // Pick a free cell
+        if(free_len == 0) {
             log("%s: error, no free cell for timer <%s>\n",
                 __func__, name);
             break;
         }
+        idx = timer_free[--free_len];
 
         // Set up the timer structure
         timer_a[idx].f = f;
         timer_a[idx].msecs = util_time(1000) + msecs;
+        timer_a[idx].period = period;
         if(p) {
             memcpy(&timer_a[idx].param, p, sizeof(TIMER_PARAM_t));
         } else {
@@ -83,11 +141,12 @@ TIMER_HANDLE_t util_timer_set(unsigned int msecs, const char *name,
         // Make the timer handle
         th = (idx << 16) | timer_a[idx].id;
 
-        // Add the item to the end of the linked list
-        UTIL_Q_ADD(&head, &(timer_a[idx]));
-
-        // Notify the timer thread that the list has changed
-        UTIL_EVENT_SETALL(&timer_c);
+        // Add the timer to the heap, notify the reactor only if
+        // it is the new earliest one
+        heap_add(idx);
+        if(timer_a[idx].hpos == 0) {
+            util_reactor_wake();
+        }
         break;
     }
     UTIL_MUTEX_GIVE(&timer_m);
@@ -95,6 +154,43 @@ TIMER_HANDLE_t util_timer_set(unsigned int msecs, const char *name,
     return th;
 }
 
+// Sets a timer to fire after specified number of milliseconds.
+// The timer is automaticaly cancelled before the handler is called.
+// If you want it to continue firing use util_timer_set_periodic().
+// If the handler function is slow/might block use thread == TRUE.
+// Do not do it 'just to be safe' as the # of threads we can run
+// simultaneously is limited.
+// msec - milliseconds till the timer should fire
+// name - pointer to a constant string naming the timer
+// f - function to call when the timer fires
+// p - pointer to parameters structure to store and pass to the timer
+//     function (by a pointer) when it is called (can be NULL)
+// thread - TRUE if it has to run in its own thread
+// Returns: timer handle if OK or 0 if fails
+TIMER_HANDLE_t util_timer_set(unsigned int msecs, const char *name,
+                              TIMER_FUNC_t f, THRD_PARAM_t *p, int thread)
+{
+    return timer_set(msecs, 0, name, f, p, thread);
+}
+
+// Sets a periodic timer. The handler is called every period msec after
+// the first call in msec, the timer stays active (the handle valid)
+// until it is cancelled. If the handler falls behind by more than
+// the period the missed calls are skipped (not bunched together).
+// See util_timer_set() for the rest of the parameters.
+// Returns: timer handle if OK or 0 if fails
+TIMER_HANDLE_t util_timer_set_periodic(unsigned int msecs,
+                                       unsigned int period,
+                                       const char *name, TIMER_FUNC_t f,
+                                       THRD_PARAM_t *p, int thread)
+{
+    if(period == 0) {
+        log("%s: invalid period for timer <%s>\n", __func__, name);
+        return 0;
+    }
+    return timer_set(msecs, period, name, f, p, thread);
+}
+
 // Cancels not yet fired timer
 // Note: always check for the return value as you might try to
 //       cancel a just fired timer and fail
@@ -127,12 +223,12 @@ int util_timer_cancel(TIMER_HANDLE_t th)
             break;
         }
 
-        // Remove the timer from the linked list and mark the entry free
-        UTIL_Q_DEL_ITEM(&(timer_a[idx]));
+        // Remove the timer from the heap and mark the entry free
+        // (no need to wake up the reactor, it will find nothing
+        // to do if it was waiting for this timer)
+        heap_del(idx);
         timer_a[idx].f = NULL;
-
-        // Notify the timer thread that the list has changed
-        UTIL_EVENT_SETALL(&timer_c);
+        timer_free[free_len++] = idx;
 
         ret = 0;
         break;
@@ -142,78 +238,135 @@ int util_timer_cancel(TIMER_HANDLE_t th)
     return ret;
 }
 
-// Timers thread function, all timer functions run in its context
-// unless set up with the option to run them in their own thread
-static void timers(THRD_PARAM_t *p)
+// Get the timers stats
+// st - where to store the stats
+// reset - TRUE to reset the counters (the depth is not reset)
+void util_timer_get_stats(TIMER_STATS_t *st, int reset)
+{
+    UTIL_MUTEX_TAKE(&timer_m);
+    timer_st.depth = heap_len;
+    memcpy(st, &timer_st, sizeof(TIMER_STATS_t));
+    if(reset) {
+        memset(&timer_st, 0, sizeof(TIMER_STATS_t));
+        timer_st.depth_max = heap_len;
+    }
+    UTIL_MUTEX_GIVE(&timer_m);
+}
+
+// Run the expired timers, called by the reactor thread (all the timer
+// functions run in its context unless set up with the option to run
+// them in their own thread, the reactor thread watchdog makes sure the
+// handlers do not hang it, see UTIL_REACTOR_EXE_TIMEOUT).
+// Returns: msec till the next timer is due (0 if the handlers have run),
+//          negative if none is active
+long util_timers_run(void)
 {
-    unsigned long delay;
+    long delay = -1;
+    unsigned long late;
     unsigned long long cur_t;
-    TIMER_CFG_t *ii_item, *run_item;
-    TIMER_CFG_t item;
+    TIMER_CFG_t *t;
+    // Copies of the timers to run on this wakeup
+    static TIMER_CFG_t run_a[UTIL_MAX_TIMERS];
+    int ii, run_len;
 
-    log("%s: started\n", __func__);
+    run_len = 0;
+    cur_t = util_time(1000);
 
-    for(;;)
-    {
-        delay = 0;
-        cur_t = util_time(1000);
-
-        UTIL_MUTEX_TAKE(&timer_m);
-        // Walk through the timer queue and pick item we need to run or
-        // if nothing found the delay to the first upcoming run.
-        run_item = NULL;
-        UTIL_Q_FOREACH(&head, ii_item) {
-            // Is it time to run the handler?
-            if(ii_item->msecs <= cur_t) {
-                run_item = ii_item;
-                break;
-            }
-            unsigned long remains = ii_item->msecs - cur_t;
-            if(delay == 0 || remains < delay) {
-                delay = remains;
-            }
+    UTIL_MUTEX_TAKE(&timer_m);
+    // Take all the expired timers from the top of the heap, re-arm
+    // the periodic ones and free the rest.
+    while(heap_len > 0) {
+        t = &(timer_a[timer_heap[0]]);
+        if(t->msecs > cur_t) {
+            delay = t->msecs - cur_t;
+            break;
+        }
+        memcpy(&(run_a[run_len++]), t, sizeof(TIMER_CFG_t));
+        late = cur_t - t->msecs;
+        ++(timer_st.fired);
+        timer_st.late_total += late;
+        if(late > timer_st.late_max) {
+            timer_st.late_max = late;
         }
-        // If run item is found make a copy then remove and mark free
-        if(run_item) {
-            UTIL_Q_DEL_ITEM(run_item);
-            memcpy(&item, run_item, sizeof(item));
-            run_item->f = NULL;
+        if(late > UTIL_TIMER_LATE_MSECS) {
+            ++(timer_st.late);
         }
-        // Clear the event
-        UTIL_EVENT_RESET(&timer_c);
-        UTIL_MUTEX_GIVE(&timer_m);
-
-        // If nothing to run wait for time or an event and when done
-        // waiting go back to the start of the loop to check what to do.
-        if(!run_item) {
-            UTIL_EVENT_TIMEDWAIT(&timer_c, delay);
+        if(t->period > 0) {
+            t->msecs += t->period;
+            if(t->msecs <= cur_t) {
+                timer_st.skipped += (cur_t - t->msecs) / t->period + 1;
+                t->msecs = cur_t + t->period;
+            }
+            heap_fix(0);
             continue;
         }
+        heap_del(timer_heap[0]);
+        t->f = NULL;
+        timer_free[free_len++] = t - timer_a;
+    }
+    if(run_len > 0) {
+        ++(timer_st.wakeups);
+    }
+    UTIL_MUTEX_GIVE(&timer_m);
 
-        // Run the handler and go back to the loop start
-        util_wd_set_timeout(TIMERS_INTHREAD_EXE_TIMEOUT);
-        if(item.new_thread) {
-            if(util_start_thrd(item.name, item.f, &item.param, NULL) != 0)
+    // Run the handlers and have the reactor come back right away to
+    // check what is due next
+    for(ii = 0; ii < run_len; ii++)
+    {
+        t = &(run_a[ii]);
+        if(t->new_thread) {
+            if(util_start_thrd(t->name, t->f, &t->param, NULL) != 0)
             {
                 log("%s: failed to start thread for <%s>\n",
-                    __func__, item.name);
+                    __func__, t->name);
             }
         } else {
-            log("%s: launching timer <%s> handler\n", __func__, item.name);
-            item.f(&item.param);
+            log("%s: launching timer <%s> handler\n", __func__, t->name);
+            t->f(&t->param);
         }
-        util_wd_set_timeout(0);
+        delay = 0;
     }
 
-    log("%s: done\n", __func__);
+    return delay;
 }
 
-// Timers subsystem init function
+// Periodic timer handler logging the timers and the reactor stats
+// for profiling (the counters are reset after each report)
+static void timer_stats_log(TIMER_PARAM_t *p)
+{
+    TIMER_STATS_t st;
+    REACTOR_STATS_t rst;
+
+    util_timer_get_stats(&st, TRUE);
+    util_reactor_get_stats(&rst, TRUE);
+    log("%s: timers fired %lu, late %lu, late max %lumsec, "
+        "late avg %llumsec, skipped %lu, depth %u, max depth %u\n",
+        __func__, st.fired, st.late, st.late_max,
+        st.fired ? st.late_total / st.fired : 0, st.skipped,
+        st.depth, st.depth_max);
+    log("%s: reactor wakeups %lu, steps %lu, pool steps %lu, "
+        "fd events %lu, pool depth max %u\n",
+        __func__, rst.wakeups, rst.steps, rst.pool_steps,
+        rst.fd_events, rst.pool_depth_max);
+}
+
+// Timers subsystem init function (the timers are run by the reactor
+// thread, see util_reactor.h)
 // Returns: 0 - success or an error code
 int util_timers_init(void)
 {
-    // Start the timers thread
-    return util_start_thrd("timers", timers, NULL, NULL);
+    static TIMER_HANDLE_t stats_timer = 0;
+    int err;
+
+    err = util_reactor_init();
+    if(err != 0 || stats_timer != 0) {
+        return err;
+    }
+    stats_timer = util_timer_set_periodic(UTIL_TIMER_STATS_PERIOD * 1000,
+                                          UTIL_TIMER_STATS_PERIOD * 1000,
+                                          "timer_stats", timer_stats_log,
+                                          NULL, FALSE);
+    return (stats_timer != 0) ? 0 : -1;
 }
 
 
@@ -357,6 +510,23 @@ void test_timers(void)
     printf("%s: Sleeping 20sec...\n", __func__);
     sleep(20);
 
+    printf("%s: Setup periodic timer2 every 2sec, timer1 in 9sec "
+           "cancelling it\n", __func__);
+    tp.int_val = (int)util_timer_set_periodic(2000, 2000, "timer2",
+                                              timer_test2, NULL, FALSE);
+    util_timer_set(9000, "timer1", timer_test1, &tp, FALSE);
+    printf("%s: Sleeping 12sec...\n", __func__);
+    sleep(12);
+
+    TIMER_STATS_t st;
+    util_timer_get_stats(&st, FALSE);
+    printf("%s: Stats: fired %lu, late %lu, late max %lumsec, "
+           "late avg %llumsec, skipped %lu, wakeups %lu, "
+           "depth %u, max depth %u\n", __func__,
+           st.fired, st.late, st.late_max,
+           st.fired ? st.late_total / st.fired : 0, st.skipped,
+           st.wakeups, st.depth, st.depth_max);
+
     printf("%s: Done\n", __func__);
 }
 #endif // DEBUG
@@ -8,12 +8,6 @@
 // MAX number of active timers
 #define UTIL_MAX_TIMERS 64
 
-// Watchdog timeout to make sure in-thread timer handlers do not
-// hang the timer thread (the handlers should finish within a
-// second or set up to run in their own thread, here it is just a
-// catch for a grossly misbehaving code).
-#define TIMERS_INTHREAD_EXE_TIMEOUT 20
-
 
 // Timer function parameters structure (the same as thread,
 // the timers might request to be run in their own thread)
@@ -25,25 +19,47 @@ typedef unsigned long TIMER_HANDLE_t;
 
 // Timer handler function type (the same as thread function type)
 // Note: the timer functions are normally fast and are called in
-//       the same thread. If any blocking or time consuming operation is
+//       the reactor thread. If any blocking or time consuming operation is
 //       executed the timer should be set up to spawd its own thread
 //       (see util_timer_set())
 typedef THRD_FUNC_t TIMER_FUNC_t;
 
+// Handler lateness (in msec) after which the firing is counted as late
+#define UTIL_TIMER_LATE_MSECS 100
+
+// How often (in seconds) to log the timers and the reactor stats
+#define UTIL_TIMER_STATS_PERIOD (60 * 60)
+
 // Timer configuration item
+// The active timers are kept in a binary min-heap ordered by the time
+// they have to fire at, the heap stores the indices of the items
+// in the timers array, the items track their position in the heap.
 typedef struct _TIMER_CFG {
-    UTIL_Q_HEADER();          // declares fields used by queue macros
     unsigned long long msecs; // uptime in msec when to fire
     TIMER_FUNC_t f;           // timer handler function (NULL if unused)
     TIMER_PARAM_t param;      // param for the timer functon call
     const char *name;         // timer name (NULL if unused)
+    unsigned int period;      // re-arm period in msec (0 - one shot)
+    int hpos;                 // position in the heap
     unsigned short id;        // timer ID
     short new_thread;         // TRUE - run the handler in a new thread
 } TIMER_CFG_t;
 
+// Timers stats (for profiling)
+typedef struct _TIMER_STATS {
+    unsigned long fired;      // # of handler calls
+    unsigned long late;       // # of calls later than UTIL_TIMER_LATE_MSECS
+    unsigned long late_max;   // max lateness (msec)
+    unsigned long long late_total; // total lateness (msec)
+    unsigned long skipped;    // # of periodic firings skipped (too late)
+    unsigned long wakeups;    // # of reactor wakeups w/ timers to run
+    unsigned int depth;       // # of active timers
+    unsigned int depth_max;   // max # of active timers
+} TIMER_STATS_t;
+
 // Sets a timer to fire after specified number of milliseconds.
 // The timer is automaticaly cancelled before the handler is called.
-// If you want it to continue firing make the handler re-set it at the end.
+// If you want it to continue firing use util_timer_set_periodic().
 // If the handler function is slow/might block use thread == TRUE.
 // Do not do it 'just to be safe' as the # of threads we can run
 // simultaneously is limited.
@@ -57,6 +73,22 @@ typedef struct _TIMER_CFG {
 TIMER_HANDLE_t util_timer_set(unsigned int msecs, const char *name,
                               TIMER_FUNC_t f, THRD_PARAM_t *p, int thread);
 
+// Sets a periodic timer. The handler is called every period msec after
+// the first call in msec, the timer stays active (the handle valid)
+// until it is cancelled. If the handler falls behind by more than
+// the period the missed calls are skipped (not bunched together).
+// See util_timer_set() for the rest of the parameters.
+// Returns: timer handle if OK or 0 if fails
+TIMER_HANDLE_t util_timer_set_periodic(unsigned int msecs,
+                                       unsigned int period,
+                                       const char *name, TIMER_FUNC_t f,
+                                       THRD_PARAM_t *p, int thread);
+
+// Get the timers stats
+// st - where to store the stats
+// reset - TRUE to reset the counters (the depth is not reset)
+void util_timer_get_stats(TIMER_STATS_t *st, int reset);
+
 // Cancels not yet fired timer
 // Note: always check for the return value as you might try to
 //       cancel a just fired timer and fail
@@ -64,7 +96,12 @@ TIMER_HANDLE_t util_timer_set(unsigned int msecs, const char *name,
 // Returns: 0 - success or an error code
 int util_timer_cancel(TIMER_HANDLE_t th);
 
-// Timers subsystem init function
+// Run the expired timers (called by the reactor thread)
+// Returns: msec till the next timer is due, negative if none is active
+long util_timers_run(void);
+
+// Timers subsystem init function (starts the reactor running them and
+// the periodic stats report, see UTIL_TIMER_STATS_PERIOD)
 // Returns: 0 - success or an error code
 int util_timers_init(void);
 
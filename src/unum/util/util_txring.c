@@ -0,0 +1,220 @@
+// (c) 2022 minim.co
+// unum packet socket TX ring
+
+#include "unum.h"
+
+
+/* Temporary, log to console from here */
+//#undef LOG_DST
+//#undef LOG_DBG_DST
+//#define LOG_DST LOG_DST_CONSOLE
+//#define LOG_DBG_DST LOG_DST_CONSOLE
+
+
+// Set up the TX ring for sending packets on the interface
+// r - the TX ring structure
+// ifname - the interface name
+// frame_size - frame size (power of 2, fitting in a memory page)
+// frame_nr - number of frames
+// flags - UTIL_TXRING_* flags
+// Returns: 0 - if successful, negative if fails
+int util_txring_open(UTIL_TXRING_t *r, char *ifname,
+                     unsigned int frame_size, unsigned int frame_nr,
+                     unsigned int flags)
+{
+    int ss, val;
+    unsigned int page_size = getpagesize();
+    struct sockaddr_ll my_addr;
+    struct tpacket_req req;
+    struct ifreq s_ifr;
+
+    r->s = -1;
+    r->ring = MAP_FAILED;
+    r->len = 0;
+
+    if(frame_size < TPACKET_HDRLEN || frame_size > page_size ||
+       (frame_size & (frame_size - 1)) != 0 ||
+       frame_nr < page_size / frame_size)
+    {
+        log("%s: invalid frame size %u or number %u\n",
+            __func__, frame_size, frame_nr);
+        return -1;
+    }
+
+    ss = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if(ss < 0)
+    {
+        log("%s: socket() failed, %s\n", __func__, strerror(errno));
+        return -2;
+    }
+
+    // Get the index of the network interface
+    memset(&s_ifr, 0, sizeof(s_ifr));
+    strncpy(s_ifr.ifr_name, ifname, sizeof(s_ifr.ifr_name)-1);
+    if(ioctl(ss, SIOCGIFINDEX, &s_ifr) < 0)
+    {
+        close(ss);
+        log("%s: SIOCGIFINDEX failed, %s\n", __func__, strerror(errno));
+        return -3;
+    }
+
+    // Bind to the interface
+    memset(&my_addr, 0, sizeof(struct sockaddr_ll));
+    my_addr.sll_family = AF_PACKET;
+    my_addr.sll_protocol = htons(ETH_P_ALL);
+    my_addr.sll_ifindex = s_ifr.ifr_ifindex;
+    if(bind(ss, (struct sockaddr *)&my_addr, sizeof(struct sockaddr_ll)) < 0)
+    {
+        close(ss);
+        log("%s: bind() failed, %s\n", __func__, strerror(errno));
+        return -4;
+    }
+
+    // Set packet loss option (skip the frames that fail to transmit)
+    val = 1;
+    if(setsockopt(ss, SOL_PACKET, PACKET_LOSS, (char *)&val, sizeof(val)) < 0)
+    {
+        close(ss);
+        log("%s: PACKET_LOSS failed, %s\n", __func__, strerror(errno));
+        return -5;
+    }
+
+#ifdef PACKET_QDISC_BYPASS
+    // Set PACKET_QDISC_BYPASS option (only available in 3.14 or later)
+    val = 1;
+    if((flags & UTIL_TXRING_QDISC_BYPASS) != 0 &&
+       setsockopt(ss, SOL_PACKET, PACKET_QDISC_BYPASS,
+                  (char *)&val, sizeof(val)) < 0)
+    {
+        close(ss);
+        log("%s: PACKET_QDISC_BYPASS failed, %s\n", __func__, strerror(errno));
+        return -6;
+    }
+#endif // PACKET_QDISC_BYPASS
+
+    // Set up TX ring (the frames do not cross the block boundaries, the
+    // number of frames is rounded up to fill in the last block)
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = page_size;
+    req.tp_frame_size = frame_size;
+    req.tp_block_nr   = (frame_nr + (page_size / frame_size) - 1) /
+                        (page_size / frame_size);
+    req.tp_frame_nr   = req.tp_block_nr * (page_size / frame_size);
+
+    if(setsockopt(ss, SOL_PACKET, PACKET_TX_RING,
+                  (char *)&req, sizeof(req)) < 0)
+    {
+        close(ss);
+        log("%s: PACKET_TX_RING failed, %s\n", __func__, strerror(errno));
+        return -7;
+    }
+
+    // mmap Tx ring memory
+    unsigned int len = req.tp_block_size * req.tp_block_nr;
+    void *ring = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, ss, 0);
+    if(ring == MAP_FAILED) {
+        close(ss);
+        log("%s: mmap error, %s\n", __func__, strerror(errno));
+        return -8;
+    }
+
+    // Setup complete
+    r->s = ss;
+    r->ring = ring;
+    r->len = len;
+    r->frame_size = frame_size;
+    r->frame_nr = req.tp_frame_nr;
+    r->next = 0;
+
+    return 0;
+}
+
+// Release the TX ring resources (no harm calling it for the ring
+// that has not been set up or has already been closed)
+void util_txring_close(UTIL_TXRING_t *r)
+{
+    if(r->len > 0)
+    {
+        if(munmap(r->ring, r->len) != 0)
+        {
+            log("%s: error unmapping memory at %p, len %u\n",
+                __func__, r->ring, r->len);
+        }
+        r->len = 0;
+        r->ring = MAP_FAILED;
+    }
+    if(r->s >= 0)
+    {
+        close(r->s);
+        r->s = -1;
+    }
+    return;
+}
+
+// Find an available frame
+// r - the TX ring
+// restart - TRUE to start looking from the first frame, otherwise
+//           continue from the frame following the last one returned
+// Returns: the frame header pointer or NULL if all the frames are in use
+struct tpacket_hdr *util_txring_get(UTIL_TXRING_t *r, int restart)
+{
+    unsigned int i, ii;
+
+    ii = restart ? 0 : r->next;
+    for(i = 0; i < r->frame_nr; ++i)
+    {
+        struct tpacket_hdr *tph = UTIL_TXRING_FRAME(r, ii);
+        ii = (ii + 1) % r->frame_nr;
+        if((volatile int)tph->tp_status == TP_STATUS_AVAILABLE)
+        {
+            r->next = ii;
+            return tph;
+        }
+    }
+
+    return NULL;
+}
+
+// Mark the frame ready to send (the packet data should already be in it)
+// r - the TX ring
+// tph - the frame header pointer (see util_txring_get())
+// len - the packet length
+void util_txring_queue(UTIL_TXRING_t *r, struct tpacket_hdr *tph,
+                       unsigned int len)
+{
+    tph->tp_len = len;
+    // The packet data and length must be in place before the kernel
+    // sees the frame status change
+    __sync_synchronize();
+    tph->tp_status = TP_STATUS_SEND_REQUEST;
+}
+
+// Have the kernel transmit the frames that are ready (does not block)
+// r - the TX ring
+// Returns: 0 - if successful (or the interface is busy), negative on error
+int util_txring_send(UTIL_TXRING_t *r)
+{
+    __sync_synchronize();
+    if(send(r->s, NULL, 0, MSG_DONTWAIT) < 0 &&
+       errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// Count the frames that are not yet available (queued or being sent)
+unsigned int util_txring_pending(UTIL_TXRING_t *r)
+{
+    unsigned int ii, count = 0;
+
+    for(ii = 0; ii < r->frame_nr; ++ii) {
+        if((volatile int)UTIL_TXRING_FRAME(r, ii)->tp_status !=
+           TP_STATUS_AVAILABLE)
+        {
+            ++count;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,83 @@
+// (c) 2022 minim.co
+// unum packet socket TX ring include file
+
+#ifndef _UTIL_TXRING_H
+#define _UTIL_TXRING_H
+
+
+// The TX ring is a PACKET_TX_RING memory shared w/ the kernel and split
+// into the fixed size frames. The sender fills in the frames (complete
+// Ethernet packets) marking them ready to send, then makes one send()
+// call for the kernel to transmit all the ready frames at once. The kernel
+// marks the frames available again as it transmits them. The frames keep
+// their content, so the packets can be prepared once and resent (only the
+// frame status needs to be changed).
+// The frames that the interface fails to transmit are dropped (the ring
+// socket is set up w/ PACKET_LOSS).
+// It is not thread safe, the users are expected to access the ring from
+// a single thread.
+
+// Flags for util_txring_open()
+#define UTIL_TXRING_QDISC_BYPASS 0x0001 // bypass qdisc (if kernel supports)
+
+// TX ring
+typedef struct _UTIL_TXRING {
+    int s;                   // the ring packet socket (-1 if not set up)
+    void *ring;              // the ring memory (MAP_FAILED if not set up)
+    unsigned int len;        // the ring memory length
+    unsigned int frame_size; // frame size
+    unsigned int frame_nr;   // number of frames
+    unsigned int next;       // index of the frame to check first for reuse
+} UTIL_TXRING_t;
+
+// Get the frame header pointer by the frame index
+#define UTIL_TXRING_FRAME(_r, _i) \
+    ((struct tpacket_hdr *)((_r)->ring + (_r)->frame_size * (_i)))
+
+// Get the pointer to the packet data in the frame
+#define UTIL_TXRING_DATA(_tph) \
+    ((void *)(_tph) + TPACKET_HDRLEN - sizeof(struct sockaddr_ll))
+
+// Max packet length the frame of the given size can hold
+#define UTIL_TXRING_MAX_PKT(_fs) \
+    ((_fs) - (TPACKET_HDRLEN - sizeof(struct sockaddr_ll)))
+
+
+// Set up the TX ring for sending packets on the interface
+// r - the TX ring structure
+// ifname - the interface name
+// frame_size - frame size (power of 2, fitting in a memory page)
+// frame_nr - number of frames
+// flags - UTIL_TXRING_* flags
+// Returns: 0 - if successful, negative if fails
+int util_txring_open(UTIL_TXRING_t *r, char *ifname,
+                     unsigned int frame_size, unsigned int frame_nr,
+                     unsigned int flags);
+
+// Release the TX ring resources (no harm calling it for the ring
+// that has not been set up or has already been closed)
+void util_txring_close(UTIL_TXRING_t *r);
+
+// Find an available frame
+// r - the TX ring
+// restart - TRUE to start looking from the first frame, otherwise
+//           continue from the frame following the last one returned
+// Returns: the frame header pointer or NULL if all the frames are in use
+struct tpacket_hdr *util_txring_get(UTIL_TXRING_t *r, int restart);
+
+// Mark the frame ready to send (the packet data should already be in it)
+// r - the TX ring
+// tph - the frame header pointer (see util_txring_get())
+// len - the packet length
+void util_txring_queue(UTIL_TXRING_t *r, struct tpacket_hdr *tph,
+                       unsigned int len);
+
+// Have the kernel transmit the frames that are ready (does not block)
+// r - the TX ring
+// Returns: 0 - if successful (or the interface is busy), negative on error
+int util_txring_send(UTIL_TXRING_t *r);
+
+// Count the frames that are not yet available (queued or being sent)
+unsigned int util_txring_pending(UTIL_TXRING_t *r);
+
+#endif // _UTIL_TXRING_H
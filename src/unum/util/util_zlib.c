@@ -40,8 +40,9 @@ int util_compress(char *buf, int buf_len, char *cbuf, int cbuf_len)
         return -1;
     }
     // Attempt to compress the data
+    // Anything but Z_STREAM_END means the output did not fit
     ret = deflate(&stream, Z_FINISH);
-    if(ret != Z_OK && ret != Z_STREAM_END)
+    if(ret != Z_STREAM_END)
     {
         log("%s: deflate() failed, error %d\n", __func__, ret);
         deflateEnd(&stream);
@@ -57,4 +58,212 @@ int util_compress(char *buf, int buf_len, char *cbuf, int cbuf_len)
     return cbuf_len - stream.avail_out;
 }
 
+// Run deflate() w/ the flush mode adding the output chunks as needed
+// Returns: the last deflate() return code
+static int gz_deflate(UTIL_GZ_t *gz, int flush)
+{
+    int ret;
+    UTIL_GZ_CHUNK_t *c;
+
+    for(;;)
+    {
+        c = gz->tail;
+        if(c == NULL || c->len >= UTIL_GZ_CHUNK_SIZE) {
+            c = UTIL_MALLOC(sizeof(UTIL_GZ_CHUNK_t));
+            if(c == NULL) {
+                log("%s: failed to allocate chunk\n", __func__);
+                return Z_MEM_ERROR;
+            }
+            c->next = NULL;
+            c->len = 0;
+            if(gz->tail == NULL) {
+                gz->head = gz->rd = c;
+            } else {
+                gz->tail->next = c;
+            }
+            gz->tail = c;
+        }
+        gz->zs.next_out = c->data + c->len;
+        gz->zs.avail_out = UTIL_GZ_CHUNK_SIZE - c->len;
+        ret = deflate(&(gz->zs), flush);
+        c->len = UTIL_GZ_CHUNK_SIZE - gz->zs.avail_out;
+        if(ret != Z_OK) {
+            break;
+        }
+        // Done when all the input is consumed and there was room left
+        // for more output (w/ Z_FINISH only Z_STREAM_END ends it)
+        if(flush != Z_FINISH &&
+           gz->zs.avail_in == 0 && gz->zs.avail_out > 0)
+        {
+            break;
+        }
+    }
+    // No progress possible is not an error here
+    if(ret == Z_BUF_ERROR && flush != Z_FINISH) {
+        ret = Z_OK;
+    }
+
+    return ret;
+}
+
+// Start streaming gzip compression
+// Returns: pointer to the compressor or NULL if fails
+UTIL_GZ_t *util_gz_start(void)
+{
+    UTIL_GZ_t *gz;
+    int ret;
+
+    gz = UTIL_MALLOC(sizeof(UTIL_GZ_t));
+    if(gz == NULL) {
+        log("%s: failed to allocate compressor\n", __func__);
+        return NULL;
+    }
+    memset(gz, 0, sizeof(UTIL_GZ_t));
+    gz->zs.zalloc = Z_NULL;
+    gz->zs.zfree = Z_NULL;
+    gz->zs.opaque = Z_NULL;
+
+    // Same parameters as util_compress() uses (gzip encoding)
+    if((ret = deflateInit2(&(gz->zs), DEFAULT_COMP_ALGO, Z_DEFLATED,
+                           15 | 16, 8, Z_DEFAULT_STRATEGY)) != Z_OK)
+    {
+        log("%s: deflateInit2() failed, error %d\n", __func__, ret);
+        UTIL_FREE(gz);
+        return NULL;
+    }
+    gz->active = TRUE;
+
+    return gz;
+}
+
+// Compress the next portion of the data. The function is compatible
+// with json_dump_callback_t (see util_tpl_to_json_cb()).
+// buf - data to compress
+// len - the data length
+// data - the compressor pointer
+// Returns: 0 if successful, -1 if fails
+int util_gz_write(const char *buf, size_t len, void *data)
+{
+    UTIL_GZ_t *gz = (UTIL_GZ_t *)data;
+    int ret;
+
+    if(!gz->active || gz->error) {
+        return -1;
+    }
+    gz->zs.next_in = (Bytef *)buf;
+    gz->zs.avail_in = len;
+    ret = gz_deflate(gz, Z_NO_FLUSH);
+    if(ret != Z_OK) {
+        log("%s: deflate() failed, error %d\n", __func__, ret);
+        gz->error = TRUE;
+        return -1;
+    }
+    gz->in_len += len;
+
+    return 0;
+}
+
+// Finish compression (after that the data can be read from the compressor)
+// Returns: 0 if successful, negative if fails
+int util_gz_finish(UTIL_GZ_t *gz)
+{
+    int ret = -1;
+    UTIL_GZ_CHUNK_t *c;
+
+    if(!gz->active) {
+        return gz->error ? -1 : 0;
+    }
+    if(!gz->error) {
+        gz->zs.next_in = NULL;
+        gz->zs.avail_in = 0;
+        ret = gz_deflate(gz, Z_FINISH);
+        if(ret != Z_STREAM_END) {
+            log("%s: deflate() failed, error %d\n", __func__, ret);
+            gz->error = TRUE;
+        }
+    }
+    deflateEnd(&(gz->zs));
+    gz->active = FALSE;
+    if(gz->error) {
+        return -1;
+    }
+
+    gz->len = 0;
+    for(c = gz->head; c != NULL; c = c->next) {
+        gz->len += c->len;
+    }
+    util_gz_seek(gz, 0);
+
+    return 0;
+}
+
+// Read the compressed data from the current position
+// gz - the compressor (must be finished)
+// buf - where to store the data
+// len - max length to read
+// Returns: length of the data read, 0 at the end of the data
+size_t util_gz_read(UTIL_GZ_t *gz, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    if(gz->active || gz->error) {
+        return 0;
+    }
+    while(done < len && gz->rd != NULL)
+    {
+        size_t n = gz->rd->len - gz->rd_off;
+        if(n > len - done) {
+            n = len - done;
+        }
+        memcpy((unsigned char *)buf + done, gz->rd->data + gz->rd_off, n);
+        done += n;
+        gz->rd_off += n;
+        if(gz->rd_off >= gz->rd->len) {
+            gz->rd = gz->rd->next;
+            gz->rd_off = 0;
+        }
+    }
+    gz->rd_pos += done;
+
+    return done;
+}
+
+// Set the compressed data read position
+// Returns: 0 if successful, negative if the position is out of range
+int util_gz_seek(UTIL_GZ_t *gz, unsigned long pos)
+{
+    UTIL_GZ_CHUNK_t *c;
+    unsigned long off = pos;
+
+    if(gz->active || gz->error || pos > gz->len) {
+        return -1;
+    }
+    for(c = gz->head; c != NULL && off >= c->len; c = c->next) {
+        off -= c->len;
+    }
+    gz->rd = c;
+    gz->rd_off = off;
+    gz->rd_pos = pos;
+
+    return 0;
+}
+
+// Free the compressor and all its data
+void util_gz_free(UTIL_GZ_t *gz)
+{
+    UTIL_GZ_CHUNK_t *c, *next;
+
+    if(gz == NULL) {
+        return;
+    }
+    if(gz->active) {
+        deflateEnd(&(gz->zs));
+    }
+    for(c = gz->head; c != NULL; c = next) {
+        next = c->next;
+        UTIL_FREE(c);
+    }
+    UTIL_FREE(gz);
+}
+
 #endif // FEATURE_GZIP_REQUESTS
@@ -13,6 +13,34 @@
 // For platforms with FUP limits, we can use Z_BEST_SPEED
 #define DEFAULT_COMP_ALGO Z_DEFAULT_COMPRESSION
 
+// Size of the chunks the streaming compression stores its output in
+#define UTIL_GZ_CHUNK_SIZE 8192
+
+// Compressed data chunk
+typedef struct _UTIL_GZ_CHUNK {
+    struct _UTIL_GZ_CHUNK *next; // next chunk or NULL if last
+    unsigned int len;            // data length in the chunk
+    unsigned char data[UTIL_GZ_CHUNK_SIZE];
+} UTIL_GZ_CHUNK_t;
+
+// Streaming gzip compressor. The data is deflated as it is written,
+// the output is collected in a list of the fixed size chunks, so
+// producing the compressed data never requires the whole uncompressed
+// data to be in memory. Once finished the compressed data can be read
+// out sequentially (and re-read after seeking back).
+typedef struct _UTIL_GZ {
+    z_stream zs;             // zlib stream (valid while compressing)
+    int active;              // TRUE while compressing
+    int error;               // TRUE if compression has failed
+    UTIL_GZ_CHUNK_t *head;   // first chunk of the compressed data
+    UTIL_GZ_CHUNK_t *tail;   // last chunk of the compressed data
+    unsigned long len;       // compressed data length
+    unsigned long in_len;    // uncompressed data length
+    UTIL_GZ_CHUNK_t *rd;     // chunk to read from next
+    unsigned int rd_off;     // read offset in the rd chunk
+    unsigned long rd_pos;    // read position in the compressed data
+} UTIL_GZ_t;
+
 // Compress data using zlib library
 // buf - pointer to data to be compressed
 // buf_len - length of the data to be compressed
@@ -22,6 +50,36 @@
 //          if fails
 int util_compress(char *msg, int len, char *cmsg, int cmsg_len);
 
+// Start streaming gzip compression
+// Returns: pointer to the compressor or NULL if fails
+UTIL_GZ_t *util_gz_start(void);
+
+// Compress the next portion of the data. The function is compatible
+// with json_dump_callback_t (see util_tpl_to_json_cb()).
+// buf - data to compress
+// len - the data length
+// data - the compressor pointer
+// Returns: 0 if successful, -1 if fails
+int util_gz_write(const char *buf, size_t len, void *data);
+
+// Finish compression (after that the data can be read from the compressor)
+// Returns: 0 if successful, negative if fails
+int util_gz_finish(UTIL_GZ_t *gz);
+
+// Read the compressed data from the current position
+// gz - the compressor (must be finished)
+// buf - where to store the data
+// len - max length to read
+// Returns: length of the data read, 0 at the end of the data
+size_t util_gz_read(UTIL_GZ_t *gz, void *buf, size_t len);
+
+// Set the compressed data read position
+// Returns: 0 if successful, negative if the position is out of range
+int util_gz_seek(UTIL_GZ_t *gz, unsigned long pos);
+
+// Free the compressor and all its data
+void util_gz_free(UTIL_GZ_t *gz);
+
 #endif // FEATURE_GZIP_REQUESTS
 
 #endif // _UTIL_ZLIB_H
@@ -28,26 +28,32 @@
 //#define LOG_DBG_DST LOG_DST_CONSOLE
 
 
-// Buffer for STA info, once allocated it is never freed.
-// The same buffer is used for all VAPs.
+// Buffer for reading the association lists, once allocated it is never
+// freed. The same buffer is used for all VAPs.
 // It is pretty big (24KB for v17.01.04)
 static void *sta_info_buf = NULL;
 
+// Index of the first STA of the current VAP in the station snapshot
+static unsigned int vap_sta_first = 0;
 
-// Capture the STAs info for an interface
+
+// Capture the STAs info for an interface (into the station snapshot)
 // Returns: # of STAs - if successful, negative error otherwise
 int wt_rt_get_stas_info(int radio_num, char *ifname)
 {
+    WT_STA_SNAP_t *s = wt_sta_snap_get();
+
     // If we do not yet have a buffer, allocate it (never freed)
     if(sta_info_buf == NULL) {
         sta_info_buf = UTIL_MALLOC(IWINFO_BUFSIZE);
     }
-    if(sta_info_buf == NULL) {
+    if(sta_info_buf == NULL || s == NULL) {
         log("%s: failed to allocate memory for STAs\n", __func__);
         return -1;
     }
 
-    return wt_iwinfo_get_stations(ifname, sta_info_buf);
+    vap_sta_first = s->count;
+    return wt_sta_snap_add_vap(s, ifname, sta_info_buf);
 }
 
 // Capture the STA info
@@ -119,20 +125,19 @@ int wt_tpl_fill_sta_info(WT_JSON_TPL_RADIO_STATE_t *rinfo,
       { NULL }
     };
 
+    WT_STA_SNAP_t *s = wt_sta_snap_get();
+
     // We must have the STA data if we are here
-    if(sta_info_buf == NULL) {
+    if(s == NULL) {
         return -1;
     }
 
     // The index is already verified to be in the proper range in the
-    // common wireless code, but check it anyway after calculating
-    // the pointer (just in case)
-    e = ((struct iwinfo_assoclist_entry *)sta_info_buf) + ii;
-    if(((void*)e) < sta_info_buf ||
-       ((void*)(e + 1)) > (sta_info_buf + IWINFO_BUFSIZE))
-    {
+    // common wireless code, but check it anyway (just in case)
+    if(ii < 0 || vap_sta_first + ii >= s->count) {
         return -2;
     }
+    e = &(s->sta[vap_sta_first + ii].e);
 
     // Capture the common info
     sprintf(sinfo->mac, MAC_PRINTF_FMT_TPL, MAC_PRINTF_ARG_TPL(e->mac));
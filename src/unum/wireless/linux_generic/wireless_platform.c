@@ -29,24 +29,101 @@
 //#define LOG_DBG_DST LOG_DST_CONSOLE
 
 
-// Get wireless counters for a station.
-// Note: doing it through iwinfo (not efficient, but hides the driver type)
-// Parameters:
-// ifname - The ifname to look up the STA on (could be NULL, search all)
-// mac_str - STA MAC address (binary)
-// wc - ptr to WIRELESS_COUNTERS_t buffer to return the data in
-// Returns:
-// 0 - ok, negative - unable to get the counters for the given MAC address
-int wireless_get_sta_counters(char *ifname, unsigned char* mac,
-                              WIRELESS_COUNTERS_t *wc)
+// The station snapshots. One is collected by the wireless telemetry
+// for the current submission, the other is collected for the counter
+// lookups.
+static WT_STA_SNAP_t *wt_snap = NULL;
+static WT_STA_SNAP_t *cntrs_snap = NULL;
+// Mutex protecting cntrs_snap
+static UTIL_MUTEX_t cntrs_snap_m = UTIL_MUTEX_INITIALIZER;
+// Association list buffer for collecting cntrs_snap (never freed)
+static void *cntrs_buf = NULL;
+
+
+// Allocate and initialize a station snapshot
+static WT_STA_SNAP_t *sta_snap_alloc(void)
+{
+    WT_STA_SNAP_t *s = UTIL_MALLOC(sizeof(WT_STA_SNAP_t));
+    if(s == NULL) {
+        log("%s: error allocating %d bytes\n",
+            __func__, (int)sizeof(WT_STA_SNAP_t));
+        return NULL;
+    }
+    s->t = 0;
+    s->count = 0;
+    if(util_rht_init(&(s->rht), WT_STA_SNAP_MAX,
+                     offsetof(WT_STA_SNAP_ENTRY_t, e.mac),
+                     ETHER_ADDR_LEN) != 0)
+    {
+        UTIL_FREE(s);
+        return NULL;
+    }
+    return s;
+}
+
+// Drop all the entries and restart the snapshot collection time
+static void sta_snap_reset(WT_STA_SNAP_t *s)
+{
+    util_rht_clear(&(s->rht));
+    s->count = 0;
+    s->t = util_time(1000);
+}
+
+// Add the STAs of a VAP to the station snapshot
+// s - the snapshot
+// ifname - the VAP interface name
+// buf - IWINFO_BUFSIZE buffer for reading the association list
+// Returns: # of STAs added, negative if error
+int wt_sta_snap_add_vap(WT_STA_SNAP_t *s, char *ifname, void *buf)
+{
+    int ii, count;
+    uint32_t hash;
+    struct iwinfo_assoclist_entry *e;
+    WT_STA_SNAP_ENTRY_t *sta, *prev;
+
+    count = wt_iwinfo_get_stations(ifname, buf);
+    if(count <= 0) {
+        return count;
+    }
+    if(count > WT_STA_SNAP_MAX - s->count) {
+        log("%s: no room for %d STAs of %s, adding %d\n",
+            __func__, count, ifname, WT_STA_SNAP_MAX - s->count);
+        count = WT_STA_SNAP_MAX - s->count;
+    }
+    for(ii = 0; ii < count; ++ii)
+    {
+        e = ((struct iwinfo_assoclist_entry *)buf) + ii;
+        sta = &(s->sta[s->count++]);
+        memcpy(&(sta->e), e, sizeof(sta->e));
+        strncpy(sta->ifname, ifname, sizeof(sta->ifname) - 1);
+        sta->ifname[sizeof(sta->ifname) - 1] = 0;
+        sta->mif = FALSE;
+
+        hash = util_rht_hash(&(s->rht), e->mac);
+        prev = util_rht_find(&(s->rht), e->mac, hash, NULL);
+        if(prev == NULL) {
+            util_rht_add(&(s->rht), sta, hash, NULL);
+            continue;
+        }
+        // Seen on another VAP, index the one w/ the most recent activity
+        prev->mif = sta->mif = TRUE;
+        if(prev->e.inactive > sta->e.inactive) {
+            util_rht_del(&(s->rht), e->mac, hash);
+            util_rht_add(&(s->rht), sta, hash, NULL);
+        }
+    }
+
+    return count;
+}
+
+// Collect the STAs of all the wireless interfaces to the snapshot
+// Note: doing it through iwinfo (the nl80211 backend does the station
+//       dump, the others hide the driver type)
+static int sta_snap_collect(WT_STA_SNAP_t *s, void *buf)
 {
     char *sysnetdev_dir = "/sys/class/net";
     struct dirent *de;
-    int ret, ii;
     DIR *dd;
-    void *buf = NULL;
-    struct iwinfo_assoclist_entry *e;
-    unsigned int rec_idle_time = (unsigned int)(-1);
 
     dd = opendir(sysnetdev_dir);
     if(dd == NULL) {
@@ -54,64 +131,85 @@ int wireless_get_sta_counters(char *ifname, unsigned char* mac,
             __func__, sysnetdev_dir, strerror(errno));
         return -1;
     }
-    // Allocate association list buffer
-    buf = UTIL_MALLOC(IWINFO_BUFSIZE);
-    if(!buf) {
-        log("%s: error allocating %d bytes\n", __func__, IWINFO_BUFSIZE);
-        return -2;
-    }
-    ret = -1;
+    sta_snap_reset(s);
     while((de = readdir(dd)) != NULL)
     {
         // Skip anything that starts w/ .
         if(de->d_name[0] == '.') {
             continue;
         }
-        char *cur_ifname = de->d_name;
-        const struct iwinfo_ops *iw = iwinfo_backend(cur_ifname);
-        if(!iw) {
+        if(!iwinfo_backend(de->d_name)) {
             continue;
         }
-        int len = 0;
-        if(iw->assoclist(cur_ifname, buf, &len) != 0 || len <= 0)
-        {
-            continue;
+        wt_sta_snap_add_vap(s, de->d_name, buf);
+    }
+    closedir(dd);
+
+    return 0;
+}
+
+// Get the station snapshot the wireless telemetry is collecting
+// for the current submission (wireless telemetry thread only).
+// Returns: pointer to the snapshot, NULL if failed to allocate
+WT_STA_SNAP_t *wt_sta_snap_get(void)
+{
+    return wt_snap;
+}
+
+// Get wireless counters for a station.
+// The station snapshot is collected again (one pass over all the VAPs)
+// for each lookup, the caller (pingflood) compares the counters taken
+// right before and after the test.
+// Parameters:
+// ifname - The ifname to look up the STA on (could be NULL, search all)
+// mac_str - STA MAC address (binary)
+// wc - ptr to WIRELESS_COUNTERS_t buffer to return the data in
+// Returns:
+// 0 - ok, negative - unable to get the counters for the given MAC address
+int wireless_get_sta_counters(char *ifname, unsigned char* mac,
+                              WIRELESS_COUNTERS_t *wc)
+{
+    WT_STA_SNAP_ENTRY_t *sta;
+    int ret = -1;
+
+    UTIL_MUTEX_TAKE(&cntrs_snap_m);
+    for(;;)
+    {
+        if(cntrs_snap == NULL) {
+            cntrs_snap = sta_snap_alloc();
         }
-        len /= sizeof(struct iwinfo_assoclist_entry);
-        e = NULL;
-        for(ii = 0; ii < len; ++ii)
-        {
-            e = ((struct iwinfo_assoclist_entry *)buf) + ii;
-            if(memcmp(e->mac, mac, ETHER_ADDR_LEN) != 0) {
-                continue;
-            }
+        if(cntrs_buf == NULL) {
+            cntrs_buf = UTIL_MALLOC(IWINFO_BUFSIZE);
+        }
+        if(cntrs_snap == NULL || cntrs_buf == NULL) {
+            log("%s: failed to allocate memory\n", __func__);
+            ret = -2;
             break;
         }
-        if(e == NULL || ii >= len) { // MAC not found in the interface assoclist
-            continue;
+        if(sta_snap_collect(cntrs_snap, cntrs_buf) != 0) {
+            break;
         }
-        if(ret == 0) { // already saw MAC on one of the interfaces
-            wc->flags |= W_COUNTERS_MIF;
+        sta = util_rht_find(&(cntrs_snap->rht), mac,
+                            util_rht_hash(&(cntrs_snap->rht), mac), NULL);
+        if(sta == NULL) {
+            break;
         }
-        if(rec_idle_time < e->inactive) { // not the most recent
-            continue;
+        if(sta->mif) {
+            wc->flags |= W_COUNTERS_MIF;
         }
-        rec_idle_time = e->inactive;
-        wc->rx_p = e->rx_packets;
-        wc->tx_p = e->tx_packets;
-        wc->rx_b = e->rx_bytes;
-        wc->tx_b = e->tx_bytes;
-        if(sizeof(e->tx_bytes) < sizeof(wc->tx_b)) { // 32 bit counters
+        wc->rx_p = sta->e.rx_packets;
+        wc->tx_p = sta->e.tx_packets;
+        wc->rx_b = sta->e.rx_bytes;
+        wc->tx_b = sta->e.tx_bytes;
+        if(sizeof(sta->e.tx_bytes) < sizeof(wc->tx_b)) { // 32 bit counters
             wc->flags |= W_COUNTERS_32B;
         }
-        strncpy(wc->ifname, cur_ifname, sizeof(wc->ifname) - 1);
+        strncpy(wc->ifname, sta->ifname, sizeof(wc->ifname) - 1);
         wc->ifname[sizeof(wc->ifname) - 1] = 0;
         ret = 0;
+        break;
     }
-    if(buf) {
-        UTIL_FREE(buf);
-        buf = NULL;
-    }
+    UTIL_MUTEX_GIVE(&cntrs_snap_m);
 
     return ret;
 }
@@ -121,6 +219,13 @@ int wt_platform_subm_init(void)
 {
     int err;
     err = wt_iwinfo_mk_if_list();
+    // Start collecting new station snapshot (allocated once, never freed)
+    if(wt_snap == NULL) {
+        wt_snap = sta_snap_alloc();
+    }
+    if(wt_snap != NULL) {
+        sta_snap_reset(wt_snap);
+    }
     return err;
 }
 int wt_platform_subm_deinit(void)
@@ -21,8 +21,42 @@
 #ifndef _WIRELESS_PLATFORM_H
 #define _WIRELESS_PLATFORM_H
 
+// Max number of STAs (across all the VAPs) in the station snapshot,
+// the STAs over the limit are left out (w/ a log message)
+#define WT_STA_SNAP_MAX (WIRELESS_MAX_RADIOS * WIRELESS_MAX_VAPS * 8)
+
+// Station snapshot entry
+typedef struct _WT_STA_SNAP_ENTRY {
+    struct iwinfo_assoclist_entry e; // the STA info (e.mac is the key)
+    char ifname[IFNAMSIZ];           // the VAP the STA is on
+    int mif;                         // TRUE if the MAC is on several VAPs
+} WT_STA_SNAP_ENTRY_t;
+
+// Station snapshot. The entries are stored in the order they are
+// added (VAP by VAP), the hash table indexes them by MAC, for the MACs
+// seen on multiple VAPs it points to the entry w/ the most recent
+// activity.
+typedef struct _WT_STA_SNAP {
+    unsigned long long t;  // time (in ms) the collection has started
+    unsigned int count;    // number of entries
+    UTIL_RHT_t rht;        // MAC to entry index
+    WT_STA_SNAP_ENTRY_t sta[WT_STA_SNAP_MAX];
+} WT_STA_SNAP_t;
+
 // Capture the STAs info for an interface
 // Returns: # of STAs - if successful, negative error otherwise
 int wt_rt_get_stas_info(int radio_num, char *ifname);
 
+// Get the station snapshot the wireless telemetry is collecting
+// for the current submission (wireless telemetry thread only).
+// Returns: pointer to the snapshot, NULL if failed to allocate
+WT_STA_SNAP_t *wt_sta_snap_get(void);
+
+// Add the STAs of a VAP to the station snapshot
+// s - the snapshot
+// ifname - the VAP interface name
+// buf - IWINFO_BUFSIZE buffer for reading the association list
+// Returns: # of STAs added, negative if error
+int wt_sta_snap_add_vap(WT_STA_SNAP_t *s, char *ifname, void *buf);
+
 #endif // _WIRELESS_PLATFORM_H
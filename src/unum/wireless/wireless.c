@@ -130,6 +130,9 @@ static JSON_VAL_TPL_t tpl_tbl_array_skip_val = { .type = JSON_VAL_SKIP };
 // Flag forcing scan at the next radio telemetry iteration
 static int force_neighborhood_scan = FALSE;
 
+// Wireless monitoring task ID
+static int wireless_tid = -1;
+
 
 // Dynamically builds JSON template for the scanlist radios array.
 static JSON_VAL_TPL_t *wt_tpl_scan_radios_array_f(char *key, int ii)
@@ -414,10 +417,12 @@ static void wireless_do_radio_telemetry(void)
 #endif // DEBUG
 
         // Send the telemetry info
-        rsp = http_post(url,
-                        "Content-Type: application/json\0"
-                        "Accept: application/json\0",
-                        jstr, strlen(jstr));
+        rsp = http_post_spool(url, jstr, strlen(jstr));
+
+        // The spooled request is delivered later by the uploader
+        if(rsp != NULL && rsp->code == HTTP_RSP_CODE_SPOOLED) {
+            break;
+        }
 
         if(rsp == NULL || (rsp->code / 100) != 2) {
             log("%s: request error, code %d%s\n",
@@ -486,10 +491,12 @@ static void wireless_do_scan_report(void)
 #endif // DEBUG
 
         // Send the telemetry info
-        rsp = http_post(url,
-                        "Content-Type: application/json\0"
-                        "Accept: application/json\0",
-                        jstr, strlen(jstr));
+        rsp = http_post_spool(url, jstr, strlen(jstr));
+
+        // The spooled request is delivered later by the uploader
+        if(rsp != NULL && rsp->code == HTTP_RSP_CODE_SPOOLED) {
+            break;
+        }
 
         if(rsp == NULL || (rsp->code / 100) != 2) {
             log("%s: request error, code %d%s\n",
@@ -513,85 +520,87 @@ static void wireless_do_scan_report(void)
     return;
 }
 
-// Wireless monitoring thread. All the wireless finctions are called from
-// here. With a few exceptions the calls are made through the routine
-// generating JSON from the template data structures.
-static void wireless(THRD_PARAM_t *p)
+// Wireless monitoring task step (runs in the reactor worker pool). All
+// the wireless finctions are called from here. With a few exceptions the
+// calls are made through the routine generating JSON from the template
+// data structures.
+static int wireless(THRD_PARAM_t *p)
 {
     static unsigned long do_telemetry_at = 0;
     static unsigned long do_scan_at = 0;
     static unsigned long do_scan_report_at = 0xFFFFFFFF;
     static int platform_init_done = FALSE;
+    static int activated = FALSE;
     unsigned long cur_t;
 
-    log("%s: started\n", __func__);
-
-    log("%s: waiting for activation to complete\n", __func__);
-    wait_for_activate();
-    log("%s: done waiting for activation\n", __func__);
-
-    util_wd_set_timeout(2 * HTTP_REQ_MAX_TIME + WIRELESS_MAX_DELAY);
-
-    for(;;) {
-        sleep(WIRELESS_ITERATE_PERIOD);
-        util_wd_poll();
-
-        // Run platform specific init
-        if(!platform_init_done) {
-            if(!(platform_init_done = wt_platform_init())) {
-                log("%s: platform init failed, skipping wireless telemetry\n",
-                    __func__);
-                continue;
-            }
+    // Wait for activation to complete
+    if(!is_agent_activated()) {
+        return ACTIVATE_TASK_POLL;
+    }
+    if(!activated) {
+        log("%s: done waiting for activation\n", __func__);
+        activated = TRUE;
+        util_wd_set_timeout(2 * HTTP_REQ_MAX_TIME + WIRELESS_MAX_DELAY);
+        return WIRELESS_ITERATE_PERIOD * 1000;
+    }
+    util_wd_poll();
+
+    // Run platform specific init
+    if(!platform_init_done) {
+        if(!(platform_init_done = wt_platform_init())) {
+            log("%s: platform init failed, skipping wireless telemetry\n",
+                __func__);
+            return WIRELESS_ITERATE_PERIOD * 1000;
         }
+    }
 
-        // Capture current time
-        cur_t = util_time(1);
-
-        // Check if it is time to report radio telemetry
-        if(do_telemetry_at < cur_t) {
-            do_telemetry_at = cur_t + unum_config.wireless_telemetry_period;
-            wireless_do_radio_telemetry();
-        }
+    // Capture current time
+    cur_t = util_time(1);
 
-        // Check if it is time to do scan (but only unless a report already
-        // pending)
-        int force_scan =
-            __sync_bool_compare_and_swap(&force_neighborhood_scan, TRUE, FALSE);
-        // Check if scan has been disabled
-        // scan is not forced
-        // and scan is not already triggered
-        if(do_scan_report_at == 0xFFFFFFFF && !force_scan &&
-            unum_config.wireless_scan_period == 0) {
-            continue;
-        }
-        // Scan only if not waiting for report and it is time to (or forced)
-        if(do_scan_report_at == 0xFFFFFFFF &&
-           (do_scan_at < cur_t || force_scan))
-        {
-            do_scan_at = cur_t + unum_config.wireless_scan_period;
-            int scan_rep_t = wireless_do_scan();
-            if(scan_rep_t >= 0) {
-                do_scan_report_at = cur_t + scan_rep_t;
-            } else {
-                do_scan_report_at = 0xFFFFFFFF;
-            }
-        }
+    // Check if it is time to report radio telemetry
+    if(do_telemetry_at < cur_t) {
+        do_telemetry_at = cur_t + unum_config.wireless_telemetry_period;
+        wireless_do_radio_telemetry();
+    }
 
-        // Check if it is time to report the scan results
-        if(do_scan_report_at < cur_t) {
-            wireless_do_scan_report();
+    // Check if it is time to do scan (but only unless a report already
+    // pending)
+    int force_scan =
+        __sync_bool_compare_and_swap(&force_neighborhood_scan, TRUE, FALSE);
+    // Check if scan has been disabled
+    // scan is not forced
+    // and scan is not already triggered
+    if(do_scan_report_at == 0xFFFFFFFF && !force_scan &&
+        unum_config.wireless_scan_period == 0) {
+        return WIRELESS_ITERATE_PERIOD * 1000;
+    }
+    // Scan only if not waiting for report and it is time to (or forced)
+    if(do_scan_report_at == 0xFFFFFFFF &&
+       (do_scan_at < cur_t || force_scan))
+    {
+        do_scan_at = cur_t + unum_config.wireless_scan_period;
+        int scan_rep_t = wireless_do_scan();
+        if(scan_rep_t >= 0) {
+            do_scan_report_at = cur_t + scan_rep_t;
+        } else {
             do_scan_report_at = 0xFFFFFFFF;
         }
     }
 
-    log("%s: done\n", __func__);
+    // Check if it is time to report the scan results
+    if(do_scan_report_at < cur_t) {
+        wireless_do_scan_report();
+        do_scan_report_at = 0xFFFFFFFF;
+    }
+
+    return WIRELESS_ITERATE_PERIOD * 1000;
 }
 
 // Function requesting the wireless scan to be performed immediately.
 void cmd_wireless_initiate_scan(void)
 {
     __sync_bool_compare_and_swap(&force_neighborhood_scan, FALSE, TRUE);
+    util_reactor_task_wake(wireless_tid, 0);
     return;
 }
 
@@ -601,8 +610,10 @@ int wireless_init(int level)
     int ret = 0;
     // Initialize wireless monitoring subsystem
     if(level == INIT_LEVEL_WIRELESS) {
-        // Start the wireless telemetry reporting job
-        ret = util_start_thrd("wireless", wireless, NULL, NULL);
+        // Start the wireless telemetry reporting task
+        wireless_tid = util_reactor_task_add("wireless", wireless, NULL, 0,
+                                             REACTOR_TASK_F_BLOCKING);
+        ret = (wireless_tid < 0) ? wireless_tid : 0;
     }
     return ret;
 }
@@ -612,6 +623,8 @@ int wireless_init(int level)
 void test_wireless(void)
 {
     set_activate_event();
-    wireless(NULL);
+    for(;;) {
+        util_msleep(wireless(NULL));
+    }
 }
 #endif // DEBUG